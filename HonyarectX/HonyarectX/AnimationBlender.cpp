@@ -0,0 +1,293 @@
+﻿#include "AnimationBlender.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	const BonePose rest_pose = { XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 0.0f) };
+
+	/// <summary>姿勢をtoへ重みの分だけ近づける（回転は最短の向きで正規化線形補間）</summary>
+	inline void BlendPose(BonePose& pose, const BonePose& to, float weight)
+	{
+		if (weight >= 1.0f) {
+			pose = to;
+			return;
+		}
+		auto q0 = XMLoadFloat4(&pose.rotation);
+		auto q1 = XMLoadFloat4(&to.rotation);
+		q1 = XMVectorSelect(q1, XMVectorNegate(q1), XMVectorLess(XMVector4Dot(q0, q1), XMVectorZero()));
+		XMStoreFloat4(&pose.rotation, XMQuaternionNormalize(XMVectorLerp(q0, q1, weight)));
+		XMStoreFloat3(&pose.translation, XMVectorLerp(XMLoadFloat3(&pose.translation), XMLoadFloat3(&to.translation), weight));
+	}
+
+	/// <summary>基準からの差分を重みの分だけ姿勢に重ねる</summary>
+	inline void AddPose(BonePose& pose, const BonePose& sample, const BonePose& reference, float weight)
+	{
+		auto sampleRotation = XMQuaternionNormalize(XMLoadFloat4(&sample.rotation));
+		auto referenceRotation = XMQuaternionNormalize(XMLoadFloat4(&reference.rotation));
+		// 基準の回転の後にdeltaを回せばサンプルの回転になる
+		auto delta = XMQuaternionMultiply(XMQuaternionConjugate(referenceRotation), sampleRotation);
+		if (weight < 1.0f) {
+			delta = XMQuaternionSlerp(XMQuaternionIdentity(), delta, weight);
+		}
+		XMStoreFloat4(&pose.rotation, XMQuaternionNormalize(XMQuaternionMultiply(XMLoadFloat4(&pose.rotation), delta)));
+		auto translation = XMLoadFloat3(&sample.translation) - XMLoadFloat3(&reference.translation);
+		XMStoreFloat3(&pose.translation, XMVectorMultiplyAdd(translation, XMVectorReplicate(weight),
+			XMLoadFloat3(&pose.translation)));
+	}
+
+	inline float MaskWeight(const vector<float>& mask, uint32_t bone)
+	{
+		return mask.empty() ? 1.0f : mask[bone];
+	}
+}
+
+void AnimationBlender::BuildSlot(const Layer& layer, Slot& slot) const
+{
+	slot.tracks.clear();
+	slot.restBones.clear();
+	slot.references.clear();
+	if (slot.clip == nullptr) {
+		return;
+	}
+	auto& tracks = slot.clip->Tracks();
+	vector<uint8_t> tracked(_boneNum, 0);
+	for (uint32_t t = 0; t < tracks.size(); ++t) {
+		auto bone = tracks[t].bone;
+		if (bone < _boneNum) {
+			tracked[bone] = 1;
+			if (MaskWeight(layer.mask, bone) > 0.0f) {
+				slot.tracks.push_back(t);
+			}
+		}
+	}
+	if (layer.mode == AnimationBlendMode::Override) {
+		for (uint32_t bone = 0; bone < _boneNum; ++bone) {
+			if (!tracked[bone] && MaskWeight(layer.mask, bone) > 0.0f) {
+				slot.restBones.push_back(bone);
+			}
+		}
+	}
+	else {
+		// 加算の基準は最初のフレームの姿勢
+		slot.references.resize(_boneNum, rest_pose);
+		slot.clip->SampleTracks(0.0f, slot.tracks.data(), slot.tracks.size(), slot.references.data());
+	}
+}
+
+float AnimationBlender::FadeRatio(const Layer& layer, uint32_t frame) const
+{
+	if (layer.fadeFrames == 0 || frame >= layer.fadeStart + layer.fadeFrames) {
+		return 1.0f;
+	}
+	if (frame <= layer.fadeStart) {
+		return 0.0f;
+	}
+	return static_cast<float>(frame - layer.fadeStart) / layer.fadeFrames;
+}
+
+uint32_t AnimationBlender::SlotFrame(const Slot& slot, uint32_t frame)
+{
+	if (slot.clip == nullptr || frame <= slot.startFrame) {
+		return 0;
+	}
+	auto elapsed = frame - slot.startFrame;
+	auto duration = slot.clip->Duration();
+	return slot.loop ? elapsed % (duration + 1) : min(elapsed, duration);
+}
+
+void AnimationBlender::BlendSlot(const Layer& layer, const Slot& slot, float weight, uint32_t frame,
+	AnimationBlendBuffers& buffers) const
+{
+	auto& tracks = slot.clip->Tracks();
+	auto& poses = buffers.poses;
+	auto& samples = buffers.samples;
+	auto markAnimated = [&buffers](uint32_t bone) {
+		if (!buffers.animated[bone]) {
+			buffers.animated[bone] = 1;
+			buffers.animatedBones.push_back(bone);
+		}
+	};
+	slot.clip->SampleTracks(static_cast<float>(SlotFrame(slot, frame)), slot.tracks.data(), slot.tracks.size(), samples.data());
+	buffers.sampledTrackNum += slot.tracks.size();
+	if (layer.mode == AnimationBlendMode::Override) {
+		for (auto t : slot.tracks) {
+			auto bone = tracks[t].bone;
+			BlendPose(poses[bone], samples[bone], weight * MaskWeight(layer.mask, bone));
+			markAnimated(bone);
+		}
+		// トラックの無いボーンは初期姿勢に近づける（もともと初期姿勢のものは変わらない）
+		for (auto bone : slot.restBones) {
+			if (buffers.animated[bone]) {
+				BlendPose(poses[bone], rest_pose, weight * MaskWeight(layer.mask, bone));
+			}
+		}
+	}
+	else {
+		for (auto t : slot.tracks) {
+			auto bone = tracks[t].bone;
+			AddPose(poses[bone], samples[bone], slot.references[bone], weight * MaskWeight(layer.mask, bone));
+			markAnimated(bone);
+		}
+	}
+}
+
+void AnimationBlender::Reset(size_t boneNum)
+{
+	_boneNum = boneNum;
+	_layers.clear();
+	_layers.emplace_back();
+}
+
+size_t AnimationBlender::AddLayer(AnimationBlendMode mode, float weight)
+{
+	_layers.emplace_back();
+	_layers.back().mode = mode;
+	_layers.back().weight = max(0.0f, weight);
+	return _layers.size() - 1;
+}
+
+void AnimationBlender::SetLayerWeight(size_t layer, float weight)
+{
+	assert(layer < _layers.size());
+	_layers[layer].weight = max(0.0f, weight);
+}
+
+float AnimationBlender::LayerWeight(size_t layer) const
+{
+	assert(layer < _layers.size());
+	return _layers[layer].weight;
+}
+
+void AnimationBlender::SetLayerMask(size_t layer, const vector<float>& mask)
+{
+	assert(layer < _layers.size());
+	assert(mask.empty() || mask.size() == _boneNum);
+	auto& l = _layers[layer];
+	l.mask = mask;
+	BuildSlot(l, l.current);
+	BuildSlot(l, l.previous);
+}
+
+void AnimationBlender::Play(size_t layer, const AnimationClip* clip, uint32_t frame, uint32_t fadeFrames, bool loop)
+{
+	assert(layer < _layers.size());
+	auto& l = _layers[layer];
+	if (fadeFrames > 0 && l.current.clip != nullptr) {
+		l.previous = move(l.current);
+	}
+	else {
+		l.previous = Slot();
+	}
+	l.current = Slot();
+	l.current.clip = clip;
+	l.current.startFrame = frame;
+	l.current.loop = loop;
+	BuildSlot(l, l.current);
+	l.fadeStart = frame;
+	l.fadeFrames = l.previous.clip != nullptr ? fadeFrames : 0;
+}
+
+void AnimationBlender::Stop(size_t layer, uint32_t frame, uint32_t fadeFrames)
+{
+	assert(layer < _layers.size());
+	auto& l = _layers[layer];
+	l.previous = fadeFrames > 0 ? move(l.current) : Slot();
+	l.current = Slot();
+	l.fadeStart = frame;
+	l.fadeFrames = l.previous.clip != nullptr ? fadeFrames : 0;
+}
+
+const AnimationClip* AnimationBlender::LayerClip(size_t layer) const
+{
+	assert(layer < _layers.size());
+	return _layers[layer].current.clip;
+}
+
+uint32_t AnimationBlender::LayerFrame(size_t layer, uint32_t frame) const
+{
+	assert(layer < _layers.size());
+	return SlotFrame(_layers[layer].current, frame);
+}
+
+void AnimationBlender::Restart(uint32_t frame)
+{
+	for (auto& layer : _layers) {
+		layer.current.startFrame = frame;
+		layer.previous = Slot();
+		layer.fadeFrames = 0;
+	}
+}
+
+void AnimationBlender::ReplaceClip(const AnimationClip* from, const AnimationClip* to)
+{
+	for (auto& layer : _layers) {
+		for (auto slot : { &layer.current, &layer.previous }) {
+			if (slot->clip == from) {
+				slot->clip = to;
+				BuildSlot(layer, *slot);
+			}
+		}
+	}
+}
+
+const AnimationClip* AnimationBlender::SingleClip(uint32_t frame, uint32_t& clipFrame) const
+{
+	const Layer* single = nullptr;
+	for (auto& layer : _layers) {
+		if (layer.weight <= 0.0f || (layer.current.clip == nullptr && FadeRatio(layer, frame) >= 1.0f)) {
+			// 何も重ねないレイヤー
+			continue;
+		}
+		if (single != nullptr) {
+			return nullptr;
+		}
+		single = &layer;
+	}
+	if (single == nullptr || single->mode != AnimationBlendMode::Override || single->weight < 1.0f || !single->mask.empty() ||
+		single->current.clip == nullptr || FadeRatio(*single, frame) < 1.0f) {
+		return nullptr;
+	}
+	clipFrame = SlotFrame(single->current, frame);
+	return single->current.clip;
+}
+
+void AnimationBlender::Evaluate(uint32_t frame, AnimationBlendBuffers& buffers) const
+{
+	// 前回動かしたボーンだけ初期姿勢に戻す
+	if (buffers.poses.size() != _boneNum) {
+		buffers.poses.assign(_boneNum, rest_pose);
+		buffers.samples.assign(_boneNum, rest_pose);
+		buffers.animated.assign(_boneNum, 0);
+		buffers.animatedBones.clear();
+	}
+	for (auto bone : buffers.animatedBones) {
+		buffers.poses[bone] = rest_pose;
+		buffers.animated[bone] = 0;
+	}
+	buffers.animatedBones.clear();
+	buffers.sampledTrackNum = 0;
+
+	for (auto& layer : _layers) {
+		if (layer.weight <= 0.0f) {
+			continue;
+		}
+		// クロスフェード中は消えていくクリップを先に重ねる
+		// 上書きでは消えていくクリップの上に新しいクリップを進み具合の重みで重ね、加算では両方を重みで分ける
+		auto fade = FadeRatio(layer, frame);
+		auto hasCurrent = layer.current.clip != nullptr;
+		float previousWeight = 0.0f;
+		if (layer.previous.clip != nullptr && fade < 1.0f) {
+			previousWeight = (hasCurrent && layer.mode == AnimationBlendMode::Override) ? 1.0f : 1.0f - fade;
+		}
+		if (previousWeight > 0.0f) {
+			BlendSlot(layer, layer.previous, layer.weight * previousWeight, frame, buffers);
+		}
+		if (hasCurrent && fade > 0.0f) {
+			BlendSlot(layer, layer.current, layer.weight * fade, frame, buffers);
+		}
+	}
+}
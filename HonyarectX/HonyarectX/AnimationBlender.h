@@ -0,0 +1,138 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "AnimationClip.h"
+
+/// <summary>レイヤーの重ね方</summary>
+enum class AnimationBlendMode {
+	Override,		// 下のレイヤーまでの姿勢を重みの分だけこのレイヤーの姿勢に置き換える
+	Additive,		// クリップの最初のフレームからの差分を重みの分だけ下のレイヤーまでの姿勢に重ねる
+};
+
+/// <summary>評価の結果と作業領域（同時に評価するスレッドごとに用意する）</summary>
+struct AnimationBlendBuffers {
+	/// <summary>ボーン番号ごとの姿勢（animatedBones以外は初期姿勢）</summary>
+	std::vector<BonePose> poses;
+	/// <summary>初期姿勢から動かしたボーン（ボーン行列を作る必要があるもの）</summary>
+	std::vector<uint32_t> animatedBones;
+	/// <summary>サンプリングした姿勢（ボーン番号ごと）</summary>
+	std::vector<BonePose> samples;
+	/// <summary>ボーンごとのanimatedBonesに入れたかどうか</summary>
+	std::vector<uint8_t> animated;
+	/// <summary>直前の評価でサンプリングしたトラック数</summary>
+	size_t sampledTrackNum = 0;
+};
+
+/// <summary>
+/// クリップをレイヤーに重ねて再生する
+/// レイヤーは追加した順に重ね、それぞれクロスフェード・重み・ボーンごとのマスクを持つ
+/// 重みが0のレイヤーやマスクで外したボーンはサンプリングしない
+/// 時間はすべて共通のフレーム番号（再生開始からのフレーム数）で表し、評価はメンバーを書き換えないので
+/// 同じ状態のまま任意のフレームを複数のスレッドから評価してよい
+/// </summary>
+class AnimationBlender
+{
+private:
+	/// <summary>レイヤーで再生中のクリップ</summary>
+	struct Slot {
+		const AnimationClip* clip = nullptr;
+		uint32_t startFrame = 0;			// クリップの0フレーム目にあたるフレーム
+		bool loop = true;
+		std::vector<uint32_t> tracks;		// サンプリングするトラック（マスクで外れていないもの）
+		std::vector<uint32_t> restBones;	// マスク内でトラックの無いボーン（上書きでは初期姿勢に近づける）
+		std::vector<BonePose> references;	// 加算の基準（tracksの最初のフレームの姿勢、ボーン番号ごと）
+	};
+	struct Layer {
+		AnimationBlendMode mode = AnimationBlendMode::Override;
+		float weight = 1.0f;
+		std::vector<float> mask;			// ボーンごとの重み（空ならすべて1）
+		Slot current;
+		Slot previous;						// クロスフェードで消えていくクリップ
+		uint32_t fadeStart = 0;
+		uint32_t fadeFrames = 0;
+	};
+	size_t _boneNum = 0;
+	std::vector<Layer> _layers;
+
+	/// <summary>マスクとクリップからサンプリングするトラックなどを求める</summary>
+	void BuildSlot(const Layer& layer, Slot& slot) const;
+
+	/// <summary>フェードの進み具合（0.0f～1.0f）</summary>
+	float FadeRatio(const Layer& layer, uint32_t frame) const;
+
+	/// <summary>クリップの何フレーム目か</summary>
+	static uint32_t SlotFrame(const Slot& slot, uint32_t frame);
+
+	/// <summary>1つのクリップを重ねる</summary>
+	void BlendSlot(const Layer& layer, const Slot& slot, float weight, uint32_t frame, AnimationBlendBuffers& buffers) const;
+
+public:
+	/// <summary>ボーン数を決め、上書きのレイヤーを1つ（0番、基本レイヤー）だけにする</summary>
+	void Reset(size_t boneNum);
+
+	/// <summary>
+	/// レイヤーを一番上に追加する
+	/// </summary>
+	/// <returns>レイヤー番号</returns>
+	size_t AddLayer(AnimationBlendMode mode, float weight = 1.0f);
+
+	size_t LayerNum() const { return _layers.size(); }
+
+	/// <summary>レイヤーの重み（0ならそのレイヤーは評価しない）</summary>
+	void SetLayerWeight(size_t layer, float weight);
+	float LayerWeight(size_t layer) const;
+
+	/// <summary>
+	/// ボーンごとの重みを設定する（0のボーンはサンプリングしない）
+	/// </summary>
+	/// <param name="mask">ボーン番号ごとの重み（空ならすべてのボーンを1にする）</param>
+	void SetLayerMask(size_t layer, const std::vector<float>& mask);
+
+	/// <summary>
+	/// クリップを再生する（それまで再生していたクリップからクロスフェードする）
+	/// フェード中にさらに再生した場合、消えていく途中のクリップは打ち切る
+	/// </summary>
+	/// <param name="layer">レイヤー番号</param>
+	/// <param name="clip">クリップ（再生している間は破棄しないこと）</param>
+	/// <param name="frame">再生を始めるフレーム</param>
+	/// <param name="fadeFrames">クロスフェードにかけるフレーム数（0なら切り替える）</param>
+	/// <param name="loop">falseなら最後のフレームで止める</param>
+	void Play(size_t layer, const AnimationClip* clip, uint32_t frame, uint32_t fadeFrames, bool loop = true);
+
+	/// <summary>再生をやめる（fadeFramesかけて消していく）</summary>
+	void Stop(size_t layer, uint32_t frame, uint32_t fadeFrames);
+
+	/// <summary>再生中のクリップ（無ければnullptr）</summary>
+	const AnimationClip* LayerClip(size_t layer) const;
+
+	/// <summary>再生中のクリップの何フレーム目か（クリップが無ければ0）</summary>
+	uint32_t LayerFrame(size_t layer, uint32_t frame) const;
+
+	/// <summary>すべてのクリップをframeから再生し直す（フェード中のものは打ち切る）</summary>
+	void Restart(uint32_t frame);
+
+	/// <summary>
+	/// 再生中のクリップを別のものに差し替える（再生位置とフェードはそのまま）
+	/// 同じ名前のモーションを読み込み直したときに呼ぶ
+	/// </summary>
+	void ReplaceClip(const AnimationClip* from, const AnimationClip* to);
+
+	/// <summary>
+	/// 1つのクリップをそのまま再生しているだけか（重み1・マスク無し・フェード無しの上書きレイヤーだけが有効）
+	/// その場合は姿勢がクリップのフレームだけで決まるので、クリップ単位の姿勢キャッシュを使える
+	/// </summary>
+	/// <param name="frame">フレーム</param>
+	/// <param name="clipFrame">クリップの何フレーム目か</param>
+	/// <returns>そのクリップ（そうでなければnullptr）</returns>
+	const AnimationClip* SingleClip(uint32_t frame, uint32_t& clipFrame) const;
+
+	/// <summary>
+	/// フレームでの姿勢を求める
+	/// </summary>
+	/// <param name="frame">フレーム</param>
+	/// <param name="buffers">結果と作業領域（前回の結果は上書きする）</param>
+	void Evaluate(uint32_t frame, AnimationBlendBuffers& buffers) const;
+};
@@ -0,0 +1,372 @@
+﻿#include "AnimationClip.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	const float sqrt2 = 1.41421356f;
+}
+
+void ComputeBezierCurves(const uint8_t* bezier, BezierCurves& curves)
+{
+	float x1[4], y1[4], x2[4], y2[4];
+	curves.linearMask = 0;
+	for (int i = 0; i < 4; ++i) {
+		x1[i] = bezier[i] / 127.0f;
+		y1[i] = bezier[4 + i] / 127.0f;
+		x2[i] = bezier[8 + i] / 127.0f;
+		y2[i] = bezier[12 + i] / 127.0f;
+		if (bezier[i] == bezier[4 + i] && bezier[8 + i] == bezier[12 + i]) {
+			// 直線はx(t) = y(t) = tになる制御点に置き換え、t = xから始めた時点で解けているようにする
+			curves.linearMask |= 1u << i;
+			x1[i] = y1[i] = 1.0f / 3.0f;
+			x2[i] = y2[i] = 2.0f / 3.0f;
+		}
+	}
+	auto p1x = XMVectorSet(x1[0], x1[1], x1[2], x1[3]);
+	auto p1y = XMVectorSet(y1[0], y1[1], y1[2], y1[3]);
+	auto p2x = XMVectorSet(x2[0], x2[1], x2[2], x2[3]);
+	auto p2y = XMVectorSet(y2[0], y2[1], y2[2], y2[3]);
+	auto one = XMVectorSplatOne();
+	auto three = XMVectorReplicate(3.0f);
+	// (1 + 3 * p1 - 3 * p2) * t^3 + (3 * p2 - 6 * p1) * t^2 + 3 * p1 * t
+	XMStoreFloat4(&curves.xa, one + three * (p1x - p2x));
+	XMStoreFloat4(&curves.xb, three * p2x - 6.0f * p1x);
+	XMStoreFloat4(&curves.xc, three * p1x);
+	XMStoreFloat4(&curves.ya, one + three * (p1y - p2y));
+	XMStoreFloat4(&curves.yb, three * p2y - 6.0f * p1y);
+	XMStoreFloat4(&curves.yc, three * p1y);
+}
+
+XMVECTOR XM_CALLCONV SolveBezierCurves(const BezierCurves& curves, FXMVECTOR x)
+{
+	const uint32_t all_linear = 0xf;
+	if (curves.linearMask == all_linear) {
+		return x;			// 計算不要
+	}
+	// tの誤差ではなくx(t)の誤差で打ち切る
+	const int max_iterations = 16;
+	const float epsilon = 1.0e-6f;
+
+	auto xa = XMLoadFloat4(&curves.xa);
+	auto xb = XMLoadFloat4(&curves.xb);
+	auto xc = XMLoadFloat4(&curves.xc);
+	auto eps = XMVectorReplicate(epsilon);
+	auto half = XMVectorReplicate(0.5f);
+	auto lo = XMVectorZero();
+	auto hi = XMVectorSplatOne();
+	auto t = x;			// 直線に近い曲線が多いので、t = xから始めるとほとんど1～3回で収まる
+	for (int i = 0; i < max_iterations; ++i) {
+		auto f = XMVectorMultiplyAdd(XMVectorMultiplyAdd(xa, t, xb), t, xc) * t - x;
+		auto error = XMVectorAbs(f);
+		if (XMVector4LessOrEqual(error, eps)) {
+			break;
+		}
+		// 解はx(t)がxより小さいtと大きいtの間にある
+		lo = XMVectorSelect(lo, t, XMVectorLess(f, XMVectorZero()));
+		hi = XMVectorSelect(hi, t, XMVectorGreater(f, XMVectorZero()));
+		// x'(t) = (3 * xa * t + 2 * xb) * t + xc（端で0になることがある）
+		auto d = XMVectorMultiplyAdd(XMVectorMultiplyAdd(XMVectorReplicate(3.0f) * xa, t, xb + xb), t, xc);
+		auto newton = t - f / d;
+		// 0除算などで範囲を外れたら二分法（NaNは比較がすべて偽になるのでこちらになる）
+		auto inside = XMVectorAndInt(XMVectorGreater(newton, lo), XMVectorLess(newton, hi));
+		auto next = XMVectorSelect((lo + hi) * half, newton, inside);
+		// 収まった曲線はそのまま（二分法で動かさない）
+		t = XMVectorSelect(next, t, XMVectorLessOrEqual(error, eps));
+	}
+	return XMVectorMultiplyAdd(XMVectorMultiplyAdd(XMLoadFloat4(&curves.ya), t, XMLoadFloat4(&curves.yb)), t,
+		XMLoadFloat4(&curves.yc)) * t;
+}
+
+PackedQuaternion PackQuaternion(FXMVECTOR q)
+{
+	XMFLOAT4 f;
+	XMStoreFloat4(&f, XMQuaternionNormalize(q));
+	float c[4] = { f.x, f.y, f.z, f.w };
+	int largest = 0;
+	for (int i = 1; i < 4; ++i) {
+		if (fabsf(c[i]) > fabsf(c[largest])) {
+			largest = i;
+		}
+	}
+	// 最大の成分が正になる方にすれば、残りの3成分は±1/√2に収まる
+	auto sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+	PackedQuaternion packed;
+	const float max_value = 32767.0f;
+	for (int i = 0, n = 0; i < 4; ++i) {
+		if (i == largest) {
+			continue;
+		}
+		auto normalized = (c[i] * sign * sqrt2 + 1.0f) * 0.5f;
+		auto value = static_cast<uint16_t>(min(max(normalized, 0.0f), 1.0f) * max_value + 0.5f);
+		packed.v[n++] = static_cast<uint16_t>(value << 1);
+	}
+	// 除いた成分の番号は1つ目と2つ目の最下位ビットに入れる
+	packed.v[0] |= largest & 1;
+	packed.v[1] |= (largest >> 1) & 1;
+	return packed;
+}
+
+XMVECTOR XM_CALLCONV UnpackQuaternion(const PackedQuaternion& packed)
+{
+	const float scale = 1.0f / 32767.0f;
+	auto largest = (packed.v[0] & 1) | ((packed.v[1] & 1) << 1);
+	float c[4];
+	float sum = 0.0f;
+	for (int i = 0, n = 0; i < 4; ++i) {
+		if (i == largest) {
+			continue;
+		}
+		c[i] = ((packed.v[n++] >> 1) * scale * 2.0f - 1.0f) * (1.0f / sqrt2);
+		sum += c[i] * c[i];
+	}
+	c[largest] = sqrtf(max(0.0f, 1.0f - sum));
+	return XMVectorSet(c[0], c[1], c[2], c[3]);
+}
+
+void AnimationClip::Compile(const vector<BoneKeyFrame>& keyframes, const vector<string>& boneNames)
+{
+	*this = AnimationClip();
+	_boneNum = boneNames.size();
+
+	// ボーン名の検索はここでだけ行う
+	unordered_map<string, uint32_t> boneTable;
+	for (uint32_t i = 0; i < boneNames.size(); ++i) {
+		boneTable.emplace(boneNames[i], i);
+	}
+	vector<vector<const BoneKeyFrame*>> keysOf(boneNames.size());
+	for (auto& keyframe : keyframes) {
+		auto it = boneTable.find(keyframe.name);
+		if (it != boneTable.end()) {
+			keysOf[it->second].push_back(&keyframe);
+		}
+	}
+
+	// 同じ補間パラメータは同じ曲線を使う
+	map<array<uint8_t, 16>, uint32_t> curveTable;
+	auto findCurve = [this, &curveTable](const uint8_t* bezier) {
+		array<uint8_t, 16> key;
+		copy(bezier, bezier + key.size(), key.begin());
+		auto it = curveTable.find(key);
+		if (it != curveTable.end()) {
+			return it->second;
+		}
+		auto index = static_cast<uint32_t>(_curves.size());
+		_curves.emplace_back();
+		ComputeBezierCurves(bezier, _curves.back());
+		curveTable.emplace(key, index);
+		return index;
+	};
+
+	for (uint32_t bone = 0; bone < keysOf.size(); ++bone) {
+		auto& keys = keysOf[bone];
+		if (keys.empty()) {
+			continue;
+		}
+		// <=は狭義の弱順序にならないので<で比べ、同じフレームの順番はstable_sortで保つ
+		stable_sort(keys.begin(), keys.end(), [](const BoneKeyFrame* lval, const BoneKeyFrame* rval) {
+			return lval->frameNo < rval->frameNo;
+			});
+		AnimationTrack track = { bone, static_cast<uint32_t>(_frames.size()), 0 };
+		for (auto key : keys) {
+			if (track.keyNum > 0 && _frames.back() == key->frameNo) {
+				// 同じフレームは後に書かれたもので上書きする
+				_rotations.back() = key->quaternion;
+				_translations.back() = key->location;
+				_curveIndices.back() = findCurve(key->bezier);
+				continue;
+			}
+			_frames.push_back(key->frameNo);
+			_rotations.push_back(key->quaternion);
+			_translations.push_back(key->location);
+			_curveIndices.push_back(findCurve(key->bezier));
+			++track.keyNum;
+		}
+		_duration = max(_duration, _frames.back());
+		_tracks.push_back(track);
+	}
+}
+
+XMVECTOR XM_CALLCONV AnimationClip::Rotation(size_t key) const
+{
+	return _packedRotations.empty() ? XMLoadFloat4(&_rotations[key]) : UnpackQuaternion(_packedRotations[key]);
+}
+
+void AnimationClip::SampleTrack(const AnimationTrack& track, float frame, BonePose& pose) const
+{
+	auto first = _frames.data() + track.keyBegin;
+	auto last = first + track.keyNum;
+	// frameより後の最初のキーフレーム
+	auto next = upper_bound(first, last, frame, [](float f, uint32_t key) {
+		return f < static_cast<float>(key);
+		});
+	if (next == first || next == last) {
+		// 範囲外は端のキーフレームのまま
+		auto k = (next == first) ? track.keyBegin : track.keyBegin + track.keyNum - 1;
+		XMStoreFloat4(&pose.rotation, Rotation(k));
+		pose.translation = _translations[k];
+		return;
+	}
+	auto k1 = static_cast<size_t>(next - _frames.data());
+	auto k0 = k1 - 1;
+	auto x = (frame - _frames[k0]) / static_cast<float>(_frames[k1] - _frames[k0]);
+	// X, Y, Z, 回転の補間曲線をまとめて解く
+	auto t = SolveBezierCurves(_curves[_curveIndices[k1]], XMVectorReplicate(x));
+	XMStoreFloat4(&pose.rotation, XMQuaternionSlerp(Rotation(k0), Rotation(k1), XMVectorGetW(t)));
+	XMStoreFloat3(&pose.translation,
+		XMVectorLerpV(XMLoadFloat3(&_translations[k0]), XMLoadFloat3(&_translations[k1]), t));
+}
+
+void AnimationClip::Sample(float frame, BonePose* poses) const
+{
+	for (auto& track : _tracks) {
+		SampleTrack(track, frame, poses[track.bone]);
+	}
+}
+
+void AnimationClip::SampleTracks(float frame, const uint32_t* tracks, size_t trackNum, BonePose* poses) const
+{
+	for (size_t i = 0; i < trackNum; ++i) {
+		auto& track = _tracks[tracks[i]];
+		SampleTrack(track, frame, poses[track.bone]);
+	}
+}
+
+ClipCompressStats AnimationClip::Compress(const ClipCompressOptions& options)
+{
+	ClipCompressStats stats = {};
+	stats.keyNum = KeyNum();
+	stats.trackNum = _tracks.size();
+	stats.bytes = MemoryBytes();
+
+	// 誤差は圧縮前のクリップと比べる
+	const auto original = *this;
+	// 判定には量子化した回転を使う
+	vector<XMFLOAT4> rotations(original.KeyNum());
+	for (size_t k = 0; k < rotations.size(); ++k) {
+		auto q = original.Rotation(k);
+		XMStoreFloat4(&rotations[k], options.quantizeRotations ? UnpackQuaternion(PackQuaternion(q)) : q);
+	}
+	auto withinError = [&options](const BonePose& a, const BonePose& b) {
+		// qと-qは同じ回転なので内積の絶対値で角度を求める（VMDのクォータニオンは正規化されていないことがある）
+		auto qa = XMQuaternionNormalize(XMLoadFloat4(&a.rotation));
+		auto qb = XMQuaternionNormalize(XMLoadFloat4(&b.rotation));
+		auto dot = fabsf(XMVectorGetX(XMVector4Dot(qa, qb)));
+		auto angle = 2.0f * acosf(min(dot, 1.0f));
+		auto distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&a.translation) - XMLoadFloat3(&b.translation)));
+		return angle <= options.maxAngle && distance <= options.maxDistance;
+	};
+	auto keyPose = [&original, &rotations](size_t k) {
+		BonePose pose;
+		pose.rotation = rotations[k];
+		pose.translation = original._translations[k];
+		return pose;
+	};
+	// 残したキーフレームprevとnextの間を補間した姿勢（無い側は端のキーフレームのまま）
+	const size_t none = SIZE_MAX;
+	auto interpolate = [&](size_t prev, size_t next, uint32_t frame) {
+		if (prev == none || (next != none && frame >= original._frames[next])) {
+			return keyPose(next);
+		}
+		if (next == none || frame <= original._frames[prev]) {
+			return keyPose(prev);
+		}
+		auto x = static_cast<float>(frame - original._frames[prev]) /
+			static_cast<float>(original._frames[next] - original._frames[prev]);
+		auto t = SolveBezierCurves(original._curves[original._curveIndices[next]], XMVectorReplicate(x));
+		BonePose pose;
+		XMStoreFloat4(&pose.rotation,
+			XMQuaternionSlerp(XMLoadFloat4(&rotations[prev]), XMLoadFloat4(&rotations[next]), XMVectorGetW(t)));
+		XMStoreFloat3(&pose.translation, XMVectorLerpV(XMLoadFloat3(&original._translations[prev]),
+			XMLoadFloat3(&original._translations[next]), t));
+		return pose;
+	};
+
+	_tracks.clear();
+	_frames.clear();
+	_rotations.clear();
+	_packedRotations.clear();
+	_translations.clear();
+	_curveIndices.clear();
+	_curves.clear();
+	vector<uint32_t> curveRemap(original._curves.size(), UINT32_MAX);
+	vector<XMFLOAT4> keptRotations;
+	vector<size_t> kept;
+	auto identity = XMQuaternionIdentity();
+	for (auto& track : original._tracks) {
+		// 前から順に、取り除いても前後の残したキーフレームの間の全フレームが許容誤差に収まるものを取り除く
+		kept.clear();
+		auto end = static_cast<size_t>(track.keyBegin) + track.keyNum;
+		for (size_t k = track.keyBegin; k < end; ++k) {
+			auto prev = kept.empty() ? none : kept.back();
+			auto next = k + 1 < end ? k + 1 : none;
+			if (prev == none && next == none) {
+				kept.push_back(k);
+				continue;
+			}
+			auto from = prev == none ? original._frames[k] : original._frames[prev];
+			auto to = next == none ? original._frames[k] : original._frames[next];
+			auto removable = true;
+			for (auto frame = from; frame <= to && removable; ++frame) {
+				BonePose expected;
+				original.SampleTrack(track, static_cast<float>(frame), expected);
+				removable = withinError(interpolate(prev, next, frame), expected);
+			}
+			if (!removable) {
+				kept.push_back(k);
+			}
+		}
+		if (kept.size() == 1) {
+			// 初期姿勢のままならトラックごと取り除く（ボーン行列は単位行列のまま）
+			BonePose rest;
+			XMStoreFloat4(&rest.rotation, identity);
+			rest.translation = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			if (withinError(keyPose(kept[0]), rest)) {
+				++stats.restTrackNum;
+				continue;
+			}
+			++stats.constantTrackNum;
+		}
+
+		AnimationTrack compressed = { track.bone, static_cast<uint32_t>(_frames.size()), static_cast<uint32_t>(kept.size()) };
+		for (auto k : kept) {
+			auto curve = original._curveIndices[k];
+			if (curveRemap[curve] == UINT32_MAX) {
+				curveRemap[curve] = static_cast<uint32_t>(_curves.size());
+				_curves.push_back(original._curves[curve]);
+			}
+			_frames.push_back(original._frames[k]);
+			keptRotations.push_back(rotations[k]);
+			_translations.push_back(original._translations[k]);
+			_curveIndices.push_back(curveRemap[curve]);
+		}
+		_tracks.push_back(compressed);
+	}
+	if (options.quantizeRotations) {
+		_packedRotations.resize(keptRotations.size());
+		for (size_t k = 0; k < keptRotations.size(); ++k) {
+			_packedRotations[k] = PackQuaternion(XMLoadFloat4(&keptRotations[k]));
+		}
+	}
+	else {
+		_rotations.swap(keptRotations);
+	}
+
+	stats.compressedKeyNum = KeyNum();
+	stats.compressedBytes = MemoryBytes();
+	return stats;
+}
+
+size_t AnimationClip::MemoryBytes() const
+{
+	return _tracks.size() * sizeof(AnimationTrack) + _frames.size() * sizeof(uint32_t) +
+		_rotations.size() * sizeof(XMFLOAT4) + _packedRotations.size() * sizeof(PackedQuaternion) +
+		_translations.size() * sizeof(XMFLOAT3) + _curveIndices.size() * sizeof(uint32_t) +
+		_curves.size() * sizeof(BezierCurves);
+}
@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <DirectXMath.h>
+
+/// <summary>VMDのボーンのキーフレーム（ボーン名のまま、クリップにする前のもの）</summary>
+struct BoneKeyFrame {
+	std::string name;					// ボーン名
+	uint32_t frameNo;					// フレーム番号
+	DirectX::XMFLOAT3 location;			// 位置
+	DirectX::XMFLOAT4 quaternion;		// クォータニオン（回転）
+	uint8_t bezier[16];					// 前のキーフレームからの補間（VMDの補間の先頭16バイト、0～127）
+};
+
+/// <summary>
+/// VMDの補間曲線4本（X, Y, Z, 回転の順）の3次式の係数
+/// 制御点(0, 0), (x1, y1), (x2, y2), (1, 1)のベジェ曲線を x(t) = ((xa * t + xb) * t + xc) * t のように持つ
+/// </summary>
+struct BezierCurves {
+	DirectX::XMFLOAT4 xa, xb, xc;
+	DirectX::XMFLOAT4 ya, yb, yc;
+	uint32_t linearMask;				// 直線（y = x）になる曲線のビット（X:1, Y:2, Z:4, 回転:8、係数もx(t) = y(t) = tにしてある）
+};
+
+/// <summary>サンプリングしたボーン1つ分の姿勢</summary>
+struct BonePose {
+	DirectX::XMFLOAT4 rotation;			// 回転（クォータニオン）
+	DirectX::XMFLOAT3 translation;		// 移動量
+};
+
+/// <summary>smallest threeで48bitにしたクォータニオン（最大の成分を除く3成分を15bitずつと、除いた成分の番号を2bit）</summary>
+struct PackedQuaternion {
+	uint16_t v[3];
+};
+
+/// <summary>クリップの圧縮の設定</summary>
+struct ClipCompressOptions {
+	float maxAngle = 0.002f;			// 回転の許容誤差（ラジアン）
+	float maxDistance = 0.005f;			// 移動量の許容誤差
+	bool quantizeRotations = true;		// 回転をPackedQuaternionにする
+};
+
+/// <summary>圧縮の結果</summary>
+struct ClipCompressStats {
+	size_t keyNum;						// 圧縮前のキーフレーム数
+	size_t compressedKeyNum;			// 圧縮後のキーフレーム数
+	size_t trackNum;					// 圧縮前のトラック数
+	size_t constantTrackNum;			// キーフレームが1つになったトラック
+	size_t restTrackNum;				// 初期姿勢から動かないので取り除いたトラック
+	size_t bytes;						// 圧縮前のメモリ
+	size_t compressedBytes;				// 圧縮後のメモリ
+};
+
+/// <summary>ボーン1つ分のキーフレームの範囲（AnimationClipの各配列の中）</summary>
+struct AnimationTrack {
+	uint32_t bone;						// ボーン番号
+	uint32_t keyBegin;					// 先頭のキーフレーム
+	uint32_t keyNum;					// キーフレーム数（1以上）
+};
+
+/// <summary>
+/// VMDの補間パラメータから曲線4本分の係数を求める
+/// 並びはx1, y1, x2, y2の順に、それぞれX, Y, Z, 回転の4つずつ（PMDActorが使っていた回転の曲線は3, 7, 11, 15番目）
+/// </summary>
+void ComputeBezierCurves(const uint8_t* bezier, BezierCurves& curves);
+
+/// <summary>
+/// 曲線4本の、xに対するyをまとめて求める
+/// x(t)は単調増加なので、tの範囲を挟み込みながらニュートン法で解き、範囲を外れる場合は二分法にする
+/// </summary>
+/// <param name="curves">曲線4本分の係数</param>
+/// <param name="x">曲線ごとのx（0.0f～1.0f）</param>
+/// <returns>曲線ごとのy</returns>
+DirectX::XMVECTOR XM_CALLCONV SolveBezierCurves(const BezierCurves& curves, DirectX::FXMVECTOR x);
+
+/// <summary>クォータニオンを48bitにする（正規化してから、qと-qは同じ回転なので最大の成分が正になる方で持つ）</summary>
+PackedQuaternion PackQuaternion(DirectX::FXMVECTOR q);
+
+/// <summary>48bitにしたクォータニオンを戻す</summary>
+DirectX::XMVECTOR XM_CALLCONV UnpackQuaternion(const PackedQuaternion& packed);
+
+/// <summary>
+/// ボーンのモーションをコンパイルしたもの（作った後は変更しない）
+/// ボーン番号順のトラックに分け、フレーム番号・回転・移動量・補間パラメータを別々の連続した配列に持つ
+/// サンプリングはトラックごとに二分探索するだけで、メモリの確保もボーン名の検索もしない
+/// </summary>
+class AnimationClip
+{
+private:
+	std::vector<AnimationTrack> _tracks;
+	/// <summary>キーフレームごとのフレーム番号（トラック内は昇順、重複なし）</summary>
+	std::vector<uint32_t> _frames;
+	/// <summary>回転（圧縮で量子化した場合は_packedRotationsを使い、こちらは空になる）</summary>
+	std::vector<DirectX::XMFLOAT4> _rotations;
+	std::vector<PackedQuaternion> _packedRotations;
+	std::vector<DirectX::XMFLOAT3> _translations;
+	/// <summary>前のキーフレームからの補間曲線（_curvesの番号）</summary>
+	std::vector<uint32_t> _curveIndices;
+	/// <summary>補間曲線（読み込み時に係数にしておく、ほとんどのキーフレームは同じ曲線なので重複を除いて持つ）</summary>
+	std::vector<BezierCurves> _curves;
+	uint32_t _duration = 0;
+	size_t _boneNum = 0;
+
+	DirectX::XMVECTOR XM_CALLCONV Rotation(size_t key) const;
+
+	/// <summary>トラック1つ分のフレームでの姿勢</summary>
+	void SampleTrack(const AnimationTrack& track, float frame, BonePose& pose) const;
+
+public:
+	/// <summary>
+	/// キーフレームからクリップを作る
+	/// ボーンごとにフレーム順に並べ、同じフレームのキーフレームはファイルで後に書かれたものを使う
+	/// </summary>
+	/// <param name="keyframes">キーフレーム（並び順は問わない）</param>
+	/// <param name="boneNames">ボーン番号ごとの名前（モデルに無いボーンのキーフレームは捨てる）</param>
+	void Compile(const std::vector<BoneKeyFrame>& keyframes, const std::vector<std::string>& boneNames);
+
+	/// <summary>
+	/// 許容誤差の範囲でクリップを小さくする
+	/// 前後のキーフレームから補間しても全フレームで圧縮前との差が許容誤差に収まるキーフレームを取り除き、
+	/// キーフレームが1つになって初期姿勢のままのトラックは取り除く（サンプリングもしなくなる）
+	/// 回転の量子化の誤差も含めて判定する
+	/// </summary>
+	ClipCompressStats Compress(const ClipCompressOptions& options);
+
+	/// <summary>
+	/// フレームでの姿勢を求める
+	/// 最初のキーフレームより前は最初の、最後より後は最後のキーフレームの姿勢にする
+	/// </summary>
+	/// <param name="frame">フレーム</param>
+	/// <param name="poses">ボーン番号ごとの姿勢（BoneNum()個、トラックのあるボーンだけ書き込む）</param>
+	void Sample(float frame, BonePose* poses) const;
+
+	/// <summary>
+	/// 指定したトラックだけフレームでの姿勢を求める（マスクで外したボーンをサンプリングしないように）
+	/// </summary>
+	/// <param name="frame">フレーム</param>
+	/// <param name="tracks">Tracks()の番号</param>
+	/// <param name="trackNum">トラック数</param>
+	/// <param name="poses">ボーン番号ごとの姿勢（指定したトラックのボーンだけ書き込む）</param>
+	void SampleTracks(float frame, const uint32_t* tracks, size_t trackNum, BonePose* poses) const;
+
+	const std::vector<AnimationTrack>& Tracks() const { return _tracks; }
+
+	/// <summary>最後のキーフレームのフレーム番号</summary>
+	uint32_t Duration() const { return _duration; }
+
+	/// <summary>キーフレーム数（重複を除いたもの）</summary>
+	size_t KeyNum() const { return _frames.size(); }
+
+	/// <summary>Compileに渡したボーン数</summary>
+	size_t BoneNum() const { return _boneNum; }
+
+	/// <summary>キーフレームなどに使っているメモリ</summary>
+	size_t MemoryBytes() const;
+};
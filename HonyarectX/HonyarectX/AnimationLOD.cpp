@@ -0,0 +1,189 @@
+﻿#include "AnimationLOD.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	AnimationLODTier TierFromPixels(const AnimationLODPolicy& policy, float pixels)
+	{
+		if (pixels >= policy.noIKPixels) {
+			return AnimationLODTier::Full;
+		}
+		if (pixels >= policy.reducedPixels) {
+			return AnimationLODTier::NoIK;
+		}
+		if (pixels >= policy.frozenPixels) {
+			return AnimationLODTier::Reduced;
+		}
+		return AnimationLODTier::Frozen;
+	}
+}
+
+const char* AnimationLODTierName(AnimationLODTier tier)
+{
+	switch (tier) {
+	case AnimationLODTier::Full:
+		return "full";
+	case AnimationLODTier::NoIK:
+		return "no-ik";
+	case AnimationLODTier::Reduced:
+		return "reduced";
+	case AnimationLODTier::Frozen:
+		return "frozen";
+	}
+	return "";
+}
+
+void AnimationLODStats::Add(const AnimationLODStats& other)
+{
+	for (size_t i = 0; i < animation_lod_tier_num; ++i) {
+		updates[i] += other.updates[i];
+	}
+	evaluations += other.evaluations;
+	ikEvaluations += other.ikEvaluations;
+	interpolations += other.interpolations;
+}
+
+float ProjectedPixels(float radius, float distance, float projectionScale)
+{
+	if (distance <= radius) {
+		return FLT_MAX;
+	}
+	return 2.0f * radius * projectionScale / distance;
+}
+
+AnimationLODTier SelectAnimationLOD(const AnimationLODPolicy& policy, float pixels, AnimationLODTier current)
+{
+	auto tier = TierFromPixels(policy, pixels);
+	if (tier >= current) {
+		return tier;
+	}
+	// 細かい段階へ戻るのは閾値を余裕を持って超えてから
+	auto raised = TierFromPixels(policy, pixels / (1.0f + max(0.0f, policy.hysteresis)));
+	return min(raised, current);
+}
+
+void InterpolateBoneMatrices(const XMMATRIX* from, const XMMATRIX* to, float t, size_t boneNum, XMMATRIX* result)
+{
+	for (size_t i = 0; i < boneNum; ++i) {
+		result[i].r[0] = XMVectorLerp(from[i].r[0], to[i].r[0], t);
+		result[i].r[1] = XMVectorLerp(from[i].r[1], to[i].r[1], t);
+		result[i].r[2] = XMVectorLerp(from[i].r[2], to[i].r[2], t);
+		result[i].r[3] = XMVectorLerp(from[i].r[3], to[i].r[3], t);
+	}
+}
+
+void AnimationLOD::SetPolicy(const AnimationLODPolicy& policy)
+{
+	_policy = policy;
+	_policy.reducedInterval = max(1u, _policy.reducedInterval);
+}
+
+const AnimationLODPolicy& AnimationLOD::Policy() const
+{
+	return _policy;
+}
+
+void AnimationLOD::SetImportance(float importance)
+{
+	_importance = max(0.0f, importance);
+}
+
+float AnimationLOD::Importance() const
+{
+	return _importance;
+}
+
+AnimationLODTier AnimationLOD::Select(float pixels)
+{
+	SetTier(SelectAnimationLOD(_policy, pixels * _importance, _tier));
+	return _tier;
+}
+
+void AnimationLOD::SetTier(AnimationLODTier tier)
+{
+	if (tier != AnimationLODTier::Reduced) {
+		// 他の段階の間に補間の両端は古くなる
+		_keyValid = false;
+	}
+	_tier = tier;
+}
+
+AnimationLODTier AnimationLOD::Tier() const
+{
+	return _tier;
+}
+
+bool AnimationLOD::Update(float frame, uint32_t lastFrame, const AnimationPoseEvaluator& evaluate, vector<XMMATRIX>& matrices)
+{
+	++_stats.updates[static_cast<size_t>(_tier)];
+	frame = min(max(frame, 0.0f), static_cast<float>(lastFrame));
+	auto frameNo = static_cast<uint32_t>(frame);
+	switch (_tier) {
+	case AnimationLODTier::Full:
+	case AnimationLODTier::NoIK: {
+		auto solveIK = _tier == AnimationLODTier::Full;
+		evaluate(frameNo, solveIK, matrices);
+		++_stats.evaluations;
+		_stats.ikEvaluations += solveIK ? 1 : 0;
+		return true;
+	}
+	case AnimationLODTier::Reduced:
+		break;
+	case AnimationLODTier::Frozen:
+		return false;
+	}
+
+	// 間隔の両端を計算しておき、間は補間する
+	auto interval = _policy.reducedInterval;
+	auto from = frameNo - frameNo % interval;
+	auto to = min(from + interval, lastFrame);
+	auto evaluated = false;
+	if (!_keyValid || _keyFrames[0] != from || _keyFrames[1] != to) {
+		for (auto& keyMatrices : _keyMatrices) {
+			keyMatrices.resize(matrices.size());
+		}
+		if (_keyValid && _keyFrames[1] == from) {
+			// 次の区間に進んだだけなら前の終わりをそのまま使う
+			swap(_keyMatrices[0], _keyMatrices[1]);
+		}
+		else {
+			evaluate(from, false, _keyMatrices[0]);
+			++_stats.evaluations;
+		}
+		if (to != from) {
+			evaluate(to, false, _keyMatrices[1]);
+			++_stats.evaluations;
+		}
+		else {
+			_keyMatrices[1] = _keyMatrices[0];
+		}
+		_keyFrames[0] = from;
+		_keyFrames[1] = to;
+		_keyValid = true;
+		evaluated = true;
+	}
+	auto t = to > from ? (frame - from) / (to - from) : 0.0f;
+	InterpolateBoneMatrices(_keyMatrices[0].data(), _keyMatrices[1].data(), min(max(t, 0.0f), 1.0f), matrices.size(),
+		matrices.data());
+	++_stats.interpolations;
+	return evaluated;
+}
+
+void AnimationLOD::Invalidate()
+{
+	_keyValid = false;
+}
+
+const AnimationLODStats& AnimationLOD::Stats() const
+{
+	return _stats;
+}
+
+void AnimationLOD::ResetStats()
+{
+	_stats = AnimationLODStats();
+}
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <DirectXMath.h>
+
+/// <summary>アニメーション更新の段階（後ろほど計算を省く）</summary>
+enum class AnimationLODTier {
+	Full,			// 毎フレーム、IKまで解く
+	NoIK,			// 毎フレーム計算するがIKは解かない
+	Reduced,		// 数フレームおきに計算（IK無し）し、間はボーン行列を補間する
+	Frozen,			// 更新しない（直前の姿勢のまま）
+};
+
+/// <summary>段階の数</summary>
+const size_t animation_lod_tier_num = 4;
+
+/// <summary>段階の名前（表示用）</summary>
+const char* AnimationLODTierName(AnimationLODTier tier);
+
+/// <summary>
+/// 段階の選び方
+/// 画面上の大きさ（バウンディングスフィアの直径のピクセル数に重要度を掛けたもの）を閾値と比べる
+/// </summary>
+struct AnimationLODPolicy {
+	/// <summary>これ未満ならIKを解かない</summary>
+	float noIKPixels = 160.0f;
+	/// <summary>これ未満ならreducedIntervalフレームおきに計算する</summary>
+	float reducedPixels = 48.0f;
+	/// <summary>これ未満なら更新しない（0なら止めない）</summary>
+	float frozenPixels = 8.0f;
+	/// <summary>Reducedで姿勢を計算するモーションのフレーム間隔</summary>
+	uint32_t reducedInterval = 2;
+	/// <summary>細かい段階へ戻るときは閾値をこの割合だけ超えるまで待つ（境界でのちらつき防止）</summary>
+	float hysteresis = 0.1f;
+};
+
+/// <summary>段階ごとの更新の回数</summary>
+struct AnimationLODStats {
+	/// <summary>その段階で更新した回数</summary>
+	uint64_t updates[animation_lod_tier_num] = {};
+	/// <summary>姿勢を計算した回数（うちIKまで解いたもの）</summary>
+	uint64_t evaluations = 0;
+	uint64_t ikEvaluations = 0;
+	/// <summary>ボーン行列を補間した回数</summary>
+	uint64_t interpolations = 0;
+
+	/// <summary>別の統計を足し込む（複数のアクターの集計用）</summary>
+	void Add(const AnimationLODStats& other);
+};
+
+/// <summary>
+/// 姿勢の計算（frameの最終的なボーン行列をmatricesに書き込む）
+/// solveIKがfalseならIKを解かなくてよい
+/// </summary>
+using AnimationPoseEvaluator = std::function<void(uint32_t frame, bool solveIK, std::vector<DirectX::XMMATRIX>& matrices)>;
+
+/// <summary>
+/// バウンディングスフィアの画面上の直径（ピクセル）
+/// </summary>
+/// <param name="radius">バウンディングスフィアの半径</param>
+/// <param name="distance">視点から中心までの距離</param>
+/// <param name="projectionScale">距離1の位置で長さ1が何ピクセルになるか</param>
+/// <returns>視点がスフィアの中にある場合はFLT_MAX</returns>
+float ProjectedPixels(float radius, float distance, float projectionScale);
+
+/// <summary>
+/// 画面上の大きさから段階を選ぶ
+/// </summary>
+/// <param name="policy">選び方</param>
+/// <param name="pixels">画面上の大きさ（重要度を掛けたもの）</param>
+/// <param name="current">今の段階（細かい段階へ戻るかどうかの判定に使う）</param>
+AnimationLODTier SelectAnimationLOD(const AnimationLODPolicy& policy, float pixels, AnimationLODTier current);
+
+/// <summary>
+/// 2つの姿勢のボーン行列を成分ごとに線形補間する
+/// 回転が少ししか変わらない間隔（Reducedの数フレーム）で使う前提で、正規直交性は保たない
+/// </summary>
+void InterpolateBoneMatrices(const DirectX::XMMATRIX* from, const DirectX::XMMATRIX* to, float t, size_t boneNum,
+	DirectX::XMMATRIX* result);
+
+/// <summary>
+/// アクターごとのアニメーション更新のLOD
+/// 画面上の大きさで段階を選び、段階に応じて姿勢の計算を省く
+/// Reducedでは間隔の両端のフレームを計算して持っておき、その間は補間したボーン行列を使う
+/// </summary>
+class AnimationLOD
+{
+private:
+	AnimationLODPolicy _policy;
+	float _importance = 1.0f;
+	AnimationLODTier _tier = AnimationLODTier::Full;
+	AnimationLODStats _stats;
+
+	/// <summary>Reducedで補間する両端のフレームとその姿勢（_keyValidがfalseなら未計算）</summary>
+	uint32_t _keyFrames[2] = {};
+	std::vector<DirectX::XMMATRIX> _keyMatrices[2];
+	bool _keyValid = false;
+
+public:
+	/// <summary>選び方を設定する</summary>
+	void SetPolicy(const AnimationLODPolicy& policy);
+	const AnimationLODPolicy& Policy() const;
+
+	/// <summary>
+	/// 重要度（画面上の大きさに掛ける、既定は1）
+	/// 主役は大きくして常にFullに、画面外や注目しないものは0にして止めるなど、呼び出し側で決める
+	/// </summary>
+	void SetImportance(float importance);
+	float Importance() const;
+
+	/// <summary>画面上の大きさ（重要度を掛ける前）から段階を選び直す</summary>
+	AnimationLODTier Select(float pixels);
+
+	/// <summary>段階を直接決める（Selectを呼ぶと選び直される）</summary>
+	void SetTier(AnimationLODTier tier);
+	AnimationLODTier Tier() const;
+
+	/// <summary>
+	/// 今の段階でボーン行列を更新する
+	/// </summary>
+	/// <param name="frame">モーションのフレーム（小数部分はReducedの補間に使う）</param>
+	/// <param name="lastFrame">モーションの最後のフレーム番号（補間する区間がはみ出さないように）</param>
+	/// <param name="evaluate">姿勢の計算</param>
+	/// <param name="matrices">ボーン行列（Frozenなら書き換えない）</param>
+	/// <returns>姿勢を計算したらtrue（表情などの付随する更新もこれに合わせて省く）</returns>
+	bool Update(float frame, uint32_t lastFrame, const AnimationPoseEvaluator& evaluate, std::vector<DirectX::XMMATRIX>& matrices);
+
+	/// <summary>Reducedの補間に使う姿勢を捨てる（モーションを読み込み直したときなど）</summary>
+	void Invalidate();
+
+	/// <summary>段階ごとの更新の回数</summary>
+	const AnimationLODStats& Stats() const;
+	void ResetStats();
+};
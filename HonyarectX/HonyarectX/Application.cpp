@@ -2,11 +2,17 @@
 #include "Dx12Wrapper.h"
 #include "PMDRenderer.h"
 #include "PMDActor.h"
+#include "ModelLoader.h"
+#include "MotionLibrary.h"
+#include <cassert>
 
 /// <summary>ウィンドウ定数</summary>
 const unsigned int window_width = 1280;
 const unsigned int window_height = 720;
 
+/// <summary>アクターごとの姿勢キャッシュの上限（バイト）</summary>
+const size_t pose_cache_max_bytes = 8 * 1024 * 1024;
+
 /// <summary>面倒だけど書かなあかんやつ</summary>
 LRESULT WindowProcedure(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
 {
@@ -64,6 +70,7 @@ void Application::Run()
 	float angle = 0.0f;
 	MSG msg = {};
 	UINT frame = 0;
+	bool texturesLogged = false;
 	while (true) {
 		if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
 			TranslateMessage(&msg);
@@ -74,6 +81,20 @@ void Application::Run()
 			break;
 		}
 
+		// デコードを終えたテクスチャをフレームの予算内でバッファにする（アクターはUpdateでビューを差し替える）
+		_dx12->UpdateTextures();
+		if (!texturesLogged) {
+			auto stats = _dx12->GetTextureStreamStats();
+			if (stats.requested > 0 && stats.decoding == 0 && stats.waiting == 0) {
+				auto& cache = _dx12->GetTextureCacheStats();
+				char log[256];
+				sprintf_s(log, "textures: ready %zu failed %zu  cache entries %zu %zu bytes  path hits %zu content hits %zu misses %zu evictions %zu\n",
+					stats.ready, stats.failed, cache.entryNum, cache.residentBytes, cache.pathHits, cache.contentHits, cache.misses, cache.evictions);
+				OutputDebugStringA(log);
+				texturesLogged = true;
+			}
+		}
+
 		// 全体の描画準備
 		_dx12->BeginDraw();
 
@@ -86,8 +107,10 @@ void Application::Run()
 
 		_dx12->SetScene();
 
-		_pmdActor->Update();
-		_pmdActor->Draw();
+		for (auto& actor : _pmdActors) {
+			actor->Update();
+			actor->Draw();
+		}
 
 		_dx12->EndDraw();
 
@@ -104,16 +127,116 @@ bool Application::Init()
 	// DirectX12ラッパー生成＆初期化
 	_dx12.reset(new Dx12Wrapper(_hwnd));
 	_pmdRenderer.reset(new PMDRenderer(*_dx12));
-	_pmdActor.reset(new PMDActor("Model/初音ミク.pmd", *_pmdRenderer));
-	//_pmdActor->LoadVMDFile("motion/motion.vmd", "pose");
-	_pmdActor->LoadVMDFile("motion/squat2.vmd", "pose");
-	_pmdActor->PlayAnimation();
+
+	// モデルはワーカースレッドで並列に読み込み、終わったものからアクターを作る
+	_modelLoader.reset(new ModelLoader(*_dx12));
+	const char* modelPaths[] = {
+		"Model/初音ミク.pmd",
+	};
+	std::vector<std::shared_future<std::shared_ptr<LoadedModel>>> loadings;
+	for (auto path : modelPaths) {
+		loadings.push_back(_modelLoader->LoadAsync(path));
+	}
+	for (auto& loading : loadings) {
+		auto loaded = loading.get();
+		if (!loaded->succeeded) {
+			assert(0);
+			continue;
+		}
+		auto actor = std::make_shared<PMDActor>(loaded, *_pmdRenderer);
+		//actor->LoadVMDFile("motion/motion.vmd", "pose");
+		actor->LoadVMDFile("motion/squat2.vmd", "pose");
+		// ループ再生するので全フレームの姿勢を先に計算しておき、再生中は行列をコピーするだけにする
+		actor->SetPoseCache(PoseCacheMode::Eager, PoseCacheFormat::Matrix, pose_cache_max_bytes, &_modelLoader->Pool());
+		actor->PlayAnimation();
+		_pmdActors.push_back(actor);
+
+		// 読み込み時間の内訳を出力
+		auto& timings = actor->GetLoadTimings();
+		char log[512];
+		sprintf_s(log, "%s: queued %.2fms parse %.2fms resolve %.2fms optimize %.2fms simplify %.2fms upload %.2fms total %.2fms\n",
+			loaded->path.c_str(), timings.queuedMs, timings.parseMs, timings.resolveMs, timings.optimizeMs, timings.simplifyMs,
+			timings.uploadMs, timings.totalMs + timings.uploadMs);
+		OutputDebugStringA(log);
+
+		// 頂点形式の変換で減ったサイズを出力
+		auto& vertexMemory = actor->GetVertexMemoryStats();
+		sprintf_s(log, "%s: vertices %s %zu bytes -> %zu bytes (saved %zu bytes)\n",
+			loaded->path.c_str(), VertexLayoutName(vertexMemory.layout), vertexMemory.sourceBytes,
+			vertexMemory.convertedBytes, vertexMemory.sourceBytes - vertexMemory.convertedBytes);
+		OutputDebugStringA(log);
+
+		// メッシュ最適化の前後の頂点キャッシュ効率を出力
+		if (auto meshStats = actor->GetMeshOptimizeStats()) {
+			sprintf_s(log, "%s: vertices %zu -> %zu (welded %zu) ACMR %.3f -> %.3f ATVR %.3f -> %.3f\n",
+				loaded->path.c_str(), meshStats->sourceVertexNum, meshStats->vertexNum, meshStats->weldedVertexNum,
+				meshStats->before.acmr, meshStats->after.acmr, meshStats->before.atvr, meshStats->after.atvr);
+			OutputDebugStringA(log);
+		}
+
+		// ボーンパレットによる描画の分割を出力
+		auto& palettes = actor->GetBonePalettes();
+		if (!palettes.levels.empty()) {
+			sprintf_s(log, "%s: bone palette %zu %s draws %zu upload %zu bones\n",
+				loaded->path.c_str(), palettes.paletteSize, palettes.split ? "split" : "whole",
+				palettes.levels[0].batches.size(), palettes.UploadBoneNum(0));
+			OutputDebugStringA(log);
+		}
+
+		// 表情の数と動く頂点数を出力
+		auto& morphs = actor->GetMorphs();
+		if (morphs.MorphNum() > 0) {
+			sprintf_s(log, "%s: morphs %zu vertices %zu offsets %zu\n",
+				loaded->path.c_str(), morphs.MorphNum(), morphs.MorphVertexNum(), morphs.OffsetNum());
+			OutputDebugStringA(log);
+		}
+
+		// LODごとの三角形数と誤差を出力
+		if (auto lodSet = actor->GetMeshLODSet()) {
+			for (size_t i = 0; i < lodSet->lods.size(); ++i) {
+				auto& lod = lodSet->lods[i];
+				sprintf_s(log, "%s: LOD%zu triangles %zu / %zu error %.4f\n",
+					loaded->path.c_str(), i + 1, lod.triangleNum, lodSet->triangleNum, lod.error);
+				OutputDebugStringA(log);
+			}
+		}
+	}
+
+	// モーションの共有状況を出力
+	auto motionStats = MotionLibrary::Instance().Stats();
+	char log[256];
+	sprintf_s(log, "motion library: files %zu motions %zu (referenced %zu) skeletons %zu %zu bytes  loads %zu hits %zu compiles %zu failures %zu  skeleton hits %zu / %zu\n",
+		motionStats.fileNum, motionStats.motionNum, motionStats.referencedNum, motionStats.skeletonNum, motionStats.bytes,
+		motionStats.loads, motionStats.hits, motionStats.compiles, motionStats.failures,
+		motionStats.skeletonHits, motionStats.skeletonBinds);
+	OutputDebugStringA(log);
 
 	return true;
 }
 
 void Application::Terminate()
 {
+	// アニメーション更新のLODの段階ごとの回数を出力（全アクターの合計）
+	AnimationLODStats animationStats;
+	for (auto& actor : _pmdActors) {
+		animationStats.Add(actor->GetAnimationLOD().Stats());
+	}
+	char log[256];
+	sprintf_s(log, "animation LOD: full %llu no-ik %llu reduced %llu frozen %llu  evaluations %llu (ik %llu) interpolations %llu\n",
+		animationStats.updates[0], animationStats.updates[1], animationStats.updates[2], animationStats.updates[3],
+		animationStats.evaluations, animationStats.ikEvaluations, animationStats.interpolations);
+	OutputDebugStringA(log);
+
+	// ボーン行列の差分更新で計算し直したボーンの数を出力（全アクターの合計）
+	IncrementalPoseStats poseStats;
+	for (auto& actor : _pmdActors) {
+		poseStats.Add(actor->GetIncrementalPose().Stats());
+	}
+	sprintf_s(log, "pose update: updates %llu (idle %llu) bones %llu / %llu matrices %llu  ik solves %llu skips %llu\n",
+		poseStats.updates, poseStats.idleUpdates, poseStats.boneUpdates, poseStats.bones, poseStats.matrixUpdates,
+		poseStats.ikSolves, poseStats.ikSkips);
+	OutputDebugStringA(log);
+
 	// もうクラスは使わないので登録解除する
 	UnregisterClass(_windowClass.lpszClassName, _windowClass.hInstance);
 }
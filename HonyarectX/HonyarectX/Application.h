@@ -16,6 +16,7 @@
 class Dx12Wrapper;
 class PMDRenderer;
 class PMDActor;
+class ModelLoader;
 
 /// <summary>
 /// シングルトン
@@ -28,7 +29,8 @@ private:
 	HWND _hwnd;
 	std::shared_ptr<Dx12Wrapper> _dx12;
 	std::shared_ptr<PMDRenderer> _pmdRenderer;
-	std::shared_ptr<PMDActor> _pmdActor;
+	std::shared_ptr<ModelLoader> _modelLoader;
+	std::vector<std::shared_ptr<PMDActor>> _pmdActors;
 	
 	/// <summary>ゲーム用ウィンドウの生成</summary>
 	void CreateGameWindow(HWND& hwnd, WNDCLASSEX& windowClass);
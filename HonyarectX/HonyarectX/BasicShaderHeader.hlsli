@@ -25,7 +25,7 @@ cbuffer cbuff0 : register(b0)
 cbuffer Transform : register(b1)
 {
 	matrix world;				// ワールド変換強烈
-	matrix bones[256];			// ボーン行列
+	matrix bones[256];			// ボーン行列（バッチごとのパレット、C++側のbone_palette_maxと合わせる）
 }
 
 // 定数バッファー1
@@ -1,6 +1,7 @@
 #include "BasicShaderHeader.hlsli"
 
-BasicType BasicVS(float4 pos : POSITION, float4 normal : NORMAL, float2 uv : TEXCOORD, min16uint2 boneno : BONENO, min16uint weight : WEIGHT)
+// スキニングと座標変換（頂点形式によらず共通）
+BasicType TransformVertex(float4 pos, float4 normal, float2 uv, min16uint2 boneno, min16uint weight)
 {
 	BasicType output;
 	float w = (float)weight / 100.0f;
@@ -16,3 +17,24 @@ BasicType BasicVS(float4 pos : POSITION, float4 normal : NORMAL, float2 uv : TEX
 	output.ray = normalize(pos.xyz - mul((float3x3)view, eye));	// 視線ベクトル
 	return output;
 }
+
+// 八面体マッピングした法線を戻す
+float3 DecodeOctahedral(float2 e)
+{
+	float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+	float t = saturate(-n.z);
+	n.xy += n.xy >= 0.0f ? -t : t;
+	return normalize(n);
+}
+
+// PMDの頂点そのまま、またはPacked32（フォーマット変換は入力アセンブラが行うので同じ入力になる）
+BasicType BasicVS(float4 pos : POSITION, float4 normal : NORMAL, float2 uv : TEXCOORD, min16uint2 boneno : BONENO, min16uint weight : WEIGHT)
+{
+	return TransformVertex(pos, normal, uv, boneno, weight);
+}
+
+// 座標、スキニング、属性を別ストリームにした頂点
+BasicType BasicSplitVS(float4 pos : POSITION, float2 octNormal : NORMAL, float2 uv : TEXCOORD, min16uint2 boneno : BONENO, min16uint weight : WEIGHT)
+{
+	return TransformVertex(pos, float4(DecodeOctahedral(octNormal), 0), uv, boneno, weight);
+}
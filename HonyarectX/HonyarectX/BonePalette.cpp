@@ -0,0 +1,244 @@
+﻿#include "BonePalette.h"
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+using namespace std;
+
+namespace
+{
+	constexpr int no_local = -1;
+
+	/// <summary>実際に影響するボーン（影響度が0の側は、もう一方と同じにする）</summary>
+	void EffectiveBones(const PMDVertex& v, uint16_t& b0, uint16_t& b1)
+	{
+		b0 = v.boneNo[0];
+		b1 = v.boneNo[1];
+		if (v.boneWeight >= 100) {
+			b1 = b0;
+		}
+		else if (v.boneWeight == 0) {
+			b0 = b1;
+		}
+	}
+
+	/// <summary>分割の作業領域</summary>
+	class Partitioner
+	{
+	private:
+		const PMDView<PMDVertex>& _vertices;
+		size_t _paletteSize;
+		BonePaletteMesh& _mesh;
+
+		vector<int> _localOf;				// モデルのボーン番号からパレット内の番号（現在のバッチ）
+		vector<uint16_t> _bones;			// 現在のバッチのパレット
+		/// <summary>（元の頂点、パレット内のボーン番号）から分割後の頂点番号</summary>
+		unordered_map<uint32_t, uint16_t> _vertexTable;
+
+		void ResetBatch()
+		{
+			for (auto b : _bones) {
+				_localOf[b] = no_local;
+			}
+			_bones.clear();
+		}
+
+		/// <summary>三角形を加えるのにパレットへ追加が必要なボーン数</summary>
+		size_t NewBoneNum(const uint16_t* tri) const
+		{
+			uint16_t added[bone_palette_min];
+			size_t addedNum = 0;
+			for (size_t k = 0; k < 3; ++k) {
+				uint16_t b[2];
+				EffectiveBones(_vertices[tri[k]], b[0], b[1]);
+				for (auto bone : b) {
+					if (_localOf[bone] == no_local && find(added, added + addedNum, bone) == added + addedNum) {
+						added[addedNum++] = bone;
+					}
+				}
+			}
+			return addedNum;
+		}
+
+		void AddBones(const uint16_t* tri)
+		{
+			for (size_t k = 0; k < 3; ++k) {
+				uint16_t b[2];
+				EffectiveBones(_vertices[tri[k]], b[0], b[1]);
+				for (auto bone : b) {
+					if (_localOf[bone] == no_local) {
+						_localOf[bone] = static_cast<int>(_bones.size());
+						_bones.push_back(bone);
+					}
+				}
+			}
+		}
+
+		/// <summary>現在のパレットで頂点を書き換えたものの番号（無ければ追加）</summary>
+		bool MapVertex(uint16_t src, uint16_t& dst)
+		{
+			auto v = _vertices[src];
+			uint16_t b0, b1;
+			EffectiveBones(v, b0, b1);
+			auto local0 = static_cast<uint32_t>(_localOf[b0]);
+			auto local1 = static_cast<uint32_t>(_localOf[b1]);
+			auto key = src | (local0 << 16) | (local1 << 24);
+			auto it = _vertexTable.find(key);
+			if (it != _vertexTable.end()) {
+				dst = it->second;
+				return true;
+			}
+			if (_mesh.vertices.size() > 0xffff) {
+				return false;
+			}
+			dst = static_cast<uint16_t>(_mesh.vertices.size());
+			v.boneNo[0] = static_cast<uint16_t>(local0);
+			v.boneNo[1] = static_cast<uint16_t>(local1);
+			_mesh.vertices.push_back(v);
+			_mesh.vertexRemap.push_back(src);
+			_vertexTable.emplace(key, dst);
+			return true;
+		}
+
+		/// <summary>現在のパレットでバッチを確定する</summary>
+		bool CloseBatch(const uint16_t* indices, uint32_t material, size_t begin, size_t end, BonePaletteLevel& level)
+		{
+			if (begin == end) {
+				return true;
+			}
+			BonePaletteBatch batch;
+			batch.material = material;
+			batch.indexOffset = static_cast<uint32_t>(begin);
+			batch.indexNum = static_cast<uint32_t>(end - begin);
+			batch.palette = static_cast<uint32_t>(_mesh.palettes.size());
+			for (auto i = begin; i < end; ++i) {
+				if (!MapVertex(indices[i], level.indices[i])) {
+					return false;
+				}
+			}
+			_mesh.palettes.push_back(_bones);
+			level.batches.push_back(batch);
+			level.palettes.push_back(batch.palette);
+			return true;
+		}
+
+	public:
+		Partitioner(const PMDView<PMDVertex>& vertices, size_t boneNum, size_t paletteSize, BonePaletteMesh& mesh) :
+			_vertices(vertices), _paletteSize(paletteSize), _mesh(mesh), _localOf(boneNum, no_local)
+		{
+			_vertexTable.reserve(vertices.size() * 2);
+		}
+
+		bool Partition(const BonePaletteSource& source, BonePaletteLevel& level)
+		{
+			auto indexNum = source.indices.size();
+			vector<uint16_t> indices(indexNum);
+			for (size_t i = 0; i < indexNum; ++i) {
+				indices[i] = source.indices[i];
+			}
+			level.indices.assign(indexNum, 0);
+
+			size_t rangeBegin = 0;
+			for (uint32_t m = 0; m < source.materialIndexNums.size(); ++m) {
+				// 三角形にならない端数は描画しない
+				auto rangeEnd = rangeBegin + source.materialIndexNums[m] / 3 * 3;
+				auto batchBegin = rangeBegin;
+				ResetBatch();
+				for (auto i = rangeBegin; i < rangeEnd; i += 3) {
+					if (_bones.size() + NewBoneNum(&indices[i]) > _paletteSize) {
+						if (!CloseBatch(indices.data(), m, batchBegin, i, level)) {
+							return false;
+						}
+						ResetBatch();
+						batchBegin = i;
+					}
+					AddBones(&indices[i]);
+				}
+				if (!CloseBatch(indices.data(), m, batchBegin, rangeEnd, level)) {
+					return false;
+				}
+				rangeBegin += source.materialIndexNums[m];
+			}
+			return true;
+		}
+	};
+}
+
+PMDView<PMDVertex> BonePaletteMesh::VertexView() const
+{
+	return PMDView<PMDVertex>(reinterpret_cast<const uint8_t*>(vertices.data()), vertices.size());
+}
+
+size_t BonePaletteMesh::UploadBoneNum(size_t level) const
+{
+	size_t ret = 0;
+	for (auto palette : levels[level].palettes) {
+		ret += palettes[palette].size();
+	}
+	return ret;
+}
+
+bool PartitionBonePalettes(const PMDView<PMDVertex>& vertices, const vector<BonePaletteSource>& sources,
+	size_t boneNum, size_t paletteSize, BonePaletteMesh& mesh)
+{
+	mesh = BonePaletteMesh();
+	mesh.paletteSize = paletteSize;
+	if (paletteSize < bone_palette_min || paletteSize > bone_palette_max) {
+		return false;
+	}
+	for (auto& source : sources) {
+		size_t materialIndexTotal = 0;
+		for (auto rangeNum : source.materialIndexNums) {
+			materialIndexTotal += rangeNum;
+		}
+		if (materialIndexTotal > source.indices.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < source.indices.size(); ++i) {
+			if (source.indices[i] >= vertices.size()) {
+				return false;
+			}
+		}
+	}
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		auto v = vertices[i];
+		if (v.boneNo[0] >= boneNum || v.boneNo[1] >= boneNum) {
+			return false;
+		}
+	}
+
+	mesh.levels.resize(sources.size());
+	if (boneNum <= paletteSize) {
+		// 全ボーンが収まるので、頂点はそのままでマテリアルごとに1バッチ
+		mesh.palettes.resize(1);
+		for (uint16_t b = 0; b < boneNum; ++b) {
+			mesh.palettes[0].push_back(b);
+		}
+		for (size_t l = 0; l < sources.size(); ++l) {
+			auto& source = sources[l];
+			auto& level = mesh.levels[l];
+			level.indices.resize(source.indices.size());
+			for (size_t i = 0; i < level.indices.size(); ++i) {
+				level.indices[i] = source.indices[i];
+			}
+			level.palettes.push_back(0);
+			uint32_t offset = 0;
+			for (uint32_t m = 0; m < source.materialIndexNums.size(); ++m) {
+				BonePaletteBatch batch = { m, offset, source.materialIndexNums[m], 0 };
+				if (batch.indexNum > 0) {
+					level.batches.push_back(batch);
+				}
+				offset += batch.indexNum;
+			}
+		}
+		return true;
+	}
+
+	mesh.split = true;
+	Partitioner partitioner(vertices, boneNum, paletteSize, mesh);
+	for (size_t l = 0; l < sources.size(); ++l) {
+		if (!partitioner.Partition(sources[l], mesh.levels[l])) {
+			return false;
+		}
+	}
+	return true;
+}
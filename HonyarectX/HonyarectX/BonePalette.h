@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PMDModelData.h"
+
+/// <summary>シェーダーの定数バッファに置けるボーン行列の数（BasicShaderHeader.hlsliのbones[]と合わせる）</summary>
+constexpr size_t bone_palette_max = 256;
+/// <summary>パレットの最小（三角形1枚が参照し得るボーン数）</summary>
+constexpr size_t bone_palette_min = 6;
+
+/// <summary>同じパレットで描画する三角形の範囲</summary>
+struct BonePaletteBatch {
+	uint32_t material;					// マテリアル番号
+	uint32_t indexOffset;				// レベル内のインデックス開始位置
+	uint32_t indexNum;					// インデックス数
+	uint32_t palette;					// 使うパレットの番号
+};
+
+/// <summary>分割元の描画単位（元のメッシュやLOD1段分）</summary>
+struct BonePaletteSource {
+	PMDView<uint16_t> indices;
+	std::vector<uint32_t> materialIndexNums;	// マテリアルごとのインデックス数（描画順）
+};
+
+/// <summary>描画単位1つ分の分割結果</summary>
+struct BonePaletteLevel {
+	/// <summary>インデックス（分割した場合は分割後の頂点を指す）</summary>
+	std::vector<uint16_t> indices;
+	/// <summary>描画順のバッチ（マテリアルの順番は元と同じ）</summary>
+	std::vector<BonePaletteBatch> batches;
+	/// <summary>このレベルで使うパレットの番号（重複なし、毎フレームこれだけ転送すればよい）</summary>
+	std::vector<uint32_t> palettes;
+};
+
+/// <summary>
+/// ボーンパレットで分割したメッシュ
+/// ボーン数がパレットに収まる場合は分割せず、全ボーンをそのまま並べたパレット1つをすべてのバッチで使う
+/// </summary>
+struct BonePaletteMesh {
+	size_t paletteSize = 0;
+	/// <summary>分割したか（falseならverticesは空で、元の頂点をそのまま使う）</summary>
+	bool split = false;
+	/// <summary>ボーン番号をパレット内の番号に置き換えた頂点（バッチをまたぐ頂点は複製する）</summary>
+	std::vector<PMDVertex> vertices;
+	/// <summary>分割後の頂点番号から元の頂点番号</summary>
+	std::vector<uint32_t> vertexRemap;
+	/// <summary>パレットごとの、パレット内の番号からモデルのボーン番号</summary>
+	std::vector<std::vector<uint16_t>> palettes;
+	/// <summary>分割元と同じ並び</summary>
+	std::vector<BonePaletteLevel> levels;
+
+	/// <summary>頂点をPMDViewとして参照する（分割した場合のみ）</summary>
+	PMDView<PMDVertex> VertexView() const;
+	/// <summary>レベルを描画するために毎フレーム転送するボーン行列の数</summary>
+	size_t UploadBoneNum(size_t level) const;
+};
+
+/// <summary>
+/// マテリアルの範囲ごとに、三角形を参照するボーンがパレットに収まるバッチに分ける
+/// 三角形は並び順のまま先頭から詰めていくので、頂点キャッシュ向けの並びは崩れない
+/// 影響度が0のボーンは参照しないものとして扱う（もう一方のボーンと同じ番号にする）
+/// </summary>
+/// <param name="vertices">頂点</param>
+/// <param name="sources">分割元（すべて同じ頂点を参照すること）</param>
+/// <param name="boneNum">モデルのボーン数</param>
+/// <param name="paletteSize">パレットの大きさ（bone_palette_min～bone_palette_max）</param>
+/// <param name="mesh">結果</param>
+/// <returns>ボーン番号が範囲外、分割後の頂点がインデックスで表せないなど、分割できない場合はfalse</returns>
+bool PartitionBonePalettes(const PMDView<PMDVertex>& vertices, const std::vector<BonePaletteSource>& sources,
+	size_t boneNum, size_t paletteSize, BonePaletteMesh& mesh);
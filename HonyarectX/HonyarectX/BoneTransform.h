@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <DirectXMath.h>
+#include "AnimationClip.h"
+
+/// <summary>
+/// 回転と移動だけの変換（ボーン1つ分の姿勢）
+/// 回転中心はtranslationに含めてあり、点pは p * rotation + translation に移る
+/// 行列にすると XMMatrixRotationQuaternion(rotation) * XMMatrixTranslationFromVector(translation) と同じ
+/// 4x4行列の半分の大きさで、つなげるのもクォータニオンの掛け算と回転1回で済む
+/// </summary>
+struct BoneTransform {
+	DirectX::XMVECTOR rotation;			// 回転（クォータニオン）
+	DirectX::XMVECTOR translation;		// 移動量（wは0）
+};
+
+/// <summary>何もしない変換</summary>
+inline BoneTransform IdentityBoneTransform()
+{
+	return { DirectX::XMQuaternionIdentity(), DirectX::XMVectorZero() };
+}
+
+/// <summary>pivotを中心にrotationで回す変換（T(-pivot) * R * T(pivot)と同じ）</summary>
+inline BoneTransform RotationAround(const DirectX::XMVECTOR& rotation, const DirectX::XMVECTOR& pivot)
+{
+	using namespace DirectX;
+	return { rotation, XMVectorSubtract(pivot, XMVector3Rotate(pivot, rotation)) };
+}
+
+/// <summary>
+/// サンプリングした姿勢を、基準点を中心に回してから移動する変換にする
+/// （T(-pivot) * R * T(pivot) * T(pose.translation)と同じ）
+/// </summary>
+inline BoneTransform PoseToBoneTransform(const BonePose& pose, const DirectX::XMFLOAT3& pivot)
+{
+	using namespace DirectX;
+	auto rotation = XMLoadFloat4(&pose.rotation);
+	auto center = XMLoadFloat3(&pivot);
+	auto translation = XMVectorAdd(XMVectorSubtract(center, XMVector3Rotate(center, rotation)), XMLoadFloat3(&pose.translation));
+	return { rotation, translation };
+}
+
+/// <summary>aをしてからbをする変換（行列のa * bと同じ）</summary>
+inline BoneTransform MultiplyBoneTransform(const BoneTransform& a, const BoneTransform& b)
+{
+	using namespace DirectX;
+	return { XMQuaternionMultiply(a.rotation, b.rotation),
+		XMVectorAdd(XMVector3Rotate(a.translation, b.rotation), b.translation) };
+}
+
+/// <summary>
+/// tをしてから、pivotを中心にrotationで回す（MultiplyBoneTransform(t, RotationAround(rotation, pivot))と同じ）
+/// 回転中心の分を移動量に直さないので、ベクトルを回すのが1回で済む
+/// </summary>
+inline BoneTransform RotateBoneTransformAround(const BoneTransform& t, const DirectX::XMVECTOR& rotation,
+	const DirectX::XMVECTOR& pivot)
+{
+	using namespace DirectX;
+	return { XMQuaternionMultiply(t.rotation, rotation),
+		XMVectorAdd(XMVector3Rotate(XMVectorSubtract(t.translation, pivot), rotation), pivot) };
+}
+
+/// <summary>逆変換（回転しかしないので、行列の逆行列を求めるより軽い）</summary>
+inline BoneTransform InverseBoneTransform(const BoneTransform& t)
+{
+	using namespace DirectX;
+	auto rotation = XMQuaternionConjugate(t.rotation);
+	return { rotation, XMVectorNegate(XMVector3Rotate(t.translation, rotation)) };
+}
+
+/// <summary>点を変換する（XMVector3Transformと同じ、wは0になる）</summary>
+inline DirectX::XMVECTOR TransformPoint(const DirectX::XMVECTOR& point, const BoneTransform& t)
+{
+	using namespace DirectX;
+	return XMVectorAdd(XMVector3Rotate(point, t.rotation), t.translation);
+}
+
+/// <summary>4x4行列にする（描画用のパレットに書き込むときだけ使う）</summary>
+inline DirectX::XMMATRIX BoneTransformToMatrix(const BoneTransform& t)
+{
+	using namespace DirectX;
+	auto mat = XMMatrixRotationQuaternion(t.rotation);
+	mat.r[3] = XMVectorSetW(t.translation, 1.0f);
+	return mat;
+}
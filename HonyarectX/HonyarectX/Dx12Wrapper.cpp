@@ -2,6 +2,9 @@
 #include <cassert>
 #include <d3dx12.h>
 #include "Application.h"
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+#include "TextureCooker.h"
 
 #pragma comment(lib, "DirectXTex.lib")
 #pragma comment(lib, "d3d12.lib")
@@ -14,6 +17,13 @@ using namespace DirectX;
 
 namespace
 {
+	/// <summary>1フレームでテクスチャバッファにする最大数</summary>
+	constexpr size_t texture_upload_max_per_frame = 8;
+	/// <summary>1フレームでテクスチャバッファの作成に使う時間の目安（ミリ秒）</summary>
+	constexpr double texture_upload_budget_ms = 2.0;
+	/// <summary>参照の無いテクスチャを残しておく上限の既定値（バイト）</summary>
+	constexpr size_t texture_cache_budget = 256 * 1024 * 1024;
+
 	/// <summary>
 	/// モデルのパスとテクスチャのパスから合成パスを得る
 	/// </summary>
@@ -141,6 +151,22 @@ Dx12Wrapper::Dx12Wrapper(HWND hwnd)
 	// テクスチャローダー関連初期化
 	CreateTextureLoaderTable();
 
+	// 破棄したテクスチャは、次に要求されたら読み込み直す
+	_textureCache.reset(new TextureCache(texture_cache_budget, [this](uint32_t entry, const vector<string>& paths) {
+		_textureTable[entry].Reset();
+		for (auto& path : paths) {
+			_textureStreamer->Forget(path);
+		}
+	}));
+
+	// WICでのデコードにCOMが必要なので各ワーカーで初期化しておく
+	_textureStreamer.reset(new TextureStreamer(
+		[this](const string& path, DecodedTexture& decoded) {
+			return SUCCEEDED(DecodeTextureFile(path.c_str(), &decoded.metadata, decoded.image, &decoded.contentHash));
+		}, 0,
+		[]() { CoInitializeEx(nullptr, COINIT_MULTITHREADED); },
+		[]() { CoUninitialize(); }));
+
 	// 深度バッファ作成
 	if (FAILED(CreateDepthStencilView())) {
 		assert(0);
@@ -214,50 +240,103 @@ Dx12Wrapper::~Dx12Wrapper()
 
 ComPtr<ID3D12Resource> Dx12Wrapper::GetTextureByPath(const char* texpath)
 {
-	auto it = _textureTable.find(texpath);
-	if (it != _textureTable.end()) {
-		// テーブル内にあったらロードするのではなくマップ内のリソースを返す
-		return _textureTable[texpath];
+	auto path = NormalizeTexturePath(texpath);
+	auto entry = _textureCache->FindPath(path);
+	if (entry == texture_cache_invalid) {
+		// テーブル内に無ければロードしてテーブルに登録する（内容が同じものがあればそれを使う）
+		DecodedTexture decoded;
+		if (FAILED(DecodeTextureFile(path.c_str(), &decoded.metadata, decoded.image, &decoded.contentHash))) {
+			return nullptr;
+		}
+		entry = InsertTexture(path, decoded);
+		if (entry == texture_cache_invalid) {
+			return nullptr;
+		}
+	}
+	return _textureTable[entry];
+}
+
+uint32_t Dx12Wrapper::InsertTexture(const string& path, const DecodedTexture& decoded)
+{
+	ComPtr<ID3D12Resource> res;
+	if (_textureCache->FindContent(decoded.contentHash) == texture_cache_invalid) {
+		res.Attach(CreateTextureFromImage(decoded.metadata, decoded.image));
+		if (res == nullptr) {
+			return texture_cache_invalid;
+		}
 	}
-	else {
-		return ComPtr<ID3D12Resource>(CreateTextureFromFile(texpath));
+	// サイズはデコード後のイメージのもの（実際の確保量はアライメントの分だけ多くなる）
+	auto entry = _textureCache->Insert(path, decoded.contentHash, decoded.image.GetPixelsSize());
+	if (res != nullptr) {
+		if (_textureTable.size() <= entry) {
+			_textureTable.resize(entry + 1);
+		}
+		_textureTable[entry] = res;
 	}
+	return entry;
 }
 
 /// <summary>テクスチャローダテーブルの作成</summary>
 void Dx12Wrapper::CreateTextureLoaderTable()
 {
-	_loadLambdaTable["sph"] = _loadLambdaTable["spa"] = _loadLambdaTable["bmp"] = _loadLambdaTable["png"] = _loadLambdaTable["jpg"] = [](const wstring& path, TexMetadata* meta, ScratchImage& img) -> HRESULT {
-		return LoadFromWICFile(path.c_str(), WIC_FLAGS_NONE, meta, img);
+	// 無圧縮のBMPとTGAは自前のデコーダーで読み、対応していない形式（パレット付きなど）だけWICやDirectXTexに任せる
+	_loadLambdaTable["sph"] = _loadLambdaTable["spa"] = _loadLambdaTable["bmp"] = [](const uint8_t* data, size_t size, TexMetadata* meta, ScratchImage& img) -> HRESULT {
+		if (SUCCEEDED(DecodeBMPMemory(data, size, meta, img))) {
+			return S_OK;
+		}
+		return LoadFromWICMemory(data, size, WIC_FLAGS_NONE, meta, img);
+	};
+
+	_loadLambdaTable["png"] = _loadLambdaTable["jpg"] = [](const uint8_t* data, size_t size, TexMetadata* meta, ScratchImage& img) -> HRESULT {
+		return LoadFromWICMemory(data, size, WIC_FLAGS_NONE, meta, img);
 	};
 
-	_loadLambdaTable["tga"] = [](const wstring& path, TexMetadata* meta, ScratchImage& img) -> HRESULT {
-		return LoadFromTGAFile(path.c_str(), meta, img);
+	_loadLambdaTable["tga"] = [](const uint8_t* data, size_t size, TexMetadata* meta, ScratchImage& img) -> HRESULT {
+		if (SUCCEEDED(DecodeTGAMemory(data, size, meta, img))) {
+			return S_OK;
+		}
+		return LoadFromTGAMemory(data, size, meta, img);
 	};
 
-	_loadLambdaTable["dds"] = [](const wstring& path, TexMetadata* meta, ScratchImage& img) -> HRESULT {
-		return LoadFromDDSFile(path.c_str(), DDS_FLAGS_NONE, meta, img);
+	_loadLambdaTable["dds"] = [](const uint8_t* data, size_t size, TexMetadata* meta, ScratchImage& img) -> HRESULT {
+		return LoadFromDDSMemory(data, size, DDS_FLAGS_NONE, meta, img);
 	};
 }
 
-/// <summary>テクスチャ名からテクスチャバッファ作成、中身をコピー</summary>
-ID3D12Resource* Dx12Wrapper::CreateTextureFromFile(const char* texpath)
+HRESULT Dx12Wrapper::DecodeTextureFile(const char* texpath, DirectX::TexMetadata* metadata, DirectX::ScratchImage& scratchImg,
+	uint64_t* contentHash) const
 {
 	string texPath = texpath;
-
-	// テクスチャのロード
-	TexMetadata metadata = {};
-	ScratchImage scratchImg = {};
-	auto wtexpath = GetWideStringFromString(texPath);	// テクスチャのファイルパス
 	auto ext = GetExtension(texPath);					// 拡張子を取得
-	auto result = _loadLambdaTable[ext](wtexpath,
-		&metadata,
-		scratchImg);
-	if (FAILED(result)) {
-		return nullptr;
+	// 複数スレッドから呼ばれるのでテーブルには追加しない（operator[]は使わない）
+	auto it = _loadLambdaTable.find(ext);
+	if (it == _loadLambdaTable.end()) {
+		return E_FAIL;
+	}
+	// クック済みのDDS（ミップマップ付きのBC1/BC3）があり、元のファイルが変わっていなければそちらを使う
+	if (ext != "dds") {
+		MappedFile cooked;
+		auto cookedPath = CookedTexturePath(texPath);
+		if (cooked.Open(cookedPath.c_str()) && IsCookedTextureFresh(cooked.Data(), cooked.Size(), texpath)) {
+			if (contentHash != nullptr) {
+				*contentHash = HashCookedTexture(cooked.Data(), cooked.Size());
+			}
+			return _loadLambdaTable.find("dds")->second(cooked.Data(), cooked.Size(), metadata, scratchImg);
+		}
+	}
+	// 一度だけ読んで、ハッシュとデコードの両方に使う
+	MappedFile file;
+	if (!file.Open(texpath)) {
+		return E_FAIL;
 	}
-	auto img = scratchImg.GetImage(0, 0, 0);			// 生データ抽出
+	if (contentHash != nullptr) {
+		*contentHash = HashTextureContent(file.Data(), file.Size());
+	}
+	return it->second(file.Data(), file.Size(), metadata, scratchImg);
+}
 
+ID3D12Resource* Dx12Wrapper::CreateTextureFromImage(const DirectX::TexMetadata& metadata, const DirectX::ScratchImage& scratchImg)
+{
 	// WriteToSubresourceで転送する用のヒープ設定
 	auto texHeapProp = CD3DX12_HEAP_PROPERTIES(D3D12_CPU_PAGE_PROPERTY_WRITE_BACK, D3D12_MEMORY_POOL_L0);
 	auto resDesc = CD3DX12_RESOURCE_DESC::Tex2D(metadata.format, metadata.width,
@@ -265,7 +344,7 @@ ID3D12Resource* Dx12Wrapper::CreateTextureFromFile(const char* texpath)
 
 	// バッファー作成
 	ID3D12Resource* texbuff = nullptr;
-	result = _dev->CreateCommittedResource(
+	auto result = _dev->CreateCommittedResource(
 		&texHeapProp,
 		D3D12_HEAP_FLAG_NONE,							// 特に指定なし
 		&resDesc,
@@ -277,20 +356,74 @@ ID3D12Resource* Dx12Wrapper::CreateTextureFromFile(const char* texpath)
 		return nullptr;
 	}
 
-	result = texbuff->WriteToSubresource(
-		0,
-		nullptr,										// 全領域へコピー
-		img->pixels,									// 元データアドレス
-		static_cast<UINT>(img->rowPitch),				// 1ラインサイズ
-		static_cast<UINT>(img->slicePitch)				// 全サイズ
-	);
-	if (FAILED(result)) {
-		return nullptr;
+	// ミップマップの段ごとに転送する（BCの場合、1ラインは4x4ブロックの1行）
+	for (size_t mip = 0; mip < metadata.mipLevels; ++mip) {
+		auto img = scratchImg.GetImage(mip, 0, 0);		// 生データ抽出
+		result = texbuff->WriteToSubresource(
+			static_cast<UINT>(mip),
+			nullptr,									// 全領域へコピー
+			img->pixels,								// 元データアドレス
+			static_cast<UINT>(img->rowPitch),			// 1ラインサイズ
+			static_cast<UINT>(img->slicePitch)			// 全サイズ
+		);
+		if (FAILED(result)) {
+			texbuff->Release();
+			return nullptr;
+		}
 	}
 
 	return texbuff;
 }
 
+TextureHandle Dx12Wrapper::RequestTexture(const string& path)
+{
+	// 書き方の違う同じパスを同じ要求にまとめる
+	return _textureStreamer->Request(NormalizeTexturePath(path));
+}
+
+void Dx12Wrapper::UpdateTextures()
+{
+	_textureStreamer->Update(texture_upload_max_per_frame, texture_upload_budget_ms, [this](const TextureRequest& request) {
+		return InsertTexture(request.path, *request.decoded) != texture_cache_invalid;
+	});
+}
+
+ComPtr<ID3D12Resource> Dx12Wrapper::GetRequestedTexture(const TextureHandle& handle)
+{
+	if (handle == nullptr || handle->state != TextureState::Ready) {
+		return nullptr;
+	}
+	auto entry = _textureCache->FindPath(handle->path);
+	return entry == texture_cache_invalid ? nullptr : _textureTable[entry];
+}
+
+TextureHandle Dx12Wrapper::AcquireTexture(const string& path)
+{
+	auto handle = RequestTexture(path);
+	_textureCache->AddRef(handle->path);
+	return handle;
+}
+
+void Dx12Wrapper::ReleaseTexture(const TextureHandle& handle)
+{
+	_textureCache->Release(handle->path);
+}
+
+void Dx12Wrapper::SetTextureBudget(size_t budget)
+{
+	_textureCache->SetBudget(budget);
+}
+
+TextureStreamStats Dx12Wrapper::GetTextureStreamStats()
+{
+	return _textureStreamer->GetStats();
+}
+
+const TextureCacheStats& Dx12Wrapper::GetTextureCacheStats() const
+{
+	return _textureCache->Stats();
+}
+
 HRESULT Dx12Wrapper::InitializeDXGIDevice()
 {
 	UINT flagsDXGI = 0;
@@ -431,6 +564,8 @@ HRESULT Dx12Wrapper::CreateSceneView()
 		1000.0f									// 遠い方
 	);
 	_mappedSceneData->eye = eye;
+	_eye = eye;
+	_projectionScale = static_cast<float>(desc.Height) / (2.0f * tanf(XM_PIDIV4 * 0.5f));
 
 	// ディスクリプタヒープを作る
 	D3D12_DESCRIPTOR_HEAP_DESC descHeapDesc = {};
@@ -546,6 +681,16 @@ void Dx12Wrapper::SetScene()
 	_cmdList->SetGraphicsRootDescriptorTable(0, _sceneDescHeap->GetGPUDescriptorHandleForHeapStart());
 }
 
+const XMFLOAT3& Dx12Wrapper::Eye() const
+{
+	return _eye;
+}
+
+float Dx12Wrapper::ProjectionScale() const
+{
+	return _projectionScale;
+}
+
 void Dx12Wrapper::EndDraw()
 {
 	auto bbIdx = _swapchain->GetCurrentBackBufferIndex();
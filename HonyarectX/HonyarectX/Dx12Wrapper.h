@@ -9,6 +9,8 @@
 #include <wrl.h>
 #include <string>
 #include <functional>
+#include "TextureStreamer.h"
+#include "TextureCache.h"
 
 class Dx12Wrapper
 {
@@ -56,6 +58,10 @@ private:
 		DirectX::XMFLOAT3 eye;	// 視点座標
 	};
 	SceneData* _mappedSceneData;
+	/// <summary>視点座標（CPU側の控え、マップ先は書き込み専用として扱う）</summary>
+	DirectX::XMFLOAT3 _eye = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	/// <summary>距離1の位置で長さ1が画面上で何ピクセルになるか（LOD選択用）</summary>
+	float _projectionScale = 1.0f;
 	ComPtr<ID3D12DescriptorHeap> _sceneDescHeap = nullptr;
 
 	/// <summary>フェンス</summary>
@@ -79,15 +85,20 @@ private:
 	/// <summary>ビュープロジェクション用ビューの生成</summary>
 	HRESULT CreateSceneView();
 
-	/// <summary>ロード用テーブル</summary>
-	using LoadLambda_t = std::function<HRESULT(const std::wstring& path, DirectX::TexMetadata*, DirectX::ScratchImage&)>;
+	/// <summary>ロード用テーブル（メモリマップしたファイルの中身からデコードする）</summary>
+	using LoadLambda_t = std::function<HRESULT(const uint8_t* data, size_t size, DirectX::TexMetadata*, DirectX::ScratchImage&)>;
 	std::map<std::string, LoadLambda_t> _loadLambdaTable;
-	/// <summary>テクスチャテーブル</summary>
-	std::unordered_map<std::string, ComPtr<ID3D12Resource>> _textureTable;
+	/// <summary>テクスチャテーブル（テクスチャキャッシュのエントリ番号から引く）</summary>
+	std::vector<ComPtr<ID3D12Resource>> _textureTable;
+	/// <summary>テクスチャの常駐管理（パスと内容のハッシュで共有し、予算を超えたら参照の無いものから破棄する）</summary>
+	std::unique_ptr<TextureCache> _textureCache;
+	/// <summary>テクスチャの非同期読み込み（ワーカーがローダテーブルを使うので、テーブルより後に宣言して先に破棄する）</summary>
+	std::unique_ptr<TextureStreamer> _textureStreamer;
 	/// <summary>テクスチャローダテーブルの作成</summary>
 	void CreateTextureLoaderTable();
-	/// <summary></summary>
-	ID3D12Resource* CreateTextureFromFile(const char* texpath);
+	/// <summary>デコード済みのテクスチャをキャッシュに登録し、内容が同じものが無ければテクスチャバッファを作る</summary>
+	/// <returns>エントリ番号（作成に失敗した場合はtexture_cache_invalid）</returns>
+	uint32_t InsertTexture(const std::string& path, const DecodedTexture& decoded);
 
 public:
 	Dx12Wrapper(HWND hwnd);
@@ -96,9 +107,39 @@ public:
 	void Update();
 	void BeginDraw();
 	void EndDraw();
-	/// <summary>テクスチャパスから必要なテクスチャバッファへのポインタを返す</summary>
+	/// <summary>テクスチャパスから必要なテクスチャバッファへのポインタを返す（キャッシュに無ければその場で読み込む）</summary>
 	/// <param name="texpath">テクスチャファイルパス</param>
 	ComPtr<ID3D12Resource> GetTextureByPath(const char* texpath);
+	/// <summary>テクスチャファイルをCPU側でデコードする（デバイスを使わないのでワーカースレッドから呼んでもよい）</summary>
+	/// <param name="texpath">テクスチャファイルパス</param>
+	/// <param name="contentHash">ファイルの内容のハッシュ（不要ならnullptr）</param>
+	HRESULT DecodeTextureFile(const char* texpath, DirectX::TexMetadata* metadata, DirectX::ScratchImage& scratchImg,
+		uint64_t* contentHash = nullptr) const;
+	/// <summary>デコード済みのイメージからテクスチャバッファを作成する</summary>
+	ID3D12Resource* CreateTextureFromImage(const DirectX::TexMetadata& metadata, const DirectX::ScratchImage& scratchImg);
+	/// <summary>
+	/// テクスチャを非同期に要求する（どのスレッドから呼んでもよく、デコードを待たずに戻る）
+	/// stateがReadyになるまでは代わりのテクスチャを使うこと
+	/// </summary>
+	/// <param name="path">テクスチャファイルパス</param>
+	TextureHandle RequestTexture(const std::string& path);
+	/// <summary>デコードを終えたテクスチャを1フレーム分の予算内でテクスチャバッファにする（メインスレッドで毎フレーム呼ぶ）</summary>
+	void UpdateTextures();
+	/// <summary>要求したテクスチャのバッファ（まだReadyでない場合はnullptr）</summary>
+	ComPtr<ID3D12Resource> GetRequestedTexture(const TextureHandle& handle);
+	/// <summary>
+	/// テクスチャを要求し、参照を増やす（メインスレッドで呼ぶ）
+	/// 参照している間は破棄されない、使い終わったらReleaseTextureを呼ぶこと
+	/// </summary>
+	TextureHandle AcquireTexture(const std::string& path);
+	/// <summary>AcquireTextureで増やした参照を減らす</summary>
+	void ReleaseTexture(const TextureHandle& handle);
+	/// <summary>参照の無いテクスチャを残しておく上限（バイト）</summary>
+	void SetTextureBudget(size_t budget);
+	/// <summary>非同期読み込みの集計</summary>
+	TextureStreamStats GetTextureStreamStats();
+	/// <summary>テクスチャキャッシュの集計</summary>
+	const TextureCacheStats& GetTextureCacheStats() const;
 
 	/// <summary>デバイス</summary>
 	ComPtr<ID3D12Device> Device();
@@ -108,4 +149,9 @@ public:
 	ComPtr<IDXGISwapChain4> Swapchain();
 
 	void SetScene();
+
+	/// <summary>視点座標</summary>
+	const DirectX::XMFLOAT3& Eye() const;
+	/// <summary>距離1の位置で長さ1が画面上で何ピクセルになるか</summary>
+	float ProjectionScale() const;
 };
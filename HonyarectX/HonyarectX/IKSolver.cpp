@@ -0,0 +1,321 @@
+﻿#include "IKSolver.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr float epsilon = 0.0005f;
+
+	/// <summary>LookAt行列によりボーン方向を解決（間のボーン数が1）</summary>
+	void SolveLookAt(const IKChain& ik, const Skeleton&, BoneTransform* transforms)
+	{
+		// この関数に来た時点でノードはひとつしかなく、チェーンに入っているノード番号はIKのルートノードのものなので、
+		// このルートノードからターゲットに向かうベクトルを考えれば良い
+		auto opos2 = TransformPoint(XMLoadFloat3(&ik.nodeRests[0]), transforms[ik.nodeIdxes[0]]);
+		auto tpos2 = TransformPoint(XMLoadFloat3(&ik.targetRest), transforms[ik.boneIdx]);	// ！？
+		auto targetVec = XMVector3Normalize(XMVectorSubtract(tpos2, opos2));
+
+		// 向きを合わせる回転をopos2を中心にかける（初期姿勢の向きを戻す回転は読み込み時に求めてある）
+		auto up = XMFLOAT3(0, 1, 0);
+		auto right = XMFLOAT3(1, 0, 0);
+		auto rot = XMQuaternionRotationMatrix(XMLoadFloat4x4(&ik.restBasis) * LookAtMatrix(targetVec, up, right));
+		transforms[ik.nodeIdxes[0]] = RotationAround(rot, opos2);
+	}
+
+	/// <summary>余弦定理IKによりボーン方向を解決（間のボーン数が2）</summary>
+	void SolveCosineIK(const IKChain& ik, const Skeleton&, BoneTransform* transforms)
+	{
+		// ターゲット（末端ボーンではなく、末端ボーンが近づく目標ボーンの座標を取得）
+		auto targetPos = TransformPoint(XMLoadFloat3(&ik.boneRest), transforms[ik.boneIdx]);
+
+		// IKチェーンは末端から数えるので、nodeIdxes[1]がルート、nodeIdxes[0]が真ん中
+		// ルートボーン座標変換
+		auto rootPos = TransformPoint(XMLoadFloat3(&ik.nodeRests[1]), transforms[ik.nodeIdxes[1]]);
+		// 真ん中はどうせ自動計算されるので計算しない
+		auto middlePos = XMLoadFloat3(&ik.nodeRests[0]);
+		// 先端ボーン
+		auto endPos = TransformPoint(XMLoadFloat3(&ik.targetRest), transforms[ik.boneIdx]);		// 本当はik.targetIdxだが・・・！？
+
+		// ルートから先端へのベクトルを作っておく
+		auto linearVec = XMVectorSubtract(endPos, rootPos);
+		float a = XMVectorGetX(XMVector3Length(linearVec));
+		float b = ik.lengths[0];
+		float c = ik.lengths[1];
+
+		linearVec = XMVector3Normalize(linearVec);
+
+		// ルートから真ん中への角度計算
+		float theta1 = acosf((a * a + b * b - c * c) / (2 * a * b));
+
+		// 真ん中からターゲットへの角度計算
+		float theta2 = acosf((b * b + c * c - a * a) / (2 * b * c));
+
+		// 「軸」を求める
+		// もし真ん中が「ひざ」であった場合には強制的にX軸とする。
+		XMVECTOR axis;
+		if (!(ik.flags & ik_chain_knee)) {
+			auto vm = XMVector3Normalize(XMVectorSubtract(endPos, rootPos));
+			auto vt = XMVector3Normalize(XMVectorSubtract(targetPos, rootPos));
+			axis = XMVector3Cross(vt, vm);
+		}
+		else {
+			auto right = XMFLOAT3(1, 0, 0);
+			axis = XMLoadFloat3(&right);
+		}
+
+		// 注意点・・・IKチェーンは根っこに向かってから数えられるため1が根っこに近い
+		auto rot2 = RotationAround(XMQuaternionRotationAxis(axis, theta2 - XM_PI), middlePos);
+
+		transforms[ik.nodeIdxes[1]] = RotateBoneTransformAround(transforms[ik.nodeIdxes[1]], XMQuaternionRotationAxis(axis, theta1), rootPos);
+		transforms[ik.nodeIdxes[0]] = MultiplyBoneTransform(rot2, transforms[ik.nodeIdxes[1]]);
+		transforms[ik.targetIdx] = transforms[ik.nodeIdxes[0]];//直前の影響を受ける
+	}
+
+	/// <summary>
+	/// CCD-IKによりボーン方向を解決（間のボーン数が3以上）
+	/// 作業領域はPMDで持てる最大のボーン数分の固定長の配列（スタック上に置くだけで初期化はしない）
+	/// </summary>
+	void SolveCCDIK(const IKChain& ik, const Skeleton& skeleton, BoneTransform* transforms)
+	{
+		auto nodeNum = ik.nodeIdxes.size();
+		assert(nodeNum <= ik_max_chain_nodes);
+
+		// ターゲット
+		auto targetOriginPos = XMLoadFloat3(&ik.boneRest);
+
+		// IK親の姿勢から見たターゲットの位置（回転と移動だけなので逆変換は共役と回転1回で求まる）
+		auto parent = transforms[ik.ikParent];
+		auto invParent = InverseBoneTransform(parent);
+		auto targetNextPos = TransformPoint(targetOriginPos, MultiplyBoneTransform(transforms[ik.boneIdx], invParent));
+
+		// まずはIKの間にあるボーンの座標を入れておく(逆順注意)
+		XMVECTOR bonePositions[ik_max_chain_nodes];
+		BoneTransform mats[ik_max_chain_nodes];
+		// 末端ノード
+		auto endPos = XMLoadFloat3(&ik.targetRest);
+		// 中間ノード（ルートを含む）
+		for (size_t i = 0; i < nodeNum; ++i) {
+			bonePositions[i] = XMLoadFloat3(&ik.nodeRests[i]);
+			mats[i] = IdentityBoneTransform();
+		}
+
+		// ikに設定されている試行回数だけ繰り返す
+		for (int c = 0; c < ik.iterations; ++c) {
+			// ターゲットと末端がほぼ一致したら抜ける
+			if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+				break;
+			}
+			// それぞれのボーンを遡りながら角度制限に引っ掛からないように曲げていく
+			for (size_t bidx = 0; bidx < nodeNum; ++bidx) {
+				const auto& pos = bonePositions[bidx];
+
+				// まず現在のノードから末端までと、現在のノードからターゲットまでのベクトルを作る
+				auto vecToEnd = XMVectorSubtract(endPos, pos);
+				auto vecToTarget = XMVectorSubtract(targetNextPos, pos);
+				vecToEnd = XMVector3Normalize(vecToEnd);
+				vecToTarget = XMVector3Normalize(vecToTarget);
+
+				// ほぼ同じベクトルになってしまった場合は外積できないため次のボーンに引き渡す
+				if (XMVectorGetX(XMVector3Length(XMVectorSubtract(vecToEnd, vecToTarget))) <= epsilon) {
+					continue;
+				}
+				// 外積計算および角度計算
+				auto cross = XMVector3Normalize(XMVector3Cross(vecToEnd, vecToTarget));
+				float angle = XMVectorGetX(XMVector3AngleBetweenVectors(vecToEnd, vecToTarget));
+				angle = min(angle, ik.limitAngle);					// 回転限界補正
+				// posを中心に回転
+				auto rot = XMQuaternionRotationAxis(cross, angle);
+				mats[bidx] = RotateBoneTransformAround(mats[bidx], rot, pos);	// 回転を保持しておく（回転を重ね掛けしておく）
+				// 対象となる点をすべて回転させる（現在の点から見て末端側を回転）
+				// 点をいくつも回すので、クォータニオンで1点ずつ回すより回転行列にしてから掛けるほうが軽い
+				auto rotMat = XMMatrixRotationQuaternion(rot);
+				for (auto idx = bidx; idx > 0; --idx) {		// 自分を回転させる必要はない
+					bonePositions[idx - 1] = XMVectorAdd(XMVector3TransformNormal(XMVectorSubtract(bonePositions[idx - 1], pos), rotMat), pos);
+				}
+				endPos = XMVectorAdd(XMVector3TransformNormal(XMVectorSubtract(endPos, pos), rotMat), pos);
+				// もし正解に近くなってたらループを抜ける
+				if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+					break;
+				}
+			}
+		}
+		for (size_t i = 0; i < nodeNum; ++i) {
+			transforms[ik.nodeIdxes[i]] = mats[i];
+		}
+		// IKの根元から先を親の姿勢に付け直す
+		skeleton.MultiplySubtree(ik.nodeIdxes.back(), parent, transforms);
+	}
+
+	void SolveNothing(const IKChain&, const Skeleton&, BoneTransform*)
+	{
+	}
+}
+
+const char* IKChainKindName(IKChainKind kind)
+{
+	switch (kind) {
+	case IKChainKind::LookAt:
+		return "lookat";
+	case IKChainKind::Cosine:
+		return "cosine";
+	case IKChainKind::CCD:
+		return "ccd";
+	default:
+		return "invalid";
+	}
+}
+
+XMMATRIX LookAtMatrix(const XMVECTOR& lookat, XMFLOAT3& up, XMFLOAT3& right)
+{
+	// 向かせたい方向（Z軸）
+	XMVECTOR vz = lookat;
+
+	// （向かせたい方向を向かせたときの）仮のY軸ベクトル
+	XMVECTOR vy = XMVector3Normalize(XMLoadFloat3(&up));
+
+	// （向かせたい方向を向かせたときの）X軸
+	//XMVECTOR vx = XMVector3Normalize(XMVector3Cross(vz, vx));
+	XMVECTOR vx = XMVector3Normalize(XMVector3Cross(vy, vz));
+	vy = XMVector3Normalize(XMVector3Cross(vz, vx));
+
+	// LookAtとupが同じ方向を向いてたらright基準で作り直す
+	if (abs(XMVectorGetX(XMVector3Dot(vy, vz))) == 1.0f) {
+		// 仮のX方向を定義
+		vx = XMVector3Normalize(XMLoadFloat3(&right));
+		// 向かせたい方向を向かせたときのY軸を計算
+		vy = XMVector3Normalize(XMVector3Cross(vz, vx));
+		// 真のX軸を計算
+		vx = XMVector3Normalize(XMVector3Cross(vy, vz));
+	}
+	XMMATRIX ret = XMMatrixIdentity();
+	ret.r[0] = vx;
+	ret.r[1] = vy;
+	ret.r[2] = vz;
+	return ret;
+}
+
+void IKSolver::Build(const PMDModelData& model, const Skeleton& skeleton)
+{
+	auto& iks = model.IKs();
+	_chains.resize(iks.size());
+	for (size_t i = 0; i < _chains.size(); ++i) {
+		auto& pmdIk = iks[i];
+		auto& ik = _chains[i];
+		ik.boneIdx = pmdIk.header.boneIdx;
+		ik.targetIdx = pmdIk.header.targetIdx;
+		ik.iterations = pmdIk.header.iterations;
+		ik.limit = pmdIk.header.limit;
+		ik.nodeIdxes.resize(pmdIk.nodeIdxes.size());
+		ik.nodeRests.resize(pmdIk.nodeIdxes.size());
+		for (size_t n = 0; n < ik.nodeIdxes.size(); ++n) {
+			ik.nodeIdxes[n] = pmdIk.nodeIdxes[n];
+			ik.nodeRests[n] = skeleton.RestPosition(ik.nodeIdxes[n]);
+		}
+
+		// 基準点から決まるもの
+		ik.flags = 0;
+		ik.ikParent = skeleton.IKParent(ik.boneIdx);
+		// ちょっとよくわからないが、PMDエディタの6.8°が0.03になっており、これは180で割っただけの値である。
+		// つまりこれをラジアンとして使用するにはXM_PIを乗算しなければならない…と思われる。
+		ik.limitAngle = ik.limit * XM_PI;
+		ik.boneRest = skeleton.RestPosition(ik.boneIdx);
+		ik.targetRest = skeleton.RestPosition(ik.targetIdx);
+		ik.lengths[0] = 0.0f;
+		ik.lengths[1] = 0.0f;
+		XMStoreFloat4x4(&ik.restBasis, XMMatrixIdentity());
+
+		auto nodeNum = ik.nodeIdxes.size();
+		auto targetRest = XMLoadFloat3(&ik.targetRest);
+		if (nodeNum == 1) {
+			ik.kind = IKChainKind::LookAt;
+			ik.kernel = SolveLookAt;
+			// 初期姿勢で中間からターゲットへ向かう向きを、Z軸から戻す回転
+			auto originVec = XMVector3Normalize(XMVectorSubtract(targetRest, XMLoadFloat3(&ik.nodeRests[0])));
+			auto up = XMFLOAT3(0, 1, 0);
+			auto right = XMFLOAT3(1, 0, 0);
+			XMStoreFloat4x4(&ik.restBasis, XMMatrixTranspose(LookAtMatrix(originVec, up, right)));
+		}
+		else if (nodeNum == 2) {
+			ik.kind = IKChainKind::Cosine;
+			ik.kernel = SolveCosineIK;
+			// 元の長さを測っておく（nodeIdxes[1]がルート）
+			auto rootRest = XMLoadFloat3(&ik.nodeRests[1]);
+			auto middleRest = XMLoadFloat3(&ik.nodeRests[0]);
+			ik.lengths[0] = XMVectorGetX(XMVector3Length(XMVectorSubtract(middleRest, rootRest)));
+			ik.lengths[1] = XMVectorGetX(XMVector3Length(XMVectorSubtract(targetRest, middleRest)));
+			if (skeleton.Flags(ik.nodeIdxes[0]) & skeleton_bone_knee) {
+				ik.flags |= ik_chain_knee;
+			}
+		}
+		else if (nodeNum > 2 && ik.ikParent < skeleton.BoneNum()) {
+			ik.kind = IKChainKind::CCD;
+			ik.kernel = SolveCCDIK;
+		}
+		else {
+			// 間のボーンが無いものと、IK親が範囲外のCCD-IKは解かない
+			ik.kind = IKChainKind::Invalid;
+			ik.kernel = SolveNothing;
+		}
+	}
+}
+
+const vector<IKChain>& IKSolver::Chains() const
+{
+	return _chains;
+}
+
+void IKSolver::Solve(const Skeleton& skeleton, const uint8_t* disabled, BoneTransform* transforms) const
+{
+	// まずはIKのターゲットボーンを動かす
+	for (auto& ik : _chains) {
+		// IK解決のためのループ
+
+		if (disabled != nullptr && disabled[ik.boneIdx]) {
+			// もしOFFなら打ち切る
+			continue;
+		}
+		ik.kernel(ik, skeleton, transforms);
+	}
+}
+
+void IKSolver::AffectedBones(const IKChain& ik, const Skeleton& skeleton, uint8_t* flags) const
+{
+	flags[ik.boneIdx] |= ik_bone_read;
+	flags[ik.targetIdx] |= ik_bone_read;
+	for (auto node : ik.nodeIdxes) {
+		flags[node] |= ik_bone_read;
+	}
+	const uint8_t read_write = ik_bone_read | ik_bone_write;
+	switch (ik.kind) {
+	case IKChainKind::Invalid:
+		break;
+	case IKChainKind::LookAt:		// LookAtは間のボーンだけ書き換える
+		flags[ik.nodeIdxes[0]] |= read_write;
+		break;
+	case IKChainKind::Cosine:		// 余弦定理IKは間のボーンとターゲットを書き換える（子孫には伝えない）
+		flags[ik.nodeIdxes[0]] |= read_write;
+		flags[ik.nodeIdxes[1]] |= read_write;
+		flags[ik.targetIdx] |= read_write;
+		break;
+	case IKChainKind::CCD:			// CCD-IKはIKボーンの親を読み、根元のノードの子孫をすべて書き換える
+	{
+		flags[ik.ikParent] |= ik_bone_read;
+		const uint32_t* begin;
+		const uint32_t* end;
+		skeleton.Subtree(ik.nodeIdxes.back(), begin, end);
+		for (auto bone = begin; bone != end; ++bone) {
+			flags[*bone] |= read_write;
+		}
+		break;
+	}
+	}
+}
+
+void IKSolver::SolveChain(const IKChain& ik, const Skeleton& skeleton, BoneTransform* transforms) const
+{
+	ik.kernel(ik, skeleton, transforms);
+}
@@ -0,0 +1,105 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "PMDModelData.h"
+#include "Skeleton.h"
+#include "BoneTransform.h"
+
+/// <summary>IKの解き方（間のボーン数で決まる）</summary>
+enum class IKChainKind : uint8_t {
+	LookAt,			// 間のボーン数が1
+	Cosine,			// 間のボーン数が2（余弦定理）
+	CCD,			// 間のボーン数が3以上
+	Invalid,		// 間のボーンが無い（解かない）
+};
+
+/// <summary>IKの解き方の名前（表示用）</summary>
+const char* IKChainKindName(IKChainKind kind);
+
+/// <summary>IKチェーンの性質（IKChain::flagsの各ビット）</summary>
+enum IKChainFlag : uint8_t {
+	ik_chain_knee = 1 << 0,		// 余弦定理IKの中間のボーンがひざ（曲げる軸をX軸に固定する）
+};
+
+/// <summary>CCD-IKの間のボーン数の上限（PMDのchainLenは8bit）</summary>
+const size_t ik_max_chain_nodes = UINT8_MAX;
+
+struct IKChain;
+
+/// <summary>IKを1本解く関数（解き方と間のボーン数に合わせて読み込み時に選ぶ）</summary>
+using IKKernel = void (*)(const IKChain& ik, const Skeleton& skeleton, BoneTransform* transforms);
+
+/// <summary>
+/// IKチェーン1本分
+/// 基準点から決まる長さや向きは読み込み時に求めておき、解くときは姿勢だけを読む
+/// </summary>
+struct IKChain {
+	uint16_t boneIdx;					// IK対象のボーンを示す
+	uint16_t targetIdx;					// ターゲットに近づけるためのボーンのインデックス
+	uint16_t iterations;				// 試行回数
+	float limit;						// 一回あたりの回転制限
+	std::vector<uint16_t> nodeIdxes;	// 間のノード番号
+
+	IKChainKind kind;					// 解き方
+	uint8_t flags;						// IKChainFlag
+	uint32_t ikParent;					// IKボーンのIK親（CCD-IKで使う）
+	float limitAngle;					// 一回あたりの回転制限（ラジアン）
+	DirectX::XMFLOAT3 boneRest;			// IKボーンの基準点
+	DirectX::XMFLOAT3 targetRest;		// ターゲットの基準点
+	std::vector<DirectX::XMFLOAT3> nodeRests;	// 間のボーンの基準点（nodeIdxesと同じ順）
+	float lengths[2];					// 余弦定理IKの根元から中間、中間からターゲットまでの長さ
+	DirectX::XMFLOAT4X4 restBasis;		// LookAtの初期姿勢の向き（中間からターゲット）を向ける回転の逆
+	IKKernel kernel;					// 解く関数
+};
+
+/// <summary>IKが姿勢を読み書きするボーン（IKSolver::AffectedBonesの各ビット）</summary>
+enum IKBoneFlag : uint8_t {
+	ik_bone_read = 1 << 0,		// IKを解くときに姿勢を読む
+	ik_bone_write = 1 << 1,		// IKで姿勢を書き換える（読むものとしても扱う）
+};
+
+/// <summary>
+/// lookatの方向をZ軸に向ける回転行列（upを仮のY軸にし、lookatと同じ向きならrightを仮のX軸にする）
+/// </summary>
+DirectX::XMMATRIX LookAtMatrix(const DirectX::XMVECTOR& lookat, DirectX::XMFLOAT3& up, DirectX::XMFLOAT3& right);
+
+/// <summary>
+/// モデルのIKを解く
+/// 姿勢は回転と移動（BoneTransform）のままで扱い、4x4行列や逆行列は使わない
+/// メンバーを書き換えないので、姿勢を別に渡せば複数のスレッドから同時に呼んでよい
+/// </summary>
+class IKSolver
+{
+private:
+	std::vector<IKChain> _chains;
+
+public:
+	/// <summary>
+	/// モデルのIKを読み込み、チェーンごとに基準点から決まるものと解く関数を求めておく
+	/// </summary>
+	/// <param name="skeleton">モデルから作った骨格（基準点・IK親・ひざ）</param>
+	void Build(const PMDModelData& model, const Skeleton& skeleton);
+
+	const std::vector<IKChain>& Chains() const;
+
+	/// <summary>
+	/// 1本のIKが姿勢を読み書きするボーンにIKBoneFlagを立てる
+	/// 読むボーンの姿勢が変わらなければ、同じ結果になるので解き直さなくてよい
+	/// </summary>
+	/// <param name="flags">ボーン番号ごとのフラグ（BoneNum()個、立てるだけで消さない）</param>
+	void AffectedBones(const IKChain& ik, const Skeleton& skeleton, uint8_t* flags) const;
+
+	/// <summary>
+	/// すべてのIKを順に解く
+	/// 作業領域はスタック上の固定長の配列なので、ヒープから確保しない
+	/// </summary>
+	/// <param name="skeleton">モデルの骨格（基準点・親・ひざ）</param>
+	/// <param name="disabled">ボーン番号ごとのIKのオフ（nullptrならすべてオン）</param>
+	/// <param name="transforms">ボーン番号ごとのモデル空間の姿勢（結果で上書きする）</param>
+	void Solve(const Skeleton& skeleton, const uint8_t* disabled, BoneTransform* transforms) const;
+
+	/// <summary>IKを1本だけ解く（読み込み時に選んでおいた関数を呼ぶ）</summary>
+	void SolveChain(const IKChain& ik, const Skeleton& skeleton, BoneTransform* transforms) const;
+};
@@ -0,0 +1,258 @@
+﻿#include "ImageDecoder.h"
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define IMAGE_DECODER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	/// <summary>変換元の画素の形式（どちらもB,G,R(,A)の順）</summary>
+	struct SourceFormat {
+		size_t bytesPerPixel;		// 3か4
+		bool hasAlpha;				// falseならアルファは255にする
+	};
+
+	uint32_t ReadU16(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8);
+	}
+
+	uint32_t ReadU32(const uint8_t* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+#ifdef IMAGE_DECODER_SSE2
+	/// <summary>4画素分のBGRA（アルファはkeepで残すかfillで埋める）をRGBAにする</summary>
+	inline __m128i SwapRedBlue(__m128i bgra, __m128i keep, __m128i fill)
+	{
+		auto red = _mm_and_si128(_mm_srli_epi32(bgra, 16), _mm_set1_epi32(0xff));
+		auto blue = _mm_slli_epi32(_mm_and_si128(bgra, _mm_set1_epi32(0xff)), 16);
+		return _mm_or_si128(_mm_or_si128(_mm_and_si128(bgra, keep), fill), _mm_or_si128(red, blue));
+	}
+#endif
+
+	/// <summary>
+	/// 1行をRGBAに変換する
+	/// 24bitは4画素（12バイト）を16バイトで読み、3バイトずつずらした4つを並べ直してから32bitと同じように変換する
+	/// </summary>
+	/// <param name="src">行の先頭</param>
+	/// <param name="srcEnd">読んでよい範囲の終わり（16バイト単位で読むときにはみ出さないように）</param>
+	void ConvertRow(const uint8_t* src, const uint8_t* srcEnd, const SourceFormat& format, size_t width, bool useSIMD, uint8_t* dst)
+	{
+		size_t x = 0;
+#ifdef IMAGE_DECODER_SSE2
+		if (useSIMD) {
+			auto keep = _mm_set1_epi32(format.hasAlpha ? static_cast<int>(0xff00ff00) : 0x0000ff00);
+			auto fill = _mm_set1_epi32(format.hasAlpha ? 0 : static_cast<int>(0xff000000));
+			if (format.bytesPerPixel == 4) {
+				for (; x + 4 <= width; x += 4) {
+					auto bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), SwapRedBlue(bgra, keep, fill));
+				}
+			}
+			else {
+				for (; x + 4 <= width && src + x * 3 + 16 <= srcEnd; x += 4) {
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 3));
+					auto p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+					auto p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+					auto bgrx = _mm_unpacklo_epi64(p01, p23);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), SwapRedBlue(bgrx, keep, fill));
+				}
+			}
+		}
+#endif
+		// 残り（SIMDを使わない場合は全部）
+		auto bpp = format.bytesPerPixel;
+		for (; x < width; ++x) {
+			auto s = src + x * bpp;
+			auto d = dst + x * 4;
+			d[0] = s[2];
+			d[1] = s[1];
+			d[2] = s[0];
+			d[3] = format.hasAlpha ? s[3] : 0xff;
+		}
+	}
+
+	/// <summary>
+	/// 画素の並んだ領域からR8G8B8A8のイメージを作る
+	/// 下から上に並んだ行は、書き込む行を逆にするだけで上下を反転する
+	/// </summary>
+	HRESULT ConvertImage(const uint8_t* pixels, const uint8_t* pixelsEnd, size_t stride, size_t width, size_t height, bool topDown,
+		const SourceFormat& format, bool useSIMD, TexMetadata* metadata, ScratchImage& image)
+	{
+		auto result = image.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, 1, 1);
+		if (FAILED(result)) {
+			return result;
+		}
+		auto img = image.GetImage(0, 0, 0);
+		for (size_t y = 0; y < height; ++y) {
+			auto src = pixels + (topDown ? y : height - 1 - y) * stride;
+			ConvertRow(src, pixelsEnd, format, width, useSIMD, img->pixels + y * img->rowPitch);
+		}
+		if (metadata != nullptr) {
+			*metadata = image.GetMetadata();
+		}
+		return S_OK;
+	}
+
+	/// <summary>RLEのTGAを展開する（ファイルと同じ画素の並びで）</summary>
+	bool ExpandTGARLE(const uint8_t* src, const uint8_t* srcEnd, size_t bytesPerPixel, size_t pixelNum, vector<uint8_t>& pixels)
+	{
+		pixels.resize(pixelNum * bytesPerPixel);
+		auto dst = pixels.data();
+		auto dstEnd = dst + pixels.size();
+		while (dst < dstEnd) {
+			if (src >= srcEnd) {
+				return false;
+			}
+			auto header = *src++;
+			size_t count = (header & 0x7f) + 1;
+			if (static_cast<size_t>(dstEnd - dst) < count * bytesPerPixel) {
+				return false;
+			}
+			if (header & 0x80) {
+				// 同じ画素の繰り返し
+				if (static_cast<size_t>(srcEnd - src) < bytesPerPixel) {
+					return false;
+				}
+				for (size_t i = 0; i < count; ++i, dst += bytesPerPixel) {
+					memcpy(dst, src, bytesPerPixel);
+				}
+				src += bytesPerPixel;
+			}
+			else {
+				// 画素がそのまま並ぶ
+				if (static_cast<size_t>(srcEnd - src) < count * bytesPerPixel) {
+					return false;
+				}
+				memcpy(dst, src, count * bytesPerPixel);
+				src += count * bytesPerPixel;
+				dst += count * bytesPerPixel;
+			}
+		}
+		return true;
+	}
+}
+
+HRESULT DecodeBMPMemory(const uint8_t* data, size_t size, TexMetadata* metadata, ScratchImage& image, bool useSIMD)
+{
+	// BITMAPFILEHEADER(14) + BITMAPINFOHEADER(40)以上
+	if (data == nullptr || size < 54 || data[0] != 'B' || data[1] != 'M') {
+		return E_FAIL;
+	}
+	auto offset = ReadU32(data + 10);
+	auto headerSize = ReadU32(data + 14);
+	auto width = static_cast<int32_t>(ReadU32(data + 18));
+	auto height = static_cast<int32_t>(ReadU32(data + 22));
+	auto bitCount = ReadU16(data + 28);
+	auto compression = ReadU32(data + 30);
+	if (headerSize < 40 || width <= 0 || height == 0 || (bitCount != 24 && bitCount != 32)) {
+		return E_FAIL;
+	}
+	// BI_BITFIELDSはマスクがBI_RGBと同じ並び（アルファ無し）のもののみ
+	const uint32_t bi_rgb = 0;
+	const uint32_t bi_bitfields = 3;
+	if (compression == bi_bitfields) {
+		if (bitCount != 32 || size < 14 + 40 + 12 ||
+			ReadU32(data + 54) != 0x00ff0000 || ReadU32(data + 58) != 0x0000ff00 || ReadU32(data + 62) != 0x000000ff) {
+			return E_FAIL;
+		}
+	}
+	else if (compression != bi_rgb) {
+		return E_FAIL;
+	}
+
+	// 高さが負なら上から下に並んでいる
+	auto topDown = height < 0;
+	size_t w = static_cast<size_t>(width);
+	size_t h = topDown ? static_cast<size_t>(-static_cast<int64_t>(height)) : static_cast<size_t>(height);
+	SourceFormat format = { bitCount / 8u, false };
+	// 各行は4バイト境界に揃う
+	auto stride = (w * format.bytesPerPixel + 3) & ~static_cast<size_t>(3);
+	if (offset > size || (size - offset) / stride < h) {
+		return E_FAIL;
+	}
+	return ConvertImage(data + offset, data + size, stride, w, h, topDown, format, useSIMD, metadata, image);
+}
+
+HRESULT DecodeTGAMemory(const uint8_t* data, size_t size, TexMetadata* metadata, ScratchImage& image, bool useSIMD)
+{
+	const size_t header_size = 18;
+	const uint8_t tga_truecolor = 2;
+	const uint8_t tga_truecolor_rle = 10;
+	if (data == nullptr || size < header_size) {
+		return E_FAIL;
+	}
+	auto idLength = data[0];
+	auto colorMapType = data[1];
+	auto imageType = data[2];
+	size_t width = ReadU16(data + 12);
+	size_t height = ReadU16(data + 14);
+	auto bitCount = data[16];
+	auto descriptor = data[17];
+	// カラーマップ付きと、右から左に並んだものは扱わない
+	if (colorMapType != 0 || (imageType != tga_truecolor && imageType != tga_truecolor_rle) ||
+		(bitCount != 24 && bitCount != 32) || (descriptor & 0x10) || width == 0 || height == 0) {
+		return E_FAIL;
+	}
+	SourceFormat format = { bitCount / 8u, bitCount == 32 };
+	auto topDown = (descriptor & 0x20) != 0;
+	auto stride = width * format.bytesPerPixel;
+	auto offset = header_size + idLength;
+	if (offset > size) {
+		return E_FAIL;
+	}
+
+	HRESULT result;
+	if (imageType == tga_truecolor) {
+		if ((size - offset) / stride < height) {
+			return E_FAIL;
+		}
+		result = ConvertImage(data + offset, data + size, stride, width, height, topDown, format, useSIMD, metadata, image);
+	}
+	else {
+		vector<uint8_t> pixels;
+		if (!ExpandTGARLE(data + offset, data + size, format.bytesPerPixel, width * height, pixels)) {
+			return E_FAIL;
+		}
+		result = ConvertImage(pixels.data(), pixels.data() + pixels.size(), stride, width, height, topDown, format, useSIMD,
+			metadata, image);
+	}
+	if (FAILED(result) || !format.hasAlpha) {
+		return result;
+	}
+
+	// アルファがすべて0なら、アルファを使っていないものとして不透明にする
+	auto img = image.GetImage(0, 0, 0);
+	for (size_t y = 0; y < height; ++y) {
+		auto row = img->pixels + y * img->rowPitch;
+		for (size_t x = 0; x < width; ++x) {
+			if (row[x * 4 + 3] != 0) {
+				return result;
+			}
+		}
+	}
+	for (size_t y = 0; y < height; ++y) {
+		auto row = img->pixels + y * img->rowPitch;
+		for (size_t x = 0; x < width; ++x) {
+			row[x * 4 + 3] = 0xff;
+		}
+	}
+	return result;
+}
+
+bool ImageDecoderHasSIMD()
+{
+#ifdef IMAGE_DECODER_SSE2
+	return true;
+#else
+	return false;
+#endif
+}
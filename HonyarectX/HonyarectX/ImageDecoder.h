@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <DirectXTex.h>
+
+/// <summary>
+/// BMP（.sph/.spaを含む）をメモリからデコードする
+/// WICを使わないので、COMの初期化をしていないワーカースレッドやWindows以外でも使える
+/// 対応するのは無圧縮の24/32bit（BI_RGBと、標準の並びのBI_BITFIELDS）のみで、それ以外はE_FAILを返す
+/// 結果はR8G8B8A8_UNORM（32bitのBMPはWICと同じくアルファを使わず255にする）
+/// </summary>
+/// <param name="data">ファイルの内容（メモリマップしたものをそのまま渡してよい）</param>
+/// <param name="size">ファイルサイズ</param>
+/// <param name="metadata">イメージの情報（不要ならnullptr）</param>
+/// <param name="image">結果</param>
+/// <param name="useSIMD">falseならSIMDを使わずに変換する（比較用）</param>
+HRESULT DecodeBMPMemory(const uint8_t* data, size_t size, DirectX::TexMetadata* metadata, DirectX::ScratchImage& image,
+	bool useSIMD = true);
+
+/// <summary>
+/// TGAをメモリからデコードする（DecodeBMPMemoryと同じくどのスレッドからでも使える）
+/// 対応するのは無圧縮とRLEの24/32bitフルカラーのみで、それ以外はE_FAILを返す
+/// 結果はR8G8B8A8_UNORM（アルファがすべて0の32bitはDirectXTexと同じく不透明として扱う）
+/// </summary>
+HRESULT DecodeTGAMemory(const uint8_t* data, size_t size, DirectX::TexMetadata* metadata, DirectX::ScratchImage& image,
+	bool useSIMD = true);
+
+/// <summary>画素の並べ替えにSIMD（SSE2）を使えるか</summary>
+bool ImageDecoderHasSIMD();
@@ -0,0 +1,204 @@
+﻿#include "IncrementalPose.h"
+#include <cassert>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	bool SameBoneTransform(const BoneTransform& a, const BoneTransform& b)
+	{
+		return XMVector4Equal(a.rotation, b.rotation) && XMVector4Equal(a.translation, b.translation);
+	}
+}
+
+void IncrementalPoseStats::Add(const IncrementalPoseStats& other)
+{
+	updates += other.updates;
+	idleUpdates += other.idleUpdates;
+	bones += other.bones;
+	boneUpdates += other.boneUpdates;
+	matrixUpdates += other.matrixUpdates;
+	ikSolves += other.ikSolves;
+	ikSkips += other.ikSkips;
+}
+
+void IncrementalPose::Reset(const Skeleton& skeleton, const IKSolver& ik)
+{
+	auto boneNum = skeleton.BoneNum();
+	_locals.assign(boneNum, IdentityBoneTransform());
+	_models.assign(boneNum, IdentityBoneTransform());
+	_results.assign(boneNum, IdentityBoneTransform());
+	_dirty.assign(boneNum, 0);
+	_dirtyBones.clear();
+	_posed.assign(boneNum, 0);
+	_posedBones.clear();
+
+	_ikFlags.assign(boneNum, 0);
+	for (auto& chain : ik.Chains()) {
+		ik.AffectedBones(chain, skeleton, _ikFlags.data());
+	}
+	_ikWrites.clear();
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_ikFlags[b] & ik_bone_write) {
+			_ikWrites.push_back(b);
+		}
+	}
+	_ikEnabled.assign(ik.Chains().size(), 0);
+	_ikSolved = false;
+	Invalidate();
+}
+
+void IncrementalPose::Invalidate()
+{
+	_valid = false;
+	_output = nullptr;
+}
+
+void IncrementalPose::InvalidateOutput()
+{
+	_output = nullptr;
+}
+
+void IncrementalPose::SetPoses(const BonePose* poses, const vector<uint32_t>& bones, const Skeleton& skeleton)
+{
+	// 今回動かすもの（2）と前回だけ動かしていたもの（1）を分ける
+	for (auto bone : bones) {
+		_posed[bone] = 2;
+	}
+	for (auto bone : _posedBones) {
+		if (_posed[bone] == 1) {
+			SetLocal(bone, IdentityBoneTransform());
+			_posed[bone] = 0;
+		}
+	}
+	for (auto bone : bones) {
+		// 基準点を中心に回して移動する（回転中心は移動量に含める）
+		SetLocal(bone, PoseToBoneTransform(poses[bone], skeleton.RestPosition(bone)));
+		_posed[bone] = 1;
+	}
+	_posedBones = bones;
+}
+
+void IncrementalPose::SetLocal(uint32_t bone, const BoneTransform& local)
+{
+	assert(bone < _locals.size());
+	if (SameBoneTransform(_locals[bone], local)) {
+		return;
+	}
+	_locals[bone] = local;
+	if (!_dirty[bone]) {
+		_dirty[bone] = 1;
+		_dirtyBones.push_back(bone);
+	}
+}
+
+size_t IncrementalPose::Update(const Skeleton& skeleton, const IKSolver& ik, const uint8_t* disabled, bool solveIK, XMMATRIX* matrices)
+{
+	auto boneNum = static_cast<uint32_t>(_locals.size());
+	++_stats.updates;
+	_stats.bones += boneNum;
+
+	// 相対の姿勢が変わったボーンの部分木（無効ならすべて）
+	for (auto bone : _dirtyBones) {
+		_dirty[bone] = 0;
+	}
+	if (_valid) {
+		skeleton.Subtrees(_dirtyBones, _ranges);
+	}
+	else {
+		_ranges.assign(1, { 0, boneNum });
+	}
+	_dirtyBones.clear();
+
+	// 親の姿勢をつなげ直し、IKの読むボーンが変わったか調べる
+	auto& order = skeleton.Order();
+	uint8_t ikFlags = 0;
+	size_t boneUpdates = 0;
+	for (auto& range : _ranges) {
+		skeleton.LocalToModel(_locals.data(), range, _models.data());
+		for (auto i = range.begin; i < range.end; ++i) {
+			auto bone = order[i];
+			_results[bone] = _models[bone];
+			ikFlags |= _ikFlags[bone];
+		}
+		boneUpdates += range.end - range.begin;
+	}
+	_stats.boneUpdates += boneUpdates;
+
+	// IKのオンオフが変わったものがあれば解き直す
+	auto& chains = ik.Chains();
+	auto solve = !_valid || solveIK != _ikSolved || (solveIK && (ikFlags & ik_bone_read) != 0);
+	if (solveIK) {
+		for (size_t c = 0; c < chains.size(); ++c) {
+			uint8_t enabled = disabled == nullptr || !disabled[chains[c].boneIdx];
+			if (enabled != _ikEnabled[c]) {
+				_ikEnabled[c] = enabled;
+				solve = true;
+			}
+		}
+	}
+	// 書き換えるボーンをIK前の姿勢に戻してから解く（IKを解かないなら戻すだけ）
+	if (solve) {
+		for (auto bone : _ikWrites) {
+			_results[bone] = _models[bone];
+		}
+		if (solveIK) {
+			ik.Solve(skeleton, disabled, _results.data());
+			++_stats.ikSolves;
+		}
+	}
+	else if (solveIK) {
+		++_stats.ikSkips;
+	}
+	_ikSolved = solveIK;
+
+	// 変わったボーンだけ行列にする（前回と違うところへ書くならすべて）
+	size_t matrixUpdates = 0;
+	if (!_valid || matrices != _output) {
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			matrices[b] = BoneTransformToMatrix(_results[b]);
+		}
+		matrixUpdates = boneNum;
+	}
+	else {
+		for (auto& range : _ranges) {
+			for (auto i = range.begin; i < range.end; ++i) {
+				auto bone = order[i];
+				// IKで書き換えたものは後でまとめて
+				if (!solve || !(_ikFlags[bone] & ik_bone_write)) {
+					matrices[bone] = BoneTransformToMatrix(_results[bone]);
+					++matrixUpdates;
+				}
+			}
+		}
+		if (solve) {
+			for (auto bone : _ikWrites) {
+				matrices[bone] = BoneTransformToMatrix(_results[bone]);
+			}
+			matrixUpdates += _ikWrites.size();
+		}
+	}
+	_stats.matrixUpdates += matrixUpdates;
+	if (boneUpdates == 0 && !solve) {
+		++_stats.idleUpdates;
+	}
+	_valid = true;
+	_output = matrices;
+	return matrixUpdates;
+}
+
+const vector<BoneTransform>& IncrementalPose::Results() const
+{
+	return _results;
+}
+
+const IncrementalPoseStats& IncrementalPose::Stats() const
+{
+	return _stats;
+}
+
+void IncrementalPose::ResetStats()
+{
+	_stats = IncrementalPoseStats();
+}
@@ -0,0 +1,94 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "Skeleton.h"
+#include "IKSolver.h"
+#include "BoneTransform.h"
+#include "AnimationClip.h"
+
+/// <summary>差分更新の回数（累計）</summary>
+struct IncrementalPoseStats {
+	/// <summary>更新した回数（うち動いたボーンが無く何も計算しなかったもの）</summary>
+	uint64_t updates = 0;
+	uint64_t idleUpdates = 0;
+	/// <summary>全ボーンを計算し直していた場合のボーン数</summary>
+	uint64_t bones = 0;
+	/// <summary>親の姿勢をつなげ直したボーンの数</summary>
+	uint64_t boneUpdates = 0;
+	/// <summary>行列にし直したボーンの数</summary>
+	uint64_t matrixUpdates = 0;
+	/// <summary>IKを解き直した回数と、読むボーンが変わらず前回の結果を使った回数</summary>
+	uint64_t ikSolves = 0;
+	uint64_t ikSkips = 0;
+
+	/// <summary>別の統計を足し込む（複数のアクターの集計用）</summary>
+	void Add(const IncrementalPoseStats& other);
+};
+
+/// <summary>
+/// 変わったボーンだけ計算し直すボーン行列の更新
+/// 親からの相対の姿勢（前回の値）、IKを解く前と後のモデル空間の姿勢をボーンごとに持ち続け、
+/// 相対の姿勢が変わったボーンの部分木だけ親の姿勢をつなげ直す
+/// IKは読むボーン（IKSolver::AffectedBones）のどれかが変わったときだけ、書き換えるボーンをIK前の姿勢に戻して解き直す
+/// 変わった判定は値の完全一致で行うので、結果はすべて計算し直した場合と同じになる
+/// </summary>
+class IncrementalPose
+{
+private:
+	std::vector<BoneTransform> _locals;			// ボーン番号ごとの親からの相対の姿勢
+	std::vector<BoneTransform> _models;			// IKを解く前のモデル空間の姿勢
+	std::vector<BoneTransform> _results;		// IKまで解いたモデル空間の姿勢
+	std::vector<uint8_t> _dirty;				// ボーン番号ごとの相対の姿勢が変わったか
+	std::vector<uint32_t> _dirtyBones;			// 相対の姿勢が変わったボーン（Skeleton::Subtreesで並びの位置に書き換わる）
+	std::vector<Skeleton::Range> _ranges;		// 計算し直す部分木
+	std::vector<uint8_t> _posed;				// ボーン番号ごとのモーションで動かしているか
+	std::vector<uint32_t> _posedBones;			// モーションで動かしているボーン
+	std::vector<uint8_t> _ikFlags;				// ボーン番号ごとのIKBoneFlag（すべてのIKの分）
+	std::vector<uint32_t> _ikWrites;			// IKで書き換えるボーン
+	std::vector<uint8_t> _ikEnabled;			// IKごとの前回解いたときのオンオフ
+	bool _ikSolved = false;						// _resultsがIKを解いたものか
+	bool _valid = false;						// falseなら次の更新ですべて計算し直す
+	const DirectX::XMMATRIX* _output = nullptr;	// 前回書き込んだ行列（違うところへ書くならすべて書き込む）
+	IncrementalPoseStats _stats;
+
+public:
+	/// <summary>骨格とIKに合わせて作り直す（すべて初期姿勢にし、次の更新ですべて計算する）</summary>
+	void Reset(const Skeleton& skeleton, const IKSolver& ik);
+
+	/// <summary>次の更新ですべて計算し直す</summary>
+	void Invalidate();
+
+	/// <summary>前回書き込んだ行列がほかで書き換えられた（姿勢キャッシュから読み出したなど）ので、次の更新ではすべて書き込む</summary>
+	void InvalidateOutput();
+
+	/// <summary>
+	/// モーションの姿勢を相対の姿勢にする（前回動かしていて今回含まれないボーンは初期姿勢に戻す）
+	/// </summary>
+	/// <param name="poses">ボーン番号ごとの姿勢</param>
+	/// <param name="bones">posesの有効なボーン番号</param>
+	void SetPoses(const BonePose* poses, const std::vector<uint32_t>& bones, const Skeleton& skeleton);
+
+	/// <summary>
+	/// 1つのボーンの相対の姿勢を書き換える（視線を向けるなどの手続き的な変更）
+	/// SetPosesのあとに呼ぶ（モーションで動かしているボーンは次のSetPosesで上書きされる）
+	/// </summary>
+	void SetLocal(uint32_t bone, const BoneTransform& local);
+
+	/// <summary>
+	/// 変わったボーンだけ計算し直して行列を更新する
+	/// </summary>
+	/// <param name="disabled">ボーン番号ごとのIKのオフ（nullptrならすべてオン）</param>
+	/// <param name="solveIK">falseならIKを解かない</param>
+	/// <param name="matrices">ボーン番号ごとの行列（前回と同じところなら変わったボーンだけ書き込む）</param>
+	/// <returns>行列にし直したボーンの数</returns>
+	size_t Update(const Skeleton& skeleton, const IKSolver& ik, const uint8_t* disabled, bool solveIK, DirectX::XMMATRIX* matrices);
+
+	/// <summary>最後に更新したIKまで解いたモデル空間の姿勢</summary>
+	const std::vector<BoneTransform>& Results() const;
+
+	const IncrementalPoseStats& Stats() const;
+	void ResetStats();
+};
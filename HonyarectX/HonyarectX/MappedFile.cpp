@@ -0,0 +1,188 @@
+﻿#include "MappedFile.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+#ifdef _WIN32
+	auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	_file = file;
+	_size = static_cast<size_t>(size.QuadPart);
+	if (_size == 0) {
+		// 空ファイルはマップできないがエラーではない
+		return true;
+	}
+	_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (_mapping == nullptr) {
+		Close();
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (_data == nullptr) {
+		Close();
+		return false;
+	}
+#else
+	_fd = open(path, O_RDONLY);
+	if (_fd < 0) {
+		return false;
+	}
+	struct stat st = {};
+	if (fstat(_fd, &st) != 0) {
+		Close();
+		return false;
+	}
+	_size = static_cast<size_t>(st.st_size);
+	if (_size == 0) {
+		return true;
+	}
+	auto addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (addr == MAP_FAILED) {
+		Close();
+		return false;
+	}
+	_data = static_cast<const uint8_t*>(addr);
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (_data != nullptr) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping != nullptr) {
+		CloseHandle(_mapping);
+	}
+	if (_file != nullptr) {
+		CloseHandle(_file);
+	}
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	if (_data != nullptr) {
+		munmap(const_cast<uint8_t*>(_data), _size);
+	}
+	if (_fd >= 0) {
+		close(_fd);
+	}
+	_fd = -1;
+#endif
+	_data = nullptr;
+	_size = 0;
+}
+
+bool MappedFile::IsOpen() const
+{
+#ifdef _WIN32
+	return _file != nullptr;
+#else
+	return _fd >= 0;
+#endif
+}
+
+const uint8_t* MappedFile::Data() const
+{
+	return _data;
+}
+
+size_t MappedFile::Size() const
+{
+	return _size;
+}
+
+bool GetFileStamp(const char* path, uint64_t& size, int64_t& time)
+{
+#ifdef _WIN32
+	struct _stat64 st = {};
+	if (_stat64(path, &st) != 0) {
+		return false;
+	}
+#else
+	struct stat st = {};
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+#endif
+	size = static_cast<uint64_t>(st.st_size);
+	time = static_cast<int64_t>(st.st_mtime);
+	return true;
+}
+
+std::vector<std::string> ListFiles(const char* directory, const char* extension)
+{
+	auto hasExtension = [extension](const std::string& name) {
+		if (extension == nullptr) {
+			return true;
+		}
+		auto length = strlen(extension);
+		return name.size() >= length && std::equal(name.end() - length, name.end(), extension, [](char a, char b) {
+			return tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b));
+		});
+	};
+	std::string base = directory;
+	if (!base.empty() && base.back() != '/' && base.back() != '\\') {
+		base += '/';
+	}
+	std::vector<std::string> files;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data = {};
+	auto find = FindFirstFileA((base + "*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE) {
+		return files;
+	}
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && hasExtension(data.cFileName)) {
+			files.push_back(base + data.cFileName);
+		}
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	auto dir = opendir(directory);
+	if (dir == nullptr) {
+		return files;
+	}
+	while (auto entry = readdir(dir)) {
+		auto path = base + entry->d_name;
+		struct stat st = {};
+		if (hasExtension(entry->d_name) && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+			files.push_back(path);
+		}
+	}
+	closedir(dir);
+#endif
+	std::sort(files.begin(), files.end());
+	return files;
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// 読み込み専用でファイルをメモリマップする
+/// （デバイスに依存しないのでツールやワーカースレッドからも使える）
+/// </summary>
+class MappedFile
+{
+private:
+#ifdef _WIN32
+	void* _file = nullptr;			// ファイルハンドル
+	void* _mapping = nullptr;		// ファイルマッピングハンドル
+#else
+	int _fd = -1;					// ファイルディスクリプタ
+#endif
+	const uint8_t* _data = nullptr;	// マップ先の先頭アドレス
+	size_t _size = 0;				// ファイルサイズ
+
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/// <summary>ファイルを開いてマップする（失敗時はfalse）</summary>
+	/// <param name="path">ファイルパス</param>
+	bool Open(const char* path);
+	/// <summary>マップを解除してファイルを閉じる</summary>
+	void Close();
+
+	bool IsOpen() const;
+	const uint8_t* Data() const;
+	size_t Size() const;
+};
+
+/// <summary>ファイルのサイズと更新時刻を得る（クック済みファイルが元のファイルより古くないかの確認用）</summary>
+bool GetFileStamp(const char* path, uint64_t& size, int64_t& time);
+
+/// <summary>
+/// ディレクトリにあるファイルのパス（"ディレクトリ/ファイル名"）を名前順に得る（サブディレクトリは含まない）
+/// </summary>
+/// <param name="extension">拡張子（".vmd"など、大文字小文字は区別しない）、nullptrならすべて</param>
+std::vector<std::string> ListFiles(const char* directory, const char* extension = nullptr);
@@ -0,0 +1,392 @@
+﻿#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+namespace
+{
+	constexpr uint32_t no_vertex = 0xffffffff;
+
+	// Forsythのスコア計算の定数
+	constexpr float cache_decay_power = 1.5f;
+	constexpr float last_triangle_score = 0.75f;
+	constexpr float valence_boost_scale = 2.0f;
+	constexpr float valence_boost_power = 0.5f;
+	constexpr size_t valence_table_size = 32;
+
+	/// <summary>頂点のスコア（キャッシュ内の位置と、まだ出力していない三角形の数から決める）</summary>
+	class VertexScoreTable
+	{
+	private:
+		float _cacheScores[vertex_cache_size];
+		float _valenceScores[valence_table_size];
+
+	public:
+		VertexScoreTable()
+		{
+			for (size_t i = 0; i < vertex_cache_size; ++i) {
+				if (i < 3) {
+					// 直前の三角形の頂点は、同じ三角形を続けて使いにくくするため固定値
+					_cacheScores[i] = last_triangle_score;
+				}
+				else {
+					auto scaler = 1.0f / (vertex_cache_size - 3);
+					_cacheScores[i] = powf(1.0f - (i - 3) * scaler, cache_decay_power);
+				}
+			}
+			for (size_t i = 0; i < valence_table_size; ++i) {
+				_valenceScores[i] = i == 0 ? 0.0f : valence_boost_scale * powf(static_cast<float>(i), -valence_boost_power);
+			}
+		}
+
+		float Score(int cachePos, uint32_t remainValence) const
+		{
+			if (remainValence == 0) {
+				// もう使われない
+				return -1.0f;
+			}
+			auto score = 0.0f;
+			if (cachePos >= 0) {
+				score += _cacheScores[cachePos];
+			}
+			score += remainValence < valence_table_size ? _valenceScores[remainValence] :
+				valence_boost_scale * powf(static_cast<float>(remainValence), -valence_boost_power);
+			return score;
+		}
+	};
+
+	/// <summary>
+	/// 三角形の並べ替え（Tom Forsyth, Linear-Speed Vertex Cache Optimisation）
+	/// 作業用の配列は頂点数分をまとめて確保し、マテリアルの範囲ごとに使いまわす
+	/// </summary>
+	class TriangleSorter
+	{
+	private:
+		const VertexScoreTable _table;
+		vector<uint32_t> _valence;			// 頂点ごとのまだ出力していない三角形の数
+		vector<uint32_t> _adjacencyOffset;	// 頂点ごとの隣接三角形リストの開始位置
+		vector<uint32_t> _adjacency;		// 隣接三角形リスト（出力済みのものは末尾に寄せて除く）
+		vector<int> _cachePos;				// 頂点ごとのキャッシュ内の位置（-1は外）
+		vector<float> _vertexScore;
+		vector<float> _triangleScore;
+		vector<bool> _triangleAdded;
+
+	public:
+		explicit TriangleSorter(size_t vertexNum) :
+			_valence(vertexNum, 0),
+			_adjacencyOffset(vertexNum, no_vertex),
+			_cachePos(vertexNum, -1),
+			_vertexScore(vertexNum, 0.0f)
+		{
+		}
+
+		/// <summary>インデックスの範囲（三角形リスト）を並べ替えてoutに書き出す</summary>
+		void Sort(const uint16_t* indices, size_t indexNum, uint16_t* out)
+		{
+			auto triNum = indexNum / 3;
+			if (triNum == 0) {
+				copy(indices, indices + indexNum, out);
+				return;
+			}
+
+			// この範囲で使う頂点だけ初期化する
+			for (size_t i = 0; i < triNum * 3; ++i) {
+				auto v = indices[i];
+				_valence[v] = 0;
+				_cachePos[v] = -1;
+				_adjacencyOffset[v] = no_vertex;
+			}
+			for (size_t i = 0; i < triNum * 3; ++i) {
+				++_valence[indices[i]];
+			}
+			// 頂点ごとに隣接三角形リストの領域を割り当てる（数え直しながら埋めるので一旦0に戻す）
+			uint32_t offset = 0;
+			for (size_t i = 0; i < triNum * 3; ++i) {
+				auto v = indices[i];
+				if (_adjacencyOffset[v] == no_vertex) {
+					_adjacencyOffset[v] = offset;
+					offset += _valence[v];
+					_valence[v] = 0;
+				}
+			}
+			_adjacency.resize(offset);
+			for (size_t t = 0; t < triNum; ++t) {
+				for (size_t k = 0; k < 3; ++k) {
+					auto v = indices[t * 3 + k];
+					_adjacency[_adjacencyOffset[v] + _valence[v]++] = static_cast<uint32_t>(t);
+				}
+			}
+			for (size_t i = 0; i < triNum * 3; ++i) {
+				auto v = indices[i];
+				_vertexScore[v] = _table.Score(-1, _valence[v]);
+			}
+			_triangleScore.assign(triNum, 0.0f);
+			_triangleAdded.assign(triNum, false);
+			for (size_t t = 0; t < triNum; ++t) {
+				for (size_t k = 0; k < 3; ++k) {
+					_triangleScore[t] += _vertexScore[indices[t * 3 + k]];
+				}
+			}
+
+			vector<uint32_t> cache;
+			vector<uint32_t> newCache;
+			cache.reserve(vertex_cache_size + 3);
+			newCache.reserve(vertex_cache_size + 3);
+			int bestTri = -1;
+			size_t searchCursor = 0;
+			for (size_t emitted = 0; emitted < triNum; ++emitted) {
+				if (bestTri < 0) {
+					// キャッシュ内から候補が見つからなかったので、まだ出力していない最初の三角形から再開する
+					// （全体からスコア最大のものを探すと三角形数の2乗になるため）
+					while (searchCursor < triNum && _triangleAdded[searchCursor]) {
+						++searchCursor;
+					}
+					bestTri = static_cast<int>(searchCursor);
+				}
+				assert(bestTri >= 0);
+
+				// 出力
+				auto tri = indices + bestTri * 3;
+				copy(tri, tri + 3, out + emitted * 3);
+				_triangleAdded[bestTri] = true;
+
+				// 隣接リストから外す
+				for (size_t k = 0; k < 3; ++k) {
+					auto v = tri[k];
+					auto begin = _adjacency.begin() + _adjacencyOffset[v];
+					auto end = begin + _valence[v];
+					auto it = find(begin, end, static_cast<uint32_t>(bestTri));
+					assert(it != end);
+					iter_swap(it, end - 1);
+					--_valence[v];
+				}
+
+				// 出力した三角形の頂点をキャッシュの先頭へ
+				newCache.clear();
+				for (size_t k = 0; k < 3; ++k) {
+					if (find(newCache.begin(), newCache.end(), tri[k]) == newCache.end()) {
+						newCache.push_back(tri[k]);
+					}
+				}
+				for (auto v : cache) {
+					if (v != tri[0] && v != tri[1] && v != tri[2]) {
+						newCache.push_back(v);
+					}
+				}
+
+				// キャッシュ内（と押し出された）頂点のスコアを更新し、次の候補を探す
+				bestTri = -1;
+				auto bestScore = -1.0f;
+				for (size_t i = 0; i < newCache.size(); ++i) {
+					auto v = newCache[i];
+					_cachePos[v] = i < vertex_cache_size ? static_cast<int>(i) : -1;
+					auto score = _table.Score(_cachePos[v], _valence[v]);
+					auto diff = score - _vertexScore[v];
+					_vertexScore[v] = score;
+					for (uint32_t a = 0; a < _valence[v]; ++a) {
+						auto t = _adjacency[_adjacencyOffset[v] + a];
+						_triangleScore[t] += diff;
+					}
+				}
+				for (size_t i = 0; i < newCache.size() && i < vertex_cache_size; ++i) {
+					auto v = newCache[i];
+					for (uint32_t a = 0; a < _valence[v]; ++a) {
+						auto t = _adjacency[_adjacencyOffset[v] + a];
+						if (_triangleScore[t] > bestScore) {
+							bestScore = _triangleScore[t];
+							bestTri = static_cast<int>(t);
+						}
+					}
+				}
+				if (newCache.size() > vertex_cache_size) {
+					newCache.resize(vertex_cache_size);
+				}
+				swap(cache, newCache);
+			}
+
+			// 3で割り切れない余りはそのまま
+			copy(indices + triNum * 3, indices + indexNum, out + triNum * 3);
+		}
+	};
+}
+
+PMDView<PMDVertex> OptimizedMesh::VertexView() const
+{
+	return PMDView<PMDVertex>(reinterpret_cast<const uint8_t*>(vertices.data()), vertices.size());
+}
+
+PMDView<uint16_t> OptimizedMesh::IndexView() const
+{
+	return PMDView<uint16_t>(reinterpret_cast<const uint8_t*>(indices.data()), indices.size());
+}
+
+void OptimizeVertexCache(vector<uint16_t>& indices, const vector<uint32_t>& materialIndexNums, size_t vertexNum)
+{
+	auto source = indices;
+	TriangleSorter sorter(vertexNum);
+	size_t rangeBegin = 0;
+	for (auto rangeNum : materialIndexNums) {
+		assert(rangeBegin + rangeNum <= indices.size());
+		sorter.Sort(source.data() + rangeBegin, rangeNum, indices.data() + rangeBegin);
+		rangeBegin += rangeNum;
+	}
+}
+
+VertexCacheStats MeasureVertexCache(const uint16_t* indices, size_t indexNum, size_t vertexNum, size_t cacheSize)
+{
+	VertexCacheStats ret;
+	if (indexNum < 3) {
+		return ret;
+	}
+	// FIFOなので、キャッシュに入った時点のミス回数を覚えておけば入っているかどうか分かる
+	vector<int64_t> insertTime(vertexNum, -static_cast<int64_t>(cacheSize) - 1);
+	vector<bool> used(vertexNum, false);
+	int64_t misses = 0;
+	size_t usedNum = 0;
+	for (size_t i = 0; i < indexNum; ++i) {
+		auto v = indices[i];
+		assert(v < vertexNum);
+		if (misses - insertTime[v] > static_cast<int64_t>(cacheSize)) {
+			insertTime[v] = misses++;
+		}
+		if (!used[v]) {
+			used[v] = true;
+			++usedNum;
+		}
+	}
+	ret.acmr = static_cast<float>(misses) / (indexNum / 3);
+	ret.atvr = static_cast<float>(misses) / usedNum;
+	return ret;
+}
+
+bool OptimizeMesh(const PMDView<PMDVertex>& vertices, const PMDView<uint16_t>& indices,
+	const vector<uint32_t>& materialIndexNums, OptimizedMesh& mesh, const vector<bool>* noWeld)
+{
+	auto vertexNum = vertices.size();
+	auto indexNum = indices.size();
+	size_t materialIndexTotal = 0;
+	for (auto rangeNum : materialIndexNums) {
+		materialIndexTotal += rangeNum;
+	}
+	if (materialIndexTotal > indexNum) {
+		return false;
+	}
+	for (size_t i = 0; i < indexNum; ++i) {
+		if (indices[i] >= vertexNum) {
+			return false;
+		}
+	}
+	if (noWeld != nullptr && noWeld->size() != vertexNum) {
+		return false;
+	}
+
+	mesh.vertices.clear();
+	mesh.indices.resize(indexNum);
+	mesh.stats = MeshOptimizeStats();
+	mesh.stats.sourceVertexNum = vertexNum;
+	if (indexNum > 0) {
+		mesh.stats.before = MeasureVertexCache(reinterpret_cast<const uint16_t*>(indices.bytes()), indexNum, vertexNum);
+	}
+
+	// 1. 完全に同じ頂点をまとめる（バイト列で並べて隣同士を比べる、代表は番号の小さいもの）
+	// 表情で動く頂点は、同じ座標でも他方が動かないことがあるのでまとめない
+	vector<uint32_t> sorted(vertexNum);
+	for (uint32_t i = 0; i < vertexNum; ++i) {
+		sorted[i] = i;
+	}
+	auto vertexBytes = vertices.bytes();
+	auto compareVertex = [vertexBytes](uint32_t lval, uint32_t rval) {
+		return memcmp(vertexBytes + lval * sizeof(PMDVertex), vertexBytes + rval * sizeof(PMDVertex), sizeof(PMDVertex));
+	};
+	sort(sorted.begin(), sorted.end(), [&compareVertex](uint32_t lval, uint32_t rval) {
+		auto cmp = compareVertex(lval, rval);
+		return cmp != 0 ? cmp < 0 : lval < rval;
+	});
+	vector<uint32_t> weld(vertexNum);
+	for (size_t i = 0; i < vertexNum; ++i) {
+		auto weldable = noWeld == nullptr || (!(*noWeld)[sorted[i]] && i > 0 && !(*noWeld)[sorted[i - 1]]);
+		if (i > 0 && weldable && compareVertex(sorted[i - 1], sorted[i]) == 0) {
+			weld[sorted[i]] = weld[sorted[i - 1]];
+			++mesh.stats.weldedVertexNum;
+		}
+		else {
+			weld[sorted[i]] = sorted[i];
+		}
+	}
+	vector<uint16_t> weldedIndices(indexNum);
+	for (size_t i = 0; i < indexNum; ++i) {
+		weldedIndices[i] = static_cast<uint16_t>(weld[indices[i]]);
+	}
+
+	// 2. マテリアルの範囲ごとに三角形を並べ替える（範囲をまたいで動かすことはしない）
+	TriangleSorter sorter(vertexNum);
+	size_t rangeBegin = 0;
+	for (auto rangeNum : materialIndexNums) {
+		sorter.Sort(weldedIndices.data() + rangeBegin, rangeNum, mesh.indices.data() + rangeBegin);
+		rangeBegin += rangeNum;
+	}
+	// どのマテリアルにも属さない残りはそのまま
+	copy(weldedIndices.begin() + rangeBegin, weldedIndices.end(), mesh.indices.begin() + rangeBegin);
+
+	// 3. 頂点を初めて参照される順に並べ替える
+	vector<uint32_t> newIndex(vertexNum, no_vertex);
+	mesh.vertexRemap.clear();
+	for (auto& idx : mesh.indices) {
+		if (newIndex[idx] == no_vertex) {
+			newIndex[idx] = static_cast<uint32_t>(mesh.vertexRemap.size());
+			mesh.vertexRemap.push_back(idx);
+		}
+		idx = static_cast<uint16_t>(newIndex[idx]);
+	}
+	// 参照されない頂点も（モーフなどで番号を使うかもしれないので）末尾に残す
+	for (uint32_t i = 0; i < vertexNum; ++i) {
+		if (weld[i] == i && newIndex[i] == no_vertex) {
+			newIndex[i] = static_cast<uint32_t>(mesh.vertexRemap.size());
+			mesh.vertexRemap.push_back(i);
+		}
+	}
+	mesh.sourceToVertex.resize(vertexNum);
+	for (uint32_t i = 0; i < vertexNum; ++i) {
+		mesh.sourceToVertex[i] = newIndex[weld[i]];
+	}
+	mesh.vertices.resize(mesh.vertexRemap.size());
+	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+		mesh.vertices[i] = vertices[mesh.vertexRemap[i]];
+	}
+
+	mesh.stats.vertexNum = mesh.vertices.size();
+	if (indexNum > 0) {
+		mesh.stats.after = MeasureVertexCache(mesh.indices.data(), indexNum, mesh.vertices.size());
+	}
+	return true;
+}
+
+vector<uint32_t> GetMaterialIndexNums(const PMDModelData& model)
+{
+	auto& materials = model.Materials();
+	vector<uint32_t> materialIndexNums(materials.size());
+	for (size_t i = 0; i < materials.size(); ++i) {
+		materialIndexNums[i] = materials[i].indicesNum;
+	}
+	return materialIndexNums;
+}
+
+bool OptimizeMesh(const PMDModelData& model, OptimizedMesh& mesh)
+{
+	auto& skins = model.Skins();
+	if (skins.empty() || skins[0].header.type != pmd_skin_base) {
+		return OptimizeMesh(model.Vertices(), model.Indices(), GetMaterialIndexNums(model), mesh);
+	}
+	vector<bool> noWeld(model.Vertices().size(), false);
+	auto& base = skins[0].vertices;
+	for (size_t i = 0; i < base.size(); ++i) {
+		// 読み込み時に確かめているが、範囲外の番号で書き込まないようにここでも確かめる
+		auto vertIdx = base[i].vertIdx;
+		if (vertIdx < noWeld.size()) {
+			noWeld[vertIdx] = true;
+		}
+	}
+	return OptimizeMesh(model.Vertices(), model.Indices(), GetMaterialIndexNums(model), mesh, &noWeld);
+}
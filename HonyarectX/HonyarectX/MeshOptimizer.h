@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "PMDModelData.h"
+
+/// <summary>頂点キャッシュ効率の指標</summary>
+struct VertexCacheStats {
+	float acmr = 0.0f;					// 三角形あたりの頂点シェーダー実行数（Average Cache Miss Ratio）
+	float atvr = 0.0f;					// 参照される頂点あたりの頂点シェーダー実行数（Average Transformed Vertex Ratio、1が理想）
+};
+
+/// <summary>最適化の結果報告</summary>
+struct MeshOptimizeStats {
+	size_t sourceVertexNum = 0;			// 元の頂点数
+	size_t vertexNum = 0;				// 最適化後の頂点数
+	size_t weldedVertexNum = 0;			// 重複していたためまとめた頂点数
+	VertexCacheStats before;			// 最適化前
+	VertexCacheStats after;				// 最適化後
+};
+
+/// <summary>
+/// 最適化済みのメッシュ
+/// マテリアルごとのインデックス範囲（数と順番）は元と同じ
+/// </summary>
+struct OptimizedMesh {
+	std::vector<PMDVertex> vertices;
+	std::vector<uint16_t> indices;
+	/// <summary>最適化後の頂点番号から元の頂点番号（まとめた場合は最初のもの）</summary>
+	std::vector<uint32_t> vertexRemap;
+	/// <summary>元の頂点番号から最適化後の頂点番号（どの三角形からも参照されない頂点は末尾に残す）</summary>
+	std::vector<uint32_t> sourceToVertex;
+	MeshOptimizeStats stats;
+
+	/// <summary>頂点をPMDViewとして参照する（VertexConverterにそのまま渡せる）</summary>
+	PMDView<PMDVertex> VertexView() const;
+	PMDView<uint16_t> IndexView() const;
+};
+
+/// <summary>シミュレーション及び並べ替えで想定する頂点キャッシュのサイズ</summary>
+constexpr size_t vertex_cache_size = 32;
+
+/// <summary>FIFOの頂点キャッシュでACMR/ATVRを計測する</summary>
+VertexCacheStats MeasureVertexCache(const uint16_t* indices, size_t indexNum, size_t vertexNum, size_t cacheSize = vertex_cache_size);
+
+/// <summary>マテリアルの範囲ごとに三角形を頂点キャッシュに当たりやすい順に並べ替える（インデックスをその場で書き換える）</summary>
+/// <param name="indices">インデックス</param>
+/// <param name="materialIndexNums">マテリアルごとのインデックス数（描画順）</param>
+/// <param name="vertexNum">頂点数</param>
+void OptimizeVertexCache(std::vector<uint16_t>& indices, const std::vector<uint32_t>& materialIndexNums, size_t vertexNum);
+
+/// <summary>
+/// マテリアルの範囲ごとにメッシュを最適化する
+/// 1. 完全に同じ頂点をまとめる（noWeldで指定した頂点はまとめない）
+/// 2. 頂点キャッシュに当たりやすいように三角形を並べ替える（Forsyth方式）
+/// 3. 頂点を初めて参照される順に並べ替える（フェッチの局所性）
+/// </summary>
+/// <param name="vertices">頂点</param>
+/// <param name="indices">インデックス</param>
+/// <param name="materialIndexNums">マテリアルごとのインデックス数（描画順）</param>
+/// <param name="mesh">結果</param>
+/// <param name="noWeld">まとめない頂点（表情で動く頂点など、元の頂点番号で引く。nullptrなら全頂点まとめてよい）</param>
+/// <returns>インデックスが頂点数を超えているなど、最適化できない場合はfalse</returns>
+bool OptimizeMesh(const PMDView<PMDVertex>& vertices, const PMDView<uint16_t>& indices,
+	const std::vector<uint32_t>& materialIndexNums, OptimizedMesh& mesh, const std::vector<bool>* noWeld = nullptr);
+
+/// <summary>モデルのマテリアルごとのインデックス数（描画順）</summary>
+std::vector<uint32_t> GetMaterialIndexNums(const PMDModelData& model);
+
+/// <summary>モデルのマテリアルの範囲でメッシュを最適化する（表情で動く頂点はまとめない）</summary>
+bool OptimizeMesh(const PMDModelData& model, OptimizedMesh& mesh);
@@ -0,0 +1,495 @@
+﻿#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t no_material = 0xffffffff;
+	constexpr uint32_t multi_material = 0xfffffffe;
+
+	/// <summary>平面からの距離の2乗和を表す二次形式（対称行列の上三角10要素）</summary>
+	struct Quadric {
+		double a[10] = {};
+
+		/// <summary>平面ax+by+cz+d=0（法線は正規化済み）を重み付きで加える</summary>
+		void AddPlane(double pa, double pb, double pc, double pd, double weight)
+		{
+			a[0] += weight * pa * pa; a[1] += weight * pa * pb; a[2] += weight * pa * pc; a[3] += weight * pa * pd;
+			a[4] += weight * pb * pb; a[5] += weight * pb * pc; a[6] += weight * pb * pd;
+			a[7] += weight * pc * pc; a[8] += weight * pc * pd;
+			a[9] += weight * pd * pd;
+		}
+
+		Quadric& operator+=(const Quadric& rval)
+		{
+			for (size_t i = 0; i < 10; ++i) {
+				a[i] += rval.a[i];
+			}
+			return *this;
+		}
+
+		double Evaluate(const XMFLOAT3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+				+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+				+ a[7] * z * z + 2 * a[8] * z
+				+ a[9];
+		}
+	};
+
+	/// <summary>縮約の候補（fromをtoの位置へ寄せる）</summary>
+	struct Collapse {
+		double cost;
+		uint32_t from;
+		uint32_t to;
+		uint32_t fromVersion;
+		uint32_t toVersion;
+
+		/// <summary>priority_queueで最小コストが先頭に来るように逆にする</summary>
+		bool operator<(const Collapse& rval) const
+		{
+			return cost > rval.cost;
+		}
+	};
+
+	XMFLOAT3 Sub(const XMFLOAT3& lval, const XMFLOAT3& rval)
+	{
+		return XMFLOAT3(lval.x - rval.x, lval.y - rval.y, lval.z - rval.z);
+	}
+
+	XMFLOAT3 Cross(const XMFLOAT3& lval, const XMFLOAT3& rval)
+	{
+		return XMFLOAT3(lval.y * rval.z - lval.z * rval.y, lval.z * rval.x - lval.x * rval.z, lval.x * rval.y - lval.y * rval.x);
+	}
+
+	float Dot(const XMFLOAT3& lval, const XMFLOAT3& rval)
+	{
+		return lval.x * rval.x + lval.y * rval.y + lval.z * rval.z;
+	}
+
+	float Length(const XMFLOAT3& v)
+	{
+		return sqrtf(Dot(v, v));
+	}
+
+	/// <summary>スキニングで影響を受けるボーンの組（順不同、影響度が0のボーンは除く）</summary>
+	uint32_t SkinKey(const PMDVertex& v)
+	{
+		auto b0 = v.boneNo[0];
+		auto b1 = v.boneNo[1];
+		if (v.boneWeight >= 100) {
+			b1 = b0;
+		}
+		else if (v.boneWeight == 0) {
+			b0 = b1;
+		}
+		if (b0 > b1) {
+			swap(b0, b1);
+		}
+		return (static_cast<uint32_t>(b0) << 16) | b1;
+	}
+
+	/// <summary>
+	/// 辺の縮約による簡略化
+	/// 三角形は縮約で消えるまで元の並び（マテリアルの範囲）の位置に留まる
+	/// </summary>
+	class Simplifier
+	{
+	private:
+		vector<XMFLOAT3> _positions;
+		vector<uint32_t> _skinKeys;
+		vector<bool> _locked;
+		vector<bool> _vertexAlive;
+		vector<uint32_t> _versions;
+		vector<Quadric> _quadrics;
+		vector<float> _bounds;				// この頂点に寄せられた元の頂点までの最大距離
+		vector<vector<uint32_t>> _merged;	// この頂点に寄せられた元の頂点
+		vector<vector<uint32_t>> _vertexTriangles;
+
+		vector<uint16_t> _triangles;		// 三角形ごとの3頂点
+		vector<uint32_t> _triangleMaterials;
+		vector<bool> _triangleAlive;
+		size_t _aliveTriangleNum = 0;
+		float _maxBound = 0.0f;
+		double _boundWeight = 0.0;			// 距離の2乗に掛ける重み（三角形の平均面積）
+
+		priority_queue<Collapse> _queue;
+
+		bool HasVertex(uint32_t tri, uint32_t v) const
+		{
+			return _triangles[tri * 3] == v || _triangles[tri * 3 + 1] == v || _triangles[tri * 3 + 2] == v;
+		}
+
+		XMFLOAT3 TriangleNormal(const uint16_t* tri) const
+		{
+			auto& p0 = _positions[tri[0]];
+			return Cross(Sub(_positions[tri[1]], p0), Sub(_positions[tri[2]], p0));
+		}
+
+		/// <summary>vがaとbの両方を含む三角形以外にも使われているか</summary>
+		bool HasOtherTriangle(uint32_t v, uint32_t a, uint32_t b) const
+		{
+			for (auto t : _vertexTriangles[v]) {
+				if (_triangleAlive[t] && !(HasVertex(t, a) && HasVertex(t, b))) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/// <summary>頂点の生きている三角形だけを残す</summary>
+		void CompactVertexTriangles(uint32_t v)
+		{
+			auto& tris = _vertexTriangles[v];
+			tris.erase(remove_if(tris.begin(), tris.end(), [this](uint32_t t) { return !_triangleAlive[t]; }), tris.end());
+		}
+
+		void PushCollapse(uint32_t from, uint32_t to)
+		{
+			if (_locked[from] || _skinKeys[from] != _skinKeys[to]) {
+				return;
+			}
+			auto q = _quadrics[from];
+			q += _quadrics[to];
+			Collapse c;
+			// 元の頂点からの距離も抑える（平坦な所で遠くまで寄せて誤差の上限が大きくなるのを防ぐ）
+			double bound = max(_bounds[to], _bounds[from] + Length(Sub(_positions[from], _positions[to])));
+			c.cost = max(q.Evaluate(_positions[to]), 0.0) + _boundWeight * bound * bound;
+			c.from = from;
+			c.to = to;
+			c.fromVersion = _versions[from];
+			c.toVersion = _versions[to];
+			_queue.push(c);
+		}
+
+		/// <summary>vを含む辺の縮約候補をすべて積む</summary>
+		void PushVertexCollapses(uint32_t v)
+		{
+			for (auto t : _vertexTriangles[v]) {
+				for (size_t k = 0; k < 3; ++k) {
+					auto n = _triangles[t * 3 + k];
+					if (n != v) {
+						PushCollapse(v, n);
+						PushCollapse(n, v);
+					}
+				}
+			}
+		}
+
+		/// <summary>縮約しても面が裏返ったり、頂点の周りがすべて消えたりしないか</summary>
+		bool CanCollapse(uint32_t from, uint32_t to) const
+		{
+			size_t remain = 0;
+			for (auto t : _vertexTriangles[from]) {
+				if (!_triangleAlive[t]) {
+					continue;
+				}
+				if (HasVertex(t, to)) {
+					// 消える三角形の残りの頂点が、どの三角形にも使われなくなってはいけない
+					for (size_t k = 0; k < 3; ++k) {
+						auto v = _triangles[t * 3 + k];
+						if (v != from && v != to && !HasOtherTriangle(v, from, to)) {
+							return false;
+						}
+					}
+					continue;
+				}
+				uint16_t tri[3];
+				for (size_t k = 0; k < 3; ++k) {
+					auto v = _triangles[t * 3 + k];
+					tri[k] = static_cast<uint16_t>(v == from ? to : v);
+				}
+				auto before = TriangleNormal(&_triangles[t * 3]);
+				auto after = TriangleNormal(tri);
+				// 向きが大きく変わるもの（裏返りを含む）は不可
+				if (Dot(before, after) <= 0.2f * Length(before) * Length(after)) {
+					return false;
+				}
+				++remain;
+			}
+			for (auto t : _vertexTriangles[to]) {
+				if (_triangleAlive[t] && !HasVertex(t, from)) {
+					++remain;
+				}
+			}
+			// 閉じた小さな部品が丸ごと消えてしまわないように
+			return remain > 0;
+		}
+
+		void DoCollapse(uint32_t from, uint32_t to)
+		{
+			for (auto t : _vertexTriangles[from]) {
+				if (!_triangleAlive[t]) {
+					continue;
+				}
+				if (HasVertex(t, to)) {
+					_triangleAlive[t] = false;
+					--_aliveTriangleNum;
+					continue;
+				}
+				for (size_t k = 0; k < 3; ++k) {
+					if (_triangles[t * 3 + k] == from) {
+						_triangles[t * 3 + k] = static_cast<uint16_t>(to);
+					}
+				}
+				_vertexTriangles[to].push_back(t);
+			}
+			_vertexTriangles[from].clear();
+			CompactVertexTriangles(to);
+
+			_quadrics[to] += _quadrics[from];
+			// 頂点は動かさずに寄せるだけなので、元の頂点から残った頂点までの距離がそのまま表面までの距離の上限になる
+			auto& merged = _merged[to];
+			merged.push_back(from);
+			merged.insert(merged.end(), _merged[from].begin(), _merged[from].end());
+			for (auto v : _merged[from]) {
+				_bounds[to] = max(_bounds[to], Length(Sub(_positions[v], _positions[to])));
+			}
+			_bounds[to] = max(_bounds[to], Length(Sub(_positions[from], _positions[to])));
+			_maxBound = max(_maxBound, _bounds[to]);
+			_merged[from].clear();
+			_merged[from].shrink_to_fit();
+			_vertexAlive[from] = false;
+			++_versions[to];
+			PushVertexCollapses(to);
+		}
+
+	public:
+		Simplifier(const PMDView<PMDVertex>& vertices, const PMDView<uint16_t>& indices, const vector<uint32_t>& materialIndexNums)
+		{
+			auto vertexNum = vertices.size();
+			_positions.resize(vertexNum);
+			_skinKeys.resize(vertexNum);
+			for (size_t i = 0; i < vertexNum; ++i) {
+				auto v = vertices[i];
+				_positions[i] = v.pos;
+				_skinKeys[i] = SkinKey(v);
+			}
+			_locked.assign(vertexNum, false);
+			_vertexAlive.assign(vertexNum, true);
+			_versions.assign(vertexNum, 0);
+			_quadrics.resize(vertexNum);
+			_bounds.assign(vertexNum, 0.0f);
+			_merged.resize(vertexNum);
+			_vertexTriangles.resize(vertexNum);
+
+			// 三角形とマテリアルの対応
+			size_t triNum = 0;
+			for (auto rangeNum : materialIndexNums) {
+				triNum += rangeNum / 3;
+			}
+			_triangles.resize(triNum * 3);
+			_triangleMaterials.resize(triNum);
+			_triangleAlive.assign(triNum, true);
+			vector<uint32_t> vertexMaterials(vertexNum, no_material);
+			size_t rangeBegin = 0;
+			size_t tri = 0;
+			for (uint32_t m = 0; m < materialIndexNums.size(); ++m) {
+				for (size_t i = 0; i + 3 <= materialIndexNums[m]; i += 3, ++tri) {
+					for (size_t k = 0; k < 3; ++k) {
+						auto v = indices[rangeBegin + i + k];
+						_triangles[tri * 3 + k] = v;
+						auto& vm = vertexMaterials[v];
+						vm = vm == no_material || vm == m ? m : multi_material;
+					}
+					_triangleMaterials[tri] = m;
+				}
+				rangeBegin += materialIndexNums[m];
+			}
+			for (size_t v = 0; v < vertexNum; ++v) {
+				// マテリアルの境界
+				if (vertexMaterials[v] == multi_material) {
+					_locked[v] = true;
+				}
+			}
+
+			// 三角形ごとの平面を頂点に足し込む（面積で重み付け）
+			for (uint32_t t = 0; t < triNum; ++t) {
+				auto i0 = _triangles[t * 3], i1 = _triangles[t * 3 + 1], i2 = _triangles[t * 3 + 2];
+				if (i0 == i1 || i1 == i2 || i2 == i0) {
+					// 元から潰れている三角形は使わない
+					_triangleAlive[t] = false;
+					continue;
+				}
+				auto normal = TriangleNormal(&_triangles[t * 3]);
+				auto len = Length(normal);
+				if (len > 0.0f) {
+					double a = normal.x / len, b = normal.y / len, c = normal.z / len;
+					double d = -(a * _positions[i0].x + b * _positions[i0].y + c * _positions[i0].z);
+					for (size_t k = 0; k < 3; ++k) {
+						_quadrics[_triangles[t * 3 + k]].AddPlane(a, b, c, d, len * 0.5);
+					}
+				}
+				for (size_t k = 0; k < 3; ++k) {
+					_vertexTriangles[_triangles[t * 3 + k]].push_back(t);
+				}
+				_boundWeight += len * 0.5;
+				++_aliveTriangleNum;
+			}
+			_boundWeight = _aliveTriangleNum > 0 ? _boundWeight / _aliveTriangleNum : 0.0;
+
+			// 開いた縁と、3枚以上で共有される辺
+			unordered_map<uint32_t, uint32_t> edgeCounts;
+			edgeCounts.reserve(_aliveTriangleNum * 3);
+			for (uint32_t t = 0; t < triNum; ++t) {
+				if (!_triangleAlive[t]) {
+					continue;
+				}
+				for (size_t k = 0; k < 3; ++k) {
+					uint32_t a = _triangles[t * 3 + k], b = _triangles[t * 3 + (k + 1) % 3];
+					++edgeCounts[(min(a, b) << 16) | max(a, b)];
+				}
+			}
+			for (auto& edge : edgeCounts) {
+				if (edge.second != 2) {
+					_locked[edge.first >> 16] = true;
+					_locked[edge.first & 0xffff] = true;
+				}
+			}
+
+			// 同じ座標に別の頂点がある（UVや法線の継ぎ目）
+			vector<uint32_t> sorted(vertexNum);
+			for (uint32_t i = 0; i < vertexNum; ++i) {
+				sorted[i] = i;
+			}
+			auto comparePos = [this](uint32_t lval, uint32_t rval) {
+				return memcmp(&_positions[lval], &_positions[rval], sizeof(XMFLOAT3));
+			};
+			sort(sorted.begin(), sorted.end(), [&comparePos](uint32_t lval, uint32_t rval) { return comparePos(lval, rval) < 0; });
+			for (size_t i = 1; i < vertexNum; ++i) {
+				if (comparePos(sorted[i - 1], sorted[i]) == 0) {
+					_locked[sorted[i - 1]] = true;
+					_locked[sorted[i]] = true;
+				}
+			}
+
+			for (uint32_t v = 0; v < vertexNum; ++v) {
+				for (auto t : _vertexTriangles[v]) {
+					for (size_t k = 0; k < 3; ++k) {
+						auto n = _triangles[t * 3 + k];
+						if (n != v) {
+							PushCollapse(v, n);
+						}
+					}
+				}
+			}
+		}
+
+		size_t AliveTriangleNum() const
+		{
+			return _aliveTriangleNum;
+		}
+
+		/// <summary>三角形数が目標以下になるか、縮約できるものが無くなるまで縮約する</summary>
+		void Simplify(size_t targetTriangleNum)
+		{
+			while (_aliveTriangleNum > targetTriangleNum && !_queue.empty()) {
+				auto c = _queue.top();
+				_queue.pop();
+				if (!_vertexAlive[c.from] || !_vertexAlive[c.to] ||
+					_versions[c.from] != c.fromVersion || _versions[c.to] != c.toVersion) {
+					// 古い候補
+					continue;
+				}
+				if (!CanCollapse(c.from, c.to)) {
+					continue;
+				}
+				DoCollapse(c.from, c.to);
+			}
+		}
+
+		/// <summary>現在の状態をLODとして書き出す</summary>
+		void Snapshot(size_t materialNum, size_t vertexNum, MeshLOD& lod) const
+		{
+			lod.indices.clear();
+			lod.materialIndexNums.assign(materialNum, 0);
+			// 三角形はマテリアル順に並んでいるので、そのまま生きているものを拾えばよい
+			for (size_t t = 0; t < _triangleAlive.size(); ++t) {
+				if (_triangleAlive[t]) {
+					lod.indices.insert(lod.indices.end(), &_triangles[t * 3], &_triangles[t * 3] + 3);
+					lod.materialIndexNums[_triangleMaterials[t]] += 3;
+				}
+			}
+			lod.triangleNum = lod.indices.size() / 3;
+			lod.error = _maxBound;
+			OptimizeVertexCache(lod.indices, lod.materialIndexNums, vertexNum);
+		}
+	};
+}
+
+const std::vector<float>& DefaultLODTriangleRatios()
+{
+	static const vector<float> ratios = { 0.5f, 0.25f, 0.125f };
+	return ratios;
+}
+
+bool GenerateMeshLODs(const PMDView<PMDVertex>& vertices, const PMDView<uint16_t>& indices,
+	const vector<uint32_t>& materialIndexNums, const vector<float>& triangleRatios, MeshLODSet& lodSet)
+{
+	lodSet = MeshLODSet();
+	size_t materialIndexTotal = 0;
+	for (auto rangeNum : materialIndexNums) {
+		materialIndexTotal += rangeNum;
+	}
+	if (materialIndexTotal > indices.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < indices.size(); ++i) {
+		if (indices[i] >= vertices.size()) {
+			return false;
+		}
+	}
+
+	// バウンディングスフィア（AABBの中心から最も遠い頂点まで）
+	if (!vertices.empty()) {
+		auto minPos = vertices[0].pos;
+		auto maxPos = minPos;
+		for (size_t i = 1; i < vertices.size(); ++i) {
+			auto p = vertices[i].pos;
+			minPos = XMFLOAT3(min(minPos.x, p.x), min(minPos.y, p.y), min(minPos.z, p.z));
+			maxPos = XMFLOAT3(max(maxPos.x, p.x), max(maxPos.y, p.y), max(maxPos.z, p.z));
+		}
+		lodSet.center = XMFLOAT3((minPos.x + maxPos.x) * 0.5f, (minPos.y + maxPos.y) * 0.5f, (minPos.z + maxPos.z) * 0.5f);
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			lodSet.radius = max(lodSet.radius, Length(Sub(vertices[i].pos, lodSet.center)));
+		}
+	}
+
+	Simplifier simplifier(vertices, indices, materialIndexNums);
+	lodSet.triangleNum = simplifier.AliveTriangleNum();
+	auto prevTriangleNum = lodSet.triangleNum;
+	for (auto ratio : triangleRatios) {
+		simplifier.Simplify(static_cast<size_t>(lodSet.triangleNum * ratio));
+		if (simplifier.AliveTriangleNum() >= prevTriangleNum) {
+			// これ以上減らせない
+			break;
+		}
+		prevTriangleNum = simplifier.AliveTriangleNum();
+		lodSet.lods.emplace_back();
+		simplifier.Snapshot(materialIndexNums.size(), vertices.size(), lodSet.lods.back());
+	}
+	return true;
+}
+
+size_t SelectMeshLOD(const MeshLODSet& lodSet, float distance, float projectionScale, float pixelError)
+{
+	// バウンディングスフィアの手前側までの距離で見積もる（近づきすぎた場合は元のメッシュ）
+	auto nearDistance = distance - lodSet.radius;
+	if (nearDistance <= 0.0f) {
+		return 0;
+	}
+	for (auto i = lodSet.lods.size(); i > 0; --i) {
+		if (lodSet.lods[i - 1].error * projectionScale / nearDistance <= pixelError) {
+			return i;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "PMDModelData.h"
+
+/// <summary>
+/// 簡略化したメッシュ1段分
+/// 頂点は元のメッシュと共通で、インデックスのみを持つ
+/// </summary>
+struct MeshLOD {
+	/// <summary>インデックス（マテリアルの範囲ごとに描画順に連結）</summary>
+	std::vector<uint16_t> indices;
+	/// <summary>マテリアルごとのインデックス数（元のメッシュとマテリアル数は同じ）</summary>
+	std::vector<uint32_t> materialIndexNums;
+	/// <summary>三角形数</summary>
+	size_t triangleNum = 0;
+	/// <summary>
+	/// 幾何誤差（モデル空間の距離）
+	/// 元のすべての頂点は、このLODの表面からこの距離以内にある
+	/// </summary>
+	float error = 0.0f;
+};
+
+/// <summary>メッシュのLOD一式</summary>
+struct MeshLODSet {
+	/// <summary>バウンディングスフィア（LOD選択時の距離計算用）</summary>
+	DirectX::XMFLOAT3 center = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float radius = 0.0f;
+	/// <summary>元の三角形数</summary>
+	size_t triangleNum = 0;
+	/// <summary>簡略化したメッシュ（詳細な順、元のメッシュは含まない）</summary>
+	std::vector<MeshLOD> lods;
+};
+
+/// <summary>各LODの目標三角形数（元に対する割合）の既定値</summary>
+const std::vector<float>& DefaultLODTriangleRatios();
+
+/// <summary>
+/// QEM（Quadric Error Metrics）による辺の縮約でLODを作る
+/// 次の頂点は動かさない（ひび割れや見た目の破綻を防ぐ）
+/// ・複数のマテリアルで使われている頂点（マテリアルの境界）
+/// ・同じ座標に別の頂点がある（UVなどの継ぎ目）
+/// ・開いた縁や、3枚以上の三角形が共有する辺の頂点
+/// また、ボーンの組み合わせが異なる頂点同士は縮約しない（スキニングの継ぎ目）
+/// </summary>
+/// <param name="vertices">頂点</param>
+/// <param name="indices">インデックス</param>
+/// <param name="materialIndexNums">マテリアルごとのインデックス数（描画順）</param>
+/// <param name="triangleRatios">各LODの目標三角形数（元に対する割合、大きい順）</param>
+/// <param name="lodSet">結果（目標まで減らせなかった場合、前のLODから減らなかったものは含めない）</param>
+/// <returns>インデックスが頂点数を超えているなど、簡略化できない場合はfalse</returns>
+bool GenerateMeshLODs(const PMDView<PMDVertex>& vertices, const PMDView<uint16_t>& indices,
+	const std::vector<uint32_t>& materialIndexNums, const std::vector<float>& triangleRatios, MeshLODSet& lodSet);
+
+/// <summary>
+/// 画面上の誤差が許容値以下になる最も粗いLODを選ぶ
+/// </summary>
+/// <param name="lodSet">LOD一式</param>
+/// <param name="distance">視点からモデルまでの距離</param>
+/// <param name="projectionScale">距離1の位置で長さ1が何ピクセルになるか</param>
+/// <param name="pixelError">許容する画面上の誤差（ピクセル）</param>
+/// <returns>0は元のメッシュ、nはlods[n - 1]</returns>
+size_t SelectMeshLOD(const MeshLODSet& lodSet, float distance, float projectionScale, float pixelError);
@@ -0,0 +1,128 @@
+﻿#include "ModelLoader.h"
+#include "Dx12Wrapper.h"
+#include "ThreadPool.h"
+#include <chrono>
+using namespace std;
+
+namespace
+{
+	using Clock = chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start, Clock::time_point end)
+	{
+		return chrono::duration<double, milli>(end - start).count();
+	}
+}
+
+/// <summary>読み込み1件分の状態（ワーカー間で共有する）</summary>
+struct ModelLoader::LoadRequest {
+	shared_ptr<LoadedModel> result;
+	ModelLoadProgress progress;
+	promise<shared_ptr<LoadedModel>> resultPromise;
+	Clock::time_point requestTime;
+
+	void Report(ModelLoadPhase phase, size_t done, size_t total)
+	{
+		if (progress) {
+			progress(result->path, phase, done, total);
+		}
+	}
+};
+
+ModelLoader::ModelLoader(Dx12Wrapper& dx12, size_t threadNum) : _dx12(dx12)
+{
+	_pool.reset(new ThreadPool(threadNum));
+}
+
+ModelLoader::~ModelLoader()
+{
+}
+
+ThreadPool& ModelLoader::Pool()
+{
+	return *_pool;
+}
+
+shared_future<shared_ptr<LoadedModel>> ModelLoader::LoadAsync(const string& path, ModelLoadProgress progress)
+{
+	auto request = make_shared<LoadRequest>();
+	request->result = make_shared<LoadedModel>();
+	request->result->path = path;
+	request->progress = progress;
+	request->requestTime = Clock::now();
+	shared_future<shared_ptr<LoadedModel>> ret = request->resultPromise.get_future().share();
+	_pool->Submit([this, request]() { ParseModel(request); });
+	return ret;
+}
+
+void ModelLoader::ParseModel(const shared_ptr<LoadRequest>& request)
+{
+	auto& result = *request->result;
+	auto start = Clock::now();
+	result.timings.queuedMs = ElapsedMs(request->requestTime, start);
+
+	// PMDの解析
+	request->Report(ModelLoadPhase::Parse, 0, 1);
+	result.model = make_shared<PMDModelData>();
+	if (!result.model->LoadWithCache(result.path.c_str())) {
+		Finish(request, false);
+		return;
+	}
+	auto parsed = Clock::now();
+	result.timings.parseMs = ElapsedMs(start, parsed);
+	request->Report(ModelLoadPhase::Parse, 1, 1);
+
+	// テクスチャパスの解決
+	// デコードはメッシュの最適化と並行して始まるよう、ここで要求だけしておく（同じパスは一度だけデコードされる）
+	request->Report(ModelLoadPhase::ResolveTextures, 0, 1);
+	result.textures = result.model->MaterialTextures();
+	for (auto& tex : result.textures) {
+		for (auto texPath : { &tex.texPath, &tex.sphPath, &tex.spaPath, &tex.toonPath }) {
+			if (!texPath->empty() && result.textureHandles.find(*texPath) == result.textureHandles.end()) {
+				result.textureHandles.emplace(*texPath, _dx12.RequestTexture(*texPath));
+			}
+		}
+	}
+	auto resolved = Clock::now();
+	result.timings.resolveMs = ElapsedMs(parsed, resolved);
+	request->Report(ModelLoadPhase::ResolveTextures, 1, 1);
+
+	// メッシュの最適化は別タスクにして、他のモデルの解析を先に進められるようにする
+	_pool->Submit([this, request]() { OptimizeModelMesh(request); });
+}
+
+void ModelLoader::OptimizeModelMesh(const shared_ptr<LoadRequest>& request)
+{
+	auto& result = *request->result;
+	auto start = Clock::now();
+	request->Report(ModelLoadPhase::OptimizeMesh, 0, 1);
+	auto mesh = make_shared<OptimizedMesh>();
+	if (OptimizeMesh(*result.model, *mesh)) {
+		result.mesh = mesh;
+	}
+	result.timings.optimizeMs = ElapsedMs(start, Clock::now());
+	request->Report(ModelLoadPhase::OptimizeMesh, 1, 1);
+
+	if (result.mesh) {
+		// LODは最適化後の頂点を共有するので、同じタスクで続けて作る
+		start = Clock::now();
+		request->Report(ModelLoadPhase::SimplifyMesh, 0, 1);
+		auto lods = make_shared<MeshLODSet>();
+		if (GenerateMeshLODs(mesh->VertexView(), mesh->IndexView(), GetMaterialIndexNums(*result.model),
+			DefaultLODTriangleRatios(), *lods)) {
+			result.lods = lods;
+		}
+		result.timings.simplifyMs = ElapsedMs(start, Clock::now());
+		request->Report(ModelLoadPhase::SimplifyMesh, 1, 1);
+	}
+	Finish(request, true);
+}
+
+void ModelLoader::Finish(const shared_ptr<LoadRequest>& request, bool succeeded)
+{
+	auto& result = *request->result;
+	result.succeeded = succeeded;
+	result.timings.totalMs = ElapsedMs(request->requestTime, Clock::now());
+	request->Report(succeeded ? ModelLoadPhase::Completed : ModelLoadPhase::Failed, 1, 1);
+	request->resultPromise.set_value(request->result);
+}
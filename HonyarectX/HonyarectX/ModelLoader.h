@@ -0,0 +1,93 @@
+﻿#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PMDModelData.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "TextureStreamer.h"
+
+class Dx12Wrapper;
+class ThreadPool;
+
+/// <summary>読み込みの段階</summary>
+enum class ModelLoadPhase {
+	Parse,					// PMDの解析
+	ResolveTextures,		// テクスチャパスの解決
+	OptimizeMesh,			// メッシュの最適化（テクスチャのデコードと並行して行う）
+	SimplifyMesh,			// LODの作成（最適化に続けて行う）
+	Completed,				// 完了
+	Failed,					// 失敗
+};
+
+/// <summary>段階ごとの所要時間（ミリ秒）</summary>
+struct ModelLoadTimings {
+	double queuedMs = 0.0;			// 要求からワーカーが着手するまで
+	double parseMs = 0.0;			// PMDの解析
+	double resolveMs = 0.0;			// テクスチャパスの解決
+	double optimizeMs = 0.0;		// メッシュの最適化
+	double simplifyMs = 0.0;		// LODの作成
+	double uploadMs = 0.0;			// GPUリソース作成（メインスレッドで行う、アクター生成時に記録）
+	double totalMs = 0.0;			// 要求から完了まで（uploadMsを除く）
+};
+
+/// <summary>ワーカースレッドで読み込みを終えたモデル（GPUリソースはまだ作られていない）</summary>
+struct LoadedModel {
+	std::string path;
+	bool succeeded = false;
+	std::shared_ptr<PMDModelData> model;
+	/// <summary>最適化済みのメッシュ（最適化できなかった場合はnullptr）</summary>
+	std::shared_ptr<OptimizedMesh> mesh;
+	/// <summary>最適化済みのメッシュから作ったLOD（meshがnullptrの場合は作らない）</summary>
+	std::shared_ptr<MeshLODSet> lods;
+	/// <summary>マテリアルごとのテクスチャパス</summary>
+	std::vector<PMDMaterialTextures> textures;
+	/// <summary>
+	/// パスからテクスチャの要求を引く（解析後すぐにDx12Wrapperへ要求しておく）
+	/// モデルの読み込みはデコードの完了を待たない
+	/// </summary>
+	std::unordered_map<std::string, TextureHandle> textureHandles;
+	ModelLoadTimings timings;
+};
+
+/// <summary>
+/// 進捗通知（ワーカースレッドから呼ばれる）
+/// done/totalは段階内の進み具合（0/1か1/1）
+/// </summary>
+using ModelLoadProgress = std::function<void(const std::string& path, ModelLoadPhase phase, size_t done, size_t total)>;
+
+/// <summary>
+/// PMDモデルの非同期読み込み
+/// 複数のモデルを並列に読み込む
+/// テクスチャはDx12WrapperのTextureStreamerに要求するだけで、デコードの完了は待たない
+/// </summary>
+class ModelLoader
+{
+private:
+	struct LoadRequest;
+
+	Dx12Wrapper& _dx12;
+	std::unique_ptr<ThreadPool> _pool;
+
+	void ParseModel(const std::shared_ptr<LoadRequest>& request);
+	void OptimizeModelMesh(const std::shared_ptr<LoadRequest>& request);
+	void Finish(const std::shared_ptr<LoadRequest>& request, bool succeeded);
+
+public:
+	/// <param name="threadNum">ワーカースレッド数（0ならハードウェアスレッド数）</param>
+	ModelLoader(Dx12Wrapper& dx12, size_t threadNum = 0);
+	/// <summary>読み込み中のものはすべて完了を待つ</summary>
+	~ModelLoader();
+
+	/// <summary>読み込みを開始し、すぐに戻る</summary>
+	/// <param name="path">PMDファイルパス</param>
+	/// <param name="progress">進捗通知（省略可）</param>
+	std::shared_future<std::shared_ptr<LoadedModel>> LoadAsync(const std::string& path, ModelLoadProgress progress = nullptr);
+
+	/// <summary>ワーカースレッド（姿勢キャッシュのベイクなど、読み込み以外の重い処理にも使う）</summary>
+	ThreadPool& Pool();
+};
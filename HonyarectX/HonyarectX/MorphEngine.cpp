@@ -0,0 +1,319 @@
+﻿#include "MorphEngine.h"
+#include <algorithm>
+#include <DirectXMath.h>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t no_base = 0xffffffff;
+
+	/// <summary>4の倍数に切り上げる（SIMDで4要素ずつ処理するため）</summary>
+	size_t AlignSimd(size_t num)
+	{
+		return (num + 3) & ~static_cast<size_t>(3);
+	}
+
+	XMVECTOR LoadFloat4(const float* p)
+	{
+		return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p));
+	}
+
+	void StoreFloat4(float* p, FXMVECTOR v)
+	{
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(p), v);
+	}
+}
+
+float MorphTrack::Sample(float frame) const
+{
+	if (frames.empty()) {
+		return 0.0f;
+	}
+	auto it = upper_bound(frames.begin(), frames.end(), frame, [](float f, uint32_t key) {
+		return f < static_cast<float>(key);
+		});
+	if (it == frames.begin()) {
+		return weights.front();
+	}
+	if (it == frames.end()) {
+		return weights.back();
+	}
+	auto i = static_cast<size_t>(it - frames.begin());
+	auto t = (frame - frames[i - 1]) / static_cast<float>(frames[i] - frames[i - 1]);
+	return weights[i - 1] + (weights[i] - weights[i - 1]) * t;
+}
+
+bool MorphEngine::Build(const PMDModelData& model, const vector<uint32_t>& vertexToSource)
+{
+	*this = MorphEngine();
+	auto& skins = model.Skins();
+	if (skins.empty() || skins[0].header.type != pmd_skin_base) {
+		return true;
+	}
+
+	// 元の頂点番号からbase内の番号
+	auto sourceNum = model.Vertices().size();
+	auto& base = skins[0].vertices;
+	vector<uint32_t> baseOf(sourceNum, no_base);
+	for (uint32_t i = 0; i < base.size(); ++i) {
+		auto vertIdx = base[i].vertIdx;
+		if (vertIdx >= sourceNum) {
+			return false;
+		}
+		baseOf[vertIdx] = i;
+	}
+
+	// baseの頂点を参照する描画用の頂点をモーフ頂点にする（描画用の頂点番号の昇順）
+	vector<vector<uint32_t>> morphVerticesOf(base.size());
+	for (uint32_t v = 0; v < vertexToSource.size(); ++v) {
+		auto src = vertexToSource[v];
+		if (src >= sourceNum) {
+			*this = MorphEngine();
+			return false;
+		}
+		if (baseOf[src] == no_base) {
+			continue;
+		}
+		morphVerticesOf[baseOf[src]].push_back(static_cast<uint32_t>(_vertices.size()));
+		_vertices.push_back(v);
+		auto pos = model.Vertices()[src].pos;
+		_baseX.push_back(pos.x);
+		_baseY.push_back(pos.y);
+		_baseZ.push_back(pos.z);
+	}
+	auto alignedNum = AlignSimd(_vertices.size());
+	_baseX.resize(alignedNum, 0.0f);
+	_baseY.resize(alignedNum, 0.0f);
+	_baseZ.resize(alignedNum, 0.0f);
+	_posX = _baseX;
+	_posY = _baseY;
+	_posZ = _baseZ;
+	_accX.resize(alignedNum);
+	_accY.resize(alignedNum);
+	_accZ.resize(alignedNum);
+
+	// base以外の表情の移動量を、モーフ頂点ごとに展開する
+	for (size_t s = 1; s < skins.size(); ++s) {
+		auto& skin = skins[s];
+		if (skin.header.type == pmd_skin_base) {
+			continue;
+		}
+		auto morph = static_cast<uint32_t>(_names.size());
+		_names.push_back(model.SkinName(s));
+		_nameTable.emplace(_names.back(), morph);
+		_morphBegin.push_back(static_cast<uint32_t>(_offsetIdx.size()));
+		for (size_t i = 0; i < skin.vertices.size(); ++i) {
+			auto sv = skin.vertices[i];
+			if (sv.vertIdx >= base.size()) {
+				*this = MorphEngine();
+				return false;
+			}
+			for (auto idx : morphVerticesOf[sv.vertIdx]) {
+				_offsetIdx.push_back(idx);
+				_offsetX.push_back(sv.pos.x);
+				_offsetY.push_back(sv.pos.y);
+				_offsetZ.push_back(sv.pos.z);
+			}
+		}
+		// 端数は移動量0で埋める（モーフ頂点0に0を足すだけなので結果は変わらない）
+		auto alignedOffsetNum = AlignSimd(_offsetIdx.size());
+		_offsetIdx.resize(alignedOffsetNum, 0);
+		_offsetX.resize(alignedOffsetNum, 0.0f);
+		_offsetY.resize(alignedOffsetNum, 0.0f);
+		_offsetZ.resize(alignedOffsetNum, 0.0f);
+	}
+	_morphBegin.push_back(static_cast<uint32_t>(_offsetIdx.size()));
+	_weights.assign(_names.size(), 0.0f);
+	_appliedWeights = _weights;
+	return true;
+}
+
+size_t MorphEngine::MorphNum() const
+{
+	return _names.size();
+}
+
+const string& MorphEngine::MorphName(size_t morph) const
+{
+	return _names[morph];
+}
+
+int MorphEngine::FindMorph(const string& name) const
+{
+	auto it = _nameTable.find(name);
+	return it == _nameTable.end() ? -1 : static_cast<int>(it->second);
+}
+
+size_t MorphEngine::MorphVertexNum() const
+{
+	return _vertices.size();
+}
+
+size_t MorphEngine::OffsetNum() const
+{
+	return _offsetIdx.size();
+}
+
+vector<MorphTrack> MorphEngine::CompileTracks(const vector<MorphKeyFrame>& keyframes) const
+{
+	// 表情ごとに分けてフレーム順に並べる（同じフレームは後に書かれたものを使う）
+	vector<vector<const MorphKeyFrame*>> keysOf(_names.size());
+	for (auto& keyframe : keyframes) {
+		auto morph = FindMorph(keyframe.name);
+		if (morph >= 0) {
+			keysOf[morph].push_back(&keyframe);
+		}
+	}
+	vector<MorphTrack> tracks;
+	for (uint32_t m = 0; m < keysOf.size(); ++m) {
+		auto& keys = keysOf[m];
+		if (keys.empty()) {
+			continue;
+		}
+		stable_sort(keys.begin(), keys.end(), [](const MorphKeyFrame* lval, const MorphKeyFrame* rval) {
+			return lval->frameNo < rval->frameNo;
+			});
+		MorphTrack track;
+		track.morph = m;
+		for (auto key : keys) {
+			if (!track.frames.empty() && track.frames.back() == key->frameNo) {
+				track.weights.back() = key->weight;
+				continue;
+			}
+			track.frames.push_back(key->frameNo);
+			track.weights.push_back(key->weight);
+		}
+		tracks.push_back(move(track));
+	}
+	return tracks;
+}
+
+void MorphEngine::SetWeight(size_t morph, float weight)
+{
+	_weights[morph] = weight;
+}
+
+float MorphEngine::GetWeight(size_t morph) const
+{
+	return _weights[morph];
+}
+
+void MorphEngine::ResetWeights()
+{
+	fill(_weights.begin(), _weights.end(), 0.0f);
+}
+
+void MorphEngine::SetWeights(const vector<MorphTrack>& tracks, float frame)
+{
+	for (auto& track : tracks) {
+		_weights[track.morph] = track.Sample(frame);
+	}
+}
+
+bool MorphEngine::Apply()
+{
+	_dirtyRanges.clear();
+	_dirtyFirst.clear();
+	_dirtyVertexNum = 0;
+	if (_weights == _appliedWeights) {
+		return false;
+	}
+	_appliedWeights = _weights;
+
+	// ウェイトが0でない表情の移動量だけを足し込む（積は4要素ずつ、足し先はモーフ頂点の番号で散らす）
+	auto alignedNum = _accX.size();
+	fill(_accX.begin(), _accX.end(), 0.0f);
+	fill(_accY.begin(), _accY.end(), 0.0f);
+	fill(_accZ.begin(), _accZ.end(), 0.0f);
+	_activeMorphNum = 0;
+	for (size_t m = 0; m < _weights.size(); ++m) {
+		auto weight = _weights[m];
+		if (weight == 0.0f) {
+			continue;
+		}
+		++_activeMorphNum;
+		auto w = XMVectorReplicate(weight);
+		for (size_t i = _morphBegin[m]; i < _morphBegin[m + 1]; i += 4) {
+			XMFLOAT4A dx, dy, dz;
+			XMStoreFloat4A(&dx, XMVectorMultiply(LoadFloat4(&_offsetX[i]), w));
+			XMStoreFloat4A(&dy, XMVectorMultiply(LoadFloat4(&_offsetY[i]), w));
+			XMStoreFloat4A(&dz, XMVectorMultiply(LoadFloat4(&_offsetZ[i]), w));
+			auto idx = &_offsetIdx[i];
+			_accX[idx[0]] += dx.x; _accY[idx[0]] += dy.x; _accZ[idx[0]] += dz.x;
+			_accX[idx[1]] += dx.y; _accY[idx[1]] += dy.y; _accZ[idx[1]] += dz.y;
+			_accX[idx[2]] += dx.z; _accY[idx[2]] += dy.z; _accZ[idx[2]] += dz.z;
+			_accX[idx[3]] += dx.w; _accY[idx[3]] += dy.w; _accZ[idx[3]] += dz.w;
+		}
+	}
+
+	// 基準座標に足して、前回から変わった頂点だけを範囲にまとめる
+	auto vertexNum = _vertices.size();
+	for (size_t i = 0; i < alignedNum; i += 4) {
+		auto x = XMVectorAdd(LoadFloat4(&_baseX[i]), LoadFloat4(&_accX[i]));
+		auto y = XMVectorAdd(LoadFloat4(&_baseY[i]), LoadFloat4(&_accY[i]));
+		auto z = XMVectorAdd(LoadFloat4(&_baseZ[i]), LoadFloat4(&_accZ[i]));
+		if (XMVector4Equal(x, LoadFloat4(&_posX[i])) &&
+			XMVector4Equal(y, LoadFloat4(&_posY[i])) &&
+			XMVector4Equal(z, LoadFloat4(&_posZ[i]))) {
+			continue;
+		}
+		XMFLOAT4A nx, ny, nz;
+		XMStoreFloat4A(&nx, x);
+		XMStoreFloat4A(&ny, y);
+		XMStoreFloat4A(&nz, z);
+		const float* newX = &nx.x;
+		const float* newY = &ny.x;
+		const float* newZ = &nz.x;
+		for (size_t k = 0; k < 4 && i + k < vertexNum; ++k) {
+			auto c = i + k;
+			if (newX[k] == _posX[c] && newY[k] == _posY[c] && newZ[k] == _posZ[c]) {
+				continue;
+			}
+			auto v = _vertices[c];
+			if (!_dirtyRanges.empty()) {
+				auto& last = _dirtyRanges.back();
+				if (last.vertex + last.count == v && _dirtyFirst.back() + last.count == c) {
+					++last.count;
+					++_dirtyVertexNum;
+					continue;
+				}
+			}
+			_dirtyRanges.push_back({ v, 1 });
+			_dirtyFirst.push_back(static_cast<uint32_t>(c));
+			++_dirtyVertexNum;
+		}
+		StoreFloat4(&_posX[i], x);
+		StoreFloat4(&_posY[i], y);
+		StoreFloat4(&_posZ[i], z);
+	}
+	return !_dirtyRanges.empty();
+}
+
+const vector<MorphDirtyRange>& MorphEngine::DirtyRanges() const
+{
+	return _dirtyRanges;
+}
+
+size_t MorphEngine::DirtyVertexNum() const
+{
+	return _dirtyVertexNum;
+}
+
+size_t MorphEngine::ActiveMorphNum() const
+{
+	return _activeMorphNum;
+}
+
+void MorphEngine::WritePositions(uint8_t* stream, size_t stride) const
+{
+	for (size_t r = 0; r < _dirtyRanges.size(); ++r) {
+		auto& range = _dirtyRanges[r];
+		auto c = _dirtyFirst[r];
+		auto dst = stream + static_cast<size_t>(range.vertex) * stride;
+		for (uint32_t k = 0; k < range.count; ++k, ++c, dst += stride) {
+			XMFLOAT3 pos(_posX[c], _posY[c], _posZ[c]);
+			memcpy(dst, &pos, sizeof(pos));
+		}
+	}
+}
@@ -0,0 +1,123 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "PMDModelData.h"
+
+/// <summary>VMDの表情キーフレーム（表情名のまま、トラックにする前のもの）</summary>
+struct MorphKeyFrame {
+	std::string name;					// 表情名
+	uint32_t frameNo;					// フレーム番号
+	float weight;						// ウェイト（0.0f～1.0f）
+};
+
+/// <summary>表情1つ分のウェイトの変化（フレーム順、キーフレーム間は線形補間）</summary>
+struct MorphTrack {
+	uint32_t morph = 0;					// 表情番号（MorphEngine内の番号）
+	std::vector<uint32_t> frames;		// フレーム番号（昇順、重複なし）
+	std::vector<float> weights;			// フレームごとのウェイト
+
+	/// <summary>フレームでのウェイト（範囲外は端の値）</summary>
+	float Sample(float frame) const;
+};
+
+/// <summary>表情の適用で書き換えた頂点の範囲（描画用の頂点番号で連続している）</summary>
+struct MorphDirtyRange {
+	uint32_t vertex;					// 先頭の頂点番号
+	uint32_t count;						// 頂点数
+};
+
+/// <summary>
+/// 頂点モーフ（表情）
+/// 表情で動く頂点だけを詰めた番号（以下、モーフ頂点）で、基準座標と出力座標をx/y/z別の配列に持つ
+/// 表情ごとの移動量も、モーフ頂点の番号とx/y/z別の配列に持ち、4要素ずつSIMDで処理する
+/// 毎フレーム、ウェイトが0でない表情だけを足し込み、座標が変わった頂点の範囲を返すので、その範囲だけ転送すればよい
+/// </summary>
+class MorphEngine
+{
+private:
+	/// <summary>モーフ頂点ごとの描画用の頂点番号（昇順）</summary>
+	std::vector<uint32_t> _vertices;
+	/// <summary>モーフ頂点の基準座標（4の倍数に切り上げた長さ）</summary>
+	std::vector<float> _baseX, _baseY, _baseZ;
+	/// <summary>直前に適用した座標</summary>
+	std::vector<float> _posX, _posY, _posZ;
+	/// <summary>足し込み用の作業領域</summary>
+	std::vector<float> _accX, _accY, _accZ;
+
+	/// <summary>表情ごとの移動量の範囲（表情mは_morphBegin[m]～_morphBegin[m + 1]、4の倍数に切り上げてある）</summary>
+	std::vector<uint32_t> _morphBegin;
+	/// <summary>移動量を足し込むモーフ頂点の番号</summary>
+	std::vector<uint32_t> _offsetIdx;
+	/// <summary>移動量</summary>
+	std::vector<float> _offsetX, _offsetY, _offsetZ;
+
+	std::vector<std::string> _names;
+	std::unordered_map<std::string, uint32_t> _nameTable;
+
+	/// <summary>設定されたウェイトと、直前に適用したウェイト</summary>
+	std::vector<float> _weights;
+	std::vector<float> _appliedWeights;
+	size_t _activeMorphNum = 0;
+	std::vector<MorphDirtyRange> _dirtyRanges;
+	/// <summary>範囲ごとの先頭のモーフ頂点の番号（範囲内はモーフ頂点の番号も連続している）</summary>
+	std::vector<uint32_t> _dirtyFirst;
+	size_t _dirtyVertexNum = 0;
+
+public:
+	/// <summary>
+	/// PMDの表情から作る
+	/// 1つの元の頂点が複数の描画用の頂点に複製されている場合（ボーンパレットの分割など）はすべてを動かす
+	/// </summary>
+	/// <param name="model">モデル（baseの無いモデルは表情なしとして扱う）</param>
+	/// <param name="vertexToSource">描画用の頂点番号から元の頂点番号（最適化などで並べ替えていなければ恒等）</param>
+	/// <returns>頂点番号が範囲外などで作れない場合はfalse（表情なしになる）</returns>
+	bool Build(const PMDModelData& model, const std::vector<uint32_t>& vertexToSource);
+
+	/// <summary>表情数（baseは含まない）</summary>
+	size_t MorphNum() const;
+	/// <summary>表情名</summary>
+	const std::string& MorphName(size_t morph) const;
+	/// <summary>表情名から番号を引く（無ければ-1）</summary>
+	int FindMorph(const std::string& name) const;
+	/// <summary>表情で動く描画用の頂点数</summary>
+	size_t MorphVertexNum() const;
+	/// <summary>全表情の移動量の数（表情ごとの4の倍数への切り上げを含む）</summary>
+	size_t OffsetNum() const;
+
+	/// <summary>VMDの表情キーフレームを表情ごとのトラックにする（モデルに無い表情は捨てる）</summary>
+	std::vector<MorphTrack> CompileTracks(const std::vector<MorphKeyFrame>& keyframes) const;
+
+	/// <summary>ウェイトを設定する（適用はApplyで行う）</summary>
+	void SetWeight(size_t morph, float weight);
+	float GetWeight(size_t morph) const;
+	/// <summary>全ウェイトを0にする</summary>
+	void ResetWeights();
+	/// <summary>トラックのフレームでのウェイトを設定する</summary>
+	void SetWeights(const std::vector<MorphTrack>& tracks, float frame);
+
+	/// <summary>
+	/// 設定されたウェイトを適用する
+	/// ウェイトが前回と同じなら何もしない
+	/// </summary>
+	/// <returns>座標が変わった頂点があればtrue（DirtyRangesを転送する）</returns>
+	bool Apply();
+
+	/// <summary>直前のApplyで座標が変わった頂点の範囲（頂点番号の昇順）</summary>
+	const std::vector<MorphDirtyRange>& DirtyRanges() const;
+	/// <summary>直前のApplyで座標が変わった頂点数</summary>
+	size_t DirtyVertexNum() const;
+	/// <summary>直前のApplyでウェイトが0でなかった表情数</summary>
+	size_t ActiveMorphNum() const;
+
+	/// <summary>
+	/// 直前のApplyで座標が変わった頂点の座標を書き込む
+	/// 座標は各頂点の先頭にfloat3で置かれていること（Raw、Packed32、Splitの座標ストリームのいずれも該当）
+	/// </summary>
+	/// <param name="stream">座標のストリームの先頭（頂点0の位置）</param>
+	/// <param name="stride">1頂点あたりのバイト数</param>
+	void WritePositions(uint8_t* stream, size_t stride) const;
+};
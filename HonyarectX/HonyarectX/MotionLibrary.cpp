@@ -0,0 +1,329 @@
+﻿#include "MotionLibrary.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <set>
+
+using namespace std;
+
+namespace
+{
+	/// <summary>読み込みやコンパイルが終わっているか</summary>
+	template<typename T>
+	bool IsReady(const shared_future<T>& future)
+	{
+		return future.wait_for(chrono::seconds(0)) == future_status::ready;
+	}
+
+	size_t IKEnableBytes(const vector<VMDIKEnable>& ikEnableData)
+	{
+		auto bytes = ikEnableData.size() * sizeof(VMDIKEnable);
+		for (auto& ikEnable : ikEnableData) {
+			for (auto& entry : ikEnable.ikEnableTable) {
+				bytes += sizeof(entry) + entry.first.capacity();
+			}
+		}
+		return bytes;
+	}
+}
+
+const MotionIKSwitch* Motion::FindIKSwitch(uint32_t frame) const
+{
+	// いつもの逆から検索
+	auto it = find_if(ikSwitches.rbegin(), ikSwitches.rend(), [frame](const MotionIKSwitch& ikSwitch) {
+		return ikSwitch.frameNo <= frame;
+	});
+	return it != ikSwitches.rend() ? &*it : nullptr;
+}
+
+size_t Motion::MemoryBytes() const
+{
+	auto bytes = sizeof(Motion) + path.capacity() + clip.MemoryBytes();
+	for (auto& track : morphTracks) {
+		bytes += sizeof(track) + track.frames.capacity() * sizeof(uint32_t) + track.weights.capacity() * sizeof(float);
+	}
+	for (auto& ikSwitch : ikSwitches) {
+		bytes += sizeof(ikSwitch) + ikSwitch.disabled.capacity();
+	}
+	for (auto names : { &unmatchedBones, &unmatchedMorphs }) {
+		for (auto& name : *names) {
+			bytes += sizeof(name) + name.capacity();
+		}
+	}
+	return bytes;
+}
+
+bool MotionLibrary::ReadFile(const string& path, FileData& file)
+{
+	VMDData vmd;
+	if (!ParseVMDFile(path.c_str(), vmd)) {
+		return false;
+	}
+	file.boneKeyFrames = move(vmd.boneKeyFrames);
+	file.morphKeyFrames = move(vmd.morphKeyFrames);
+	file.ikEnableData = move(vmd.ikEnableData);
+
+	file.bytes = sizeof(FileData) + IKEnableBytes(file.ikEnableData);
+	for (auto& key : file.boneKeyFrames) {
+		file.bytes += sizeof(key) + key.name.capacity();
+	}
+	for (auto& key : file.morphKeyFrames) {
+		file.bytes += sizeof(key) + key.name.capacity();
+	}
+	return true;
+}
+
+MotionLibrary::CompiledMotion* MotionLibrary::FindMotion(Entry& entry, const MotionSkeleton* skeleton)
+{
+	for (auto& compiled : entry.motions) {
+		if (compiled.skeleton.get() == skeleton) {
+			return &compiled;
+		}
+	}
+	return nullptr;
+}
+
+shared_ptr<Motion> MotionLibrary::Compile(const string& path, const FileData& file, const SkeletonHandle& skeleton,
+	const MorphEngine& morphs)
+{
+	auto motion = make_shared<Motion>();
+	motion->path = path;
+	motion->skeleton = skeleton;
+	// ボーン名の検索はここでだけ行い、再生中はボーン番号だけを使う
+	auto& boneNames = skeleton->boneNames;
+	motion->clip.Compile(file.boneKeyFrames, boneNames);
+	// 見た目が変わらない範囲でキーフレームを減らし、動かないボーンはサンプリングしない
+	motion->clip.Compress(ClipCompressOptions());
+	// 表情ごとのトラックにしておく（モデルに無い表情は捨てる）
+	motion->morphTracks = morphs.CompileTracks(file.morphKeyFrames);
+
+	unordered_map<string, uint32_t> boneTable;
+	for (uint32_t i = 0; i < boneNames.size(); ++i) {
+		boneTable.emplace(boneNames[i], i);
+	}
+	set<string> unmatchedBones;
+	for (auto& key : file.boneKeyFrames) {
+		if (boneTable.find(key.name) == boneTable.end()) {
+			unmatchedBones.insert(key.name);
+		}
+	}
+	// IKのオンオフもボーン番号で引けるようにしておく
+	motion->ikSwitches.resize(file.ikEnableData.size());
+	for (size_t i = 0; i < file.ikEnableData.size(); ++i) {
+		auto& ikEnable = file.ikEnableData[i];
+		auto& ikSwitch = motion->ikSwitches[i];
+		ikSwitch.frameNo = ikEnable.frameNo;
+		ikSwitch.disabled.assign(boneNames.size(), 0);
+		for (auto& entry : ikEnable.ikEnableTable) {
+			auto it = boneTable.find(entry.first);
+			if (it == boneTable.end()) {
+				unmatchedBones.insert(entry.first);
+				continue;
+			}
+			ikSwitch.disabled[it->second] = entry.second ? 0 : 1;
+		}
+	}
+	set<string> unmatchedMorphs;
+	for (auto& key : file.morphKeyFrames) {
+		if (morphs.FindMorph(key.name) < 0) {
+			unmatchedMorphs.insert(key.name);
+		}
+	}
+	motion->unmatchedBones.assign(unmatchedBones.begin(), unmatchedBones.end());
+	motion->unmatchedMorphs.assign(unmatchedMorphs.begin(), unmatchedMorphs.end());
+	return motion;
+}
+
+MotionLibrary& MotionLibrary::Instance()
+{
+	static MotionLibrary instance;
+	return instance;
+}
+
+SkeletonHandle MotionLibrary::BindSkeleton(const vector<string>& boneNames, const MorphEngine& morphs)
+{
+	auto skeleton = make_shared<MotionSkeleton>();
+	skeleton->boneNames = boneNames;
+	skeleton->morphNames.resize(morphs.MorphNum());
+	for (size_t m = 0; m < skeleton->morphNames.size(); ++m) {
+		skeleton->morphNames[m] = morphs.MorphName(m);
+	}
+	// 名前の並びのハッシュ（ボーンと表情の区切りが分かるように数も混ぜる）
+	hash<string> hashName;
+	auto h = boneNames.size() * 0x9e3779b97f4a7c15ull + skeleton->morphNames.size();
+	for (auto names : { &skeleton->boneNames, &skeleton->morphNames }) {
+		for (auto& name : *names) {
+			h ^= hashName(name) + 0x9e3779b9 + (h << 6) + (h >> 2);
+		}
+	}
+	skeleton->hash = static_cast<size_t>(h);
+
+	lock_guard<mutex> lock(_mutex);
+	++_stats.skeletonBinds;
+	auto range = _skeletons.equal_range(skeleton->hash);
+	for (auto it = range.first; it != range.second;) {
+		auto existing = it->second.lock();
+		if (existing == nullptr) {
+			// 使われなくなった骨格
+			it = _skeletons.erase(it);
+			continue;
+		}
+		if (existing->boneNames == skeleton->boneNames && existing->morphNames == skeleton->morphNames) {
+			++_stats.skeletonHits;
+			return existing;
+		}
+		++it;
+	}
+	_skeletons.emplace(skeleton->hash, skeleton);
+	return skeleton;
+}
+
+MotionHandle MotionLibrary::Load(const string& path, const SkeletonHandle& skeleton, const MorphEngine& morphs)
+{
+	assert(skeleton != nullptr && skeleton->morphNames.size() == morphs.MorphNum());
+	auto key = NormalizeTexturePath(path);
+	promise<shared_ptr<const FileData>> filePromise;
+	promise<MotionHandle> motionPromise;
+	shared_future<shared_ptr<const FileData>> file;
+	shared_future<MotionHandle> motion;
+	bool reading = false;
+	bool compiling = false;
+	{
+		lock_guard<mutex> lock(_mutex);
+		auto& entry = _entries[key];
+		if (!entry.file.valid()) {
+			// 最初に求めたスレッドが読み込む
+			entry.file = filePromise.get_future().share();
+			reading = true;
+		}
+		file = entry.file;
+		if (auto compiled = FindMotion(entry, skeleton.get())) {
+			++_stats.hits;
+			motion = compiled->motion;
+		}
+		else {
+			CompiledMotion newCompiled;
+			newCompiled.skeleton = skeleton;
+			newCompiled.motion = motionPromise.get_future().share();
+			entry.motions.push_back(newCompiled);
+			motion = newCompiled.motion;
+			compiling = true;
+		}
+	}
+
+	// 読み込みとコンパイルはロックの外で行う
+	if (reading) {
+		auto newFile = make_shared<FileData>();
+		auto succeeded = ReadFile(path, *newFile);
+		{
+			lock_guard<mutex> lock(_mutex);
+			if (succeeded) {
+				++_stats.loads;
+				_stats.bytes += newFile->bytes;
+			}
+			else {
+				// 次に求められたときに読み込み直せるように取り除く（待っているものにはnullptrを返す）
+				++_stats.failures;
+				_entries.erase(key);
+			}
+		}
+		filePromise.set_value(succeeded ? newFile : nullptr);
+	}
+	if (compiling) {
+		auto data = file.get();
+		if (data == nullptr) {
+			motionPromise.set_value(nullptr);
+			return nullptr;
+		}
+		auto newMotion = Compile(key, *data, skeleton, morphs);
+		{
+			lock_guard<mutex> lock(_mutex);
+			++_stats.compiles;
+			auto it = _entries.find(key);
+			auto compiled = it != _entries.end() ? FindMotion(it->second, skeleton.get()) : nullptr;
+			if (compiled != nullptr) {
+				compiled->bytes = newMotion->MemoryBytes();
+				_stats.bytes += compiled->bytes;
+			}
+		}
+		motionPromise.set_value(newMotion);
+	}
+	return motion.get();
+}
+
+vector<MotionHandle> MotionLibrary::LoadFiles(const vector<string>& paths, const SkeletonHandle& skeleton,
+	const MorphEngine& morphs, ThreadPool* pool)
+{
+	vector<MotionHandle> motions(paths.size());
+	if (pool == nullptr) {
+		for (size_t i = 0; i < paths.size(); ++i) {
+			motions[i] = Load(paths[i], skeleton, morphs);
+		}
+		return motions;
+	}
+	// Loadはどのスレッドから呼んでもよいので、ファイルごとにタスクにする
+	vector<future<void>> tasks;
+	tasks.reserve(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i) {
+		tasks.push_back(pool->Enqueue([&, i]() {
+			motions[i] = Load(paths[i], skeleton, morphs);
+		}));
+	}
+	for (auto& task : tasks) {
+		task.get();
+	}
+	return motions;
+}
+
+size_t MotionLibrary::Purge()
+{
+	lock_guard<mutex> lock(_mutex);
+	size_t purged = 0;
+	for (auto it = _entries.begin(); it != _entries.end();) {
+		auto& entry = it->second;
+		if (!IsReady(entry.file)) {
+			// 読み込み中
+			++it;
+			continue;
+		}
+		auto unused = remove_if(entry.motions.begin(), entry.motions.end(), [this](const CompiledMotion& compiled) {
+			// コンパイル中のものと、ライブラリ以外から参照されているものは残す
+			if (!IsReady(compiled.motion) || compiled.motion.get().use_count() > 1) {
+				return false;
+			}
+			_stats.bytes -= compiled.bytes;
+			return true;
+		});
+		purged += entry.motions.end() - unused;
+		entry.motions.erase(unused, entry.motions.end());
+		if (entry.motions.empty()) {
+			_stats.bytes -= entry.file.get()->bytes;
+			it = _entries.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+	return purged;
+}
+
+MotionLibraryStats MotionLibrary::Stats() const
+{
+	lock_guard<mutex> lock(_mutex);
+	auto stats = _stats;
+	for (auto& skeleton : _skeletons) {
+		stats.skeletonNum += skeleton.second.expired() ? 0 : 1;
+	}
+	for (auto& entry : _entries) {
+		stats.fileNum += IsReady(entry.second.file) ? 1 : 0;
+		for (auto& compiled : entry.second.motions) {
+			if (IsReady(compiled.motion)) {
+				++stats.motionNum;
+				stats.referencedNum += compiled.motion.get().use_count() > 1 ? 1 : 0;
+			}
+		}
+	}
+	return stats;
+}
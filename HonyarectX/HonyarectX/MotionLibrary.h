@@ -0,0 +1,154 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "AnimationClip.h"
+#include "MorphEngine.h"
+#include "VMDParser.h"
+
+class ThreadPool;
+
+/// <summary>
+/// モーションを結び付ける骨格（ボーン名と表情名の並び）
+/// 並びがすべて同じモデル（同じモデルを別に読み込んだものなど）は同じものを共有し、コンパイル済みのモーションも共有する
+/// </summary>
+struct MotionSkeleton {
+	std::vector<std::string> boneNames;		// ボーン番号ごとの名前
+	std::vector<std::string> morphNames;	// 表情番号（MorphEngine内の番号）ごとの名前
+	size_t hash = 0;						// 名前の並びのハッシュ（探すときに使う）
+};
+
+/// <summary>骨格の参照</summary>
+using SkeletonHandle = std::shared_ptr<const MotionSkeleton>;
+
+/// <summary>IKのオンオフの切り替え（ボーン番号で引けるようにしたもの）</summary>
+struct MotionIKSwitch {
+	uint32_t frameNo;						// フレーム番号
+	std::vector<uint8_t> disabled;			// ボーン番号ごと（1ならそのボーンをターゲットとするIKを解かない）
+};
+
+/// <summary>
+/// 読み込んだモーション（骨格に合わせてコンパイルしたもの、作った後は変更しない）
+/// 同じ骨格で同じVMDを再生するアクターはすべて同じものを参照する
+/// 再生中は名前を使わず、ボーン番号と表情番号だけで引く
+/// </summary>
+struct Motion {
+	std::string path;						// 正規化したパス
+	SkeletonHandle skeleton;				// コンパイルした骨格
+	AnimationClip clip;						// ボーンのモーション（ボーン番号で引けるようにコンパイルしたもの）
+	std::vector<MorphTrack> morphTracks;	// 表情のトラック
+	std::vector<MotionIKSwitch> ikSwitches;	// IKのオンオフ（VMDに書かれた順）
+	std::vector<std::string> unmatchedBones;	// 骨格に無いので捨てたボーン名（ボーンのキーフレームとIKのオンオフ、名前順）
+	std::vector<std::string> unmatchedMorphs;	// 骨格に無いので捨てた表情名（名前順）
+
+	/// <summary>フレームで有効なIKのオンオフ（まだ切り替えていなければnullptr、すべてオン）</summary>
+	const MotionIKSwitch* FindIKSwitch(uint32_t frame) const;
+
+	/// <summary>使っているメモリ（おおよそ）</summary>
+	size_t MemoryBytes() const;
+};
+
+/// <summary>モーションの参照（参照がある間は破棄されない）</summary>
+using MotionHandle = std::shared_ptr<const Motion>;
+
+/// <summary>モーションライブラリの集計</summary>
+struct MotionLibraryStats {
+	size_t loads = 0;				// VMDファイルを読み込んだ回数
+	size_t failures = 0;			// 読み込めなかった回数
+	size_t hits = 0;				// 読み込み・コンパイル済みのものを返した回数
+	size_t compiles = 0;			// 骨格に合わせてコンパイルした回数（読み込み済みのVMDを別の骨格で使う場合も含む）
+	size_t skeletonBinds = 0;		// BindSkeletonを呼んだ回数
+	size_t skeletonHits = 0;		// そのうち同じ骨格があったので共有した回数
+	size_t fileNum = 0;				// 保持しているVMDの数
+	size_t skeletonNum = 0;			// 使われている骨格の数
+	size_t motionNum = 0;			// 保持しているコンパイル済みのモーションの数
+	size_t referencedNum = 0;		// そのうちアクターが参照しているもの
+	size_t bytes = 0;				// 保持しているVMDの内容とモーションのサイズ
+};
+
+/// <summary>
+/// プロセス全体で共有するモーションのライブラリ
+/// VMDはパスごとに1回だけ読み込み、骨格ごとに1回だけコンパイルして、同じものを使うアクターで共有する
+/// アクターは参照（MotionHandle）と自分の再生状態だけを持つ
+/// どのスレッドから呼んでもよい（読み込みとコンパイルはロックの外で行い、同じものを同時に求めたら先に始めた方の完了を待つ）
+/// VMDの内容は変わらないものとして扱うので、ファイルを書き換えても読み込み直さない（Purgeで破棄されるまで）
+/// </summary>
+class MotionLibrary
+{
+private:
+	/// <summary>VMDの内容（モデルによらない部分）</summary>
+	struct FileData {
+		std::vector<BoneKeyFrame> boneKeyFrames;
+		std::vector<MorphKeyFrame> morphKeyFrames;
+		std::vector<VMDIKEnable> ikEnableData;
+		size_t bytes = 0;
+	};
+	/// <summary>骨格ごとにコンパイルしたモーション</summary>
+	struct CompiledMotion {
+		SkeletonHandle skeleton;
+		std::shared_future<MotionHandle> motion;	// コンパイル中なら完了を待つ（失敗したらnullptr）
+		size_t bytes = 0;							// コンパイルが終わるまでは0
+	};
+	struct Entry {
+		std::shared_future<std::shared_ptr<const FileData>> file;	// 読み込み中なら完了を待つ（失敗したらnullptr）
+		std::vector<CompiledMotion> motions;
+	};
+
+	mutable std::mutex _mutex;
+	std::unordered_map<std::string, Entry> _entries;
+	/// <summary>骨格（ハッシュごと、アクターとモーションが参照しなくなったら破棄される）</summary>
+	std::unordered_multimap<size_t, std::weak_ptr<const MotionSkeleton>> _skeletons;
+	MotionLibraryStats _stats;
+
+	/// <summary>VMDファイルを読み込む（モーションに使う部分だけを残す）</summary>
+	static bool ReadFile(const std::string& path, FileData& file);
+
+	/// <summary>骨格のモーションを探す（ロックした状態で呼ぶ）</summary>
+	static CompiledMotion* FindMotion(Entry& entry, const MotionSkeleton* skeleton);
+
+	/// <summary>VMDの内容を骨格に合わせてコンパイルする</summary>
+	static std::shared_ptr<Motion> Compile(const std::string& path, const FileData& file, const SkeletonHandle& skeleton,
+		const MorphEngine& morphs);
+
+public:
+	/// <summary>プロセス全体で共有するライブラリ</summary>
+	static MotionLibrary& Instance();
+
+	/// <summary>
+	/// モデルの骨格を得る（同じ並びの骨格があればそれを返す、モデルごとに1回呼んで持っておく）
+	/// </summary>
+	/// <param name="boneNames">モデルのボーン番号ごとの名前</param>
+	/// <param name="morphs">モデルの表情</param>
+	SkeletonHandle BindSkeleton(const std::vector<std::string>& boneNames, const MorphEngine& morphs);
+
+	/// <summary>
+	/// モーションを得る（無ければVMDを読み込み、骨格に合わせてコンパイルする）
+	/// </summary>
+	/// <param name="path">VMDファイルのパス</param>
+	/// <param name="skeleton">BindSkeletonで得た骨格（同じ骨格のアクターはコンパイル済みのものを共有する）</param>
+	/// <param name="morphs">骨格を得たモデルの表情（表情名から番号を引くのに使う）</param>
+	/// <returns>読み込めなければnullptr</returns>
+	MotionHandle Load(const std::string& path, const SkeletonHandle& skeleton, const MorphEngine& morphs);
+
+	/// <summary>
+	/// 複数のモーションを並列に読み込む（結果はpathsと同じ順、読み込めなかったものはnullptr）
+	/// </summary>
+	/// <param name="pool">読み込みとコンパイルを行うスレッド（nullptrなら呼び出したスレッドで順に行う）</param>
+	std::vector<MotionHandle> LoadFiles(const std::vector<std::string>& paths, const SkeletonHandle& skeleton,
+		const MorphEngine& morphs, ThreadPool* pool);
+
+	/// <summary>
+	/// どのアクターからも参照されていないモーションと、モーションが無くなったVMDの内容を破棄する
+	/// （骨格はアクターとモーションが参照しなくなった時点で破棄される）
+	/// </summary>
+	/// <returns>破棄したモーションの数</returns>
+	size_t Purge();
+
+	MotionLibraryStats Stats() const;
+};
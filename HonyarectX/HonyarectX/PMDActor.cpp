@@ -2,8 +2,8 @@
 #include "PMDRenderer.h"
 #include "Dx12Wrapper.h"
 #include <d3dx12.h>
-#include <array>
 #include <algorithm>
+#include <chrono>
 using namespace Microsoft::WRL;
 using namespace std;
 using namespace DirectX;
@@ -12,84 +12,6 @@ using namespace DirectX;
 
 namespace
 {
-	/// <summary>
-	/// テクスチャのパスをセパレータ文字で分離する
-	/// </summary>
-	/// <param name="path">対象のパス文字列</param>
-	/// <param name="splitter">区切り文字</param>
-	/// <returns>分離後の文字列ペア</returns>
-	pair<string, string> SplitFileName(const string& path, const char splitter = '*')
-	{
-		auto idx = path.find(splitter);
-		pair<string, string> ret;
-		ret.first = path.substr(0, idx);
-		ret.second = path.substr(idx + 1, path.length() - idx - 1);
-		return ret;
-	}
-
-	/// <summary>
-	/// ファイル名から拡張子を取得する
-	/// </summary>
-	/// <param name="path">対象のパス文字列</param>
-	/// <returns>拡張子</returns>
-	string GetExtension(const string& path)
-	{
-		auto idx = path.rfind('.');
-		return path.substr(idx + 1, path.length() - idx - 1);
-	}
-
-	/// <summary>
-	/// モデルのパスとテクスチャのパスから合成パスを得る
-	/// </summary>
-	/// <param name="modelPath">アプリケーションから見たpmdモデルのパス</param>
-	/// <param name="texPath">PMDモデルから見たテクスチャのパス</param>
-	/// <returns>アプリケーションから見たテクスチャのパス</returns>
-	string GetTexturePathFromModelAndTexPath(const string& modelPath, const char* texPath)
-	{
-		// ファイルのフォルダ区切りは\と/の二種類が使用される可能性があり
-		// ともかく末尾の\か/を得られればいいので、双方のrfindをとり比較する
-		// int型に代入しているのは見つからなかった場合はrfindがepos(-1→0xffffffff)を返すため
-		int pathIndex1 = static_cast<int>(modelPath.rfind('/'));
-		int pathIndex2 = static_cast<int>(modelPath.rfind('\\'));
-		auto pathIndex = max(pathIndex1, pathIndex2);
-		auto folderPath = modelPath.substr(0, pathIndex + 1);
-		return folderPath + texPath;
-	}
-
-	XMMATRIX LookAtMatrix(const XMVECTOR& lookat, XMFLOAT3& up, XMFLOAT3& right)
-	{
-		// 向かせたい方向（Z軸）
-		XMVECTOR vz = lookat;
-
-		// （向かせたい方向を向かせたときの）仮のY軸ベクトル
-		XMVECTOR vy = XMVector3Normalize(XMLoadFloat3(&up));
-
-		// （向かせたい方向を向かせたときの）X軸
-		//XMVECTOR vx = XMVector3Normalize(XMVector3Cross(vz, vx));
-		XMVECTOR vx = XMVector3Normalize(XMVector3Cross(vy, vz));
-		vy = XMVector3Normalize(XMVector3Cross(vz, vx));
-
-		// LookAtとupが同じ方向を向いてたらright基準で作り直す
-		if (abs(XMVector3Dot(vy, vz).m128_f32[0]) == 1.0f) {
-			// 仮のX方向を定義
-			vx = XMVector3Normalize(XMLoadFloat3(&right));
-			// 向かせたい方向を向かせたときのY軸を計算
-			vy = XMVector3Normalize(XMVector3Cross(vz, vx));
-			// 真のX軸を計算
-			vx = XMVector3Normalize(XMVector3Cross(vy, vz));
-		}
-		XMMATRIX ret = XMMatrixIdentity();
-		ret.r[0] = vx;
-		ret.r[1] = vy;
-		ret.r[2] = vz;
-		return ret;
-	}
-
-	XMMATRIX LookAtMatrix(const XMVECTOR& origin, const XMVECTOR& lookat, XMFLOAT3& up, XMFLOAT3& right)
-	{
-		return XMMatrixTranspose(LookAtMatrix(origin, up, right)) * LookAtMatrix(lookat, up, right);
-	}
-
 	enum class BoneType {
 		Rotation,		// 回転
 		RotAndMove,		// 回転＆移動
@@ -111,541 +33,459 @@ void PMDActor::LookAt(float x, float y, float z)
 	_localMat = LookAtMatrix(lookat, up, right);
 }
 
-void PMDActor::SolveLookAt(const PMDIK& ik)
+void* PMDActor::Transform::operator new(size_t size)
 {
-	// この関数に来た時点でノードはひとつしかなく、チェーンに入っているノード番号はIKのルートノードのものなので、
-	// このルートノードからターゲットに向かうベクトルを考えれば良い
-	auto rootNode = _boneNodeAddressArray[ik.nodeIdxes[0]];
-	auto targetNode = _boneNodeAddressArray[ik.targetIdx];	// ！？
-
-	auto opos1 = XMLoadFloat3(&rootNode->startPos);
-	auto tpos1 = XMLoadFloat3(&targetNode->startPos);
-
-	auto opos2 = XMVector3Transform(opos1, _boneMatrices[ik.nodeIdxes[0]]);
-	auto tpos2 = XMVector3Transform(tpos1, _boneMatrices[ik.boneIdx]);
-
-	auto originVec = XMVectorSubtract(tpos1, opos1);
-	auto targetVec = XMVectorSubtract(tpos2, opos2);
+	return _aligned_malloc(size, 16);
+}
 
-	originVec = XMVector3Normalize(originVec);
-	targetVec = XMVector3Normalize(targetVec);
+PMDActor::PMDActor(const char* filepath, PMDRenderer& renderer) :
+	_renderer(renderer),
+	_dx12(renderer._dx12),
+	_angle(0.0f)
+{
+	_transform.world = XMMatrixIdentity();
+	LoadPMDFile(filepath);
+	CreateVertexAndIndexBuffer();
+	RequestMaterialTextures(_modelData->MaterialTextures());
+	CreateTransformView();
+	CreateMaterialData();
+	CreateMaterialAndTextureView();
+}
 
-	auto up = XMFLOAT3(0, 1, 0);
-	auto right = XMFLOAT3(1, 0, 0);
-	XMMATRIX mat = XMMatrixTranslationFromVector(-opos2) * LookAtMatrix(originVec, targetVec, up, right) * XMMatrixTranslationFromVector(opos2);
+PMDActor::PMDActor(const std::shared_ptr<LoadedModel>& loaded, PMDRenderer& renderer) :
+	_renderer(renderer),
+	_dx12(renderer._dx12),
+	_angle(0.0f)
+{
+	// 解析はModelLoaderで済んでいるので、ここではGPUリソースの作成のみ行う（テクスチャは要求済み）
+	auto start = chrono::high_resolution_clock::now();
+	_transform.world = XMMatrixIdentity();
+	_modelData = loaded->model;
+	_mesh = loaded->mesh;
+	_lods = loaded->lods;
+	ReadModelData();
+	CreateVertexAndIndexBuffer();
+	RequestMaterialTextures(loaded->textures);
+	CreateTransformView();
+	CreateMaterialData();
+	CreateMaterialAndTextureView();
+	_loadTimings = loaded->timings;
+	_loadTimings.uploadMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
 
-	_boneMatrices[ik.nodeIdxes[0]] = mat;
+PMDActor::~PMDActor()
+{
+	for (auto& handle : _acquiredTextures) {
+		_dx12.ReleaseTexture(handle);
+	}
 }
 
-void PMDActor::SolveCosineIK(const PMDIK& ik)
+void PMDActor::LoadVMDFile(const char* filepath, const char* name)
 {
-	vector<XMVECTOR> positions;		// IK構成点を保存
-	array<float, 2> edgeLens;		// IKのそれぞれのボーン間の距離を保存
-
-	// ターゲット（末端ボーンではなく、末端ボーンが近づく目標ボーンの座標を取得）
-	auto& targetNode = _boneNodeAddressArray[ik.boneIdx];
-	auto targetPos = XMVector3Transform(XMLoadFloat3(&targetNode->startPos), _boneMatrices[ik.boneIdx]);
-
-	// IKチェーンが逆順なので、逆に並ぶようにしている
-	// 末端ボーン
-	auto endNode = _boneNodeAddressArray[ik.targetIdx];
-	positions.emplace_back(XMLoadFloat3(&endNode->startPos));
-	// 中間及びルートボーン
-	for (auto& chainBoneIdx : ik.nodeIdxes) {
-		auto boneNode = _boneNodeAddressArray[chainBoneIdx];
-		positions.emplace_back(XMLoadFloat3(&boneNode->startPos));
+	// 同じファイルを同じ骨格で読み込んだアクターがあれば、読み込みもコンパイルもせずにそれを共有する
+	auto& library = MotionLibrary::Instance();
+	if (_motionSkeleton == nullptr) {
+		_motionSkeleton = library.BindSkeleton(_boneNameArray, _morphs);
 	}
-	// ちょっと分かりづらいので逆にしておく
-	reverse(positions.begin(), positions.end());
-
-	// 元の長さを測っておく
-	edgeLens[0] = XMVector3Length(XMVectorSubtract(positions[1], positions[0])).m128_f32[0];
-	edgeLens[1] = XMVector3Length(XMVectorSubtract(positions[2], positions[1])).m128_f32[0];
-
-	// ルートボーン座標変換（逆順になっているため使用するインデックスに注意）
-	positions[0] = XMVector3Transform(positions[0], _boneMatrices[ik.nodeIdxes[1]]);
-	// 真ん中はどうせ自動計算されるので計算しない
-	// 先端ボーン
-	positions[2] = XMVector3Transform(positions[2], _boneMatrices[ik.boneIdx]);		// 本当はik.targetIdxだが・・・！？
-
-	// ルートから先端へのベクトルを作っておく
-	auto linearVec = XMVectorSubtract(positions[2], positions[0]);
-	float a = XMVector3Length(linearVec).m128_f32[0];
-	float b = edgeLens[0];
-	float c = edgeLens[1];
-
-	linearVec = XMVector3Normalize(linearVec);
-
-	// ルートから真ん中への角度計算
-	float theta1 = acosf((a * a + b * b - c * c) / (2 * a * b));
-
-	// 真ん中からターゲットへの角度計算
-	float theta2 = acosf((b * b + c * c - a * a) / (2 * b * c));
-
-	// 「軸」を求める
-	// もし真ん中が「ひざ」であった場合には強制的にX軸とする。
-	XMVECTOR axis;
-	if (find(_kneeIdxes.begin(), _kneeIdxes.end(), ik.nodeIdxes[0]) == _kneeIdxes.end()) {
-		auto vm = XMVector3Normalize(XMVectorSubtract(positions[2], positions[0]));
-		auto vt = XMVector3Normalize(XMVectorSubtract(targetPos, positions[0]));
-		axis = XMVector3Cross(vt, vm);
+	auto motion = library.Load(filepath, _motionSkeleton, _morphs);
+	if (motion == nullptr) {
+		assert(0);
+		return;
 	}
-	else {
-		auto right = XMFLOAT3(1, 0, 0);
-		axis = XMLoadFloat3(&right);
+
+	// 同じ名前のものは置き換える（再生しているレイヤーはそのまま新しいものを再生する）
+	auto& slot = _motions[name];
+	auto previous = slot;
+	slot = motion;
+	if (previous != nullptr && previous != motion) {
+		_blender.ReplaceClip(&previous->clip, &motion->clip);
+		if (_baseMotion == previous.get()) {
+			_baseMotion = motion.get();
+		}
+		// 補間用の姿勢は使えず、置き換えたモーションの姿勢キャッシュも使えない（ベイクし直すにはSetPoseCacheを呼ぶ）
+		_animationLOD.Invalidate();
+		if (_poseCacheMotion == previous.get()) {
+			_poseCacheMotion = motion.get();
+			_poseCache.Reset(_boneMatrices.size(), motion->clip.Duration() + 1, _poseCacheFormat, _poseCacheMaxBytes);
+		}
 	}
 
-	// 注意点・・・IKチェーンは根っこに向かってから数えられるため1が根っこに近い
-	auto mat1 = XMMatrixTranslationFromVector(-positions[0]);
-	mat1 *= XMMatrixRotationAxis(axis, theta1);
-	mat1 *= XMMatrixTranslationFromVector(positions[0]);
-
-	auto mat2 = XMMatrixTranslationFromVector(-positions[1]);
-	mat2 *= XMMatrixRotationAxis(axis, theta2 - XM_PI);
-	mat2 *= XMMatrixTranslationFromVector(positions[1]);
-
-	_boneMatrices[ik.nodeIdxes[1]] *= mat1;
-	_boneMatrices[ik.nodeIdxes[0]] = mat2 * _boneMatrices[ik.nodeIdxes[1]];
-	_boneMatrices[ik.targetIdx] = _boneMatrices[ik.nodeIdxes[0]];//直前の影響を受ける
-	//_boneMatrices[ik.nodeIdxes[1]] = _boneMatrices[ik.boneIdx];
-	//_boneMatrices[ik.nodeIdxes[0]] = _boneMatrices[ik.boneIdx];
-	//_boneMatrices[ik.targetIdx] *= _boneMatrices[ik.boneIdx];
+	if (_blender.LayerClip(0) == nullptr) {
+		// 最初のフレームの姿勢にしておく
+		PlayMotion(name);
+		UpdatePose(CurrentFrame(), _boneMatrices, false);
+	}
 }
 
-constexpr float epsilon = 0.0005f;
-void PMDActor::SolveCCDIK(const PMDIK& ik)
+void PMDActor::PlayAnimation()
 {
-	// ターゲット
-	auto targetBoneNode = _boneNodeAddressArray[ik.boneIdx];
-	auto targetOriginPos = XMLoadFloat3(&targetBoneNode->startPos);
-
-	auto parentMat = _boneMatrices[_boneNodeAddressArray[ik.boneIdx]->ikParentBone];
-	XMVECTOR det;
-	auto invParentMat = XMMatrixInverse(&det, parentMat);
-	auto targetNextPos = XMVector3Transform(targetOriginPos, _boneMatrices[ik.boneIdx] * invParentMat);
-
-	// まずはIKの間にあるボーンの座標を入れておく(逆順注意)
-	std::vector<XMVECTOR> bonePositions;
-	//auto endPos = XMVector3Transform(
-	//	XMLoadFloat3(&_boneNodeAddressArray[ik.targetIdx]->startPos),
-	//	//_boneMatrices[ik.targetIdx]);
-	//	XMMatrixIdentity());
-	// 末端ノード
-	auto endPos = XMLoadFloat3(&_boneNodeAddressArray[ik.targetIdx]->startPos);
-	// 中間ノード（ルートを含む）
-	for (auto& cidx : ik.nodeIdxes) {
-		//bonePositions.emplace_back(XMVector3Transform(XMLoadFloat3(&_boneNodeAddressArray[cidx]->startPos), _boneMatrices[cidx] ));
-		bonePositions.push_back(XMLoadFloat3(&_boneNodeAddressArray[cidx]->startPos));
-	}
+	_startTime = timeGetTime();
+	_blender.Restart(0);
+	_animationLOD.Invalidate();
+}
 
-	vector<XMMATRIX> mats(bonePositions.size());
-	fill(mats.begin(), mats.end(), XMMatrixIdentity());
-	// ちょっとよくわからないが、PMDエディタの6.8°が0.03になっており、これは180で割っただけの値である。
-	// つまりこれをラジアンとして使用するにはXM_PIを乗算しなければならない…と思われる。
-	auto ikLimit = ik.limit * XM_PI;
-	// ikに設定されている試行回数だけ繰り返す
-	for (int c = 0; c < ik.iterations; ++c) {
-		// ターゲットと末端がほぼ一致したら抜ける
-		if (XMVector3Length(XMVectorSubtract(endPos, targetNextPos)).m128_f32[0] <= epsilon) {
-			break;
+UINT PMDActor::CurrentFrame() const
+{
+	auto elapsedTime = timeGetTime() - _startTime;	// 経過時間を測る
+	return static_cast<UINT>(30 * (elapsedTime / 1000.0f));
+}
+
+void PMDActor::MotionUpdate()
+{
+	auto elapsedTime = timeGetTime() - _startTime;	// 経過時間を測る
+	auto frame = 30 * (elapsedTime / 1000.0f);
+
+	// 段階に応じて計算を省く（止めている間や補間している間は表情も更新しない）
+	// ループはレイヤーごとにクリップの長さで行うので、フレームは再生開始から数え続ける
+	auto evaluated = _animationLOD.Update(frame, UINT32_MAX, [this](uint32_t frameNo, bool solveIK, vector<XMMATRIX>& matrices) {
+		// 1つのクリップをそのまま再生していて、同じフレームを計算済みなら読み出すだけ
+		// （IKまで解いたものなのでIKを省く段階でもそのまま使う）
+		uint32_t clipFrame = 0;
+		auto cacheable = _poseCacheMotion != nullptr && _blender.SingleClip(frameNo, clipFrame) == &_poseCacheMotion->clip;
+		if (cacheable && _poseCache.Contains(clipFrame)) {
+			_poseCache.Load(clipFrame, matrices.data());
+			// 差分更新で書いた行列は上書きされたので、次に計算するときはすべて書き込む
+			_incrementalPose.InvalidateOutput();
+			return;
 		}
-		// それぞれのボーンを遡りながら角度制限に引っ掛からないように曲げていく
-		for (int bidx = 0; bidx < bonePositions.size(); ++bidx) {
-			const auto& pos = bonePositions[bidx];
-
-			// まず現在のノードから末端までと、現在のノードからターゲットまでのベクトルを作る
-			auto vecToEnd = XMVectorSubtract(endPos, pos);
-			auto vecToTarget = XMVectorSubtract(targetNextPos, pos);
-			vecToEnd = XMVector3Normalize(vecToEnd);
-			vecToTarget = XMVector3Normalize(vecToTarget);
-
-			// ほぼ同じベクトルになってしまった場合は外積できないため次のボーンに引き渡す
-			if (XMVector3Length(XMVectorSubtract(vecToEnd, vecToTarget)).m128_f32[0] <= epsilon) {
-				continue;
-			}
-			// 外積計算および角度計算
-			auto cross = XMVector3Normalize(XMVector3Cross(vecToEnd, vecToTarget));
-			float angle = XMVector3AngleBetweenVectors(vecToEnd, vecToTarget).m128_f32[0];
-			angle = min(angle, ikLimit);						// 回転限界補正
-			XMMATRIX rot = XMMatrixRotationAxis(cross, angle);	// 回転行列
-			// posを中心に回転
-			auto mat = XMMatrixTranslationFromVector(-pos) *
-				rot *
-				XMMatrixTranslationFromVector(pos);
-			mats[bidx] *= mat;									// 回転行列を保持しておく（乗算で回転重ね掛けを作っておく）
-			// 対象となる点をすべて回転させる（現在の点から見て末端側を回転）
-			for (auto idx = bidx - 1; idx >= 0; --idx) {		// 自分を回転させる必要はない
-				bonePositions[idx] = XMVector3Transform(bonePositions[idx], mat);
-			}
-			endPos = XMVector3Transform(endPos, mat);
-			// もし正解に近くなってたらループを抜ける
-			if (XMVector3Length(XMVectorSubtract(endPos, targetNextPos)).m128_f32[0] <= epsilon) {
-				break;
-			}
+		UpdatePose(frameNo, matrices, solveIK);
+		if (cacheable && solveIK && _poseCacheMode != PoseCacheMode::None && _poseCache.CanStore(clipFrame)) {
+			_poseCache.Store(clipFrame, matrices.data());
 		}
+	}, _boneMatrices);
+	if (evaluated) {
+		MorphUpdate(static_cast<UINT>(frame));
 	}
-	int idx = 0;
-	for (auto& cidx : ik.nodeIdxes) {
-		_boneMatrices[cidx] = mats[idx];
-		++idx;
-	}
-	auto node = _boneNodeAddressArray[ik.nodeIdxes.back()];
-	RecursiveMatrixMultiply(node, parentMat, true);
 }
 
-float PMDActor::GetYFromXOnBezier(float x, const XMFLOAT2& a, const XMFLOAT2& b, uint8_t n)
+void PMDActor::SelectAnimationLOD()
+{
+	// バウンディングスフィアの画面上の大きさで選ぶ（ワールド行列は回転のみなので中心だけ変換する）
+	auto center = XMVector3Transform(XMLoadFloat3(&_boundCenter), _transform.world);
+	auto distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(center, XMLoadFloat3(&_dx12.Eye()))));
+	_animationLOD.Select(ProjectedPixels(_boundRadius, distance, _dx12.ProjectionScale()));
+}
+
+void PMDActor::UpdatePose(UINT frameNo, vector<XMMATRIX>& boneMatrices, bool solveIK)
+{
+	// モーションデータ更新（レイヤーを重ね、重みが0のレイヤーやマスクで外したボーンはサンプリングしない）
+	_blender.Evaluate(frameNo, _blendBuffers);
+	// 前回と値の変わったボーンの部分木だけつなげ直し、IKは読むボーンが変わったときだけ解き直す
+	_incrementalPose.SetPoses(_blendBuffers.poses.data(), _blendBuffers.animatedBones, _skeleton);
+	_incrementalPose.Update(_skeleton, _ik, IKDisabled(_baseMotion, _blender.LayerFrame(0, frameNo)), solveIK,
+		boneMatrices.data());
+}
+
+void PMDActor::BuildBoneMatrices(const BonePose* poses, const vector<uint32_t>& bones, const Motion* motion, UINT motionFrame,
+	vector<BoneTransform>& transforms, vector<XMMATRIX>& boneMatrices, bool solveIK) const
 {
-	if (a.x == a.y && b.x == b.y)
-		return x;			// 計算不要
+	// 姿勢クリア（していないと前フレームのポーズが重ねがけされてモデルが壊れる）
+	transforms.resize(boneMatrices.size());
+	std::fill(transforms.begin(), transforms.end(), IdentityBoneTransform());
 
-	float t = x;
-	const float k0 = 1 + 3 * a.x - 3 * b.x;		// t^3の係数
-	const float k1 = 3 * b.x - 6 * a.x;			// t^2の係数
-	const float k2 = 3 * a.x;					// tの係数
+	ApplyBonePoses(poses, bones, transforms);
+	// 親から子へ順に親の姿勢をつなげる（親が先に並んでいるので1回のループで済む）
+	_skeleton.LocalToModel(transforms.data());
 
-	// 誤差の範囲内かどうかに使用する定数
-	constexpr float epsilon = 0.0005f;
+	if (solveIK) {
+		IKSolve(motion, motionFrame, transforms.data());
+	}
 
-	for (int i = 0; i < n; ++i) {
-		// f(t)求めます
-		auto ft = k0 * t * t * t + k1 * t * t + k2 * t - x;
-		// もし結果が0に近い（誤差の範囲内）なら打ち切り
-		if (ft <= epsilon && ft >= -epsilon)
-			break;
+	// 行列にするのは最後の1回だけ
+	for (size_t i = 0; i < boneMatrices.size(); ++i) {
+		boneMatrices[i] = BoneTransformToMatrix(transforms[i]);
+	}
+}
 
-		t -= ft / 2;
+void PMDActor::SetPoseCache(PoseCacheMode mode, PoseCacheFormat format, size_t maxBytes, ThreadPool* pool)
+{
+	_poseCacheMode = mode;
+	_poseCacheFormat = format;
+	_poseCacheMaxBytes = maxBytes;
+	// 基本レイヤーで再生しているモーションのフレームごとに保存する
+	_poseCacheMotion = mode != PoseCacheMode::None ? _baseMotion : nullptr;
+	if (_poseCacheMotion == nullptr || _poseCacheMotion->clip.Tracks().empty()) {
+		_poseCacheMotion = nullptr;
+		_poseCache.Clear();
+		return;
+	}
+	auto motion = _poseCacheMotion;
+	_poseCache.Reset(_boneMatrices.size(), motion->clip.Duration() + 1, format, maxBytes);
+	if (mode == PoseCacheMode::Eager) {
+		// 複数のスレッドから呼ばれるので、作業用の姿勢はフレームごとに用意する
+		vector<uint32_t> bones;
+		for (auto& track : motion->clip.Tracks()) {
+			bones.push_back(track.bone);
+		}
+		auto boneNum = _boneMatrices.size();
+		_poseCache.Bake([this, motion, &bones, boneNum](uint32_t frame, vector<XMMATRIX>& matrices) {
+			vector<BonePose> poses(boneNum);
+			vector<BoneTransform> transforms(boneNum);
+			motion->clip.Sample(static_cast<float>(frame), poses.data());
+			BuildBoneMatrices(poses.data(), bones, motion, frame, transforms, matrices, true);
+		}, pool);
 	}
-	// 既に求めたいtは求めているのでyを計算する
-	auto r = 1 - t;
-	return t * t * t + 3 * t * t * r * b.y + 3 * t * r * r * a.y;
 }
 
-void* PMDActor::Transform::operator new(size_t size)
+const PoseCache& PMDActor::GetPoseCache() const
 {
-	return _aligned_malloc(size, 16);
+	return _poseCache;
 }
 
-PMDActor::PMDActor(const char* filepath, PMDRenderer& renderer) :
-	_renderer(renderer),
-	_dx12(renderer._dx12),
-	_angle(0.0f)
+void PMDActor::SetAnimationLODPolicy(const AnimationLODPolicy& policy)
 {
-	_transform.world = XMMatrixIdentity();
-	LoadPMDFile(filepath);
-	CreateTransformView();
-	CreateMaterialData();
-	CreateMaterialAndTextureView();
+	_animationLOD.SetPolicy(policy);
 }
 
-PMDActor::~PMDActor()
+void PMDActor::SetAnimationImportance(float importance)
 {
+	_animationLOD.SetImportance(importance);
 }
 
-void PMDActor::LoadVMDFile(const char* filepath, const char* name)
+const AnimationLOD& PMDActor::GetAnimationLOD() const
 {
-	FILE* fp;
-	fopen_s(&fp, filepath, "rb");
-	if (fp == nullptr) {
-		assert(0);
-		return;
-	}
+	return _animationLOD;
+}
 
-	fseek(fp, 50, SEEK_SET);	// 最初の50バイトは飛ばしてOK
-	UINT keyframeNum = 0;
-	fread(&keyframeNum, sizeof(keyframeNum), 1, fp);
+const IncrementalPose& PMDActor::GetIncrementalPose() const
+{
+	return _incrementalPose;
+}
 
-	struct VMDKeyFrame {
-		char boneName[15];		// ボーン名
-		UINT frameNo;			// フレーム番号
-		XMFLOAT3 location;		// 位置
-		XMFLOAT4 quaternion;	// クォータニオン（回転）
-		UINT8 bezier[64];		// [4][4][4] ベジェ補間パラメータ
-	};
-	vector<VMDKeyFrame> keyframes(keyframeNum);
-	for (auto& keyframe : keyframes) {
-		fread(keyframe.boneName, sizeof(keyframe.boneName), 1, fp);	// ボーン名
-		
-		fread(&keyframe.frameNo,
-			sizeof(keyframe.frameNo)			// フレーム番号
-			+ sizeof(keyframe.location)			// 位置（IKの時に使用予定）
-			+ sizeof(keyframe.quaternion)		// クォータニオン
-			+ sizeof(keyframe.bezier),			// 補間ベジェデータ
-			1, fp);
+size_t PMDActor::AddAnimationLayer(AnimationBlendMode mode, float weight)
+{
+	return _blender.AddLayer(mode, weight);
+}
+
+bool PMDActor::PlayMotion(const char* name, size_t layer, UINT fadeFrames, bool loop)
+{
+	auto it = _motions.find(name);
+	if (it == _motions.end()) {
+		return false;
+	}
+	_blender.Play(layer, &it->second->clip, CurrentFrame(), fadeFrames, loop);
+	if (layer == 0) {
+		_baseMotion = it->second.get();
 	}
+	// 補間用に計算しておいた先のフレームの姿勢は変わる
+	_animationLOD.Invalidate();
+	return true;
+}
 
-#pragma pack(1)
-	// 表情データ（頂点モーフデータ）
-	struct VMDMorph {
-		char name[15];		// 名前（パディングしてしまう）
-		uint32_t frameNo;	// フレーム番号
-		float weight;		// ウェイト（0.0f～1.0f）
-	};
-#pragma pack()
-	uint32_t morphCount = 0;
-	fread(&morphCount, sizeof(morphCount), 1, fp);
-	vector<VMDMorph> morphs(morphCount);
-	fread(morphs.data(), sizeof(VMDMorph), morphCount, fp);
-
-#pragma pack(1)
-	// カメラ
-	struct VMDCamera {
-		uint32_t frameNo;			// フレーム番号
-		float distance;				// 距離
-		XMFLOAT3 pos;				// 座標
-		XMFLOAT3 eulerAngle;		// オイラー角
-		uint8_t interpolation[24];	// 補完
-		uint32_t fov;				// 視界角
-		uint8_t persFlg;			// パースフラグON/OFF
-	};
-#pragma pack()
-	uint32_t vmdCameraCount = 0;
-	fread(&vmdCameraCount, sizeof(vmdCameraCount), 1, fp);
-	vector<VMDCamera> cameraData(vmdCameraCount);
-	fread(cameraData.data(), sizeof(VMDCamera), vmdCameraCount, fp);
-
-	// ライト照明データ
-	struct VMDLight {
-		uint32_t frameNo;	// フレーム番号
-		XMFLOAT3 rgb;		// ライト色
-		XMFLOAT3 vec;		// 光線ベクトル（平行光線）
-	};
-	uint32_t vmdLightCount = 0;
-	fread(&vmdLightCount, sizeof(vmdLightCount), 1, fp);
-	vector<VMDLight> lights(vmdLightCount);
-	fread(lights.data(), sizeof(VMDLight), vmdLightCount, fp);
-
-#pragma pack(1)
-	// セルフ影データ
-	struct VMDSelfShadow {
-		uint32_t frameNo;	// フレーム番号
-		uint8_t mode;		// 影モード（0:影なし、1：モード1、2:モード2）
-		float distance;		// 距離
-	};
-#pragma pack()
-	uint32_t selfShadowCount = 0;
-	fread(&selfShadowCount, sizeof(selfShadowCount), 1, fp);
-	vector<VMDSelfShadow> selfShadowData(selfShadowCount);
-	fread(selfShadowData.data(), sizeof(VMDSelfShadow), selfShadowCount, fp);
-
-	// IKオンオフ切り替わり数
-	uint32_t ikSwitchCount = 0;
-	fread(&ikSwitchCount, sizeof(ikSwitchCount), 1, fp);
-	// IK切り替えのデータ構造は少しだけ特殊で、いくつ切り替えようがそのキーフレームは消費される。
-	// その中で切り替える可能性のあるIKの名前とそのフラグがすべて登録されている状態。
-
-	// ここからは気を遣って読み込む。
-	// キーフレームごとのデータでありIKボーン（名前で検索）ごとにオン、オフフラグを
-	// 持っているというデータであるとして構造体を作っていく。
-	_ikEnableData.resize(ikSwitchCount);
-	for (auto& ikEnable : _ikEnableData) {
-		// キーフレーム情報なのでまずはフレーム番号読み込み
-		fread(&ikEnable.frameNo, sizeof(ikEnable.frameNo), 1, fp);
-		// 次に可視フラグがあるがこれは使用しないので1バイトシークでもOK
-		uint8_t visibleFlg = 0;
-		fread(&visibleFlg, sizeof(visibleFlg), 1, fp);
-		// 対象ボーン数読み込み
-		uint32_t ikBoneCount = 0;
-		fread(&ikBoneCount, sizeof(ikBoneCount), 1, fp);
-		// ループしつつ名前とON/OFF情報を取得
-		for (UINT i = 0; i < ikBoneCount; ++i) {
-			char ikBoneName[20];
-			fread(ikBoneName, _countof(ikBoneName), 1, fp);
-			uint8_t flg = 0;
-			fread(&flg, sizeof(flg), 1, fp);
-			ikEnable.ikEnableTable[ikBoneName] = flg;
-		}
+void PMDActor::StopMotion(size_t layer, UINT fadeFrames)
+{
+	_blender.Stop(layer, CurrentFrame(), fadeFrames);
+	if (layer == 0) {
+		_baseMotion = nullptr;
 	}
+	_animationLOD.Invalidate();
+}
 
-	fclose(fp);
+void PMDActor::SetAnimationLayerWeight(size_t layer, float weight)
+{
+	_blender.SetLayerWeight(layer, weight);
+	_animationLOD.Invalidate();
+}
 
-	// VMDのキーフレームデータから、実際に使用するキーフレームテーブルへ変換
-	for (auto& f : keyframes) {
-		auto q = XMLoadFloat4(&f.quaternion);
-		XMFLOAT2 ip1((float)f.bezier[3] / 127.0f, (float)f.bezier[7] / 127.0f);
-		XMFLOAT2 ip2((float)f.bezier[11] / 127.0f, (float)f.bezier[15] / 127.0f);
-		_motiondata[f.boneName].emplace_back(KeyFrame(f.frameNo, q, f.location, ip1, ip2));
-		_duration = max<UINT>(_duration, f.frameNo);
+bool PMDActor::SetAnimationLayerMask(size_t layer, const char* rootBoneName)
+{
+	vector<float> mask;
+	if (rootBoneName != nullptr) {
+		auto it = _boneNameTable.find(rootBoneName);
+		if (it == _boneNameTable.end()) {
+			return false;
+		}
+		// 起点のボーンと子孫（骨格の並びで連続している）を1にする
+		mask.resize(_boneNameArray.size(), 0.0f);
+		const uint32_t* begin;
+		const uint32_t* end;
+		_skeleton.Subtree(it->second, begin, end);
+		for (auto bone = begin; bone != end; ++bone) {
+			mask[*bone] = 1.0f;
+		}
 	}
+	_blender.SetLayerMask(layer, mask);
+	_animationLOD.Invalidate();
+	return true;
+}
 
-	// モーションデータをキーフレームでソート
-	for (auto& motion : _motiondata) {
-		sort(motion.second.begin(), motion.second.end(),
-			[](const KeyFrame& lval, const KeyFrame& rval) {
-				return lval.frameNo <= rval.frameNo;
-			});
+const AnimationBlender& PMDActor::GetAnimationBlender() const
+{
+	return _blender;
+}
+
+void PMDActor::ApplyBonePoses(const BonePose* poses, const vector<uint32_t>& bones, vector<BoneTransform>& transforms) const
+{
+	for (auto bone : bones) {
+		// 基準点を中心に回して移動する（回転中心は移動量に含める）
+		transforms[bone] = PoseToBoneTransform(poses[bone], _skeleton.RestPosition(bone));
 	}
+}
 
-	for (auto& bonemotion : _motiondata) {
-		auto itBoneNode = _boneNodeTable.find(bonemotion.first);
-		if (itBoneNode == _boneNodeTable.end()) {
-			continue;
-		}
-		auto& node = itBoneNode->second;
-		auto& pos = node.startPos;
-		auto mat = XMMatrixTranslation(-pos.x, -pos.y, -pos.z) *
-			XMMatrixRotationQuaternion(bonemotion.second[0].quaternion) *
-			XMMatrixTranslation(pos.x, pos.y, pos.z);
-		_boneMatrices[node.boneIdx] = mat;
+void PMDActor::MorphUpdate(UINT frameNo)
+{
+	// 表情は基本レイヤーのモーションのものを使う
+	if (_baseMotion == nullptr) {
+		return;
+	}
+	_morphs.SetWeights(_baseMotion->morphTracks, static_cast<float>(_blender.LayerFrame(0, frameNo)));
+	// 頂点バッファはアップロードヒープにあり、前フレームの描画完了を待ってから呼ばれるので直接書き換えてよい
+	if (_morphs.Apply() && _mappedPositions != nullptr) {
+		_morphs.WritePositions(_mappedPositions, _positionStride);
 	}
-	auto ident = XMMatrixIdentity();
-	RecursiveMatrixMultiply(&_boneNodeTable["センター"], ident);
-	copy(_boneMatrices.begin(), _boneMatrices.end(), _mappedMatrices + 1);
 }
 
-void PMDActor::PlayAnimation()
+void PMDActor::IKSolve(const Motion* motion, UINT motionFrame, BoneTransform* transforms) const
 {
-	_startTime = timeGetTime();
+	_ik.Solve(_skeleton, IKDisabled(motion, motionFrame), transforms);
 }
 
-void PMDActor::MotionUpdate()
+const uint8_t* PMDActor::IKDisabled(const Motion* motion, UINT motionFrame) const
 {
-	auto elapsedTime = timeGetTime() - _startTime;	// 経過時間を測る
-	UINT frameNo = static_cast<UINT>(30 * (elapsedTime / 1000.0f));
-	if (frameNo > _duration) {
-		_startTime = timeGetTime();
-		frameNo = 0;
+	// このフレームで有効なIKのオンオフ（ボーン番号で引く）
+	auto ikSwitch = motion != nullptr ? motion->FindIKSwitch(motionFrame) : nullptr;
+	return ikSwitch != nullptr ? ikSwitch->disabled.data() : nullptr;
+}
+
+HRESULT PMDActor::LoadPMDFile(const char* path)
+{
+	// ファイルはメモリマップして解析するだけで、ここではGPUリソースを作らない
+	_modelData = make_shared<PMDModelData>();
+	if (!_modelData->LoadWithCache(path)) {
+		// エラー処理
+		assert(0);
+		return ERROR_FILE_NOT_FOUND;
+	}
+	auto mesh = make_shared<OptimizedMesh>();
+	if (OptimizeMesh(*_modelData, *mesh)) {
+		_mesh = mesh;
+		auto lods = make_shared<MeshLODSet>();
+		if (GenerateMeshLODs(mesh->VertexView(), mesh->IndexView(), GetMaterialIndexNums(*_modelData),
+			DefaultLODTriangleRatios(), *lods)) {
+			_lods = lods;
+		}
 	}
+	return ReadModelData();
+}
 
-	// 行列情報クリア（していないと前フレームのポーズが重ねがけされてモデルが壊れる）
-	auto ident = XMMatrixIdentity();
-	std::fill(_boneMatrices.begin(), _boneMatrices.end(), ident);
+HRESULT PMDActor::ReadModelData()
+{
+	auto& pmdMaterials = _modelData->Materials();
+	_materials.resize(pmdMaterials.size());
 
-	// モーションデータ更新
-	for (auto& bonemotion : _motiondata) {
-		auto itBoneNode = _boneNodeTable.find(bonemotion.first);
-		if (itBoneNode == _boneNodeTable.end()) {
-			continue;
-		}
-		auto& node = itBoneNode->second;
-		// 合致するものを探す
-		auto keyframes = bonemotion.second;
-
-		auto rit = find_if(keyframes.rbegin(), keyframes.rend(), [frameNo](const KeyFrame& keyframe) {
-			return keyframe.frameNo <= frameNo;
-			});
-		if (rit == keyframes.rend()) {
-			// 合致するものがなければ飛ばす
-			continue;
-		}
+	// コピー
+	for (UINT i = 0; i < pmdMaterials.size(); i++) {
+		auto pmdMaterial = pmdMaterials[i];
+		_materials[i].indicesNum = pmdMaterial.indicesNum;
+		_materials[i].material.diffuse = pmdMaterial.diffuse;
+		_materials[i].material.alpha = pmdMaterial.alpha;
+		_materials[i].material.specular = pmdMaterial.specular;
+		_materials[i].material.specularity = pmdMaterial.specularity;
+		_materials[i].material.ambient = pmdMaterial.ambient;
+		_materials[i].additional.toonIdx = pmdMaterial.toonIdx;
+		_materials[i].additional.edgeFlg = pmdMaterial.edgeFlg != 0;
+	}
 
-		XMMATRIX rotation = XMMatrixIdentity();
-		XMVECTOR offset = XMLoadFloat3(&rit->offset);
-		auto it = rit.base();
-		if (it != keyframes.end()) {
-			auto t = static_cast<float>(frameNo - rit->frameNo) / static_cast<float>(it->frameNo - rit->frameNo);
-			t = GetYFromXOnBezier(t, it->p1, it->p2, 12);
-			rotation = XMMatrixRotationQuaternion(XMQuaternionSlerp(rit->quaternion, it->quaternion, t));
-			offset = XMVectorLerp(offset, XMLoadFloat3(&it->offset), t);
+	auto& pmdBones = _modelData->Bones();
+
+	// インデックスと名前の対応関係構築のために後で使う
+	_boneNameArray.resize(pmdBones.size());
+	// 名前からボーン番号を引く表を作る（名前順に並べてあるので常に末尾へ追加できる）
+	auto& boneNameOrder = _modelData->BoneNameOrder();
+	for (size_t i = 0; i < boneNameOrder.size(); ++i) {
+		auto idx = boneNameOrder[i];
+		auto boneName = _modelData->BoneName(idx);
+		_boneNameTable.emplace_hint(_boneNameTable.end(), boneName, idx);
+		_boneNameArray[idx] = boneName;
+	}
+	// 親子関係・基準点・ひざを骨格にまとめる（親が子より前になるように並べる）
+	_skeleton.Build(*_modelData);
+	_ik.Build(*_modelData, _skeleton);
+	_boneMatrices.resize(pmdBones.size());
+	_blender.Reset(pmdBones.size());
+	_incrementalPose.Reset(_skeleton, _ik);
+
+	// バウンディングスフィア（AABBの中心から最も遠い頂点まで）
+	auto& vertices = _modelData->Vertices();
+	if (!vertices.empty()) {
+		auto minPos = vertices[0].pos;
+		auto maxPos = minPos;
+		for (size_t i = 1; i < vertices.size(); ++i) {
+			auto p = vertices[i].pos;
+			minPos = XMFLOAT3(min(minPos.x, p.x), min(minPos.y, p.y), min(minPos.z, p.z));
+			maxPos = XMFLOAT3(max(maxPos.x, p.x), max(maxPos.y, p.y), max(maxPos.z, p.z));
 		}
-		else {
-			rotation = XMMatrixRotationQuaternion(rit->quaternion);
+		auto center = (XMLoadFloat3(&minPos) + XMLoadFloat3(&maxPos)) * 0.5f;
+		XMStoreFloat3(&_boundCenter, center);
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			auto p = vertices[i].pos;
+			_boundRadius = max(_boundRadius, XMVectorGetX(XMVector3Length(XMLoadFloat3(&p) - center)));
 		}
-
-		auto& pos = node.startPos;
-		auto mat = XMMatrixTranslation(-pos.x, -pos.y, -pos.z)	// 原点に戻し
-			* rotation											// 回転
-			* XMMatrixTranslation(pos.x, pos.y, pos.z);			// 元の座標に戻す
-		_boneMatrices[node.boneIdx] = mat * XMMatrixTranslationFromVector(offset);
 	}
-	RecursiveMatrixMultiply(&_boneNodeTable["センター"], ident);
 
-	IKSolve(frameNo);
+	// ボーンをすべて初期化
+	std::fill(_boneMatrices.begin(), _boneMatrices.end(), XMMatrixIdentity());
 
-	copy(_boneMatrices.begin(), _boneMatrices.end(), _mappedMatrices + 1);
+	return S_OK;
 }
 
-void PMDActor::IKSolve(int frameNo)
+HRESULT PMDActor::CreateVertexAndIndexBuffer()
 {
-	// いつもの逆から検索
-	auto it = find_if(_ikEnableData.rbegin(), _ikEnableData.rend(),
-		[frameNo](const VMDIKEnable& ikenable) {
-			return ikenable.frameNo <= static_cast<UINT>(frameNo);
-		});
-
-	// まずはIKのターゲットボーンを動かす
-	for (auto& ik : _ikData) {
-		// IK解決のためのループ
-
-		if (it != _ikEnableData.rend()) {
-			auto ikEnableIt = it->ikEnableTable.find(_boneNameArray[ik.boneIdx]);
-			if (ikEnableIt != it->ikEnableTable.end()) {
-				if (!ikEnableIt->second) {
-					// もしOFFなら打ち切る
-					continue;
-				}
-			}
-		}
-
-		auto childrenNodesCount = ik.nodeIdxes.size();
-
-		switch (childrenNodesCount) {
-		case 0:		// 間のボーン数が0はありえない
-			assert(0);
-			continue;
-		case 1:		// 間のボーン数が1のときはLookAt
-			SolveLookAt(ik);
-			break;
-		case 2:		// 間のボーン数が2のときは余弦定理IK
-			SolveCosineIK(ik);
-			break;
-		default:	// 3以上のときはCCD-IK
-			SolveCCDIK(ik);
-			break;
+	// 最適化済みのメッシュがあればそちらを使う（マテリアルごとのインデックスの範囲は同じ）
+	auto vertices = _mesh ? _mesh->VertexView() : _modelData->Vertices();
+	auto indices = _mesh ? _mesh->IndexView() : _modelData->Indices();
+	if (vertices.empty() || indices.empty()) {
+		// ボーンのみのモデルなど、描画するものが無い
+		return S_OK;
+	}
+
+	// 元のメッシュと各LODを、参照するボーンがパレットに収まるように分割する
+	vector<BonePaletteSource> sources(1);
+	sources[0].indices = indices;
+	sources[0].materialIndexNums = GetMaterialIndexNums(*_modelData);
+	if (_lods) {
+		for (auto& lod : _lods->lods) {
+			BonePaletteSource source;
+			source.indices = PMDView<uint16_t>(reinterpret_cast<const uint8_t*>(lod.indices.data()), lod.indices.size());
+			source.materialIndexNums = lod.materialIndexNums;
+			sources.push_back(source);
 		}
 	}
-}
-
-HRESULT PMDActor::LoadPMDFile(const char* path)
-{
-	// PMDヘッダ構造体
-	struct PMDHeader {
-		float version;			// 例：00 00 80 3F == 1.00
-		char model_name[20];	// モデル名
-		char comment[256];		// モデルコメント
-	};
-	char signature[3];
-	PMDHeader pmdheader = {};
-
-	string strModelPath = path;
+	if (!PartitionBonePalettes(vertices, sources, _modelData->Bones().size(), _renderer.GetBonePaletteSize(), _bonePalettes)) {
+		assert(0);
+		return E_FAIL;
+	}
+	if (_bonePalettes.split) {
+		// ボーン番号をパレット内の番号に書き換えた頂点を使う
+		vertices = _bonePalettes.VertexView();
+	}
 
-	FILE* fp;
-	fopen_s(&fp, strModelPath.c_str(), "rb");
-	if (fp == nullptr) {
-		// エラー処理
+	// 表情は描画用の頂点番号で作る（最適化や分割で並べ替え・複製した頂点を元の頂点番号に戻して対応付ける）
+	vector<uint32_t> vertexToSource(vertices.size());
+	for (uint32_t v = 0; v < vertexToSource.size(); ++v) {
+		auto idx = _bonePalettes.split ? _bonePalettes.vertexRemap[v] : v;
+		vertexToSource[v] = _mesh ? _mesh->vertexRemap[idx] : idx;
+	}
+	if (!_morphs.Build(*_modelData, vertexToSource)) {
+		// 表情が壊れていても描画はできる
 		assert(0);
-		return ERROR_FILE_NOT_FOUND;
 	}
-	fread(signature, sizeof(signature), 1, fp);
-	fread(&pmdheader, sizeof(pmdheader), 1, fp);
-
-	unsigned int vertNum;		// 頂点数
-	fread(&vertNum, sizeof(vertNum), 1, fp);
-
-#pragma pack(1)	// ここから1バイトパッキング（アライメントは発生しない）
-	// PMDマテリアル構造体
-	struct PMDMaterial {
-		XMFLOAT3 diffuse;					// ディフューズ色
-		float alpha;						// ディフューズα
-		float specularity;					// スペキュラの強さ（乗算値）
-		XMFLOAT3 specular;					// スペキュラ色
-		XMFLOAT3 ambient;					// アンビエント色
-		unsigned char toonIdx;				// トゥーン番号
-		unsigned char edgeFlg;				// マテリアル毎の輪郭線フラグ
-		// 1バイトパッキングにしないとここで2バイトのパディングが発生する
-		unsigned int indicesNum;			// このマテリアルが割当たるインデックス数
-		char texFilePath[20];				// テクスチャファイル名
-	};	// 70バイトになる（パディングなしの場合）
-#pragma pack()	// 1バイトパッキング解除
-
-	constexpr size_t pmdvertex_size = 38;						// 頂点1つあたりのサイズ
-	vector<unsigned char> vertices(vertNum * pmdvertex_size);	// バッファの確保
-	fread(vertices.data(), vertices.size(), 1, fp);				// 読み込み
-
-	unsigned int indicesNum;									// インデックス数
-	fread(&indicesNum, sizeof(indicesNum), 1, fp);
+
+	// ストリームは1つのバッファに16バイト境界で並べる
+	auto layout = _renderer.GetVertexLayout();
+	auto format = GetVertexStreamFormat(layout);
+	size_t streamOffsets[vertex_stream_max] = {};
+	size_t vbSize = 0;
+	for (size_t i = 0; i < format.streamNum; ++i) {
+		streamOffsets[i] = vbSize;
+		vbSize = (vbSize + format.strides[i] * vertices.size() + 0xf) & ~0xf;
+	}
+	_vertexMemory.layout = layout;
+	_vertexMemory.sourceBytes = _modelData->Vertices().byteSize();
+	_vertexMemory.convertedBytes = GetVertexBytes(layout, vertices.size());
 
 	auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
-	auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(vertices.size() * sizeof(vertices[0]));
+	auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(vbSize);
 
 	// UPLOAD（確保は可能）
 	auto result = _dx12.Device()->CreateCommittedResource(
@@ -656,20 +496,48 @@ HRESULT PMDActor::LoadPMDFile(const char* path)
 		nullptr,
 		IID_PPV_ARGS(_vb.ReleaseAndGetAddressOf())
 	);
+	if (FAILED(result)) {
+		assert(SUCCEEDED(result));
+		return result;
+	}
 
+	// マップしたファイルから直接変換して書き込む（中間バッファは作らない）
 	unsigned char* vertMap = nullptr;
 	result = _vb->Map(0, nullptr, (void**)&vertMap);
-	copy(vertices.begin(), vertices.end(), vertMap);
-	_vb->Unmap(0, nullptr);
-
-	_vbView.BufferLocation = _vb->GetGPUVirtualAddress();		// バッファの仮想アドレス
-	_vbView.SizeInBytes = static_cast<UINT>(vertices.size());	// 全バイト数
-	_vbView.StrideInBytes = pmdvertex_size;						// 1頂点あたりのバイト数
+	if (FAILED(result)) {
+		assert(SUCCEEDED(result));
+		return result;
+	}
+	uint8_t* streams[vertex_stream_max] = {};
+	for (size_t i = 0; i < format.streamNum; ++i) {
+		streams[i] = vertMap + streamOffsets[i];
+	}
+	ConvertVertices(vertices, layout, streams);
+	if (_morphs.MorphNum() > 0) {
+		// 座標はどの形式でも先頭のストリームの各頂点の先頭にある
+		_mappedPositions = streams[0];
+		_positionStride = format.strides[0];
+	}
+	else {
+		_vb->Unmap(0, nullptr);
+	}
 
-	vector<unsigned short> indices(indicesNum);					// インデックス用バッファ
-	fread(indices.data(), indices.size() * sizeof(indices[0]), 1, fp);
+	_vbViewNum = static_cast<UINT>(format.streamNum);
+	for (size_t i = 0; i < format.streamNum; ++i) {
+		_vbViews[i].BufferLocation = _vb->GetGPUVirtualAddress() + streamOffsets[i];		// バッファの仮想アドレス
+		_vbViews[i].SizeInBytes = static_cast<UINT>(format.strides[i] * vertices.size());	// 全バイト数
+		_vbViews[i].StrideInBytes = format.strides[i];										// 1頂点あたりのバイト数
+	}
 
-	auto resDescBuf = CD3DX12_RESOURCE_DESC::Buffer(indices.size() * sizeof(indices[0]));
+	// 元のメッシュに続けて各LODのインデックスを並べる（頂点は共通）
+	_lodIndexOffsets.clear();
+	size_t indexNum = 0;
+	for (auto& level : _bonePalettes.levels) {
+		_lodIndexOffsets.push_back(static_cast<UINT>(indexNum));
+		indexNum += level.indices.size();
+	}
+	auto ibSize = indexNum * sizeof(uint16_t);
+	auto resDescBuf = CD3DX12_RESOURCE_DESC::Buffer(ibSize);
 
 	// 設定は、バッファのサイズ以外頂点バッファの設定を使いまわしてOKだと思われる
 	result = _dx12.Device()->CreateCommittedResource(
@@ -680,187 +548,143 @@ HRESULT PMDActor::LoadPMDFile(const char* path)
 		nullptr,
 		IID_PPV_ARGS(_ib.ReleaseAndGetAddressOf())
 	);
+	if (FAILED(result)) {
+		assert(SUCCEEDED(result));
+		return result;
+	}
 
 	// 作ったバッファにインデックスデータをコピー
 	unsigned short* mappedIdx = nullptr;
-	_ib->Map(0, nullptr, (void**)&mappedIdx);
-	std::copy(indices.begin(), indices.end(), mappedIdx);
+	result = _ib->Map(0, nullptr, (void**)&mappedIdx);
+	if (FAILED(result)) {
+		assert(SUCCEEDED(result));
+		return result;
+	}
+	for (size_t i = 0; i < _bonePalettes.levels.size(); ++i) {
+		auto& levelIndices = _bonePalettes.levels[i].indices;
+		copy(levelIndices.begin(), levelIndices.end(), mappedIdx + _lodIndexOffsets[i]);
+	}
 	_ib->Unmap(0, nullptr);
 
 	// インデックスバッファビューを作成
 	_ibView.BufferLocation = _ib->GetGPUVirtualAddress();
 	_ibView.Format = DXGI_FORMAT_R16_UINT;
-	_ibView.SizeInBytes = static_cast<UINT>(indices.size() * sizeof(indices[0]));
+	_ibView.SizeInBytes = static_cast<UINT>(ibSize);
 
-	unsigned int materialNum;
-	fread(&materialNum, sizeof(materialNum), 1, fp);
-	_materials.resize(materialNum);
-	_textureResources.resize(materialNum);
-	_sphResources.resize(materialNum);
-	_spaResources.resize(materialNum);
-	_toonResources.resize(materialNum);
-
-	vector<PMDMaterial> pmdMaterials(materialNum);
-	fread(pmdMaterials.data(), pmdMaterials.size() * sizeof(PMDMaterial), 1, fp);
+	return S_OK;
+}
 
-	// コピー
-	for (UINT i = 0; i < pmdMaterials.size(); i++) {
-		_materials[i].indicesNum = pmdMaterials[i].indicesNum;
-		_materials[i].material.diffuse = pmdMaterials[i].diffuse;
-		_materials[i].material.alpha = pmdMaterials[i].alpha;
-		_materials[i].material.specular = pmdMaterials[i].specular;
-		_materials[i].material.specularity = pmdMaterials[i].specularity;
-		_materials[i].material.ambient = pmdMaterials[i].ambient;
+void PMDActor::RequestMaterialTextures(const vector<PMDMaterialTextures>& textures)
+{
+	for (UINT slot = 0; slot < material_texture_num; ++slot) {
+		MaterialTextureResources(slot).assign(textures.size(), nullptr);
 	}
+	_pendingTextures.clear();
+	for (auto& handle : _acquiredTextures) {
+		_dx12.ReleaseTexture(handle);
+	}
+	_acquiredTextures.clear();
 
-	for (UINT i = 0; i < pmdMaterials.size(); i++) {
-		// トゥーンリソースの読み込み
-		string toonFilePath = "toon/";
-		char toonFileName[16];
-		sprintf_s(toonFileName, 16, "toon%02d.bmp", pmdMaterials[i].toonIdx + 1);
-		toonFilePath += toonFileName;
-		_toonResources[i] = _dx12.GetTextureByPath(toonFilePath.c_str());
-
-		_textureResources[i] = nullptr;
-		_sphResources[i] = nullptr;
-		_spaResources[i] = nullptr;
-		if (strlen(pmdMaterials[i].texFilePath) == 0) {
-			continue;
-		}
-
-		string texFileName = pmdMaterials[i].texFilePath;
-		string sphFileName = "";
-		string spaFileName = "";
-		if (count(texFileName.begin(), texFileName.end(), '*') > 0) {
-			// スプリッタがある
-			auto namepair = SplitFileName(texFileName);
-			auto firstExt = GetExtension(namepair.first);
-			if (firstExt == "sph") {
-				texFileName = namepair.second;
-				sphFileName = namepair.first;
-			}
-			else if (firstExt == "spa") {
-				texFileName = namepair.second;
-				spaFileName = namepair.first;
-			}
-			else {
-				texFileName = namepair.first;
-				auto secondExt = GetExtension(namepair.second);
-				if (secondExt == "sph") {
-					sphFileName = namepair.second;
-				}
-				else if (secondExt == "spa") {
-					spaFileName = namepair.second;
-				}
-			}
-		}
-		else {
-			auto ext = GetExtension(texFileName);
-			if (ext == "sph") {
-				sphFileName = pmdMaterials[i].texFilePath;
-				texFileName = "";
+	for (UINT i = 0; i < textures.size(); i++) {
+		auto& tex = textures[i];
+		const string* paths[material_texture_num] = { &tex.texPath, &tex.sphPath, &tex.spaPath, &tex.toonPath };
+		for (UINT slot = 0; slot < material_texture_num; ++slot) {
+			if (paths[slot]->empty()) {
+				continue;
 			}
-			else if (ext == "spa") {
-				spaFileName = pmdMaterials[i].texFilePath;
-				texFileName = "";
+			// 同じパスは一度だけデコードされ、同じハンドルが返る（内容が同じテクスチャも1つを共有する）
+			auto handle = _dx12.AcquireTexture(*paths[slot]);
+			_acquiredTextures.push_back(handle);
+			auto res = _dx12.GetRequestedTexture(handle);
+			if (res != nullptr) {
+				MaterialTextureResources(slot)[i] = res;
 			}
-			else {
-				texFileName = pmdMaterials[i].texFilePath;
+			else if (handle->state != TextureState::Failed) {
+				_pendingTextures.push_back({ handle, i, slot });
 			}
 		}
+		_materials[i].additional.texPath = tex.texPath;
+	}
+}
 
-		if (texFileName != "") {
-			auto texFilePath = GetTexturePathFromModelAndTexPath(strModelPath, texFileName.c_str());
-			_textureResources[i] = _dx12.GetTextureByPath(texFilePath.c_str());
-		}
-		if (sphFileName != "") {
-			auto sphFilePath = GetTexturePathFromModelAndTexPath(strModelPath, sphFileName.c_str());
-			_sphResources[i] = _dx12.GetTextureByPath(sphFilePath.c_str());
-		}
-		if (spaFileName != "") {
-			auto spaFilePath = GetTexturePathFromModelAndTexPath(strModelPath, spaFileName.c_str());
-			_spaResources[i] = _dx12.GetTextureByPath(spaFilePath.c_str());
-		}
+vector<ComPtr<ID3D12Resource>>& PMDActor::MaterialTextureResources(UINT slot)
+{
+	switch (slot) {
+	case 0:
+		return _textureResources;
+	case 1:
+		return _sphResources;
+	case 2:
+		return _spaResources;
+	default:
+		return _toonResources;
 	}
+}
 
-	UINT16 boneNum = 0;
-	fread(&boneNum, sizeof(boneNum), 1, fp);
-#pragma pack(1)
-	// 読み込み用ボーン構造体
-	struct PMDBone {
-		char boneName[20];					// ボーン名
-		UINT16 parentNo;					// 親ボーン番号
-		UINT16 nextNo;						// 先端のボーン番号
-		UINT8 type;							// ボーン種別
-		UINT16 ikBoneNo;					// IKボーン番号
-		XMFLOAT3 pos;						// ボーンの基準点座標
-	};
-#pragma pack()	// 1バイトパッキング解除
-	vector<PMDBone> pmdBones(boneNum);
-	fread(pmdBones.data(), sizeof(PMDBone), boneNum, fp);
-
-	uint16_t ikNum = 0;
-	fread(&ikNum, sizeof(ikNum), 1, fp);
-
-	_ikData.resize(ikNum);
-	for (auto& ik : _ikData) {
-		fread(&ik.boneIdx, sizeof(ik.boneIdx), 1, fp);
-		fread(&ik.targetIdx, sizeof(ik.targetIdx), 1, fp);
-		uint8_t chainLen = 0;
-		fread(&chainLen, sizeof(chainLen), 1, fp);
-		ik.nodeIdxes.resize(chainLen);
-		fread(&ik.iterations, sizeof(ik.iterations), 1, fp);
-		fread(&ik.limit, sizeof(ik.limit), 1, fp);
-		if (chainLen == 0)
-			continue;
-		fread(ik.nodeIdxes.data(), sizeof(ik.nodeIdxes[0]), chainLen, fp);
+ComPtr<ID3D12Resource> PMDActor::FallbackTexture(UINT slot) const
+{
+	// 基本テクスチャとsphは乗算なので白、spaは加算なので黒、トゥーンはグラデーション
+	switch (slot) {
+	case 0:
+	case 1:
+		return _renderer._whiteTex;
+	case 2:
+		return _renderer._blackTex;
+	default:
+		return _renderer._gradTex;
 	}
+}
 
-	fclose(fp);
+const ModelLoadTimings& PMDActor::GetLoadTimings() const
+{
+	return _loadTimings;
+}
 
-	// インデックスと名前の対応関係構築のために後で使う
-	vector<string> boneNames(pmdBones.size());
-	_boneNameArray.resize(pmdBones.size());
-	_boneNodeAddressArray.resize(pmdBones.size());
-	// ボーンノードマップを作る
-	for (int idx = 0; idx < pmdBones.size(); ++idx) {
-		auto& pb = pmdBones[idx];
-		boneNames[idx] = pb.boneName;
-		auto& node = _boneNodeTable[pb.boneName];
-		node.boneIdx = idx;
-		node.startPos = pb.pos;
-		node.boneType = pb.type;
-		node.parentBone = pb.parentNo;
-		node.ikParentBone = pb.ikBoneNo;
-		_boneNameArray[idx] = pb.boneName;
-		_boneNodeAddressArray[idx] = &node;
-
-		string boneName = pb.boneName;
-		if (boneName.find("ひざ") != std::string::npos) {
-			_kneeIdxes.emplace_back(idx);
-		}
-	}
-	// 親子関係を構築する
-	for (auto& pb : pmdBones) {
-		if (pb.parentNo >= pmdBones.size()) {
-			continue;
-		}
-		auto parentName = boneNames[pb.parentNo];
-		_boneNodeTable[parentName].children.emplace_back(&_boneNodeTable[pb.boneName]);
-	}
-	_boneMatrices.resize(pmdBones.size());
+const VertexMemoryStats& PMDActor::GetVertexMemoryStats() const
+{
+	return _vertexMemory;
+}
 
-	// ボーンをすべて初期化
-	std::fill(_boneMatrices.begin(), _boneMatrices.end(), XMMatrixIdentity());
+const MeshOptimizeStats* PMDActor::GetMeshOptimizeStats() const
+{
+	return _mesh ? &_mesh->stats : nullptr;
+}
 
-	return S_OK;
+const MeshLODSet* PMDActor::GetMeshLODSet() const
+{
+	return _lods.get();
+}
+
+void PMDActor::SetLODPixelError(float pixelError)
+{
+	_lodPixelError = pixelError;
+}
+
+size_t PMDActor::GetCurrentLOD() const
+{
+	return _currentLOD;
+}
+
+const BonePaletteMesh& PMDActor::GetBonePalettes() const
+{
+	return _bonePalettes;
+}
+
+const MorphEngine& PMDActor::GetMorphs() const
+{
+	return _morphs;
 }
 
 HRESULT PMDActor::CreateTransformView()
 {
-	// GPUバッファ作成
-	auto buffSize = sizeof(XMMATRIX) * (1 + _boneMatrices.size());
-	buffSize = (buffSize + 0xff) & ~0xFF;
+	// GPUバッファ作成（パレットごとにワールド＋パレットのボーン行列分、256バイト境界に並べる）
+	_paletteOffsets.resize(_bonePalettes.palettes.size());
+	size_t buffSize = 0;
+	for (size_t i = 0; i < _bonePalettes.palettes.size(); ++i) {
+		_paletteOffsets[i] = buffSize;
+		buffSize += (sizeof(XMMATRIX) * (1 + _bonePalettes.palettes[i].size()) + 0xff) & ~0xff;
+	}
+	buffSize = max<size_t>(buffSize, 0x100);
 	auto heapProp = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
 	auto resDesc = CD3DX12_RESOURCE_DESC::Buffer(buffSize);
 
@@ -877,59 +701,41 @@ HRESULT PMDActor::CreateTransformView()
 		return result;
 	}
 
-	// マップとコピー
-	result = _transformBuff->Map(0, nullptr, (void**)&_mappedMatrices);
+	// マップ（行列は描画直前に書き込む）
+	result = _transformBuff->Map(0, nullptr, (void**)&_mappedTransform);
 	if (FAILED(result)) {
 		assert(SUCCEEDED(result));
 		return result;
 	}
-	_mappedMatrices[0] = _transform.world;
-	auto armNode = _boneNodeTable["左腕"];
-	auto& armPos = armNode.startPos;
-	auto armMat = XMMatrixTranslation(-armPos.x, -armPos.y, -armPos.z)
-		* XMMatrixRotationZ(XM_PIDIV2)
-		* XMMatrixTranslation(armPos.x, armPos.y, armPos.z);
-	auto elbowNode = _boneNodeTable["左ひじ"];
-	auto& elbowPos = elbowNode.startPos;
-	auto elbowMat = XMMatrixTranslation(-elbowPos.x, -elbowPos.y, -elbowPos.z)
-		* XMMatrixRotationZ(-XM_PIDIV2)
-		* XMMatrixTranslation(elbowPos.x, elbowPos.y, elbowPos.z);
-	_boneMatrices[armNode.boneIdx] = armMat;
-	_boneMatrices[elbowNode.boneIdx] = elbowMat;
-	auto ident = XMMatrixIdentity();
-	RecursiveMatrixMultiply(&_boneNodeTable["センター"], ident);
-	std::copy(_boneMatrices.begin(), _boneMatrices.end(), _mappedMatrices + 1);
-
-	// ビューの作成
-	D3D12_DESCRIPTOR_HEAP_DESC transformDescHeapDesc = {};
-	transformDescHeapDesc.NumDescriptors = 1;		// とりあえずワールドひとつ
-	transformDescHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	transformDescHeapDesc.NodeMask = 0;
-
-	transformDescHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;	// デスクリプタヒープ種別
-	// 生成
-	result = _dx12.Device()->CreateDescriptorHeap(&transformDescHeapDesc, IID_PPV_ARGS(_transformHeap.ReleaseAndGetAddressOf()));
-	if (FAILED(result)) {
-		assert(SUCCEEDED(result));
-		return result;
+	auto arm = _boneNameTable.find("左腕");
+	if (arm != _boneNameTable.end()) {
+		auto& armPos = _skeleton.RestPosition(arm->second);
+		_boneMatrices[arm->second] = XMMatrixTranslation(-armPos.x, -armPos.y, -armPos.z)
+			* XMMatrixRotationZ(XM_PIDIV2)
+			* XMMatrixTranslation(armPos.x, armPos.y, armPos.z);
 	}
+	auto elbow = _boneNameTable.find("左ひじ");
+	if (elbow != _boneNameTable.end()) {
+		auto& elbowPos = _skeleton.RestPosition(elbow->second);
+		_boneMatrices[elbow->second] = XMMatrixTranslation(-elbowPos.x, -elbowPos.y, -elbowPos.z)
+			* XMMatrixRotationZ(-XM_PIDIV2)
+			* XMMatrixTranslation(elbowPos.x, elbowPos.y, elbowPos.z);
+	}
+	_skeleton.LocalToModel(_boneMatrices.data());
 
-	D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc = {};
-	cbvDesc.BufferLocation = _transformBuff->GetGPUVirtualAddress();
-	cbvDesc.SizeInBytes = static_cast<UINT>(buffSize);
-	_dx12.Device()->CreateConstantBufferView(&cbvDesc, _transformHeap->GetCPUDescriptorHandleForHeapStart());
-
+	// ビューはルートパラメータにパレットのアドレスを直接指定するので作らない
 	return S_OK;
 }
 
-void PMDActor::RecursiveMatrixMultiply(BoneNode* node, const DirectX::XMMATRIX& mat, bool flg)
+void PMDActor::UploadBoneMatrices(size_t level)
 {
-	if (node == nullptr)
-		return;
-
-	_boneMatrices[node->boneIdx] *= mat;
-	for (auto& cnode : node->children) {
-		RecursiveMatrixMultiply(cnode, _boneMatrices[node->boneIdx]);
+	for (auto palette : _bonePalettes.levels[level].palettes) {
+		auto mapped = reinterpret_cast<XMMATRIX*>(_mappedTransform + _paletteOffsets[palette]);
+		mapped[0] = _transform.world;
+		auto& bones = _bonePalettes.palettes[palette];
+		for (size_t i = 0; i < bones.size(); ++i) {
+			mapped[i + 1] = _boneMatrices[bones[i]];
+		}
 	}
 }
 
@@ -991,12 +797,6 @@ HRESULT PMDActor::CreateMaterialAndTextureView()
 	matCBVDesc.BufferLocation = _materialBuff->GetGPUVirtualAddress();				// バッファーアドレス
 	matCBVDesc.SizeInBytes = static_cast<UINT>(materialBuffSize);					// マテリアルの256アライメントサイズ
 
-	// 通常テクスチャビュー作成
-	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;		// 後述
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;							// 2Dテクスチャ
-	srvDesc.Texture2D.MipLevels = 1;												// ミップマップは使用しないので1
-	srvDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;									// デフォルト
 	CD3DX12_CPU_DESCRIPTOR_HANDLE matDescHeapH(_materialHeap->GetCPUDescriptorHandleForHeapStart());	// 先頭を記録
 	auto incSize = _dx12.Device()->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 	for (UINT i = 0; i < _materials.size(); i++) {
@@ -1005,59 +805,102 @@ HRESULT PMDActor::CreateMaterialAndTextureView()
 		matDescHeapH.ptr += incSize;
 		matCBVDesc.BufferLocation += materialBuffSize;
 
-		// シェーダーリソースビュー
-		// テクスチャが空の場合は白テクスチャを使う
-		auto texResource = _textureResources[i] == nullptr ? _renderer._whiteTex : _textureResources[i];
-		srvDesc.Format = texResource->GetDesc().Format;
-		_dx12.Device()->CreateShaderResourceView(texResource.Get(), &srvDesc, matDescHeapH);
-		matDescHeapH.ptr += incSize;
-
-		// スフィア
-		auto sphResource = _sphResources[i] == nullptr ? _renderer._whiteTex : _sphResources[i];
-		srvDesc.Format = sphResource->GetDesc().Format;
-		_dx12.Device()->CreateShaderResourceView(sphResource.Get(), &srvDesc, matDescHeapH);
-		matDescHeapH.ptr += incSize;
+		// シェーダーリソースビュー（基本テクスチャ、sph、spa、toon）
+		// テクスチャが空かデコード中の場合は代わりのテクスチャを使う
+		for (UINT slot = 0; slot < material_texture_num; ++slot) {
+			CreateTextureView(i, slot);
+			matDescHeapH.ptr += incSize;
+		}
+	}
 
-		auto spaResource = _spaResources[i] == nullptr ? _renderer._blackTex : _spaResources[i];
-		srvDesc.Format = spaResource->GetDesc().Format;
-		_dx12.Device()->CreateShaderResourceView(spaResource.Get(), &srvDesc, matDescHeapH);
-		matDescHeapH.ptr += incSize;
+	return S_OK;
+}
 
-		auto toonResource = _toonResources[i] == nullptr ? _renderer._gradTex : _toonResources[i];
-		srvDesc.Format = toonResource->GetDesc().Format;
-		_dx12.Device()->CreateShaderResourceView(toonResource.Get(), &srvDesc, matDescHeapH);
-		matDescHeapH.ptr += incSize;
+void PMDActor::CreateTextureView(UINT material, UINT slot)
+{
+	auto resource = MaterialTextureResources(slot)[material];
+	if (resource == nullptr) {
+		resource = FallbackTexture(slot);
 	}
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;							// 2Dテクスチャ
+	srvDesc.Texture2D.MipLevels = resource->GetDesc().MipLevels;					// クック済みのテクスチャはミップマップを持つ
+	srvDesc.Format = resource->GetDesc().Format;
+	auto incSize = _dx12.Device()->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(_materialHeap->GetCPUDescriptorHandleForHeapStart(),
+		material * (material_texture_num + 1) + 1 + slot, incSize);
+	_dx12.Device()->CreateShaderResourceView(resource.Get(), &srvDesc, handle);
+}
 
-	return S_OK;
+void PMDActor::UpdateTextureBindings()
+{
+	if (_pendingTextures.empty() || _materialHeap == nullptr) {
+		return;
+	}
+	// 前のフレームのGPU処理はEndDrawで完了を待っているので、ここでビューを書き換えてよい
+	auto it = remove_if(_pendingTextures.begin(), _pendingTextures.end(), [this](const PendingTexture& pending) {
+		auto state = pending.handle->state.load();
+		if (state == TextureState::Ready) {
+			MaterialTextureResources(pending.slot)[pending.material] = _dx12.GetRequestedTexture(pending.handle);
+			CreateTextureView(pending.material, pending.slot);
+			return true;
+		}
+		// 失敗したものは代わりのテクスチャのまま
+		return state == TextureState::Failed;
+	});
+	_pendingTextures.erase(it, _pendingTextures.end());
 }
 
 void PMDActor::Update()
 {
 	_angle += 0.001f;
-	_mappedMatrices[0] = XMMatrixRotationY(_angle);
+	_transform.world = XMMatrixRotationY(_angle);
+	UpdateTextureBindings();
+	SelectAnimationLOD();
 	MotionUpdate();
 }
 
 void PMDActor::Draw()
 {
-	_dx12.CommandList()->IASetVertexBuffers(0, 1, &_vbView);
+	if (_bonePalettes.levels.empty()) {
+		// 描画するものが無い
+		return;
+	}
+	_dx12.CommandList()->IASetVertexBuffers(0, _vbViewNum, _vbViews);
 	_dx12.CommandList()->IASetIndexBuffer(&_ibView);
 
-	ID3D12DescriptorHeap* transheaps[] = { _transformHeap.Get() };
-	_dx12.CommandList()->SetDescriptorHeaps(1, transheaps);
-	_dx12.CommandList()->SetGraphicsRootDescriptorTable(1, _transformHeap->GetGPUDescriptorHandleForHeapStart());
-
 	ID3D12DescriptorHeap* mdh[] = { _materialHeap.Get() };
 	_dx12.CommandList()->SetDescriptorHeaps(1, mdh);
 
-	auto materialH = _materialHeap->GetGPUDescriptorHandleForHeapStart();
+	// 視点からの距離で画面上の誤差が許容値に収まる最も粗いLODを選ぶ
+	// （バウンディングスフィアはバインドポーズのもの、ワールド行列は回転のみなので中心だけ変換する）
+	_currentLOD = 0;
+	if (_lodIndexOffsets.size() > 1 && _lodPixelError > 0.0f) {
+		auto center = XMVector3Transform(XMLoadFloat3(&_lods->center), _transform.world);
+		auto distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(center, XMLoadFloat3(&_dx12.Eye()))));
+		_currentLOD = SelectMeshLOD(*_lods, distance, _dx12.ProjectionScale(), _lodPixelError);
+	}
+	UploadBoneMatrices(_currentLOD);
+
+	// バッチごとにパレットとマテリアルを切り替えて描画する（同じものが続く場合は設定し直さない）
+	auto& level = _bonePalettes.levels[_currentLOD];
+	auto transformAddress = _transformBuff->GetGPUVirtualAddress();
+	auto materialHeapStart = _materialHeap->GetGPUDescriptorHandleForHeapStart();
 	auto cbvSrvIncSize = _dx12.Device()->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV) * 5;
-	UINT idxOffset = 0;
-	for (auto& m : _materials) {
-		_dx12.CommandList()->SetGraphicsRootDescriptorTable(2, materialH);
-		_dx12.CommandList()->DrawIndexedInstanced(m.indicesNum, 1, idxOffset, 0, 0);
-		materialH.ptr += cbvSrvIncSize;
-		idxOffset += m.indicesNum;
+	auto palette = UINT32_MAX;
+	auto material = UINT32_MAX;
+	for (auto& batch : level.batches) {
+		if (batch.palette != palette) {
+			palette = batch.palette;
+			_dx12.CommandList()->SetGraphicsRootConstantBufferView(1, transformAddress + _paletteOffsets[palette]);
+		}
+		if (batch.material != material) {
+			material = batch.material;
+			auto materialH = materialHeapStart;
+			materialH.ptr += static_cast<UINT64>(cbvSrvIncSize) * material;
+			_dx12.CommandList()->SetGraphicsRootDescriptorTable(2, materialH);
+		}
+		_dx12.CommandList()->DrawIndexedInstanced(batch.indexNum, 1, _lodIndexOffsets[_currentLOD] + batch.indexOffset, 0, 0);
 	}
 }
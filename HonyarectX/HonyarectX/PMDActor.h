@@ -7,6 +7,20 @@
 #include <unordered_map>
 #include <string>
 #include <wrl.h>
+#include <memory>
+#include "PMDModelData.h"
+#include "ModelLoader.h"
+#include "VertexConverter.h"
+#include "BonePalette.h"
+#include "MorphEngine.h"
+#include "AnimationClip.h"
+#include "AnimationBlender.h"
+#include "PoseCache.h"
+#include "AnimationLOD.h"
+#include "MotionLibrary.h"
+#include "Skeleton.h"
+#include "IKSolver.h"
+#include "IncrementalPose.h"
 
 class Dx12Wrapper;
 class PMDRenderer;
@@ -16,7 +30,6 @@ class PMDActor
 	friend PMDRenderer;
 
 private:
-	UINT _duration = 0;
 	PMDRenderer& _renderer;
 	Dx12Wrapper& _dx12;
 	DirectX::XMMATRIX _localMat;
@@ -26,13 +39,17 @@ private:
 	/// <summary>頂点関連</summary>
 	ComPtr<ID3D12Resource> _vb = nullptr;
 	ComPtr<ID3D12Resource> _ib = nullptr;
-	D3D12_VERTEX_BUFFER_VIEW _vbView = {};
+	/// <summary>頂点ストリームごとのビュー（形式によって1～3個）</summary>
+	D3D12_VERTEX_BUFFER_VIEW _vbViews[vertex_stream_max] = {};
+	UINT _vbViewNum = 0;
+	VertexMemoryStats _vertexMemory;
 	D3D12_INDEX_BUFFER_VIEW _ibView = {};
+	/// <summary>頂点バッファの座標ストリーム（表情がある場合はマップしたままにして、変わった頂点だけ書き換える）</summary>
+	uint8_t* _mappedPositions = nullptr;
+	UINT _positionStride = 0;
 
 	/// <summary>座標変換行列（今はワールドのみ）</summary>
 	ComPtr<ID3D12Resource> _transformMat = nullptr;
-	/// <summary>座標変換ヒープ</summary>
-	ComPtr<ID3D12DescriptorHeap> _transformHeap = nullptr;
 
 	/// <summary>
 	/// シェーダー側に投げられるマテリアルデータ
@@ -69,8 +86,16 @@ private:
 	};
 
 	Transform _transform;
-	DirectX::XMMATRIX* _mappedMatrices = nullptr;
+	/// <summary>
+	/// ワールド＆ボーン行列のバッファ（パレットごとに、ワールド行列に続けてパレットのボーン行列を置く）
+	/// 描画するLODのパレットだけを描画直前に書き込む
+	/// </summary>
+	uint8_t* _mappedTransform = nullptr;
 	ComPtr<ID3D12Resource> _transformBuff = nullptr;
+	/// <summary>パレットごとのバッファ内の開始位置（定数バッファの境界に合わせる）</summary>
+	std::vector<size_t> _paletteOffsets;
+	/// <summary>ボーンパレットで分割した描画単位（元のメッシュと各LOD）</summary>
+	BonePaletteMesh _bonePalettes;
 
 	/// <summary>マテリアル関連</summary>
 	std::vector<Material> _materials;
@@ -79,30 +104,35 @@ private:
 	std::vector<ComPtr<ID3D12Resource>> _sphResources;
 	std::vector<ComPtr<ID3D12Resource>> _spaResources;
 	std::vector<ComPtr<ID3D12Resource>> _toonResources;
+	/// <summary>マテリアルごとのテクスチャの数（デスクリプタは定数バッファに続けて基本テクスチャ、sph、spa、toonの順）</summary>
+	static constexpr UINT material_texture_num = 4;
+	/// <summary>デコードを待っているテクスチャ（それまでは代わりのテクスチャをビューに置いておく）</summary>
+	struct PendingTexture {
+		TextureHandle handle;
+		UINT material;						// マテリアル番号
+		UINT slot;							// 0:基本テクスチャ、1:sph、2:spa、3:toon
+	};
+	std::vector<PendingTexture> _pendingTextures;
+	/// <summary>参照しているテクスチャ（破棄時に参照を返す）</summary>
+	std::vector<TextureHandle> _acquiredTextures;
+	/// <summary>スロットのテクスチャリソース</summary>
+	std::vector<ComPtr<ID3D12Resource>>& MaterialTextureResources(UINT slot);
+	/// <summary>スロットのテクスチャが無い（まだ読み込まれていない）場合に使うテクスチャ</summary>
+	ComPtr<ID3D12Resource> FallbackTexture(UINT slot) const;
 
 	/// <summary>ボーン関連</summary>
 	std::vector<DirectX::XMMATRIX> _boneMatrices;
 
-	struct BoneNode {
-		uint32_t boneIdx;					// ボーンインデックス
-		uint32_t boneType;					// ボーン種別
-		uint32_t parentBone;				// 親ボーン
-		uint32_t ikParentBone;				// IK親ボーン
-		DirectX::XMFLOAT3 startPos;			// ボーン基準点（回転中心）
-		std::vector<BoneNode*> children;	// 子ノード
-	};
-	std::map<std::string, BoneNode> _boneNodeTable;
+	/// <summary>親が子より前になるように並べた骨格（親子関係・基準点・ひざなど）</summary>
+	Skeleton _skeleton;
+	std::map<std::string, uint32_t> _boneNameTable;	// 名前からボーン番号を検索する
 	std::vector<std::string> _boneNameArray;		// インデックスから名前を変作詞安いようにしておく
-	std::vector<BoneNode*> _boneNodeAddressArray;	// インデックスからノードを検索しやすいようにしておく
-
-	struct PMDIK {
-		uint16_t boneIdx;					// IK対象のボーンを示す
-		uint16_t targetIdx;					// ターゲットに近づけるためのボーンのインデックス
-		uint16_t iterations;				// 試行回数
-		float limit;						// 一回あたりの回転制限
-		std::vector<uint16_t> nodeIdxes;	// 間のノード番号
-	};
-	std::vector<PMDIK> _ikData;
+
+	/// <summary>IK（骨格と同じく回転と移動の姿勢で解く）</summary>
+	IKSolver _ik;
+
+	/// <summary>表情（描画用の頂点番号で作る）</summary>
+	MorphEngine _morphs;
 
 	/// <summary>
 	/// 読み込んだマテリアルをもとにマテリアルバッファを作成
@@ -113,67 +143,231 @@ private:
 	ComPtr<ID3D12DescriptorHeap> _materialHeap = nullptr;
 	/// <summary>マテリアル＆テクスチャのビューを作成</summary>
 	HRESULT CreateMaterialAndTextureView();
+	/// <summary>テクスチャのビューを作成（テクスチャが無ければ代わりのテクスチャを使う）</summary>
+	void CreateTextureView(UINT material, UINT slot);
+	/// <summary>デコードを終えたテクスチャのビューを差し替える</summary>
+	void UpdateTextureBindings();
 
-	/// <summary>座標変換用ビューの作成</summary>
+	/// <summary>座標変換用バッファの作成（パレットごとに領域を確保する）</summary>
 	HRESULT CreateTransformView();
 
-	/// <summary>PMDファイルのロード</summary>
+	/// <summary>LODの描画に使うパレットのワールド＆ボーン行列を書き込む</summary>
+	void UploadBoneMatrices(size_t level);
+
+	/// <summary>PMDファイルのデータ（メモリマップしたまま保持する）</summary>
+	std::shared_ptr<PMDModelData> _modelData;
+	/// <summary>最適化済みのメッシュ（最適化できなかった場合はnullptr、PMDの頂点とインデックスをそのまま使う）</summary>
+	std::shared_ptr<OptimizedMesh> _mesh;
+	/// <summary>LOD（作れなかった場合はnullptr）</summary>
+	std::shared_ptr<MeshLODSet> _lods;
+	/// <summary>LODごとのインデックスバッファ内の開始位置（0は元のメッシュ、インデックスはパレットで分割した後のもの）</summary>
+	std::vector<UINT> _lodIndexOffsets;
+	/// <summary>LOD選択で許容する画面上の誤差（ピクセル）</summary>
+	float _lodPixelError = 1.0f;
+	/// <summary>バインドポーズのバウンディングスフィア（アニメーションのLOD選択用、LODを作らなかったモデルでも使う）</summary>
+	DirectX::XMFLOAT3 _boundCenter = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float _boundRadius = 0.0f;
+	/// <summary>直前の描画で使ったLOD（0は元のメッシュ）</summary>
+	size_t _currentLOD = 0;
+	/// <summary>読み込みにかかった時間</summary>
+	ModelLoadTimings _loadTimings;
+
+	/// <summary>PMDファイルのロード（解析のみでGPUリソースは作らない）</summary>
 	HRESULT LoadPMDFile(const char* path);
 
-	void RecursiveMatrixMultiply(BoneNode* node, const DirectX::XMMATRIX& mat, bool flg = false);
+	/// <summary>解析済みのデータからマテリアルとボーンの情報を構築</summary>
+	HRESULT ReadModelData();
+
+	/// <summary>
+	/// 解析済みのデータから頂点＆インデックスバッファを作成（頂点はレンダラーの形式に変換する）
+	/// ボーン数がレンダラーのパレットに収まらない場合は描画をパレットごとに分割する
+	/// インデックスバッファには元のメッシュに続けて各LODのインデックスを並べる
+	/// </summary>
+	HRESULT CreateVertexAndIndexBuffer();
+
+	/// <summary>
+	/// マテリアルが参照するテクスチャを要求し、参照を増やす（デコードは待たない）
+	/// 読み込み済みのものはそのまま使い、それ以外はUpdateTextureBindingsで差し替える
+	/// </summary>
+	void RequestMaterialTextures(const std::vector<PMDMaterialTextures>& textures);
 
 	/// <summary>テスト用Y軸回転</summary>
 	float _angle;
 
-	struct KeyFrame {
-		UINT frameNo;
-		DirectX::XMVECTOR quaternion;
-		DirectX::XMFLOAT3 offset;
-		DirectX::XMFLOAT2 p1;
-		DirectX::XMFLOAT2 p2;
-		KeyFrame(UINT fno, DirectX::XMVECTOR& q, DirectX::XMFLOAT3& ofst, const DirectX::XMFLOAT2& ip1, const DirectX::XMFLOAT2& ip2) :
-			frameNo(fno), quaternion(q), offset(ofst), p1(ip1), p2(ip2)
-		{
-		}
-	};
-	std::unordered_map<std::string, std::vector<KeyFrame>> _motiondata;
+	/// <summary>
+	/// LoadVMDFileで付けた名前ごとのモーション（MotionLibraryで共有しているもの）
+	/// レイヤーが参照するので、ここで参照を持っている間は破棄されない
+	/// </summary>
+	std::map<std::string, MotionHandle> _motions;
+	/// <summary>モーションを結び付ける骨格（最初にモーションを読み込むときに得る、同じ骨格のモデルと共有する）</summary>
+	SkeletonHandle _motionSkeleton;
+	/// <summary>基本レイヤーで再生しているモーション（IKのオンオフと表情はこのモーションのものを使う）</summary>
+	const Motion* _baseMotion = nullptr;
+	/// <summary>姿勢キャッシュを作ったモーション（1つのクリップをそのまま再生している間だけ使う）</summary>
+	const Motion* _poseCacheMotion = nullptr;
 
-	float GetYFromXOnBezier(float x, const DirectX::XMFLOAT2& a, const DirectX::XMFLOAT2& b, uint8_t n = 12);
+	/// <summary>レイヤーに重ねて再生しているクリップ</summary>
+	AnimationBlender _blender;
+	/// <summary>姿勢の評価の作業領域（メインスレッドでの更新用、毎フレーム確保しないように持っておく）</summary>
+	AnimationBlendBuffers _blendBuffers;
 
-	std::vector<uint32_t> _kneeIdxes;
+	/// <summary>サンプリングした姿勢を指定したボーンの回転と移動にする</summary>
+	void ApplyBonePoses(const BonePose* poses, const std::vector<uint32_t>& bones,
+		std::vector<BoneTransform>& transforms) const;
 
-	/// <summary>アニメーション開始時点のミリ秒時刻</summary>
-	UINT64 _startTime;
+	/// <summary>変わったボーンだけ計算し直すボーン行列の更新（メインスレッドでの更新用）</summary>
+	IncrementalPose _incrementalPose;
 
-	void MotionUpdate();
+	/// <summary>
+	/// フレームの最終的なボーン行列（IKまで解いたもの）を求める
+	/// 前回の更新から姿勢が変わったボーンの部分木だけ計算し直し、変わったボーンの行列だけ書き込む
+	/// </summary>
+	/// <param name="frameNo">再生開始からのフレーム数</param>
+	/// <param name="boneMatrices">結果</param>
+	/// <param name="solveIK">falseならIKを解かない（アニメーションのLODで遠くのものに使う）</param>
+	void UpdatePose(UINT frameNo, std::vector<DirectX::XMMATRIX>& boneMatrices, bool solveIK = true);
 
-	/// <summary>CCD-IKによりボーン方向を解決</summary>
-	void SolveCCDIK(const PMDIK& ik);
+	/// <summary>
+	/// 姿勢から最終的なボーン行列を求める（メンバーを書き換えないので、姿勢キャッシュを作るときに複数のスレッドから呼んでよい）
+	/// 親子の姿勢をつなげるのもIKも回転と移動のままで計算し、4x4行列にするのは最後に1回だけ
+	/// </summary>
+	/// <param name="poses">ボーン番号ごとの姿勢</param>
+	/// <param name="bones">初期姿勢から動かしたボーン（それ以外は単位行列のまま）</param>
+	/// <param name="motion">IKのオンオフに使うモーション</param>
+	/// <param name="motionFrame">モーションの何フレーム目か</param>
+	/// <param name="transforms">作業領域（ボーン番号ごとのモデル空間の姿勢）</param>
+	/// <param name="boneMatrices">結果</param>
+	/// <param name="solveIK">falseならIKを解かない</param>
+	void BuildBoneMatrices(const BonePose* poses, const std::vector<uint32_t>& bones, const Motion* motion, UINT motionFrame,
+		std::vector<BoneTransform>& transforms, std::vector<DirectX::XMMATRIX>& boneMatrices, bool solveIK) const;
 
-	/// <summary>余弦定理IKによりボーン方向を解決</summary>
-	void SolveCosineIK(const PMDIK& ik);
+	/// <summary>再生開始からのフレーム数</summary>
+	UINT CurrentFrame() const;
 
-	/// <summary>LookAt行列によりボーン方向を解決</summary>
-	void SolveLookAt(const PMDIK& ik);
+	/// <summary>姿勢キャッシュ（ループ再生で同じフレームを計算し直さない）</summary>
+	PoseCache _poseCache;
+	PoseCacheMode _poseCacheMode = PoseCacheMode::None;
+	PoseCacheFormat _poseCacheFormat = PoseCacheFormat::Quantized;
+	size_t _poseCacheMaxBytes = 0;
 
-	void IKSolve(int frameNo);
+	/// <summary>アニメーション更新のLOD（画面上の大きさで計算を省く）</summary>
+	AnimationLOD _animationLOD;
+	/// <summary>視点からの距離で段階を選び直す</summary>
+	void SelectAnimationLOD();
 
-	//IKオンオフデータ
-	struct VMDIKEnable {
-		uint32_t frameNo;
-		std::unordered_map<std::string, bool> ikEnableTable;
-	};
-	std::vector<VMDIKEnable> _ikEnableData;
+	/// <summary>アニメーション開始時点のミリ秒時刻</summary>
+	UINT64 _startTime = 0;
+
+	void MotionUpdate();
+
+	/// <summary>IKを解く（オンオフはモーションのmotionFrameでの設定に従う、モーションが無ければすべてオン）</summary>
+	void IKSolve(const Motion* motion, UINT motionFrame, BoneTransform* transforms) const;
+	/// <summary>モーションのmotionFrameでのボーン番号ごとのIKのオフ（設定が無ければnullptr）</summary>
+	const uint8_t* IKDisabled(const Motion* motion, UINT motionFrame) const;
+
+	/// <summary>表情を適用し、座標が変わった頂点だけ頂点バッファを書き換える</summary>
+	void MorphUpdate(UINT frameNo);
 
 public:
 	PMDActor(const char* filepath, PMDRenderer& renderer);
+	/// <summary>ModelLoaderで読み込み済みのモデルから作成する（メインスレッドで呼ぶこと）</summary>
+	PMDActor(const std::shared_ptr<LoadedModel>& loaded, PMDRenderer& renderer);
 	~PMDActor();
 	/// <summary>クローンは頂点及びマテリアルは共通のバッファを見るようにする</summary>
 	PMDActor* Clone();
+	/// <summary>
+	/// VMDファイルを読み込み、nameで再生できるようにする
+	/// 基本レイヤーで何も再生していなければ、そのまま基本レイヤーで再生する
+	/// 同じ名前で読み込み直すと、再生しているレイヤーもそのまま新しいものを再生する
+	/// モーションはMotionLibraryで共有するので、同じモデルで同じファイルを読み込むのは最初のアクターだけ
+	/// </summary>
 	void LoadVMDFile(const char* filepath, const char* name);
 	void Update();
 	void Draw();
 	void PlayAnimation();
 
+	/// <summary>
+	/// 姿勢キャッシュを設定する（LoadVMDFileの後に呼ぶ、モーションを読み込み直すと空になる）
+	/// </summary>
+	/// <param name="mode">埋め方（Eagerは全フレームを計算し終わるまで戻らない）</param>
+	/// <param name="format">保存する形式</param>
+	/// <param name="maxBytes">保存に使うメモリの上限（超える分のフレームは毎回計算する）</param>
+	/// <param name="pool">Eagerで計算を分担させるワーカースレッド（nullptrならこのスレッドで計算する）</param>
+	void SetPoseCache(PoseCacheMode mode, PoseCacheFormat format, size_t maxBytes, ThreadPool* pool = nullptr);
+
+	/// <summary>姿勢キャッシュ</summary>
+	const PoseCache& GetPoseCache() const;
+
+	/// <summary>
+	/// アニメーションのレイヤーを一番上に追加する（0番は上書きの基本レイヤー）
+	/// </summary>
+	/// <returns>レイヤー番号</returns>
+	size_t AddAnimationLayer(AnimationBlendMode mode, float weight = 1.0f);
+
+	/// <summary>
+	/// 読み込んだモーションをレイヤーで再生する
+	/// </summary>
+	/// <param name="name">LoadVMDFileで付けた名前</param>
+	/// <param name="layer">レイヤー番号</param>
+	/// <param name="fadeFrames">それまで再生していたものからクロスフェードするフレーム数</param>
+	/// <param name="loop">falseなら最後のフレームで止める</param>
+	/// <returns>その名前のモーションが無ければfalse</returns>
+	bool PlayMotion(const char* name, size_t layer = 0, UINT fadeFrames = 0, bool loop = true);
+
+	/// <summary>レイヤーの再生をやめる（fadeFramesかけて消していく）</summary>
+	void StopMotion(size_t layer, UINT fadeFrames = 0);
+
+	/// <summary>レイヤーの重み（0ならそのレイヤーは評価しない）</summary>
+	void SetAnimationLayerWeight(size_t layer, float weight);
+
+	/// <summary>
+	/// レイヤーをボーンとその子孫だけに効かせる（上半身だけ別のモーションにするなど）
+	/// </summary>
+	/// <param name="rootBoneName">起点のボーン名（nullptrならすべてのボーン）</param>
+	/// <returns>ボーンが無ければfalse</returns>
+	bool SetAnimationLayerMask(size_t layer, const char* rootBoneName);
+
+	/// <summary>アニメーションのレイヤー</summary>
+	const AnimationBlender& GetAnimationBlender() const;
+
+	/// <summary>アニメーション更新のLODの段階の選び方</summary>
+	void SetAnimationLODPolicy(const AnimationLODPolicy& policy);
+
+	/// <summary>
+	/// アニメーション更新の重要度（画面上の大きさに掛ける、既定は1）
+	/// 主役は大きくして常にIKまで解き、注目しないものは小さくして早めに間引く
+	/// </summary>
+	void SetAnimationImportance(float importance);
+
+	/// <summary>アニメーション更新のLOD（今の段階と段階ごとの更新の回数）</summary>
+	const AnimationLOD& GetAnimationLOD() const;
+
+	/// <summary>ボーン行列の差分更新（計算し直したボーンの数など）</summary>
+	const IncrementalPose& GetIncrementalPose() const;
+
 	void LookAt(float x, float y, float z);
+
+	/// <summary>読み込みにかかった時間（ModelLoader経由で作成した場合のみ）</summary>
+	const ModelLoadTimings& GetLoadTimings() const;
+
+	/// <summary>頂点バッファのサイズ</summary>
+	const VertexMemoryStats& GetVertexMemoryStats() const;
+
+	/// <summary>メッシュ最適化の結果（最適化していない場合はnullptr）</summary>
+	const MeshOptimizeStats* GetMeshOptimizeStats() const;
+
+	/// <summary>LOD一式（作っていない場合はnullptr）</summary>
+	const MeshLODSet* GetMeshLODSet() const;
+
+	/// <summary>LOD選択で許容する画面上の誤差（ピクセル、0以下ならLODを使わない）</summary>
+	void SetLODPixelError(float pixelError);
+
+	/// <summary>直前の描画で使ったLOD（0は元のメッシュ、nはGetMeshLODSet()->lods[n - 1]）</summary>
+	size_t GetCurrentLOD() const;
+
+	/// <summary>ボーンパレットによる描画の分割</summary>
+	const BonePaletteMesh& GetBonePalettes() const;
+
+	/// <summary>表情</summary>
+	const MorphEngine& GetMorphs() const;
 };
@@ -0,0 +1,749 @@
+﻿#include "PMDModelData.h"
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	/// <summary>
+	/// マップしたファイルを先頭から順に読み進める（範囲外は読まない）
+	/// </summary>
+	class SectionReader
+	{
+	private:
+		const uint8_t* _cur;
+		const uint8_t* _end;
+
+	public:
+		SectionReader(const uint8_t* data, size_t size) : _cur(data), _end(data + size) {}
+
+		size_t Remain() const
+		{
+			return static_cast<size_t>(_end - _cur);
+		}
+
+		template<typename T>
+		bool Read(T& out)
+		{
+			if (Remain() < sizeof(T)) {
+				return false;
+			}
+			memcpy(&out, _cur, sizeof(T));
+			_cur += sizeof(T);
+			return true;
+		}
+
+		template<typename T>
+		bool View(size_t count, PMDView<T>& out)
+		{
+			if (count > Remain() / sizeof(T)) {
+				return false;
+			}
+			out = PMDView<T>(_cur, count);
+			_cur += count * sizeof(T);
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// 固定長の文字配列から文字列を作る（終端文字が無い場合は配列長で打ち切る）
+	/// </summary>
+	string FixedString(const char* str, size_t maxLen)
+	{
+		auto end = find(str, str + maxLen, '\0');
+		return string(str, end);
+	}
+
+	/// <summary>
+	/// テクスチャのパスをセパレータ文字で分離する
+	/// </summary>
+	/// <param name="path">対象のパス文字列</param>
+	/// <param name="splitter">区切り文字</param>
+	/// <returns>分離後の文字列ペア</returns>
+	pair<string, string> SplitFileName(const string& path, const char splitter = '*')
+	{
+		auto idx = path.find(splitter);
+		pair<string, string> ret;
+		ret.first = path.substr(0, idx);
+		ret.second = path.substr(idx + 1, path.length() - idx - 1);
+		return ret;
+	}
+
+	/// <summary>
+	/// ファイル名から拡張子を取得する
+	/// </summary>
+	/// <param name="path">対象のパス文字列</param>
+	/// <returns>拡張子</returns>
+	string GetExtension(const string& path)
+	{
+		auto idx = path.rfind('.');
+		return path.substr(idx + 1, path.length() - idx - 1);
+	}
+
+	/// <summary>
+	/// モデルのパスとテクスチャのパスから合成パスを得る
+	/// </summary>
+	/// <param name="modelPath">アプリケーションから見たpmdモデルのパス</param>
+	/// <param name="texPath">PMDモデルから見たテクスチャのパス</param>
+	/// <returns>アプリケーションから見たテクスチャのパス</returns>
+	string GetTexturePathFromModelAndTexPath(const string& modelPath, const string& texPath)
+	{
+		// ファイルのフォルダ区切りは\と/の二種類が使用される可能性があり
+		// ともかく末尾の\か/を得られればいいので、双方のrfindをとり比較する
+		// int型に代入しているのは見つからなかった場合はrfindがepos(-1→0xffffffff)を返すため
+		int pathIndex1 = static_cast<int>(modelPath.rfind('/'));
+		int pathIndex2 = static_cast<int>(modelPath.rfind('\\'));
+		auto pathIndex = max(pathIndex1, pathIndex2);
+		auto folderPath = modelPath.substr(0, pathIndex + 1);
+		return folderPath + texPath;
+	}
+
+	/// <summary>モデルファイルのあるフォルダ（末尾の区切り文字を含む）</summary>
+	string GetFolderPath(const string& modelPath)
+	{
+		return GetTexturePathFromModelAndTexPath(modelPath, "");
+	}
+
+	FILE* OpenFile(const char* path, const char* mode)
+	{
+#ifdef _MSC_VER
+		FILE* fp = nullptr;
+		fopen_s(&fp, path, mode);
+		return fp;
+#else
+		return fopen(path, mode);
+#endif
+	}
+
+	// クック済みファイル（.pmdc）の形式
+	// ヘッダの後ろに各ブロックが16バイト境界で並び、ヘッダのセクション表から直接参照する
+	constexpr char cooked_magic[4] = { 'P', 'M', 'D', 'C' };
+	constexpr uint32_t cooked_version = 2;
+	constexpr size_t cooked_alignment = 16;
+	constexpr uint32_t cooked_no_string = 0xffffffff;
+
+	/// <summary>ブロックの種類</summary>
+	enum CookedSectionId {
+		Section_Header,				// PMDHeader
+		Section_Vertices,			// PMDVertex[]
+		Section_Indices,			// uint16_t[]
+		Section_Materials,			// PMDMaterial[]
+		Section_Bones,				// PMDBone[]
+		Section_IKHeaders,			// PMDIKHeader[]
+		Section_IKNodes,			// uint16_t[]（IKのノード番号を順に連結したもの）
+		Section_SkinHeaders,		// PMDSkinHeader[]
+		Section_SkinVertices,		// PMDSkinVertex[]（表情の頂点を順に連結したもの）
+		Section_MaterialTextures,	// CookedMaterialTextures[]
+		Section_KneeBones,			// uint32_t[]
+		Section_BoneNameOrder,		// uint16_t[]
+		Section_Strings,			// char[]（終端文字区切り）
+		Section_Num
+	};
+
+	struct CookedSection {
+		uint64_t offset;			// ファイル先頭からの位置
+		uint64_t count;				// 要素数
+		uint32_t stride;			// 1要素のサイズ（読み込み側の構造体と一致しなければ無効）
+		uint32_t reserved;
+	};
+
+	struct CookedHeader {
+		char magic[4];				// "PMDC"
+		uint32_t version;			// 形式のバージョン
+		uint64_t sourceSize;		// 元のPMDファイルのサイズ
+		int64_t sourceTime;			// 元のPMDファイルの更新時刻
+		uint64_t fileSize;			// このファイルのサイズ
+		CookedSection sections[Section_Num];
+	};
+
+	/// <summary>テクスチャ名の文字列テーブル上の位置（無い場合はcooked_no_string）</summary>
+	struct CookedMaterialTextures {
+		uint32_t tex;
+		uint32_t sph;
+		uint32_t spa;
+		uint32_t toon;
+	};
+
+	/// <summary>クック済みファイルの書き出し</summary>
+	class CookedWriter
+	{
+	private:
+		vector<uint8_t> _buffer;
+		CookedHeader _header = {};
+
+	public:
+		CookedWriter()
+		{
+			_buffer.resize(sizeof(CookedHeader));
+		}
+
+		void AddSection(CookedSectionId id, const void* data, size_t count, size_t stride)
+		{
+			_buffer.resize((_buffer.size() + cooked_alignment - 1) & ~(cooked_alignment - 1));
+			auto& section = _header.sections[id];
+			section.offset = _buffer.size();
+			section.count = count;
+			section.stride = static_cast<uint32_t>(stride);
+			auto bytes = static_cast<const uint8_t*>(data);
+			_buffer.insert(_buffer.end(), bytes, bytes + count * stride);
+		}
+
+		bool Write(const char* path, uint64_t sourceSize, int64_t sourceTime)
+		{
+			memcpy(_header.magic, cooked_magic, sizeof(cooked_magic));
+			_header.version = cooked_version;
+			_header.sourceSize = sourceSize;
+			_header.sourceTime = sourceTime;
+			_header.fileSize = _buffer.size();
+			memcpy(_buffer.data(), &_header, sizeof(_header));
+
+			// 書きかけのファイルを他から読まれないように、一時ファイルに書いてから置き換える
+			string tmpPath = string(path) + ".tmp";
+			auto fp = OpenFile(tmpPath.c_str(), "wb");
+			if (fp == nullptr) {
+				return false;
+			}
+			auto written = fwrite(_buffer.data(), 1, _buffer.size(), fp);
+			fclose(fp);
+			if (written != _buffer.size()) {
+				remove(tmpPath.c_str());
+				return false;
+			}
+			remove(path);
+			return rename(tmpPath.c_str(), path) == 0;
+		}
+	};
+
+	/// <summary>文字列テーブルに追加して位置を返す</summary>
+	uint32_t AddString(vector<char>& strings, const string& str)
+	{
+		if (str.empty()) {
+			return cooked_no_string;
+		}
+		auto ret = static_cast<uint32_t>(strings.size());
+		strings.insert(strings.end(), str.begin(), str.end());
+		strings.push_back('\0');
+		return ret;
+	}
+
+	/// <summary>文字列テーブルから取り出す（範囲外の場合は空）</summary>
+	string GetString(const PMDView<char>& strings, uint32_t offset)
+	{
+		if (offset == cooked_no_string || offset >= strings.size()) {
+			return "";
+		}
+		auto begin = reinterpret_cast<const char*>(strings.bytes()) + offset;
+		auto end = reinterpret_cast<const char*>(strings.bytes()) + strings.size();
+		return string(begin, find(begin, end, '\0'));
+	}
+}
+
+PMDModelData::PMDModelData()
+{
+}
+
+PMDModelData::~PMDModelData()
+{
+}
+
+void PMDModelData::Clear()
+{
+	_file.Close();
+	_cooked = false;
+	_header = {};
+	_vertices = PMDView<PMDVertex>();
+	_indices = PMDView<uint16_t>();
+	_materials = PMDView<PMDMaterial>();
+	_bones = PMDView<PMDBone>();
+	_iks.clear();
+	_skins.clear();
+	_materialTextureNames.clear();
+	_materialTextures.clear();
+	_kneeBones = PMDView<uint32_t>();
+	_boneNameOrder = PMDView<uint16_t>();
+	_kneeBonesStorage.clear();
+	_boneNameOrderStorage.clear();
+}
+
+bool PMDModelData::Validate() const
+{
+	// インデックスが頂点数を超える番号を参照していないか
+	for (size_t i = 0; i < _indices.size(); ++i) {
+		if (_indices[i] >= _vertices.size()) {
+			return false;
+		}
+	}
+
+	// マテリアルが参照するインデックスの合計がインデックス数を超えていないか
+	size_t materialIndices = 0;
+	for (size_t i = 0; i < _materials.size(); ++i) {
+		materialIndices += _materials[i].indicesNum;
+	}
+	if (materialIndices > _indices.size()) {
+		return false;
+	}
+
+	// IKの対象、ターゲット、ノードがボーン数を超えていないか
+	auto boneNum = _bones.size();
+	for (auto& ik : _iks) {
+		if (ik.header.boneIdx >= boneNum || ik.header.targetIdx >= boneNum) {
+			return false;
+		}
+		for (size_t i = 0; i < ik.nodeIdxes.size(); ++i) {
+			if (ik.nodeIdxes[i] >= boneNum) {
+				return false;
+			}
+		}
+	}
+
+	// 表情のbaseは先頭だけで頂点番号を、base以外はbase内の番号を参照しているか
+	size_t baseVertNum = 0;
+	for (size_t s = 0; s < _skins.size(); ++s) {
+		auto& skin = _skins[s];
+		if (skin.header.type == pmd_skin_base) {
+			if (s != 0) {
+				return false;
+			}
+			baseVertNum = skin.vertices.size();
+		}
+		auto limit = skin.header.type == pmd_skin_base ? _vertices.size() : baseVertNum;
+		for (size_t i = 0; i < skin.vertices.size(); ++i) {
+			if (skin.vertices[i].vertIdx >= limit) {
+				return false;
+			}
+		}
+	}
+
+	// ひざボーンとボーン名の並びがボーン数を超えていないか
+	for (size_t i = 0; i < _kneeBones.size(); ++i) {
+		if (_kneeBones[i] >= boneNum) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < _boneNameOrder.size(); ++i) {
+		if (_boneNameOrder[i] >= boneNum) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PMDModelData::Load(const char* path)
+{
+	Clear();
+	_path = path;
+	if (!_file.Open(path)) {
+		return false;
+	}
+
+	SectionReader reader(_file.Data(), _file.Size());
+	char signature[3] = {};
+	if (!reader.Read(signature) || memcmp(signature, "Pmd", sizeof(signature)) != 0) {
+		return false;
+	}
+	if (!reader.Read(_header)) {
+		return false;
+	}
+
+	// 頂点
+	uint32_t vertNum = 0;
+	if (!reader.Read(vertNum) || !reader.View(vertNum, _vertices)) {
+		return false;
+	}
+
+	// インデックス
+	uint32_t indicesNum = 0;
+	if (!reader.Read(indicesNum) || !reader.View(indicesNum, _indices)) {
+		return false;
+	}
+
+	// マテリアル
+	uint32_t materialNum = 0;
+	if (!reader.Read(materialNum) || !reader.View(materialNum, _materials)) {
+		return false;
+	}
+	// ボーン
+	uint16_t boneNum = 0;
+	if (!reader.Read(boneNum) || !reader.View(boneNum, _bones)) {
+		return false;
+	}
+
+	// IK（ノード数が可変長なので1本ずつ）
+	uint16_t ikNum = 0;
+	if (!reader.Read(ikNum)) {
+		return false;
+	}
+	_iks.resize(ikNum);
+	for (auto& ik : _iks) {
+		if (!reader.Read(ik.header) || !reader.View(ik.header.chainLen, ik.nodeIdxes)) {
+			return false;
+		}
+	}
+
+	// 表情（頂点数が可変長なので1つずつ、古いファイルなど表情が無くてもよい）
+	uint16_t skinNum = 0;
+	if (reader.Remain() > 0 && !reader.Read(skinNum)) {
+		return false;
+	}
+	_skins.resize(skinNum);
+	for (auto& skin : _skins) {
+		if (!reader.Read(skin.header) || !reader.View(skin.header.vertNum, skin.vertices)) {
+			return false;
+		}
+	}
+
+	BuildDerivedData();
+	return Validate();
+}
+
+bool PMDModelData::LoadCooked(const char* cookedPath, const char* sourcePath)
+{
+	Clear();
+	_path = sourcePath;
+
+	// 元ファイルが更新されていたら使わない
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!GetFileStamp(sourcePath, sourceSize, sourceTime)) {
+		return false;
+	}
+	if (!_file.Open(cookedPath) || _file.Size() < sizeof(CookedHeader)) {
+		Clear();
+		return false;
+	}
+	CookedHeader header;
+	memcpy(&header, _file.Data(), sizeof(header));
+	if (memcmp(header.magic, cooked_magic, sizeof(cooked_magic)) != 0 ||
+		header.version != cooked_version ||
+		header.fileSize != _file.Size() ||
+		header.sourceSize != sourceSize ||
+		header.sourceTime != sourceTime) {
+		Clear();
+		return false;
+	}
+
+	// セクション表を検証しつつビューを作る
+	bool valid = true;
+	auto getSection = [this, &header, &valid](CookedSectionId id, size_t stride) -> pair<const uint8_t*, size_t> {
+		auto& section = header.sections[id];
+		if (section.stride != stride || section.offset > _file.Size() ||
+			section.count > (_file.Size() - section.offset) / stride) {
+			valid = false;
+			return make_pair(nullptr, 0);
+		}
+		return make_pair(_file.Data() + section.offset, static_cast<size_t>(section.count));
+	};
+	auto headerSection = getSection(Section_Header, sizeof(PMDHeader));
+	auto vertices = getSection(Section_Vertices, sizeof(PMDVertex));
+	auto indices = getSection(Section_Indices, sizeof(uint16_t));
+	auto materials = getSection(Section_Materials, sizeof(PMDMaterial));
+	auto bones = getSection(Section_Bones, sizeof(PMDBone));
+	auto ikHeaders = getSection(Section_IKHeaders, sizeof(PMDIKHeader));
+	auto ikNodes = getSection(Section_IKNodes, sizeof(uint16_t));
+	auto skinHeaders = getSection(Section_SkinHeaders, sizeof(PMDSkinHeader));
+	auto skinVertices = getSection(Section_SkinVertices, sizeof(PMDSkinVertex));
+	auto materialTextures = getSection(Section_MaterialTextures, sizeof(CookedMaterialTextures));
+	auto kneeBones = getSection(Section_KneeBones, sizeof(uint32_t));
+	auto boneNameOrder = getSection(Section_BoneNameOrder, sizeof(uint16_t));
+	auto strings = getSection(Section_Strings, sizeof(char));
+	if (!valid || headerSection.second != 1 ||
+		materialTextures.second != materials.second || boneNameOrder.second != bones.second) {
+		Clear();
+		return false;
+	}
+
+	memcpy(&_header, headerSection.first, sizeof(_header));
+	_vertices = PMDView<PMDVertex>(vertices.first, vertices.second);
+	_indices = PMDView<uint16_t>(indices.first, indices.second);
+	_materials = PMDView<PMDMaterial>(materials.first, materials.second);
+	_bones = PMDView<PMDBone>(bones.first, bones.second);
+	_kneeBones = PMDView<uint32_t>(kneeBones.first, kneeBones.second);
+	_boneNameOrder = PMDView<uint16_t>(boneNameOrder.first, boneNameOrder.second);
+
+	// IKはノード番号のブロックを先頭から順に切り分ける
+	PMDView<uint16_t> nodes(ikNodes.first, ikNodes.second);
+	PMDView<PMDIKHeader> headers(ikHeaders.first, ikHeaders.second);
+	_iks.resize(headers.size());
+	size_t nodeOffset = 0;
+	for (size_t i = 0; i < _iks.size(); ++i) {
+		auto& ik = _iks[i];
+		ik.header = headers[i];
+		if (nodeOffset + ik.header.chainLen > nodes.size()) {
+			Clear();
+			return false;
+		}
+		ik.nodeIdxes = PMDView<uint16_t>(ikNodes.first + nodeOffset * sizeof(uint16_t), ik.header.chainLen);
+		nodeOffset += ik.header.chainLen;
+	}
+
+	// 表情も同様に頂点のブロックを先頭から順に切り分ける
+	PMDView<PMDSkinHeader> skinHeaderView(skinHeaders.first, skinHeaders.second);
+	_skins.resize(skinHeaderView.size());
+	size_t skinVertexOffset = 0;
+	for (size_t i = 0; i < _skins.size(); ++i) {
+		auto& skin = _skins[i];
+		skin.header = skinHeaderView[i];
+		if (skin.header.vertNum > skinVertices.second - skinVertexOffset) {
+			Clear();
+			return false;
+		}
+		skin.vertices = PMDView<PMDSkinVertex>(skinVertices.first + skinVertexOffset * sizeof(PMDSkinVertex), skin.header.vertNum);
+		skinVertexOffset += skin.header.vertNum;
+	}
+
+	PMDView<CookedMaterialTextures> textures(materialTextures.first, materialTextures.second);
+	PMDView<char> stringTable(strings.first, strings.second);
+	_materialTextureNames.resize(textures.size());
+	for (size_t i = 0; i < textures.size(); ++i) {
+		auto tex = textures[i];
+		auto& names = _materialTextureNames[i];
+		names.texPath = GetString(stringTable, tex.tex);
+		names.sphPath = GetString(stringTable, tex.sph);
+		names.spaPath = GetString(stringTable, tex.spa);
+		names.toonPath = GetString(stringTable, tex.toon);
+	}
+	BuildMaterialTexturePaths();
+	if (!Validate()) {
+		Clear();
+		return false;
+	}
+
+	_cooked = true;
+	return true;
+}
+
+bool PMDModelData::LoadWithCache(const char* path, bool writeCooked)
+{
+	auto cookedPath = CookedPath(path);
+	if (LoadCooked(cookedPath.c_str(), path)) {
+		return true;
+	}
+	if (!Load(path)) {
+		return false;
+	}
+	if (writeCooked) {
+		// 書き出せなくても（読み込み専用の場所など）読み込み自体は成功している
+		WriteCooked(cookedPath.c_str());
+	}
+	return true;
+}
+
+bool PMDModelData::WriteCooked(const char* cookedPath) const
+{
+	uint64_t sourceSize = 0;
+	int64_t sourceTime = 0;
+	if (!GetFileStamp(_path.c_str(), sourceSize, sourceTime)) {
+		return false;
+	}
+
+	vector<PMDIKHeader> ikHeaders;
+	vector<uint16_t> ikNodes;
+	for (auto& ik : _iks) {
+		ikHeaders.push_back(ik.header);
+		for (size_t i = 0; i < ik.nodeIdxes.size(); ++i) {
+			ikNodes.push_back(ik.nodeIdxes[i]);
+		}
+	}
+
+	vector<PMDSkinHeader> skinHeaders;
+	vector<uint8_t> skinVertices;
+	for (auto& skin : _skins) {
+		skinHeaders.push_back(skin.header);
+		skinVertices.insert(skinVertices.end(), skin.vertices.bytes(), skin.vertices.bytes() + skin.vertices.byteSize());
+	}
+
+	vector<char> strings;
+	vector<CookedMaterialTextures> textures(_materialTextureNames.size());
+	for (size_t i = 0; i < textures.size(); ++i) {
+		auto& names = _materialTextureNames[i];
+		textures[i].tex = AddString(strings, names.texPath);
+		textures[i].sph = AddString(strings, names.sphPath);
+		textures[i].spa = AddString(strings, names.spaPath);
+		textures[i].toon = AddString(strings, names.toonPath);
+	}
+
+	CookedWriter writer;
+	writer.AddSection(Section_Header, &_header, 1, sizeof(PMDHeader));
+	writer.AddSection(Section_Vertices, _vertices.bytes(), _vertices.size(), sizeof(PMDVertex));
+	writer.AddSection(Section_Indices, _indices.bytes(), _indices.size(), sizeof(uint16_t));
+	writer.AddSection(Section_Materials, _materials.bytes(), _materials.size(), sizeof(PMDMaterial));
+	writer.AddSection(Section_Bones, _bones.bytes(), _bones.size(), sizeof(PMDBone));
+	writer.AddSection(Section_IKHeaders, ikHeaders.data(), ikHeaders.size(), sizeof(PMDIKHeader));
+	writer.AddSection(Section_IKNodes, ikNodes.data(), ikNodes.size(), sizeof(uint16_t));
+	writer.AddSection(Section_SkinHeaders, skinHeaders.data(), skinHeaders.size(), sizeof(PMDSkinHeader));
+	writer.AddSection(Section_SkinVertices, skinVertices.data(), skinVertices.size() / sizeof(PMDSkinVertex), sizeof(PMDSkinVertex));
+	writer.AddSection(Section_MaterialTextures, textures.data(), textures.size(), sizeof(CookedMaterialTextures));
+	writer.AddSection(Section_KneeBones, _kneeBones.bytes(), _kneeBones.size(), sizeof(uint32_t));
+	writer.AddSection(Section_BoneNameOrder, _boneNameOrder.bytes(), _boneNameOrder.size(), sizeof(uint16_t));
+	writer.AddSection(Section_Strings, strings.data(), strings.size(), sizeof(char));
+	return writer.Write(cookedPath, sourceSize, sourceTime);
+}
+
+std::string PMDModelData::CookedPath(const std::string& path)
+{
+	return path + "c";
+}
+
+bool PMDModelData::IsCooked() const
+{
+	return _cooked;
+}
+
+const std::string& PMDModelData::Path() const
+{
+	return _path;
+}
+
+const PMDHeader& PMDModelData::Header() const
+{
+	return _header;
+}
+
+const PMDView<PMDVertex>& PMDModelData::Vertices() const
+{
+	return _vertices;
+}
+
+const PMDView<uint16_t>& PMDModelData::Indices() const
+{
+	return _indices;
+}
+
+const PMDView<PMDMaterial>& PMDModelData::Materials() const
+{
+	return _materials;
+}
+
+const PMDView<PMDBone>& PMDModelData::Bones() const
+{
+	return _bones;
+}
+
+const std::vector<PMDIKView>& PMDModelData::IKs() const
+{
+	return _iks;
+}
+
+const std::vector<PMDSkinView>& PMDModelData::Skins() const
+{
+	return _skins;
+}
+
+std::string PMDModelData::BoneName(size_t boneIdx) const
+{
+	auto bone = _bones[boneIdx];
+	return FixedString(bone.boneName, sizeof(bone.boneName));
+}
+
+std::string PMDModelData::SkinName(size_t skinIdx) const
+{
+	auto& skin = _skins[skinIdx].header;
+	return FixedString(skin.skinName, sizeof(skin.skinName));
+}
+
+void PMDModelData::BuildDerivedData()
+{
+	// ひざボーンとボーン名の並び
+	_boneNameOrderStorage.resize(_bones.size());
+	for (size_t idx = 0; idx < _bones.size(); ++idx) {
+		_boneNameOrderStorage[idx] = static_cast<uint16_t>(idx);
+		if (BoneName(idx).find("ひざ") != std::string::npos) {
+			_kneeBonesStorage.push_back(static_cast<uint32_t>(idx));
+		}
+	}
+	stable_sort(_boneNameOrderStorage.begin(), _boneNameOrderStorage.end(), [this](uint16_t lval, uint16_t rval) {
+		return BoneName(lval) < BoneName(rval);
+	});
+	_kneeBones = PMDView<uint32_t>(reinterpret_cast<const uint8_t*>(_kneeBonesStorage.data()), _kneeBonesStorage.size());
+	_boneNameOrder = PMDView<uint16_t>(reinterpret_cast<const uint8_t*>(_boneNameOrderStorage.data()), _boneNameOrderStorage.size());
+
+	// テクスチャ名の分離
+	_materialTextureNames.resize(_materials.size());
+	for (size_t i = 0; i < _materials.size(); ++i) {
+		auto material = _materials[i];
+		auto& textures = _materialTextureNames[i];
+
+		// トゥーンはアプリケーション共通のフォルダから読む
+		char toonFileName[16];
+		snprintf(toonFileName, sizeof(toonFileName), "toon%02d.bmp", material.toonIdx + 1);
+		textures.toonPath = string("toon/") + toonFileName;
+
+		auto texFilePath = FixedString(material.texFilePath, sizeof(material.texFilePath));
+		if (texFilePath.empty()) {
+			continue;
+		}
+
+		string texFileName = texFilePath;
+		string sphFileName = "";
+		string spaFileName = "";
+		if (count(texFileName.begin(), texFileName.end(), '*') > 0) {
+			// スプリッタがある
+			auto namepair = SplitFileName(texFileName);
+			auto firstExt = GetExtension(namepair.first);
+			if (firstExt == "sph") {
+				texFileName = namepair.second;
+				sphFileName = namepair.first;
+			}
+			else if (firstExt == "spa") {
+				texFileName = namepair.second;
+				spaFileName = namepair.first;
+			}
+			else {
+				texFileName = namepair.first;
+				auto secondExt = GetExtension(namepair.second);
+				if (secondExt == "sph") {
+					sphFileName = namepair.second;
+				}
+				else if (secondExt == "spa") {
+					spaFileName = namepair.second;
+				}
+			}
+		}
+		else {
+			auto ext = GetExtension(texFileName);
+			if (ext == "sph") {
+				sphFileName = texFilePath;
+				texFileName = "";
+			}
+			else if (ext == "spa") {
+				spaFileName = texFilePath;
+				texFileName = "";
+			}
+		}
+
+		textures.texPath = texFileName;
+		textures.sphPath = sphFileName;
+		textures.spaPath = spaFileName;
+	}
+	BuildMaterialTexturePaths();
+}
+
+void PMDModelData::BuildMaterialTexturePaths()
+{
+	// クック済みファイルにはモデルのフォルダからの相対パスで持っているので、ここで毎回合成する
+	auto folderPath = GetFolderPath(_path);
+	_materialTextures = _materialTextureNames;
+	for (auto& textures : _materialTextures) {
+		for (auto texPath : { &textures.texPath, &textures.sphPath, &textures.spaPath }) {
+			if (!texPath->empty()) {
+				*texPath = folderPath + *texPath;
+			}
+		}
+	}
+}
+
+const std::vector<PMDMaterialTextures>& PMDModelData::MaterialTextures() const
+{
+	return _materialTextures;
+}
+
+const PMDView<uint32_t>& PMDModelData::KneeBones() const
+{
+	return _kneeBones;
+}
+
+const PMDView<uint16_t>& PMDModelData::BoneNameOrder() const
+{
+	return _boneNameOrder;
+}
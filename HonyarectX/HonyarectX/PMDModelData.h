@@ -0,0 +1,233 @@
+﻿#pragma once
+
+#include <DirectXMath.h>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+#pragma pack(1)	// ここから1バイトパッキング（ファイル上のレイアウトそのまま）
+/// <summary>PMDヘッダ（シグネチャ"Pmd"の直後に続く）</summary>
+struct PMDHeader {
+	float version;						// 例：00 00 80 3F == 1.00
+	char modelName[20];					// モデル名
+	char comment[256];					// モデルコメント
+};
+
+/// <summary>PMD頂点（38バイト）</summary>
+struct PMDVertex {
+	DirectX::XMFLOAT3 pos;				// 座標
+	DirectX::XMFLOAT3 normal;			// 法線
+	DirectX::XMFLOAT2 uv;				// UV座標
+	uint16_t boneNo[2];					// ボーン番号
+	uint8_t boneWeight;					// ボーン影響度（boneNo[0]側、0～100）
+	uint8_t edgeFlg;					// 輪郭線フラグ
+};
+
+/// <summary>PMDマテリアル（70バイト）</summary>
+struct PMDMaterial {
+	DirectX::XMFLOAT3 diffuse;			// ディフューズ色
+	float alpha;						// ディフューズα
+	float specularity;					// スペキュラの強さ（乗算値）
+	DirectX::XMFLOAT3 specular;			// スペキュラ色
+	DirectX::XMFLOAT3 ambient;			// アンビエント色
+	uint8_t toonIdx;					// トゥーン番号
+	uint8_t edgeFlg;					// マテリアル毎の輪郭線フラグ
+	uint32_t indicesNum;				// このマテリアルが割当たるインデックス数
+	char texFilePath[20];				// テクスチャファイル名
+};
+
+/// <summary>PMDボーン（39バイト）</summary>
+struct PMDBone {
+	char boneName[20];					// ボーン名
+	uint16_t parentNo;					// 親ボーン番号
+	uint16_t nextNo;					// 先端のボーン番号
+	uint8_t type;						// ボーン種別
+	uint16_t ikBoneNo;					// IKボーン番号
+	DirectX::XMFLOAT3 pos;				// ボーンの基準点座標
+};
+
+/// <summary>PMD IKの固定長部分（この後ろにchainLen個のノード番号が続く）</summary>
+struct PMDIKHeader {
+	uint16_t boneIdx;					// IK対象のボーン
+	uint16_t targetIdx;					// ターゲットに近づけるためのボーン
+	uint8_t chainLen;					// 間のノード数
+	uint16_t iterations;				// 試行回数
+	float limit;						// 一回あたりの回転制限
+};
+
+/// <summary>PMD表情の固定長部分（この後ろにvertNum個のPMDSkinVertexが続く）</summary>
+struct PMDSkinHeader {
+	char skinName[20];					// 表情名
+	uint32_t vertNum;					// 表情で動く頂点数
+	uint8_t type;						// 種類（0:base、1:まゆ、2:目、3:リップ、4:その他）
+};
+
+/// <summary>
+/// PMD表情の頂点（16バイト）
+/// baseは頂点番号と基準の座標、base以外はbaseの頂点リスト内の番号とbaseからの移動量
+/// </summary>
+struct PMDSkinVertex {
+	uint32_t vertIdx;					// 頂点番号（base以外はbase内の番号）
+	DirectX::XMFLOAT3 pos;				// 座標（base以外は移動量）
+};
+#pragma pack()	// 1バイトパッキング解除
+
+static_assert(sizeof(PMDHeader) == 280, "PMDHeader size mismatch");
+static_assert(sizeof(PMDVertex) == 38, "PMDVertex size mismatch");
+static_assert(sizeof(PMDMaterial) == 70, "PMDMaterial size mismatch");
+static_assert(sizeof(PMDBone) == 39, "PMDBone size mismatch");
+static_assert(sizeof(PMDIKHeader) == 11, "PMDIKHeader size mismatch");
+static_assert(sizeof(PMDSkinHeader) == 25, "PMDSkinHeader size mismatch");
+static_assert(sizeof(PMDSkinVertex) == 16, "PMDSkinVertex size mismatch");
+
+/// <summary>表情の種類でbaseを表す値</summary>
+constexpr uint8_t pmd_skin_base = 0;
+
+/// <summary>
+/// マップしたファイル上の配列をコピーせずに参照するビュー
+/// 要素は境界チェック付きで値として取り出す（アライメントされていない位置にあってもよい）
+/// </summary>
+template<typename T>
+class PMDView
+{
+private:
+	const uint8_t* _data = nullptr;
+	size_t _size = 0;
+
+public:
+	PMDView() = default;
+	PMDView(const uint8_t* data, size_t size) : _data(data), _size(size) {}
+
+	T operator[](size_t idx) const
+	{
+		assert(idx < _size);
+		T ret;
+		std::memcpy(&ret, _data + idx * sizeof(T), sizeof(T));
+		return ret;
+	}
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	/// <summary>先頭アドレス（そのままGPUバッファへ転送する場合などに使用）</summary>
+	const uint8_t* bytes() const { return _data; }
+	size_t byteSize() const { return _size * sizeof(T); }
+};
+
+/// <summary>IK1本分のビュー</summary>
+struct PMDIKView {
+	PMDIKHeader header;					// 固定長部分
+	PMDView<uint16_t> nodeIdxes;		// 間のノード番号
+};
+
+/// <summary>表情1つ分のビュー</summary>
+struct PMDSkinView {
+	PMDSkinHeader header;				// 固定長部分
+	PMDView<PMDSkinVertex> vertices;	// 表情の頂点
+};
+
+/// <summary>マテリアルが参照するテクスチャのパス（無い場合は空）</summary>
+struct PMDMaterialTextures {
+	std::string texPath;				// 基本テクスチャ
+	std::string sphPath;				// スフィアマップ（乗算）
+	std::string spaPath;				// スフィアマップ（加算）
+	std::string toonPath;				// トゥーン
+};
+
+/// <summary>
+/// PMDファイルのパーサ
+/// ファイルをメモリマップし、各セクションへの型付きビューを提供する（GPUリソースは作らない）
+/// 解析後に毎回同じ結果になる処理（テクスチャパスの分離、ひざボーンの検索など）の結果も持つ
+/// それらをまとめてクック済みファイル（.pmdc）に書き出しておくと、次回からは解析せずにマップするだけで済む
+/// </summary>
+class PMDModelData
+{
+private:
+	MappedFile _file;
+	std::string _path;
+	bool _cooked = false;
+
+	PMDHeader _header = {};
+	PMDView<PMDVertex> _vertices;
+	PMDView<uint16_t> _indices;
+	PMDView<PMDMaterial> _materials;
+	PMDView<PMDBone> _bones;
+	std::vector<PMDIKView> _iks;
+	std::vector<PMDSkinView> _skins;
+
+	/// <summary>マテリアルごとのテクスチャ名（モデルのフォルダからの相対パス、トゥーンのみアプリケーションから見たパス）</summary>
+	std::vector<PMDMaterialTextures> _materialTextureNames;
+	/// <summary>マテリアルごとのテクスチャパス（アプリケーションから見たパス）</summary>
+	std::vector<PMDMaterialTextures> _materialTextures;
+	/// <summary>「ひざ」を含むボーンの番号</summary>
+	PMDView<uint32_t> _kneeBones;
+	/// <summary>ボーン番号をボーン名の昇順に並べたもの</summary>
+	PMDView<uint16_t> _boneNameOrder;
+	/// <summary>生のPMDから読み込んだ場合の_kneeBonesと_boneNameOrderの実体</summary>
+	std::vector<uint32_t> _kneeBonesStorage;
+	std::vector<uint16_t> _boneNameOrderStorage;
+
+	void Clear();
+	/// <summary>解析結果から派生データを作る</summary>
+	void BuildDerivedData();
+	/// <summary>セクション間の番号の参照が範囲内か確かめる（生のPMDとクック済みファイルのどちらを読んだ後にも行う）</summary>
+	bool Validate() const;
+	/// <summary>テクスチャ名をアプリケーションから見たパスにする</summary>
+	void BuildMaterialTexturePaths();
+
+public:
+	PMDModelData();
+	~PMDModelData();
+	PMDModelData(const PMDModelData&) = delete;
+	PMDModelData& operator=(const PMDModelData&) = delete;
+
+	/// <summary>PMDファイルを開いて解析する（形式不正やサイズ不足の場合はfalse）</summary>
+	/// <param name="path">PMDファイルパス</param>
+	bool Load(const char* path);
+
+	/// <summary>クック済みファイルをマップする（バージョン違いや元ファイルが更新されている場合はfalse）</summary>
+	/// <param name="cookedPath">クック済みファイルパス</param>
+	/// <param name="sourcePath">元のPMDファイルパス</param>
+	bool LoadCooked(const char* cookedPath, const char* sourcePath);
+
+	/// <summary>
+	/// クック済みファイルが新しければそれを使い、そうでなければPMDを解析してクック済みファイルを書き出す
+	/// </summary>
+	/// <param name="path">PMDファイルパス</param>
+	/// <param name="writeCooked">PMDを解析した場合にクック済みファイルを書き出すか</param>
+	bool LoadWithCache(const char* path, bool writeCooked = true);
+
+	/// <summary>クック済みファイルを書き出す</summary>
+	/// <param name="cookedPath">書き出し先</param>
+	bool WriteCooked(const char* cookedPath) const;
+
+	/// <summary>PMDファイルパスに対応するクック済みファイルパス</summary>
+	static std::string CookedPath(const std::string& path);
+
+	/// <summary>クック済みファイルから読み込んだか</summary>
+	bool IsCooked() const;
+
+	const std::string& Path() const;
+	const PMDHeader& Header() const;
+	const PMDView<PMDVertex>& Vertices() const;
+	const PMDView<uint16_t>& Indices() const;
+	const PMDView<PMDMaterial>& Materials() const;
+	const PMDView<PMDBone>& Bones() const;
+	const std::vector<PMDIKView>& IKs() const;
+	/// <summary>表情（baseがある場合は先頭がbase）</summary>
+	const std::vector<PMDSkinView>& Skins() const;
+
+	/// <summary>ボーン名を取得する（終端文字が無くても20バイトで打ち切る）</summary>
+	std::string BoneName(size_t boneIdx) const;
+
+	/// <summary>表情名を取得する（終端文字が無くても20バイトで打ち切る）</summary>
+	std::string SkinName(size_t skinIdx) const;
+
+	/// <summary>マテリアルごとのテクスチャパス（'*'区切りのsph/spaを分離し、アプリケーションから見たパスにしたもの）</summary>
+	const std::vector<PMDMaterialTextures>& MaterialTextures() const;
+	/// <summary>「ひざ」を含むボーンの番号</summary>
+	const PMDView<uint32_t>& KneeBones() const;
+	/// <summary>ボーン番号をボーン名の昇順に並べたもの（名前をキーにしたmapを順に構築する場合に使う）</summary>
+	const PMDView<uint16_t>& BoneNameOrder() const;
+};
@@ -19,7 +19,9 @@ namespace
 	}
 }
 
-PMDRenderer::PMDRenderer(Dx12Wrapper& dx12) : _dx12(dx12)
+PMDRenderer::PMDRenderer(Dx12Wrapper& dx12, VertexLayout vertexLayout, size_t bonePaletteSize) :
+	_dx12(dx12), _vertexLayout(vertexLayout),
+	_bonePaletteSize(max(bone_palette_min, min(bonePaletteSize, bone_palette_max)))
 {
 	assert(SUCCEEDED(CreateRootSignature()));
 	assert(SUCCEEDED(CreateGraphicsPipelineForPMD()));
@@ -129,9 +131,11 @@ HRESULT PMDRenderer::CreateGraphicsPipelineForPMD()
 	ComPtr<ID3DBlob> vsBlob = nullptr;
 	ComPtr<ID3DBlob> psBlob = nullptr;
 	ComPtr<ID3DBlob> errorBlob = nullptr;
+	// 頂点形式ごとのエントリポイント（Packed32は入力アセンブラで変換されるのでRawと同じ）
+	auto vsEntryPoint = _vertexLayout == VertexLayout::Split ? "BasicSplitVS" : "BasicVS";
 	auto result = D3DCompileFromFile(L"BasicVertexShader.hlsl",
 		nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-		"BasicVS", "vs_5_0",
+		vsEntryPoint, "vs_5_0",
 		D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION,
 		0, &vsBlob, &errorBlob);
 	if (!CheckShaderCompileResult(result, errorBlob.Get())) {
@@ -147,14 +151,35 @@ HRESULT PMDRenderer::CreateGraphicsPipelineForPMD()
 		assert(0);
 		return result;
 	}
-	D3D12_INPUT_ELEMENT_DESC inputLayout[] = {
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "BONENO",   0, DXGI_FORMAT_R16G16_UINT,     0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "WEIGHT",   0, DXGI_FORMAT_R8_UINT,         0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "EDGE_FLG", 0, DXGI_FORMAT_R8_UINT,         0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	// 頂点形式ごとの入力レイアウト（輪郭線フラグはシェーダーで使わないので読まない）
+	D3D12_INPUT_ELEMENT_DESC rawInputLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT,    0, offsetof(PMDVertex, pos),        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT,    0, offsetof(PMDVertex, normal),     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,       0, offsetof(PMDVertex, uv),         D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "BONENO",   0, DXGI_FORMAT_R16G16_UINT,        0, offsetof(PMDVertex, boneNo),     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "WEIGHT",   0, DXGI_FORMAT_R8_UINT,            0, offsetof(PMDVertex, boneWeight), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 	};
+	D3D12_INPUT_ELEMENT_DESC packedInputLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT,    0, offsetof(PackedVertex, pos),        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL",   0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, offsetof(PackedVertex, normal),     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT,       0, offsetof(PackedVertex, uv),         D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "BONENO",   0, DXGI_FORMAT_R16G16_UINT,        0, offsetof(PackedVertex, boneNo),     D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "WEIGHT",   0, DXGI_FORMAT_R8_UINT,            0, offsetof(PackedVertex, boneWeight), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+	D3D12_INPUT_ELEMENT_DESC splitInputLayout[] = {
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT,    0, 0,                                   D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "BONENO",   0, DXGI_FORMAT_R16G16_UINT,        1, offsetof(SkinVertex, boneNo),        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "WEIGHT",   0, DXGI_FORMAT_R8_UINT,            1, offsetof(SkinVertex, boneWeight),    D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL",   0, DXGI_FORMAT_R16G16_SNORM,       2, offsetof(AttributeVertex, normal),   D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT,       2, offsetof(AttributeVertex, uv),       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+	D3D12_INPUT_LAYOUT_DESC inputLayout = { rawInputLayout, _countof(rawInputLayout) };
+	if (_vertexLayout == VertexLayout::Packed32) {
+		inputLayout = { packedInputLayout, _countof(packedInputLayout) };
+	}
+	else if (_vertexLayout == VertexLayout::Split) {
+		inputLayout = { splitInputLayout, _countof(splitInputLayout) };
+	}
 
 	// グラフィックスパイプラインステートの設定
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC gpipeline = {};
@@ -175,8 +200,7 @@ HRESULT PMDRenderer::CreateGraphicsPipelineForPMD()
 	gpipeline.DSVFormat = DXGI_FORMAT_D32_FLOAT;
 	gpipeline.DepthStencilState.StencilEnable = false;
 
-	gpipeline.InputLayout.pInputElementDescs = inputLayout;			// レイアウト先頭アドレス
-	gpipeline.InputLayout.NumElements = _countof(inputLayout);		// レイアウト配列数
+	gpipeline.InputLayout = inputLayout;							// レイアウト先頭アドレスと配列数
 
 	gpipeline.IBStripCutValue = D3D12_INDEX_BUFFER_STRIP_CUT_VALUE_DISABLED;	// ストリップ時のカットなし
 	gpipeline.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;	// 三角形で構成
@@ -199,17 +223,16 @@ HRESULT PMDRenderer::CreateGraphicsPipelineForPMD()
 HRESULT PMDRenderer::CreateRootSignature()
 {
 	// レンジ
-	CD3DX12_DESCRIPTOR_RANGE descTblRange[4] = {};					// テクスチャと定数の2つ
+	CD3DX12_DESCRIPTOR_RANGE descTblRange[3] = {};					// テクスチャと定数の2つ
 	descTblRange[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);	// 定数[b0]（ビュープロジェクション用）
-	descTblRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);	// 定数[b1]（ワールド、ボーン用）
-	descTblRange[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 2);	// 定数[b2]（マテリアル用）
-	descTblRange[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 4, 0);	// テクスチャ4つ（基本とsphとspaとトゥーン）
+	descTblRange[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 2);	// 定数[b2]（マテリアル用）
+	descTblRange[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 4, 0);	// テクスチャ4つ（基本とsphとspaとトゥーン）
 
 	// ルートパラメータ
 	CD3DX12_ROOT_PARAMETER rootParam[3] = {};
 	rootParam[0].InitAsDescriptorTable(1, &descTblRange[0]);	// ビュープロジェクション変換
-	rootParam[1].InitAsDescriptorTable(1, &descTblRange[1]);	// ワールド・ボーン変換
-	rootParam[2].InitAsDescriptorTable(2, &descTblRange[2]);	// マテリアル周り
+	rootParam[1].InitAsConstantBufferView(1);					// ワールド・ボーン変換[b1]（バッチごとにパレットのアドレスを直接指定する）
+	rootParam[2].InitAsDescriptorTable(2, &descTblRange[1]);	// マテリアル周り
 
 	CD3DX12_STATIC_SAMPLER_DESC samplerDescs[2] = {};
 	samplerDescs[0].Init(0);
@@ -242,3 +265,13 @@ ID3D12RootSignature* PMDRenderer::GetRootSignature()
 {
 	return _rootSignature.Get();
 }
+
+VertexLayout PMDRenderer::GetVertexLayout() const
+{
+	return _vertexLayout;
+}
+
+size_t PMDRenderer::GetBonePaletteSize() const
+{
+	return _bonePaletteSize;
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <wrl.h>
 #include <memory>
+#include "VertexConverter.h"
+#include "BonePalette.h"
 
 class Dx12Wrapper;
 class PMDActor;
@@ -14,6 +16,10 @@ class PMDRenderer
 
 private:
 	Dx12Wrapper& _dx12;
+	/// <summary>アクターが頂点バッファを作る際の形式</summary>
+	VertexLayout _vertexLayout;
+	/// <summary>アクターが描画を分割する際のボーンパレットの大きさ</summary>
+	size_t _bonePaletteSize;
 	template<typename T>
 	using ComPtr = Microsoft::WRL::ComPtr<T>;
 
@@ -44,10 +50,13 @@ private:
 	bool CheckShaderCompileResult(HRESULT result, ID3DBlob* error = nullptr);
 
 public:
-	PMDRenderer(Dx12Wrapper& dx12);
+	/// <param name="bonePaletteSize">1回の描画で参照できるボーン数（これを超えるモデルは描画を分割する）</param>
+	PMDRenderer(Dx12Wrapper& dx12, VertexLayout vertexLayout = VertexLayout::Packed32, size_t bonePaletteSize = bone_palette_max);
 	~PMDRenderer();
 	void Update();
 	void Draw();
 	ID3D12PipelineState* GetPipelineState();
 	ID3D12RootSignature* GetRootSignature();
+	VertexLayout GetVertexLayout() const;
+	size_t GetBonePaletteSize() const;
 };
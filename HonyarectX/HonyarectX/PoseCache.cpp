@@ -0,0 +1,140 @@
+﻿#include "PoseCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <future>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	/// <summary>量子化した行列（回転部分の3x3を[-1, 1]の16bit、移動部分はそのまま）</summary>
+	struct QuantizedMatrix {
+		int16_t rotation[9];
+		uint16_t padding;
+		float translation[3];
+	};
+	static_assert(sizeof(QuantizedMatrix) == 32, "QuantizedMatrix must be 32 bytes");
+
+	const float snorm16_scale = 32767.0f;
+
+	int16_t ToSnorm16(float value)
+	{
+		value = min(max(value, -1.0f), 1.0f);
+		return static_cast<int16_t>(value * snorm16_scale + (value >= 0.0f ? 0.5f : -0.5f));
+	}
+}
+
+size_t PoseCache::BoneBytes(PoseCacheFormat format)
+{
+	return format == PoseCacheFormat::Matrix ? sizeof(XMMATRIX) : sizeof(QuantizedMatrix);
+}
+
+void PoseCache::Reset(size_t boneNum, uint32_t frameNum, PoseCacheFormat format, size_t maxBytes)
+{
+	_format = format;
+	_boneNum = boneNum;
+	_frameBytes = BoneBytes(format) * boneNum;
+	_frameNum = frameNum;
+	_frameCapacity = _frameBytes == 0 ? 0 : static_cast<uint32_t>(min<size_t>(frameNum, maxBytes / _frameBytes));
+	_data.assign(_frameBytes * _frameCapacity, 0);
+	_cached.assign(_frameCapacity, 0);
+	_cachedNum = 0;
+}
+
+void PoseCache::Clear()
+{
+	*this = PoseCache();
+}
+
+void PoseCache::Store(uint32_t frame, const XMMATRIX* matrices)
+{
+	assert(CanStore(frame));
+	Write(frame, matrices);
+	if (!_cached[frame]) {
+		_cached[frame] = 1;
+		++_cachedNum;
+	}
+}
+
+void PoseCache::Write(uint32_t frame, const XMMATRIX* matrices)
+{
+	auto dst = _data.data() + _frameBytes * frame;
+	if (_format == PoseCacheFormat::Matrix) {
+		memcpy(dst, matrices, _frameBytes);
+	}
+	else {
+		// ボーン行列は回転と移動だけなので、3x3は[-1, 1]に収まり、4列目は(0, 0, 0, 1)
+		auto quantized = reinterpret_cast<QuantizedMatrix*>(dst);
+		for (size_t i = 0; i < _boneNum; ++i) {
+			XMFLOAT4X4 m;
+			XMStoreFloat4x4(&m, matrices[i]);
+			auto& q = quantized[i];
+			for (int r = 0; r < 3; ++r) {
+				for (int c = 0; c < 3; ++c) {
+					q.rotation[r * 3 + c] = ToSnorm16(m.m[r][c]);
+				}
+			}
+			q.padding = 0;
+			q.translation[0] = m.m[3][0];
+			q.translation[1] = m.m[3][1];
+			q.translation[2] = m.m[3][2];
+		}
+	}
+}
+
+void PoseCache::Load(uint32_t frame, XMMATRIX* matrices) const
+{
+	assert(Contains(frame));
+	auto src = _data.data() + _frameBytes * frame;
+	if (_format == PoseCacheFormat::Matrix) {
+		memcpy(matrices, src, _frameBytes);
+		return;
+	}
+	auto quantized = reinterpret_cast<const QuantizedMatrix*>(src);
+	const float scale = 1.0f / snorm16_scale;
+	for (size_t i = 0; i < _boneNum; ++i) {
+		auto& q = quantized[i];
+		auto& r = q.rotation;
+		matrices[i] = XMMATRIX(
+			r[0] * scale, r[1] * scale, r[2] * scale, 0.0f,
+			r[3] * scale, r[4] * scale, r[5] * scale, 0.0f,
+			r[6] * scale, r[7] * scale, r[8] * scale, 0.0f,
+			q.translation[0], q.translation[1], q.translation[2], 1.0f);
+	}
+}
+
+void PoseCache::Bake(const PoseEvaluator& evaluate, ThreadPool* pool)
+{
+	// フレームを区間に分けて計算する（作業用の行列は区間ごとに1つ）
+	auto bakeRange = [this, &evaluate](uint32_t begin, uint32_t end) {
+		vector<XMMATRIX> matrices(_boneNum);
+		for (auto frame = begin; frame < end; ++frame) {
+			if (_cached[frame]) {
+				continue;
+			}
+			evaluate(frame, matrices);
+			Write(frame, matrices.data());
+			_cached[frame] = 1;
+		}
+	};
+	if (pool == nullptr || pool->ThreadNum() <= 1) {
+		bakeRange(0, _frameCapacity);
+	}
+	else {
+		auto chunkNum = static_cast<uint32_t>(pool->ThreadNum() * 4);
+		auto chunkSize = max<uint32_t>(1, (_frameCapacity + chunkNum - 1) / chunkNum);
+		vector<future<void>> tasks;
+		for (uint32_t begin = 0; begin < _frameCapacity; begin += chunkSize) {
+			auto end = min(begin + chunkSize, _frameCapacity);
+			tasks.push_back(pool->Enqueue([&bakeRange, begin, end]() { bakeRange(begin, end); }));
+		}
+		for (auto& task : tasks) {
+			task.get();
+		}
+	}
+	// 保存済みの数はフラグから数え直す（ワーカースレッドからは数えない）
+	_cachedNum = static_cast<size_t>(count(_cached.begin(), _cached.end(), 1));
+}
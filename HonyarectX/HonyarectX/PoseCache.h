@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <DirectXMath.h>
+
+class ThreadPool;
+
+/// <summary>姿勢キャッシュの埋め方</summary>
+enum class PoseCacheMode {
+	None,			// 使わない（毎フレーム計算する）
+	Lazy,			// 初めて再生したフレームを保存する
+	Eager,			// 最初に全フレームをワーカースレッドで計算しておく
+};
+
+/// <summary>姿勢キャッシュに保存する形式</summary>
+enum class PoseCacheFormat {
+	Matrix,			// 行列そのまま（64バイト/ボーン、読み出しはコピーのみ）
+	Quantized,		// 回転部分の3x3を16bit固定小数点、移動部分をfloat（32バイト/ボーン）
+};
+
+/// <summary>姿勢の計算（frameの最終的なボーン行列をmatricesに書き込む、Bakeでは複数のスレッドから同時に呼ばれる）</summary>
+using PoseEvaluator = std::function<void(uint32_t frame, std::vector<DirectX::XMMATRIX>& matrices)>;
+
+/// <summary>
+/// ループ再生するモーションの姿勢キャッシュ
+/// IKまで解いた最終的なボーン行列をフレーム番号ごとに保存し、同じフレームを再生するときは計算せずに読み出す
+/// 上限のメモリに収まるフレーム数までを保存し、それより後のフレームは保存しない
+/// </summary>
+class PoseCache
+{
+private:
+	PoseCacheFormat _format = PoseCacheFormat::Quantized;
+	size_t _boneNum = 0;
+	size_t _frameBytes = 0;
+	uint32_t _frameNum = 0;
+	/// <summary>保存できるフレーム数（0～_frameCapacity - 1のフレームを保存する）</summary>
+	uint32_t _frameCapacity = 0;
+	std::vector<uint8_t> _data;
+	/// <summary>フレームごとの保存済みフラグ（Bakeではフレームごとに別のスレッドが書き込む）</summary>
+	std::vector<uint8_t> _cached;
+	size_t _cachedNum = 0;
+
+	/// <summary>フレームの領域に書き込む（保存済みフラグは変えない）</summary>
+	void Write(uint32_t frame, const DirectX::XMMATRIX* matrices);
+
+public:
+	/// <summary>
+	/// キャッシュを空にして作り直す
+	/// </summary>
+	/// <param name="boneNum">ボーン数</param>
+	/// <param name="frameNum">モーションのフレーム数（最後のフレーム番号 + 1）</param>
+	/// <param name="format">保存する形式</param>
+	/// <param name="maxBytes">保存に使うメモリの上限</param>
+	void Reset(size_t boneNum, uint32_t frameNum, PoseCacheFormat format, size_t maxBytes);
+
+	/// <summary>空にする（保存できるフレームも無くなる）</summary>
+	void Clear();
+
+	/// <summary>保存済みか</summary>
+	bool Contains(uint32_t frame) const { return frame < _frameCapacity && _cached[frame] != 0; }
+
+	/// <summary>保存できるフレームか（メモリの上限に収まるか）</summary>
+	bool CanStore(uint32_t frame) const { return frame < _frameCapacity; }
+
+	/// <summary>フレームのボーン行列を保存する（保存済みの数を数えるので1つのスレッドから呼ぶ、複数のスレッドで埋めるのはBake）</summary>
+	void Store(uint32_t frame, const DirectX::XMMATRIX* matrices);
+
+	/// <summary>保存したボーン行列を読み出す（Matrix形式はコピーするだけ）</summary>
+	void Load(uint32_t frame, DirectX::XMMATRIX* matrices) const;
+
+	/// <summary>
+	/// 保存できるフレームをすべて計算して保存する（終わるまで戻らない）
+	/// </summary>
+	/// <param name="evaluate">姿勢の計算</param>
+	/// <param name="pool">分担させるワーカースレッド（nullptrなら呼んだスレッドで計算する）</param>
+	void Bake(const PoseEvaluator& evaluate, ThreadPool* pool);
+
+	PoseCacheFormat Format() const { return _format; }
+	uint32_t FrameNum() const { return _frameNum; }
+	uint32_t FrameCapacity() const { return _frameCapacity; }
+	size_t CachedFrameNum() const { return _cachedNum; }
+
+	/// <summary>保存に使うメモリ（確保済みのもの）</summary>
+	size_t MemoryBytes() const { return _data.size(); }
+
+	/// <summary>1ボーンあたりのバイト数</summary>
+	static size_t BoneBytes(PoseCacheFormat format);
+};
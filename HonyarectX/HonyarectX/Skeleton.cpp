@@ -0,0 +1,246 @@
+﻿#include "Skeleton.h"
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+using namespace DirectX;
+
+const uint32_t Skeleton::no_parent;
+
+void Skeleton::Build(const PMDModelData& model)
+{
+	auto& bones = model.Bones();
+	auto boneNum = static_cast<uint32_t>(bones.size());
+	_parents.resize(boneNum);
+	_ikParents.resize(boneNum);
+	_restPositions.resize(boneNum);
+	_flags.assign(boneNum, 0);
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		auto bone = bones[b];
+		_parents[b] = bone.parentNo < boneNum && bone.parentNo != b ? bone.parentNo : no_parent;
+		_ikParents[b] = bone.ikBoneNo;
+		_restPositions[b] = bone.pos;
+		_flags[b] = bone.type == 2 ? skeleton_bone_ik : 0;
+	}
+	auto& kneeBones = model.KneeBones();
+	for (size_t i = 0; i < kneeBones.size(); ++i) {
+		if (kneeBones[i] < boneNum) {
+			_flags[kneeBones[i]] |= skeleton_bone_knee;
+		}
+	}
+
+	// 子の一覧（ボーン番号の順）
+	vector<uint32_t> childStarts(boneNum + 1, 0);
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_parents[b] != no_parent) {
+			++childStarts[_parents[b] + 1];
+		}
+	}
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		childStarts[b + 1] += childStarts[b];
+	}
+	vector<uint32_t> children(childStarts[boneNum]);
+	auto fill = childStarts;
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_parents[b] != no_parent) {
+			children[fill[_parents[b]]++] = b;
+		}
+	}
+
+	// 根から深さ優先で並べる（子はボーン番号の順）
+	_order.clear();
+	_order.reserve(boneNum);
+	_positions.assign(boneNum, no_parent);
+	_subtreeEnds.assign(boneNum, 0);
+	vector<uint32_t> stack;
+	auto visit = [&](uint32_t root) {
+		stack.push_back(root);
+		while (!stack.empty()) {
+			auto bone = stack.back();
+			stack.pop_back();
+			_positions[bone] = static_cast<uint32_t>(_order.size());
+			_order.push_back(bone);
+			// 後に積んだものが先に出るので逆順に積む
+			// 子の一覧は元の親で作ってあるので、循環を切ったボーン（親が変わった）や並べ済みのボーンは積まない
+			for (auto c = childStarts[bone + 1]; c > childStarts[bone]; --c) {
+				auto child = children[c - 1];
+				if (_positions[child] == no_parent && _parents[child] == bone) {
+					stack.push_back(child);
+				}
+			}
+		}
+	};
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_parents[b] == no_parent) {
+			visit(b);
+		}
+	}
+	// 根にたどり着かないもの（親が循環している）は、まだ並べていないボーンから根として並べ直す
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_positions[b] == no_parent) {
+			_parents[b] = no_parent;
+			visit(b);
+		}
+	}
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_parents[b] == no_parent) {
+			_flags[b] |= skeleton_bone_root;
+		}
+	}
+
+	// 子孫の終わり（後ろから、子の終わりの最大を親に伝える）
+	_orderParents.resize(boneNum);
+	for (uint32_t i = 0; i < boneNum; ++i) {
+		_subtreeEnds[i] = i + 1;
+		_orderParents[i] = _parents[_order[i]];
+	}
+	for (auto i = boneNum; i > 0; --i) {
+		auto parent = _orderParents[i - 1];
+		if (parent != no_parent) {
+			auto& end = _subtreeEnds[_positions[parent]];
+			if (end < _subtreeEnds[i - 1]) {
+				end = _subtreeEnds[i - 1];
+			}
+		}
+	}
+	_sorted = true;
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (_parents[b] != no_parent && _parents[b] > b) {
+			_sorted = false;
+			break;
+		}
+	}
+
+	// ボーン番号の順で親が先になっているなら、行列を先頭から順に読み書きするようにボーン番号の順で並べる
+	_links.clear();
+	for (uint32_t i = 0; i < boneNum; ++i) {
+		auto bone = _sorted ? i : _order[i];
+		if (_parents[bone] != no_parent) {
+			_links.push_back({ bone, _parents[bone] });
+		}
+	}
+}
+
+size_t Skeleton::BoneNum() const
+{
+	return _parents.size();
+}
+
+const vector<uint32_t>& Skeleton::Order() const
+{
+	return _order;
+}
+
+bool Skeleton::IsSorted() const
+{
+	return _sorted;
+}
+
+uint32_t Skeleton::Parent(uint32_t bone) const
+{
+	return _parents[bone];
+}
+
+uint32_t Skeleton::IKParent(uint32_t bone) const
+{
+	return _ikParents[bone];
+}
+
+const XMFLOAT3& Skeleton::RestPosition(uint32_t bone) const
+{
+	return _restPositions[bone];
+}
+
+uint8_t Skeleton::Flags(uint32_t bone) const
+{
+	return _flags[bone];
+}
+
+size_t Skeleton::RootNum() const
+{
+	size_t rootNum = 0;
+	for (auto flags : _flags) {
+		rootNum += (flags & skeleton_bone_root) ? 1 : 0;
+	}
+	return rootNum;
+}
+
+void Skeleton::Subtree(uint32_t bone, const uint32_t*& begin, const uint32_t*& end) const
+{
+	assert(bone < _positions.size());
+	auto position = _positions[bone];
+	begin = _order.data() + position;
+	end = _order.data() + _subtreeEnds[position];
+}
+
+void Skeleton::LocalToModel(XMMATRIX* matrices) const
+{
+	for (auto& link : _links) {
+		matrices[link.bone] *= matrices[link.parent];
+	}
+}
+
+void Skeleton::MultiplySubtree(uint32_t bone, const XMMATRIX& parentMatrix, XMMATRIX* matrices) const
+{
+	assert(bone < _positions.size());
+	auto position = _positions[bone];
+	auto end = _subtreeEnds[position];
+	matrices[bone] *= parentMatrix;
+	for (auto i = position + 1; i < end; ++i) {
+		matrices[_order[i]] *= matrices[_orderParents[i]];
+	}
+}
+
+void Skeleton::LocalToModel(BoneTransform* transforms) const
+{
+	for (auto& link : _links) {
+		transforms[link.bone] = MultiplyBoneTransform(transforms[link.bone], transforms[link.parent]);
+	}
+}
+
+void Skeleton::MultiplySubtree(uint32_t bone, const BoneTransform& parent, BoneTransform* transforms) const
+{
+	assert(bone < _positions.size());
+	auto position = _positions[bone];
+	auto end = _subtreeEnds[position];
+	transforms[bone] = MultiplyBoneTransform(transforms[bone], parent);
+	for (auto i = position + 1; i < end; ++i) {
+		auto b = _order[i];
+		transforms[b] = MultiplyBoneTransform(transforms[b], transforms[_orderParents[i]]);
+	}
+}
+
+void Skeleton::Subtrees(vector<uint32_t>& bones, vector<Range>& ranges) const
+{
+	ranges.clear();
+	for (auto& bone : bones) {
+		assert(bone < _positions.size());
+		bone = _positions[bone];
+	}
+	sort(bones.begin(), bones.end());
+	uint32_t end = 0;
+	for (auto position : bones) {
+		// 前の範囲（子孫は連続している）に含まれていれば計算済み
+		if (!ranges.empty() && position < end) {
+			continue;
+		}
+		end = _subtreeEnds[position];
+		// 隣り合う範囲はつなげる
+		if (!ranges.empty() && ranges.back().end == position) {
+			ranges.back().end = end;
+		}
+		else {
+			ranges.push_back({ position, end });
+		}
+	}
+}
+
+void Skeleton::LocalToModel(const BoneTransform* locals, const Range& range, BoneTransform* models) const
+{
+	assert(range.begin <= range.end && range.end <= _order.size());
+	for (auto i = range.begin; i < range.end; ++i) {
+		auto bone = _order[i];
+		auto parent = _orderParents[i];
+		models[bone] = parent != no_parent ? MultiplyBoneTransform(locals[bone], models[parent]) : locals[bone];
+	}
+}
@@ -0,0 +1,106 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "PMDModelData.h"
+#include "BoneTransform.h"
+
+/// <summary>ボーンの性質（Skeleton::Flagsの各ビット）</summary>
+enum SkeletonBoneFlag : uint8_t {
+	skeleton_bone_root = 1 << 0,		// 親が無い
+	skeleton_bone_ik = 1 << 1,			// IKボーン（PMDのボーン種別2）
+	skeleton_bone_knee = 1 << 2,		// ひざ（余弦定理IKで曲げる軸をX軸に固定する）
+};
+
+/// <summary>
+/// 平らに並べた骨格
+/// ボーンを親が子より前になる順（根から深さ優先）に並べ、親・初期位置・フラグをボーン番号ごとの配列で持つ
+/// 親の無いボーンはすべて根として扱う（「センター」の子孫以外も親の行列を掛ける）
+/// 深さ優先で並べるので、あるボーンとその子孫は並びの中で連続する
+/// 行列はボーン番号の順に並べたものを使う（描画やモーションと同じ番号のまま）
+/// </summary>
+class Skeleton
+{
+public:
+	/// <summary>親の無いボーンの親番号</summary>
+	static const uint32_t no_parent = UINT32_MAX;
+
+	/// <summary>Order()の中の範囲[begin, end)</summary>
+	struct Range {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+private:
+	/// <summary>親の行列を掛けるボーンと親の組</summary>
+	struct Link {
+		uint32_t bone;
+		uint32_t parent;
+	};
+	std::vector<Link> _links;					// 親のあるボーンを親が先になる順に並べたもの（根は含まない）
+	std::vector<uint32_t> _order;				// 親が子より前になる順のボーン番号
+	std::vector<uint32_t> _orderParents;		// _orderと同じ順の親のボーン番号（行列を掛けるループで使う）
+	std::vector<uint32_t> _subtreeEnds;			// _orderと同じ順の、子孫の終わりの位置
+	std::vector<uint32_t> _positions;			// ボーン番号ごとの_orderでの位置
+	std::vector<uint32_t> _parents;				// ボーン番号ごとの親
+	std::vector<uint32_t> _ikParents;			// ボーン番号ごとのIKボーン番号（PMDのikBoneNo）
+	std::vector<DirectX::XMFLOAT3> _restPositions;	// ボーン番号ごとの基準点（回転中心）
+	std::vector<uint8_t> _flags;				// ボーン番号ごとのSkeletonBoneFlag
+	bool _sorted = false;						// ボーン番号の順のままで親が子より前になっている（_linksもボーン番号の順）
+
+public:
+	/// <summary>
+	/// モデルのボーンから作る
+	/// 親の番号が範囲外や自分自身のボーン、親をたどると循環しているボーンは根として扱う
+	/// </summary>
+	void Build(const PMDModelData& model);
+
+	size_t BoneNum() const;
+	/// <summary>親が子より前になる順のボーン番号</summary>
+	const std::vector<uint32_t>& Order() const;
+	/// <summary>ボーン番号の順のままで親が子より前になっているか（並べ替えていない）</summary>
+	bool IsSorted() const;
+	uint32_t Parent(uint32_t bone) const;
+	uint32_t IKParent(uint32_t bone) const;
+	const DirectX::XMFLOAT3& RestPosition(uint32_t bone) const;
+	uint8_t Flags(uint32_t bone) const;
+	/// <summary>根の数</summary>
+	size_t RootNum() const;
+
+	/// <summary>boneとその子孫のボーン番号（Order()の中の連続した範囲）</summary>
+	void Subtree(uint32_t bone, const uint32_t*& begin, const uint32_t*& end) const;
+
+	/// <summary>
+	/// ボーンごとの行列（親からの相対）に親の行列を親から子へ順に掛けて、モデル空間の行列にする
+	/// 親のあるボーンの並びを先頭から1回ループするだけで、再帰も根かどうかの分岐もしない
+	/// </summary>
+	/// <param name="matrices">ボーン番号の順に並んだ行列（BoneNum()個）</param>
+	void LocalToModel(DirectX::XMMATRIX* matrices) const;
+	/// <summary>LocalToModelの回転と移動の姿勢版（行列を作らずに親の姿勢をつなげる）</summary>
+	void LocalToModel(BoneTransform* transforms) const;
+
+	/// <summary>
+	/// boneにparentMatrixを掛け、その子孫に親の行列を掛け直す（IKで途中のボーンを動かしたとき用）
+	/// </summary>
+	void MultiplySubtree(uint32_t bone, const DirectX::XMMATRIX& parentMatrix, DirectX::XMMATRIX* matrices) const;
+	/// <summary>MultiplySubtreeの回転と移動の姿勢版</summary>
+	void MultiplySubtree(uint32_t bone, const BoneTransform& parent, BoneTransform* transforms) const;
+
+	/// <summary>
+	/// bonesの各ボーンとその子孫をOrder()の中の範囲にする（ほかのボーンの子孫として含まれるものはまとめる）
+	/// 範囲は前から順に並び、重ならない
+	/// </summary>
+	/// <param name="bones">ボーン番号（作業用に並びの位置へ書き換える）</param>
+	/// <param name="ranges">結果（上書きする）</param>
+	void Subtrees(std::vector<uint32_t>& bones, std::vector<Range>& ranges) const;
+
+	/// <summary>
+	/// Order()の中の範囲のボーンだけ、親からの相対の姿勢に親のモデル空間の姿勢を掛けてmodelsに書き込む（変わった部分木だけ計算し直す用）
+	/// 範囲の外にある親はmodelsが計算済みであること（Subtreesの範囲を前から順に渡せばよい）
+	/// </summary>
+	/// <param name="locals">ボーン番号ごとの親からの相対の姿勢</param>
+	/// <param name="models">ボーン番号ごとのモデル空間の姿勢</param>
+	void LocalToModel(const BoneTransform* locals, const Range& range, BoneTransform* models) const;
+};
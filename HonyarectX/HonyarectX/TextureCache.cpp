@@ -0,0 +1,298 @@
+﻿#include "TextureCache.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+using namespace std;
+
+namespace
+{
+	constexpr uint64_t prime1 = 11400714785074694791ull;
+	constexpr uint64_t prime2 = 14029467366897019727ull;
+	constexpr uint64_t prime3 = 1609587929392839161ull;
+	constexpr uint64_t prime4 = 9650029242287828579ull;
+	constexpr uint64_t prime5 = 2870177450012600261ull;
+
+	uint64_t Rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	uint64_t Read64(const uint8_t* p)
+	{
+		uint64_t ret;
+		memcpy(&ret, p, sizeof(ret));
+		return ret;
+	}
+
+	uint64_t Round(uint64_t acc, uint64_t input)
+	{
+		return Rotl(acc + input * prime2, 31) * prime1;
+	}
+
+	uint64_t MergeRound(uint64_t acc, uint64_t val)
+	{
+		return (acc ^ Round(0, val)) * prime1 + prime4;
+	}
+
+	/// <summary>Shift-JISの1バイト目か</summary>
+	bool IsShiftJISLeadByte(unsigned char c)
+	{
+		return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+	}
+}
+
+uint64_t HashTextureContent(const void* data, size_t size)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	auto end = p + size;
+	uint64_t hash;
+	if (size >= 32) {
+		uint64_t acc[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+		for (; p + 32 <= end; p += 32) {
+			for (int i = 0; i < 4; ++i) {
+				acc[i] = Round(acc[i], Read64(p + i * 8));
+			}
+		}
+		hash = Rotl(acc[0], 1) + Rotl(acc[1], 7) + Rotl(acc[2], 12) + Rotl(acc[3], 18);
+		for (int i = 0; i < 4; ++i) {
+			hash = MergeRound(hash, acc[i]);
+		}
+	}
+	else {
+		hash = prime5;
+	}
+	hash += size;
+	for (; p + 8 <= end; p += 8) {
+		hash = Rotl(hash ^ Round(0, Read64(p)), 27) * prime1 + prime4;
+	}
+	for (; p < end; ++p) {
+		hash = Rotl(hash ^ (*p * prime5), 11) * prime1;
+	}
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+string NormalizeTexturePath(const string& path)
+{
+	// 区切りと大文字を揃える（2バイト文字はそのまま写す）
+	string unified;
+	unified.reserve(path.size());
+	for (size_t i = 0; i < path.size(); ++i) {
+		auto c = static_cast<unsigned char>(path[i]);
+		if (IsShiftJISLeadByte(c) && i + 1 < path.size()) {
+			unified += path[i];
+			unified += path[++i];
+		}
+		else if (c == '\\') {
+			unified += '/';
+		}
+		else if (c >= 'A' && c <= 'Z') {
+			unified += static_cast<char>(c - 'A' + 'a');
+		}
+		else {
+			unified += path[i];
+		}
+	}
+
+	// .と..を取り除く（先頭の..は戻りようが無いので残す）
+	vector<string> segments;
+	size_t begin = 0;
+	while (begin <= unified.size()) {
+		auto end = unified.find('/', begin);
+		if (end == string::npos) {
+			end = unified.size();
+		}
+		auto segment = unified.substr(begin, end - begin);
+		if (segment == "..") {
+			if (!segments.empty() && segments.back() != "..") {
+				segments.pop_back();
+			}
+			else {
+				segments.push_back(segment);
+			}
+		}
+		else if (!segment.empty() && segment != ".") {
+			segments.push_back(segment);
+		}
+		begin = end + 1;
+	}
+	string ret = !unified.empty() && unified[0] == '/' ? "/" : "";
+	for (size_t i = 0; i < segments.size(); ++i) {
+		if (i > 0) {
+			ret += '/';
+		}
+		ret += segments[i];
+	}
+	return ret;
+}
+
+TextureCache::TextureCache(size_t budget, EvictCallback onEvict) :
+	_budget(budget), _onEvict(move(onEvict))
+{
+}
+
+void TextureCache::AddEntryRef(uint32_t entry, size_t count)
+{
+	auto& e = _entries[entry];
+	if (count == 0) {
+		return;
+	}
+	if (e.refCount == 0) {
+		_lru.erase(e.lru);
+		e.lru = _lru.end();
+		++_stats.referencedNum;
+	}
+	e.refCount += count;
+}
+
+void TextureCache::AddRef(const string& path)
+{
+	auto& p = _paths[path];
+	if (p.refCount > 0 || p.entry != texture_cache_invalid) {
+		++_stats.pathHits;
+	}
+	++p.refCount;
+	if (p.entry != texture_cache_invalid) {
+		AddEntryRef(p.entry, 1);
+	}
+}
+
+void TextureCache::Release(const string& path)
+{
+	auto it = _paths.find(path);
+	if (it == _paths.end() || it->second.refCount == 0) {
+		assert(0);
+		return;
+	}
+	auto& p = it->second;
+	--p.refCount;
+	if (p.entry == texture_cache_invalid) {
+		// 読み込まれる前に参照が無くなった
+		if (p.refCount == 0) {
+			_paths.erase(it);
+		}
+		return;
+	}
+	auto& e = _entries[p.entry];
+	if (--e.refCount == 0) {
+		e.lru = _lru.insert(_lru.end(), p.entry);
+		--_stats.referencedNum;
+		Trim(0);
+	}
+}
+
+uint32_t TextureCache::FindPath(const string& path) const
+{
+	auto it = _paths.find(path);
+	return it == _paths.end() ? texture_cache_invalid : it->second.entry;
+}
+
+uint32_t TextureCache::FindContent(uint64_t hash) const
+{
+	auto it = _hashes.find(hash);
+	return it == _hashes.end() ? texture_cache_invalid : it->second;
+}
+
+uint32_t TextureCache::Insert(const string& path, uint64_t hash, size_t bytes)
+{
+	auto& p = _paths[path];
+	if (p.entry != texture_cache_invalid) {
+		// 既に対応付けてある
+		return p.entry;
+	}
+	auto refCount = p.refCount;
+	auto found = _hashes.find(hash);
+	if (found != _hashes.end()) {
+		// 内容が同じテクスチャを共有する
+		++_stats.contentHits;
+		p.entry = found->second;
+		auto& e = _entries[p.entry];
+		e.paths.push_back(path);
+		if (e.refCount == 0 && refCount == 0) {
+			// 参照は増えないが、使われたので新しい側へ移す
+			_lru.splice(_lru.end(), _lru, e.lru);
+		}
+		AddEntryRef(p.entry, refCount);
+		return p.entry;
+	}
+
+	++_stats.misses;
+	// 新しいテクスチャの分を空けておく（破棄されるのは参照の無いパスだけなので、pはそのまま使える）
+	Trim(bytes);
+	uint32_t entry;
+	if (!_freeEntries.empty()) {
+		entry = _freeEntries.back();
+		_freeEntries.pop_back();
+	}
+	else {
+		entry = static_cast<uint32_t>(_entries.size());
+		_entries.emplace_back();
+	}
+	auto& e = _entries[entry];
+	e.hash = hash;
+	e.bytes = bytes;
+	e.refCount = refCount;
+	e.paths.assign(1, path);
+	e.used = true;
+	e.lru = _lru.end();
+	if (refCount == 0) {
+		e.lru = _lru.insert(_lru.end(), entry);
+	}
+	else {
+		++_stats.referencedNum;
+	}
+	p.entry = entry;
+	_hashes.emplace(hash, entry);
+	++_stats.entryNum;
+	_stats.residentBytes += bytes;
+	_stats.peakBytes = max(_stats.peakBytes, _stats.residentBytes);
+	return entry;
+}
+
+void TextureCache::Evict(uint32_t entry)
+{
+	auto& e = _entries[entry];
+	assert(e.used && e.refCount == 0);
+	_lru.erase(e.lru);
+	// 参照の無いテクスチャを指すパスは、どれも参照が無い
+	for (auto& path : e.paths) {
+		_paths.erase(path);
+	}
+	_hashes.erase(e.hash);
+	_stats.residentBytes -= e.bytes;
+	--_stats.entryNum;
+	++_stats.evictions;
+	auto paths = move(e.paths);
+	e = Entry();
+	_freeEntries.push_back(entry);
+	if (_onEvict) {
+		_onEvict(entry, paths);
+	}
+}
+
+void TextureCache::Trim(size_t reserveBytes)
+{
+	while (!_lru.empty() && _stats.residentBytes + reserveBytes > _budget) {
+		Evict(_lru.front());
+	}
+}
+
+void TextureCache::SetBudget(size_t budget)
+{
+	_budget = budget;
+	Trim(0);
+}
+
+size_t TextureCache::Budget() const
+{
+	return _budget;
+}
+
+const TextureCacheStats& TextureCache::Stats() const
+{
+	return _stats;
+}
@@ -0,0 +1,113 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>テクスチャキャッシュのエントリ番号（無効値）</summary>
+constexpr uint32_t texture_cache_invalid = 0xffffffff;
+
+/// <summary>テクスチャキャッシュの集計</summary>
+struct TextureCacheStats {
+	size_t pathHits = 0;			// 参照済みか読み込み済みのパスを参照した回数
+	size_t contentHits = 0;			// 別のパスと内容が同じで、テクスチャを共有した回数
+	size_t misses = 0;				// テクスチャを新しく作った回数
+	size_t evictions = 0;			// 予算を超えて破棄した回数
+	size_t entryNum = 0;			// 保持しているテクスチャ数
+	size_t referencedNum = 0;		// そのうち参照されているもの
+	size_t residentBytes = 0;		// 保持しているテクスチャのサイズ
+	size_t peakBytes = 0;			// residentBytesの最大
+};
+
+/// <summary>
+/// ファイルの内容からハッシュ値を得る（内容が同じテクスチャを見つけるため）
+/// 8バイトずつ4レーンで掛け算と回転を繰り返す（xxHash64と同じ形のラウンド）
+/// </summary>
+uint64_t HashTextureContent(const void* data, size_t size);
+
+/// <summary>
+/// テクスチャのパスを正規化する（区切りを/に、英字を小文字にし、.と..を取り除く）
+/// Shift-JISの2バイト目は変換しない（「ソ」などの2バイト目は\と同じ値のため）
+/// </summary>
+std::string NormalizeTexturePath(const std::string& path);
+
+/// <summary>
+/// テクスチャの常駐管理（メインスレッドのみで使う）
+/// パスと内容のハッシュの両方でテクスチャを引き、同じパスも別のパスで同じ内容のものも1つのテクスチャを共有する
+/// 参照はパスごとに数え、テクスチャの参照数はそれを指すパスの参照数の合計になる
+/// 参照の無いテクスチャは予算を超えるまで残し、超えたら最後に使われたのが古いものから破棄する
+/// テクスチャそのものは持たず、エントリ番号で呼び出し側が管理する
+/// </summary>
+class TextureCache
+{
+public:
+	/// <summary>テクスチャを破棄したときに呼ばれる（呼び出し側はエントリ番号のテクスチャを解放する）</summary>
+	using EvictCallback = std::function<void(uint32_t entry, const std::vector<std::string>& paths)>;
+
+private:
+	struct Entry {
+		uint64_t hash = 0;
+		size_t bytes = 0;
+		size_t refCount = 0;
+		/// <summary>このテクスチャを指すパス（正規化済み）</summary>
+		std::vector<std::string> paths;
+		/// <summary>参照が無い場合のLRU内の位置</summary>
+		std::list<uint32_t>::iterator lru;
+		bool used = false;
+	};
+	struct PathEntry {
+		uint32_t entry = texture_cache_invalid;
+		size_t refCount = 0;
+	};
+
+	std::vector<Entry> _entries;
+	std::vector<uint32_t> _freeEntries;
+	std::unordered_map<std::string, PathEntry> _paths;
+	std::unordered_map<uint64_t, uint32_t> _hashes;
+	/// <summary>参照の無いテクスチャ（先頭が最も古い）</summary>
+	std::list<uint32_t> _lru;
+	size_t _budget;
+	EvictCallback _onEvict;
+	TextureCacheStats _stats;
+
+	void AddEntryRef(uint32_t entry, size_t count);
+	void Evict(uint32_t entry);
+	/// <summary>保持しているサイズにreserveBytesを足して予算に収まるまで破棄する</summary>
+	void Trim(size_t reserveBytes);
+
+public:
+	/// <param name="budget">参照の無いテクスチャを残しておく上限（バイト、参照中のものはこれを超えても破棄しない）</param>
+	/// <param name="onEvict">破棄の通知</param>
+	TextureCache(size_t budget, EvictCallback onEvict);
+
+	/// <summary>パスの参照を増やす（まだ読み込まれていないパスでもよい）</summary>
+	/// <param name="path">正規化済みのパス</param>
+	void AddRef(const std::string& path);
+	/// <summary>パスの参照を減らす（テクスチャの参照が無くなったら破棄の候補にする）</summary>
+	void Release(const std::string& path);
+
+	/// <summary>パスに対応するテクスチャのエントリ番号（無ければtexture_cache_invalid）</summary>
+	uint32_t FindPath(const std::string& path) const;
+	/// <summary>内容が同じテクスチャのエントリ番号（無ければtexture_cache_invalid、この場合は呼び出し側でテクスチャを作ってからInsertする）</summary>
+	uint32_t FindContent(uint64_t hash) const;
+
+	/// <summary>
+	/// パスにテクスチャを対応付ける
+	/// 内容が同じものがあればそれを共有し、無ければ新しいエントリを作る（予算を超える分は先に破棄する）
+	/// </summary>
+	/// <param name="path">正規化済みのパス</param>
+	/// <param name="hash">内容のハッシュ</param>
+	/// <param name="bytes">テクスチャのサイズ</param>
+	/// <returns>エントリ番号</returns>
+	uint32_t Insert(const std::string& path, uint64_t hash, size_t bytes);
+
+	/// <summary>予算を変える（超えている分はすぐに破棄する）</summary>
+	void SetBudget(size_t budget);
+	size_t Budget() const;
+
+	const TextureCacheStats& Stats() const;
+};
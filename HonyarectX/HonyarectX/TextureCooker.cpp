@@ -0,0 +1,790 @@
+﻿#include "TextureCooker.h"
+#include "MappedFile.h"
+#include "TextureCache.h"
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t block_dim = 4;
+	constexpr size_t block_pixel_num = 16;
+	constexpr size_t bc1_block_bytes = 8;
+	constexpr size_t bc3_block_bytes = 16;
+	constexpr int color_refine_max = 4;				// 端点を詰め直す最大回数
+
+	// DDSファイルの形式（DirectXTexのDDS.hと同じ並び）
+	constexpr uint32_t dds_magic = 0x20534444;				// "DDS "
+	constexpr uint32_t dds_fourcc_dxt1 = 0x31545844;		// "DXT1"
+	constexpr uint32_t dds_fourcc_dxt5 = 0x35545844;		// "DXT5"
+	constexpr uint32_t ddpf_alphapixels = 0x1;
+	constexpr uint32_t ddpf_fourcc = 0x4;
+	constexpr uint32_t ddpf_rgb = 0x40;
+	constexpr uint32_t ddsd_caps = 0x1;
+	constexpr uint32_t ddsd_height = 0x2;
+	constexpr uint32_t ddsd_width = 0x4;
+	constexpr uint32_t ddsd_pitch = 0x8;
+	constexpr uint32_t ddsd_pixelformat = 0x1000;
+	constexpr uint32_t ddsd_mipmapcount = 0x20000;
+	constexpr uint32_t ddsd_linearsize = 0x80000;
+	constexpr uint32_t ddscaps_complex = 0x8;
+	constexpr uint32_t ddscaps_texture = 0x1000;
+	constexpr uint32_t ddscaps_mipmap = 0x400000;
+
+	// 予約領域に入れる元のファイルの情報
+	constexpr uint32_t stamp_magic = 0x43545848;			// "HXTC"
+	constexpr uint32_t stamp_version = 1;
+	enum StampIndex {
+		stamp_magic_index,
+		stamp_version_index,
+		stamp_size_low,
+		stamp_size_high,
+		stamp_time_low,
+		stamp_time_high,
+	};
+
+#pragma pack(1)
+	struct DDSPixelFormat {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t fourCC;
+		uint32_t rgbBitCount;
+		uint32_t rBitMask;
+		uint32_t gBitMask;
+		uint32_t bBitMask;
+		uint32_t aBitMask;
+	};
+
+	struct DDSHeader {
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t pitchOrLinearSize;
+		uint32_t depth;
+		uint32_t mipMapCount;
+		uint32_t reserved1[11];
+		DDSPixelFormat ddspf;
+		uint32_t caps;
+		uint32_t caps2;
+		uint32_t caps3;
+		uint32_t caps4;
+		uint32_t reserved2;
+	};
+#pragma pack()
+	static_assert(sizeof(DDSHeader) == 124, "DDSヘッダのサイズが違う");
+
+	/// <summary>リニアな色（0～1）で持つミップマップ1段分（縮小の元にする）</summary>
+	struct LinearLevel {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		vector<XMFLOAT4> pixels;
+	};
+
+	bool IsBlockCompressed(DXGI_FORMAT format)
+	{
+		return format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC3_UNORM;
+	}
+
+	size_t BlockBytes(DXGI_FORMAT format)
+	{
+		return format == DXGI_FORMAT_BC1_UNORM ? bc1_block_bytes : bc3_block_bytes;
+	}
+
+	/// <summary>ミップマップ1段のバイト数と1行のバイト数</summary>
+	void MipSize(DXGI_FORMAT format, uint32_t width, uint32_t height, size_t& rowPitch, size_t& size)
+	{
+		if (IsBlockCompressed(format)) {
+			size_t blockWidth = max<uint32_t>(1, (width + block_dim - 1) / block_dim);
+			size_t blockHeight = max<uint32_t>(1, (height + block_dim - 1) / block_dim);
+			rowPitch = blockWidth * BlockBytes(format);
+			size = rowPitch * blockHeight;
+		}
+		else {
+			rowPitch = static_cast<size_t>(width) * 4;
+			size = rowPitch * height;
+		}
+	}
+
+	/// <summary>ミップマップの並びを作り、データの領域を確保する</summary>
+	void LayoutMips(DXGI_FORMAT format, uint32_t width, uint32_t height, size_t mipNum, CookedTexture& cooked)
+	{
+		cooked.format = format;
+		cooked.mips.resize(mipNum);
+		size_t offset = 0;
+		for (auto& mip : cooked.mips) {
+			mip.width = width;
+			mip.height = height;
+			mip.offset = offset;
+			MipSize(format, width, height, mip.rowPitch, mip.size);
+			offset += mip.size;
+			width = max<uint32_t>(1, width / 2);
+			height = max<uint32_t>(1, height / 2);
+		}
+		cooked.data.assign(offset, 0);
+	}
+
+	/// <summary>元のイメージをR8G8B8A8に揃える</summary>
+	bool ToRGBA(const Image& source, vector<uint8_t>& rgba)
+	{
+		size_t r, b;
+		bool hasAlpha = true;
+		switch (source.format) {
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			r = 0;
+			b = 2;
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			r = 2;
+			b = 0;
+			break;
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+			r = 2;
+			b = 0;
+			hasAlpha = false;
+			break;
+		default:
+			return false;
+		}
+		rgba.resize(source.width * source.height * 4);
+		auto dst = rgba.data();
+		for (size_t y = 0; y < source.height; ++y) {
+			auto src = source.pixels + y * source.rowPitch;
+			for (size_t x = 0; x < source.width; ++x, src += 4, dst += 4) {
+				dst[0] = src[r];
+				dst[1] = src[1];
+				dst[2] = src[b];
+				dst[3] = hasAlpha ? src[3] : 0xff;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>R8G8B8A8（sRGB）をリニアな色にする</summary>
+	void ToLinear(const uint8_t* rgba, uint32_t width, uint32_t height, LinearLevel& level)
+	{
+		level.width = width;
+		level.height = height;
+		level.pixels.resize(static_cast<size_t>(width) * height);
+		const auto scale = XMVectorReplicate(1.0f / 255.0f);
+		for (size_t i = 0; i < level.pixels.size(); ++i, rgba += 4) {
+			auto c = XMVectorSet(rgba[0], rgba[1], rgba[2], rgba[3]) * scale;
+			XMStoreFloat4(&level.pixels[i], XMColorSRGBToRGB(c));
+		}
+	}
+
+	/// <summary>2x2の平均で半分に縮小する（奇数の端は最後の画素を繰り返す）</summary>
+	void Downsample(const LinearLevel& src, LinearLevel& dst)
+	{
+		dst.width = max<uint32_t>(1, src.width / 2);
+		dst.height = max<uint32_t>(1, src.height / 2);
+		dst.pixels.resize(static_cast<size_t>(dst.width) * dst.height);
+		for (uint32_t y = 0; y < dst.height; ++y) {
+			auto y0 = min(y * 2, src.height - 1);
+			auto y1 = min(y * 2 + 1, src.height - 1);
+			for (uint32_t x = 0; x < dst.width; ++x) {
+				auto x0 = min(x * 2, src.width - 1);
+				auto x1 = min(x * 2 + 1, src.width - 1);
+				auto sum = XMLoadFloat4(&src.pixels[y0 * src.width + x0]) + XMLoadFloat4(&src.pixels[y0 * src.width + x1]) +
+					XMLoadFloat4(&src.pixels[y1 * src.width + x0]) + XMLoadFloat4(&src.pixels[y1 * src.width + x1]);
+				XMStoreFloat4(&dst.pixels[y * dst.width + x], sum * 0.25f);
+			}
+		}
+	}
+
+	/// <summary>リニアな色をR8G8B8A8（sRGB）に戻す</summary>
+	void ToSRGB(const LinearLevel& level, vector<uint8_t>& rgba)
+	{
+		rgba.resize(level.pixels.size() * 4);
+		const auto scale = XMVectorReplicate(255.0f);
+		const auto half = XMVectorReplicate(0.5f);
+		for (size_t i = 0; i < level.pixels.size(); ++i) {
+			auto c = XMVectorSaturate(XMColorRGBToSRGB(XMLoadFloat4(&level.pixels[i])));
+			XMFLOAT4 q;
+			XMStoreFloat4(&q, XMVectorMultiplyAdd(c, scale, half));
+			rgba[i * 4 + 0] = static_cast<uint8_t>(q.x);
+			rgba[i * 4 + 1] = static_cast<uint8_t>(q.y);
+			rgba[i * 4 + 2] = static_cast<uint8_t>(q.z);
+			rgba[i * 4 + 3] = static_cast<uint8_t>(q.w);
+		}
+	}
+
+	/// <summary>8bitの色（0～255）を565にする</summary>
+	uint16_t To565(FXMVECTOR color)
+	{
+		XMFLOAT4 c;
+		XMStoreFloat4(&c, XMVectorClamp(color, XMVectorZero(), XMVectorReplicate(255.0f)));
+		auto r = static_cast<uint32_t>(c.x * (31.0f / 255.0f) + 0.5f);
+		auto g = static_cast<uint32_t>(c.y * (63.0f / 255.0f) + 0.5f);
+		auto b = static_cast<uint32_t>(c.z * (31.0f / 255.0f) + 0.5f);
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	/// <summary>565を8bitの色に戻す</summary>
+	void From565(uint16_t color, uint32_t* rgb)
+	{
+		auto r = (color >> 11) & 0x1f;
+		auto g = (color >> 5) & 0x3f;
+		auto b = color & 0x1f;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	/// <summary>BC1/BC3の色のパレット（fourColorがfalseなら3色と透明の黒）</summary>
+	void ColorPalette(uint16_t c0, uint16_t c1, bool fourColor, uint32_t palette[4][4])
+	{
+		From565(c0, palette[0]);
+		From565(c1, palette[1]);
+		palette[0][3] = palette[1][3] = 0xff;
+		for (size_t ch = 0; ch < 3; ++ch) {
+			auto p0 = palette[0][ch];
+			auto p1 = palette[1][ch];
+			if (fourColor) {
+				palette[2][ch] = (2 * p0 + p1) / 3;
+				palette[3][ch] = (p0 + 2 * p1) / 3;
+			}
+			else {
+				palette[2][ch] = (p0 + p1) / 2;
+				palette[3][ch] = 0;
+			}
+		}
+		palette[2][3] = 0xff;
+		palette[3][3] = fourColor ? 0xff : 0;
+	}
+
+	/// <summary>BC3のアルファのパレット（a0 > a1なら8段階、そうでなければ6段階と0と255）</summary>
+	void AlphaPalette(uint32_t a0, uint32_t a1, uint32_t palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1) {
+			for (uint32_t i = 1; i < 7; ++i) {
+				palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+			}
+		}
+		else {
+			for (uint32_t i = 1; i < 5; ++i) {
+				palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 0xff;
+		}
+	}
+
+	/// <summary>
+	/// 端点を決めた色ブロックで、各画素に最も近いパレットの色を選ぶ
+	/// パレットの4色の各チャンネルを1つのベクトルに並べ、1画素につき4色分の距離を一度に求める
+	/// </summary>
+	/// <returns>二乗誤差の合計</returns>
+	float FitColorIndices(const XMVECTOR* colors, uint16_t& c0, uint16_t& c1, uint32_t& indices)
+	{
+		// 常に4色モードにする（c0 > c1）
+		if (c0 < c1) {
+			swap(c0, c1);
+		}
+		indices = 0;
+		if (c0 == c1) {
+			uint32_t rgb[3];
+			From565(c0, rgb);
+			auto p = XMVectorSet(static_cast<float>(rgb[0]), static_cast<float>(rgb[1]), static_cast<float>(rgb[2]), 0.0f);
+			float error = 0.0f;
+			for (size_t i = 0; i < block_pixel_num; ++i) {
+				error += XMVectorGetX(XMVector3LengthSq(colors[i] - p));
+			}
+			return error;
+		}
+		uint32_t palette[4][4];
+		ColorPalette(c0, c1, true, palette);
+		auto pr = XMVectorSet(static_cast<float>(palette[0][0]), static_cast<float>(palette[1][0]), static_cast<float>(palette[2][0]), static_cast<float>(palette[3][0]));
+		auto pg = XMVectorSet(static_cast<float>(palette[0][1]), static_cast<float>(palette[1][1]), static_cast<float>(palette[2][1]), static_cast<float>(palette[3][1]));
+		auto pb = XMVectorSet(static_cast<float>(palette[0][2]), static_cast<float>(palette[1][2]), static_cast<float>(palette[2][2]), static_cast<float>(palette[3][2]));
+		float error = 0.0f;
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			auto dr = XMVectorSplatX(colors[i]) - pr;
+			auto dg = XMVectorSplatY(colors[i]) - pg;
+			auto db = XMVectorSplatZ(colors[i]) - pb;
+			XMFLOAT4 d;
+			XMStoreFloat4(&d, dr * dr + dg * dg + db * db);
+			uint32_t best = 0;
+			auto bestDistance = d.x;
+			if (d.y < bestDistance) { best = 1; bestDistance = d.y; }
+			if (d.z < bestDistance) { best = 2; bestDistance = d.z; }
+			if (d.w < bestDistance) { best = 3; bestDistance = d.w; }
+			indices |= best << (i * 2);
+			error += bestDistance;
+		}
+		return error;
+	}
+
+	/// <summary>選んだ割り当てに対して、二乗誤差が最小になる端点を最小二乗法で求める</summary>
+	bool RefineColorEndpoints(const XMVECTOR* colors, uint32_t indices, XMVECTOR& e0, XMVECTOR& e1)
+	{
+		// 割り当てごとのc0の重み（c1の重みは1から引いたもの）
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		auto ax = XMVectorZero();
+		auto bx = XMVectorZero();
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			auto w = weights[(indices >> (i * 2)) & 3];
+			aa += w * w;
+			ab += w * (1.0f - w);
+			bb += (1.0f - w) * (1.0f - w);
+			ax += colors[i] * w;
+			bx += colors[i] * (1.0f - w);
+		}
+		auto det = aa * bb - ab * ab;
+		if (fabs(det) < 1e-6f) {
+			return false;
+		}
+		auto inv = 1.0f / det;
+		e0 = (ax * bb - bx * ab) * inv;
+		e1 = (bx * aa - ax * ab) * inv;
+		return true;
+	}
+
+	/// <summary>
+	/// 4x4の色（0～255、wは使わない）からBC1の色ブロックを作る
+	/// 共分散行列の最大の固有ベクトル（主軸）をべき乗法で求め、主軸上の両端を端点にする
+	/// </summary>
+	void EncodeColorBlock(const XMVECTOR* colors, bool refine, uint8_t* block)
+	{
+		auto mean = XMVectorZero();
+		auto minColor = colors[0];
+		auto maxColor = colors[0];
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			mean += colors[i];
+			minColor = XMVectorMin(minColor, colors[i]);
+			maxColor = XMVectorMax(maxColor, colors[i]);
+		}
+		mean = mean * (1.0f / block_pixel_num);
+
+		// 共分散行列（対称なので列と行は同じ）
+		auto covX = XMVectorZero();
+		auto covY = XMVectorZero();
+		auto covZ = XMVectorZero();
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			auto d = colors[i] - mean;
+			covX += d * XMVectorSplatX(d);
+			covY += d * XMVectorSplatY(d);
+			covZ += d * XMVectorSplatZ(d);
+		}
+		// べき乗法（最初の軸は範囲の対角線）
+		auto axis = maxColor - minColor;
+		for (int iter = 0; iter < 8; ++iter) {
+			auto next = covX * XMVectorSplatX(axis) + covY * XMVectorSplatY(axis) + covZ * XMVectorSplatZ(axis);
+			if (XMVectorGetX(XMVector3LengthSq(next)) < 1e-12f) {
+				break;
+			}
+			axis = XMVector3Normalize(next);
+		}
+		axis = XMVector3Normalize(XMVectorSetW(axis, 0.0f));
+
+		// 主軸に射影した両端
+		auto minT = 0.0f;
+		auto maxT = 0.0f;
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			auto t = XMVectorGetX(XMVector3Dot(colors[i] - mean, axis));
+			minT = min(minT, t);
+			maxT = max(maxT, t);
+		}
+		auto e0 = mean + axis * maxT;
+		auto e1 = mean + axis * minT;
+		auto c0 = To565(e0);
+		auto c1 = To565(e1);
+		uint32_t indices;
+		auto error = FitColorIndices(colors, c0, c1, indices);
+
+		// 割り当てが変わらなくなるか、誤差が減らなくなるまで詰め直す
+		for (int iter = 0; refine && iter < color_refine_max && error > 0.0f && RefineColorEndpoints(colors, indices, e0, e1); ++iter) {
+			auto r0 = To565(e0);
+			auto r1 = To565(e1);
+			uint32_t refinedIndices;
+			auto refinedError = FitColorIndices(colors, r0, r1, refinedIndices);
+			if (refinedError >= error) {
+				break;
+			}
+			auto unchanged = refinedIndices == indices;
+			c0 = r0;
+			c1 = r1;
+			indices = refinedIndices;
+			error = refinedError;
+			if (unchanged) {
+				break;
+			}
+		}
+
+		block[0] = static_cast<uint8_t>(c0);
+		block[1] = static_cast<uint8_t>(c0 >> 8);
+		block[2] = static_cast<uint8_t>(c1);
+		block[3] = static_cast<uint8_t>(c1 >> 8);
+		memcpy(block + 4, &indices, sizeof(indices));
+	}
+
+	/// <summary>4x4のアルファ（0～255）からBC3のアルファブロックを作る（最大と最小を端点にした8段階）</summary>
+	void EncodeAlphaBlock(const uint8_t* alphas, uint8_t* block)
+	{
+		uint32_t a0 = alphas[0];
+		uint32_t a1 = alphas[0];
+		for (size_t i = 1; i < block_pixel_num; ++i) {
+			a0 = max<uint32_t>(a0, alphas[i]);
+			a1 = min<uint32_t>(a1, alphas[i]);
+		}
+		block[0] = static_cast<uint8_t>(a0);
+		block[1] = static_cast<uint8_t>(a1);
+		uint64_t bits = 0;
+		if (a0 != a1) {
+			uint32_t palette[8];
+			AlphaPalette(a0, a1, palette);
+			auto p0 = XMVectorSet(static_cast<float>(palette[0]), static_cast<float>(palette[1]), static_cast<float>(palette[2]), static_cast<float>(palette[3]));
+			auto p1 = XMVectorSet(static_cast<float>(palette[4]), static_cast<float>(palette[5]), static_cast<float>(palette[6]), static_cast<float>(palette[7]));
+			for (size_t i = 0; i < block_pixel_num; ++i) {
+				auto a = XMVectorReplicate(alphas[i]);
+				float distances[8];
+				XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(distances), XMVectorAbs(a - p0));
+				XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(distances + 4), XMVectorAbs(a - p1));
+				uint64_t best = 0;
+				for (uint64_t k = 1; k < 8; ++k) {
+					if (distances[k] < distances[best]) {
+						best = k;
+					}
+				}
+				bits |= best << (i * 3);
+			}
+		}
+		for (size_t i = 0; i < 6; ++i) {
+			block[2 + i] = static_cast<uint8_t>(bits >> (i * 8));
+		}
+	}
+
+	/// <summary>ブロックの4x4画素を取り出す（イメージの外は端の画素を繰り返す）</summary>
+	void GatherBlock(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by, XMVECTOR* colors, uint8_t* alphas)
+	{
+		for (uint32_t y = 0; y < block_dim; ++y) {
+			auto sy = min(by * block_dim + y, height - 1);
+			for (uint32_t x = 0; x < block_dim; ++x) {
+				auto sx = min(bx * block_dim + x, width - 1);
+				auto p = rgba + (static_cast<size_t>(sy) * width + sx) * 4;
+				colors[y * block_dim + x] = XMVectorSet(p[0], p[1], p[2], 0.0f);
+				alphas[y * block_dim + x] = p[3];
+			}
+		}
+	}
+
+	/// <summary>R8G8B8A8のミップマップ1段を圧縮して書き込む</summary>
+	void EncodeMip(const uint8_t* rgba, const CookedMip& mip, DXGI_FORMAT format, bool refine, uint8_t* dst)
+	{
+		if (!IsBlockCompressed(format)) {
+			memcpy(dst, rgba, mip.size);
+			return;
+		}
+		auto blockBytes = BlockBytes(format);
+		auto blockWidth = static_cast<uint32_t>(mip.rowPitch / blockBytes);
+		auto blockHeight = static_cast<uint32_t>(mip.size / mip.rowPitch);
+		XMVECTOR colors[block_pixel_num];
+		uint8_t alphas[block_pixel_num];
+		for (uint32_t by = 0; by < blockHeight; ++by) {
+			for (uint32_t bx = 0; bx < blockWidth; ++bx) {
+				auto block = dst + by * mip.rowPitch + bx * blockBytes;
+				GatherBlock(rgba, mip.width, mip.height, bx, by, colors, alphas);
+				if (format == DXGI_FORMAT_BC3_UNORM) {
+					EncodeAlphaBlock(alphas, block);
+					block += 8;
+				}
+				EncodeColorBlock(colors, refine, block);
+			}
+		}
+	}
+
+	void DecodeColorBlock(const uint8_t* block, bool allowThreeColor, uint8_t* rgba)
+	{
+		auto c0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+		auto c1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+		uint32_t indices;
+		memcpy(&indices, block + 4, sizeof(indices));
+		uint32_t palette[4][4];
+		ColorPalette(c0, c1, !allowThreeColor || c0 > c1, palette);
+		for (size_t i = 0; i < block_pixel_num; ++i) {
+			auto& p = palette[(indices >> (i * 2)) & 3];
+			for (size_t ch = 0; ch < 4; ++ch) {
+				rgba[i * 4 + ch] = static_cast<uint8_t>(p[ch]);
+			}
+		}
+	}
+
+	/// <summary>ヘッダを読み、形式とミップマップ数を調べる</summary>
+	bool ReadHeader(const uint8_t* data, size_t size, DDSHeader& header, DXGI_FORMAT& format)
+	{
+		uint32_t magic;
+		if (size < sizeof(magic) + sizeof(header)) {
+			return false;
+		}
+		memcpy(&magic, data, sizeof(magic));
+		memcpy(&header, data + sizeof(magic), sizeof(header));
+		if (magic != dds_magic || header.size != sizeof(DDSHeader) || header.ddspf.size != sizeof(DDSPixelFormat) ||
+			header.reserved1[stamp_magic_index] != stamp_magic || header.reserved1[stamp_version_index] != stamp_version ||
+			header.width == 0 || header.height == 0) {
+			return false;
+		}
+		auto& pf = header.ddspf;
+		if ((pf.flags & ddpf_fourcc) && pf.fourCC == dds_fourcc_dxt1) {
+			format = DXGI_FORMAT_BC1_UNORM;
+		}
+		else if ((pf.flags & ddpf_fourcc) && pf.fourCC == dds_fourcc_dxt5) {
+			format = DXGI_FORMAT_BC3_UNORM;
+		}
+		else if ((pf.flags & ddpf_rgb) && pf.rgbBitCount == 32 && pf.rBitMask == 0xff && pf.gBitMask == 0xff00 &&
+			pf.bBitMask == 0xff0000 && pf.aBitMask == 0xff000000) {
+			format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+		else {
+			return false;
+		}
+		return header.mipMapCount >= 1 && header.mipMapCount <= 32;
+	}
+}
+
+bool CookTexture(const Image& source, const TextureCookOptions& options, CookedTexture& cooked)
+{
+	cooked = CookedTexture();
+	if (source.width == 0 || source.height == 0 || source.width > 0xffff || source.height > 0xffff) {
+		return false;
+	}
+	auto width = static_cast<uint32_t>(source.width);
+	auto height = static_cast<uint32_t>(source.height);
+	vector<uint8_t> rgba;
+	if (!ToRGBA(source, rgba)) {
+		return false;
+	}
+
+	// 形式を決める（BCは最上段が4x4のブロックに割り切れる場合のみ）
+	auto blockAligned = width % block_dim == 0 && height % block_dim == 0;
+	DXGI_FORMAT format;
+	switch (options.format) {
+	case TextureCookFormat::BC1:
+		format = DXGI_FORMAT_BC1_UNORM;
+		break;
+	case TextureCookFormat::BC3:
+		format = DXGI_FORMAT_BC3_UNORM;
+		break;
+	case TextureCookFormat::RGBA:
+		format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		break;
+	default:
+		if (!blockAligned) {
+			format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+		else {
+			auto opaque = true;
+			for (size_t i = 3; i < rgba.size() && opaque; i += 4) {
+				opaque = rgba[i] == 0xff;
+			}
+			format = opaque ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC3_UNORM;
+		}
+		break;
+	}
+	if (IsBlockCompressed(format) && !blockAligned) {
+		return false;
+	}
+
+	size_t mipNum = 1;
+	if (options.generateMips) {
+		for (auto w = width, h = height; w > 1 || h > 1; w = max<uint32_t>(1, w / 2), h = max<uint32_t>(1, h / 2)) {
+			++mipNum;
+		}
+	}
+	LayoutMips(format, width, height, mipNum, cooked);
+
+	// 最上段は元の画素をそのまま使い、以降はリニアな色で縮小していく
+	LinearLevel level;
+	LinearLevel next;
+	if (mipNum > 1) {
+		ToLinear(rgba.data(), width, height, level);
+	}
+	for (size_t m = 0; m < mipNum; ++m) {
+		auto& mip = cooked.mips[m];
+		if (m > 0) {
+			Downsample(level, next);
+			swap(level, next);
+			ToSRGB(level, rgba);
+		}
+		EncodeMip(rgba.data(), mip, format, options.refine, cooked.data.data() + mip.offset);
+	}
+	return true;
+}
+
+void DecodeBC1Block(const uint8_t* block, uint8_t* rgba)
+{
+	DecodeColorBlock(block, true, rgba);
+}
+
+void DecodeBC3Block(const uint8_t* block, uint8_t* rgba)
+{
+	DecodeColorBlock(block + 8, false, rgba);
+	uint32_t palette[8];
+	AlphaPalette(block[0], block[1], palette);
+	uint64_t bits = 0;
+	for (size_t i = 0; i < 6; ++i) {
+		bits |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+	}
+	for (size_t i = 0; i < block_pixel_num; ++i) {
+		rgba[i * 4 + 3] = static_cast<uint8_t>(palette[(bits >> (i * 3)) & 7]);
+	}
+}
+
+bool DecompressCookedMip(const CookedTexture& cooked, size_t mip, vector<uint8_t>& rgba)
+{
+	if (mip >= cooked.mips.size()) {
+		return false;
+	}
+	auto& m = cooked.mips[mip];
+	auto src = cooked.data.data() + m.offset;
+	rgba.resize(static_cast<size_t>(m.width) * m.height * 4);
+	if (!IsBlockCompressed(cooked.format)) {
+		memcpy(rgba.data(), src, rgba.size());
+		return true;
+	}
+	auto blockBytes = BlockBytes(cooked.format);
+	auto blockWidth = m.rowPitch / blockBytes;
+	auto blockHeight = m.size / m.rowPitch;
+	uint8_t block[block_pixel_num * 4];
+	for (size_t by = 0; by < blockHeight; ++by) {
+		for (size_t bx = 0; bx < blockWidth; ++bx) {
+			auto p = src + by * m.rowPitch + bx * blockBytes;
+			if (cooked.format == DXGI_FORMAT_BC1_UNORM) {
+				DecodeBC1Block(p, block);
+			}
+			else {
+				DecodeBC3Block(p, block);
+			}
+			// イメージの外にはみ出した画素は捨てる
+			for (size_t y = 0; y < block_dim && by * block_dim + y < m.height; ++y) {
+				for (size_t x = 0; x < block_dim && bx * block_dim + x < m.width; ++x) {
+					memcpy(&rgba[((by * block_dim + y) * m.width + bx * block_dim + x) * 4], &block[(y * block_dim + x) * 4], 4);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+string CookedTexturePath(const string& sourcePath)
+{
+	return sourcePath + ".dds";
+}
+
+bool WriteCookedTexture(const char* path, const CookedTexture& cooked, const char* sourcePath)
+{
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (cooked.mips.empty() || !GetFileStamp(sourcePath, sourceSize, sourceTime)) {
+		return false;
+	}
+
+	DDSHeader header = {};
+	header.size = sizeof(DDSHeader);
+	header.flags = ddsd_caps | ddsd_height | ddsd_width | ddsd_pixelformat | ddsd_mipmapcount;
+	header.width = cooked.Width();
+	header.height = cooked.Height();
+	header.mipMapCount = static_cast<uint32_t>(cooked.mips.size());
+	header.caps = ddscaps_texture;
+	if (cooked.mips.size() > 1) {
+		header.caps |= ddscaps_complex | ddscaps_mipmap;
+	}
+	header.ddspf.size = sizeof(DDSPixelFormat);
+	if (IsBlockCompressed(cooked.format)) {
+		header.flags |= ddsd_linearsize;
+		header.pitchOrLinearSize = static_cast<uint32_t>(cooked.mips[0].size);
+		header.ddspf.flags = ddpf_fourcc;
+		header.ddspf.fourCC = cooked.format == DXGI_FORMAT_BC1_UNORM ? dds_fourcc_dxt1 : dds_fourcc_dxt5;
+	}
+	else {
+		header.flags |= ddsd_pitch;
+		header.pitchOrLinearSize = static_cast<uint32_t>(cooked.mips[0].rowPitch);
+		header.ddspf.flags = ddpf_rgb | ddpf_alphapixels;
+		header.ddspf.rgbBitCount = 32;
+		header.ddspf.rBitMask = 0xff;
+		header.ddspf.gBitMask = 0xff00;
+		header.ddspf.bBitMask = 0xff0000;
+		header.ddspf.aBitMask = 0xff000000;
+	}
+	header.reserved1[stamp_magic_index] = stamp_magic;
+	header.reserved1[stamp_version_index] = stamp_version;
+	header.reserved1[stamp_size_low] = static_cast<uint32_t>(sourceSize);
+	header.reserved1[stamp_size_high] = static_cast<uint32_t>(sourceSize >> 32);
+	header.reserved1[stamp_time_low] = static_cast<uint32_t>(sourceTime);
+	header.reserved1[stamp_time_high] = static_cast<uint32_t>(static_cast<uint64_t>(sourceTime) >> 32);
+
+	FILE* fp = nullptr;
+#ifdef _MSC_VER
+	fopen_s(&fp, path, "wb");
+#else
+	fp = fopen(path, "wb");
+#endif
+	if (fp == nullptr) {
+		return false;
+	}
+	auto ok = fwrite(&dds_magic, sizeof(dds_magic), 1, fp) == 1 &&
+		fwrite(&header, sizeof(header), 1, fp) == 1 &&
+		fwrite(cooked.data.data(), cooked.data.size(), 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		remove(path);
+	}
+	return ok;
+}
+
+bool LoadCookedTexture(const uint8_t* data, size_t size, CookedTexture& cooked)
+{
+	cooked = CookedTexture();
+	DDSHeader header;
+	DXGI_FORMAT format;
+	if (!ReadHeader(data, size, header, format)) {
+		return false;
+	}
+	LayoutMips(format, header.width, header.height, header.mipMapCount, cooked);
+	auto payload = sizeof(dds_magic) + sizeof(header);
+	if (size - payload < cooked.data.size()) {
+		cooked = CookedTexture();
+		return false;
+	}
+	memcpy(cooked.data.data(), data + payload, cooked.data.size());
+	return true;
+}
+
+bool IsCookedTextureFresh(const uint8_t* data, size_t size, const char* sourcePath)
+{
+	DDSHeader header;
+	DXGI_FORMAT format;
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!ReadHeader(data, size, header, format) || !GetFileStamp(sourcePath, sourceSize, sourceTime)) {
+		return false;
+	}
+	auto stampSize = header.reserved1[stamp_size_low] | (static_cast<uint64_t>(header.reserved1[stamp_size_high]) << 32);
+	auto stampTime = header.reserved1[stamp_time_low] | (static_cast<uint64_t>(header.reserved1[stamp_time_high]) << 32);
+	return stampSize == sourceSize && static_cast<int64_t>(stampTime) == sourceTime;
+}
+
+uint64_t HashCookedTexture(const uint8_t* data, size_t size)
+{
+	auto headerSize = sizeof(dds_magic) + sizeof(DDSHeader);
+	if (size < headerSize) {
+		return HashTextureContent(data, size);
+	}
+	// 元のファイルの情報を除いたヘッダと、ミップマップの内容
+	DDSHeader header;
+	memcpy(&header, data + sizeof(dds_magic), sizeof(header));
+	for (auto index : { stamp_size_low, stamp_size_high, stamp_time_low, stamp_time_high }) {
+		header.reserved1[index] = 0;
+	}
+	return HashTextureContent(&header, sizeof(header)) ^
+		(HashTextureContent(data + headerSize, size - headerSize) * 0x9e3779b97f4a7c15ull);
+}
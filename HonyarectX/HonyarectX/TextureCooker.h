@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <DirectXTex.h>
+
+/// <summary>クックするテクスチャの形式</summary>
+enum class TextureCookFormat {
+	Auto,		// アルファがすべて255ならBC1、そうでなければBC3（幅と高さが4の倍数でなければRGBA）
+	BC1,		// 色のみ（4x4を8バイト）
+	BC3,		// 色とアルファ（4x4を16バイト）
+	RGBA,		// 圧縮しない（R8G8B8A8）
+};
+
+/// <summary>クックの設定</summary>
+struct TextureCookOptions {
+	TextureCookFormat format = TextureCookFormat::Auto;
+	bool generateMips = true;		// ミップマップを1x1まで作る
+	bool refine = true;				// BC1/BC3の色の端点を最小二乗法で1回詰め直す
+};
+
+/// <summary>ミップマップ1段分の位置（CookedTexture::dataの中）</summary>
+struct CookedMip {
+	uint32_t width;
+	uint32_t height;
+	size_t rowPitch;				// 1行（圧縮形式は4x4ブロックの1行）のバイト数
+	size_t offset;
+	size_t size;
+};
+
+/// <summary>クック済みのテクスチャ（全ミップマップを大きい順に連結したもの）</summary>
+struct CookedTexture {
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	std::vector<CookedMip> mips;
+	std::vector<uint8_t> data;
+
+	uint32_t Width() const { return mips.empty() ? 0 : mips[0].width; }
+	uint32_t Height() const { return mips.empty() ? 0 : mips[0].height; }
+};
+
+/// <summary>
+/// テクスチャをクックする（デバイスを使わないのでツールやワーカースレッドからも使える）
+/// ミップマップは色をsRGBからリニアに戻してから2x2の平均で縮小し、sRGBに戻して格納する（アルファはそのまま平均）
+/// BC1/BC3の色は、ブロック内の色の主軸をべき乗法で求めて両端を端点にし、各画素を最も近い色に割り当てる
+/// 形式はこれまでと同じ見た目になるようにSRGBの付かないUNORMにする
+/// </summary>
+/// <param name="source">元のイメージ（R8G8B8A8、B8G8R8A8、B8G8R8X8のいずれか）</param>
+/// <param name="options">クックの設定</param>
+/// <param name="cooked">結果</param>
+/// <returns>元のイメージの形式に対応していない、BCなのに幅と高さが4の倍数でない場合はfalse</returns>
+bool CookTexture(const DirectX::Image& source, const TextureCookOptions& options, CookedTexture& cooked);
+
+/// <summary>クック済みのテクスチャのミップマップ1段をR8G8B8A8に展開する（画質の確認用）</summary>
+/// <param name="cooked">クック済みのテクスチャ</param>
+/// <param name="mip">ミップマップの段</param>
+/// <param name="rgba">結果（幅×高さ×4バイト）</param>
+bool DecompressCookedMip(const CookedTexture& cooked, size_t mip, std::vector<uint8_t>& rgba);
+
+/// <summary>BC1ブロック（8バイト）を4x4のR8G8B8A8に展開する</summary>
+void DecodeBC1Block(const uint8_t* block, uint8_t* rgba);
+
+/// <summary>BC3ブロック（16バイト）を4x4のR8G8B8A8に展開する</summary>
+void DecodeBC3Block(const uint8_t* block, uint8_t* rgba);
+
+/// <summary>クック済みのテクスチャを置くパス（元のファイル名に.ddsを付けたもの）</summary>
+std::string CookedTexturePath(const std::string& sourcePath);
+
+/// <summary>
+/// クック済みのテクスチャをDDSファイルに書き出す
+/// ヘッダの予約領域に元のファイルのサイズと更新時刻を入れ、元のファイルが変わったら使わないようにする
+/// </summary>
+/// <param name="path">書き出すパス</param>
+/// <param name="cooked">クック済みのテクスチャ</param>
+/// <param name="sourcePath">元のファイル</param>
+bool WriteCookedTexture(const char* path, const CookedTexture& cooked, const char* sourcePath);
+
+/// <summary>WriteCookedTextureで書き出したDDSファイルを読み込む（ヘッダを検証し、内容はコピーする）</summary>
+bool LoadCookedTexture(const uint8_t* data, size_t size, CookedTexture& cooked);
+
+/// <summary>クック済みのDDSファイルが元のファイルから作られ、その後元のファイルが変わっていないか</summary>
+/// <param name="data">DDSファイルの内容</param>
+/// <param name="size">DDSファイルのサイズ</param>
+/// <param name="sourcePath">元のファイル</param>
+bool IsCookedTextureFresh(const uint8_t* data, size_t size, const char* sourcePath);
+
+/// <summary>
+/// クック済みのDDSファイルの内容のハッシュ（元のファイルの情報は除く）
+/// 別のファイルから同じ内容にクックされたものを同じテクスチャとして扱うため
+/// </summary>
+uint64_t HashCookedTexture(const uint8_t* data, size_t size);
@@ -0,0 +1,156 @@
+﻿#include "TextureStreamer.h"
+#include "ThreadPool.h"
+using namespace std;
+
+namespace
+{
+	using Clock = chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start, Clock::time_point end)
+	{
+		return chrono::duration<double, milli>(end - start).count();
+	}
+}
+
+TextureCompletionQueue::~TextureCompletionQueue()
+{
+	auto node = _head.exchange(nullptr);
+	while (node != nullptr) {
+		auto next = node->next;
+		delete node;
+		node = next;
+	}
+}
+
+void TextureCompletionQueue::Push(const TextureHandle& request)
+{
+	auto node = new Node{ request, _head.load(memory_order_relaxed) };
+	// 失敗した場合はnode->nextが現在の先頭に更新されるので、そのままやり直せばよい
+	while (!_head.compare_exchange_weak(node->next, node, memory_order_release, memory_order_relaxed)) {
+	}
+}
+
+size_t TextureCompletionQueue::PopAll(deque<TextureHandle>& out)
+{
+	auto node = _head.exchange(nullptr, memory_order_acquire);
+	// 後に積まれたものが先頭なので、反転して積まれた順にする
+	Node* reversed = nullptr;
+	while (node != nullptr) {
+		auto next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+	}
+	size_t ret = 0;
+	while (reversed != nullptr) {
+		auto next = reversed->next;
+		out.push_back(move(reversed->request));
+		delete reversed;
+		reversed = next;
+		++ret;
+	}
+	return ret;
+}
+
+TextureStreamer::TextureStreamer(TextureDecoder decoder, size_t threadNum,
+	function<void()> threadBegin, function<void()> threadEnd) :
+	_decoder(move(decoder))
+{
+	_pool.reset(new ThreadPool(threadNum, threadBegin, threadEnd));
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	// ワーカーが完了キューに積み終わるのを待ってから、キューと要求を破棄する
+	_pool.reset();
+}
+
+TextureHandle TextureStreamer::Request(const string& path)
+{
+	TextureHandle request;
+	{
+		lock_guard<mutex> lock(_mutex);
+		auto it = _requests.find(path);
+		if (it != _requests.end()) {
+			return it->second;
+		}
+		request = make_shared<TextureRequest>();
+		request->path = path;
+		request->requestTime = Clock::now();
+		_requests.emplace(path, request);
+	}
+	++_decodingNum;
+	_pool->Submit([this, request]() { Decode(request); });
+	return request;
+}
+
+void TextureStreamer::Decode(const TextureHandle& request)
+{
+	auto start = Clock::now();
+	auto decoded = make_shared<DecodedTexture>();
+	auto succeeded = _decoder(request->path, *decoded);
+	request->decodeMs = ElapsedMs(start, Clock::now());
+	if (succeeded) {
+		request->decoded = decoded;
+	}
+	// 失敗したものも、メインスレッドで集計するためにキューへ積む
+	request->state = succeeded ? TextureState::Decoded : TextureState::Failed;
+	_completed.Push(request);
+	--_decodingNum;
+}
+
+size_t TextureStreamer::Update(size_t maxUploads, double budgetMs, const TextureUploader& upload)
+{
+	_completed.PopAll(_uploadQueue);
+	auto start = Clock::now();
+	size_t ret = 0;
+	while (!_uploadQueue.empty() && ret < maxUploads) {
+		if (ret > 0 && ElapsedMs(start, Clock::now()) >= budgetMs) {
+			break;
+		}
+		auto request = move(_uploadQueue.front());
+		_uploadQueue.pop_front();
+		if (request->state == TextureState::Decoded && upload(*request)) {
+			request->state = TextureState::Ready;
+			++_readyNum;
+		}
+		else {
+			request->state = TextureState::Failed;
+			++_failedNum;
+		}
+		request->decoded.reset();
+		request->readyMs = ElapsedMs(request->requestTime, Clock::now());
+		++ret;
+	}
+	return ret;
+}
+
+void TextureStreamer::Forget(const string& path)
+{
+	lock_guard<mutex> lock(_mutex);
+	auto it = _requests.find(path);
+	if (it != _requests.end() && it->second->state == TextureState::Ready) {
+		--_readyNum;
+		_requests.erase(it);
+	}
+}
+
+bool TextureStreamer::Idle() const
+{
+	return _decodingNum == 0 && _uploadQueue.empty() && _completed.Empty();
+}
+
+TextureStreamStats TextureStreamer::GetStats()
+{
+	// 要求数より先にデコード中の数を読む（間に要求が増えても転送待ちが負にならない）
+	TextureStreamStats ret;
+	ret.decoding = _decodingNum;
+	{
+		lock_guard<mutex> lock(_mutex);
+		ret.requested = _requests.size();
+	}
+	ret.ready = _readyNum;
+	ret.failed = _failedNum;
+	ret.waiting = ret.requested - ret.decoding - ret.ready - ret.failed;
+	return ret;
+}
@@ -0,0 +1,156 @@
+﻿#pragma once
+
+#include <DirectXTex.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ThreadPool;
+
+/// <summary>デコード済みのテクスチャ</summary>
+struct DecodedTexture {
+	DirectX::TexMetadata metadata = {};
+	DirectX::ScratchImage image;
+	/// <summary>ファイルの内容のハッシュ（内容が同じテクスチャを共有するため）</summary>
+	uint64_t contentHash = 0;
+};
+
+/// <summary>テクスチャ要求の状態</summary>
+enum class TextureState {
+	Decoding,				// ワーカースレッドでデコード中（またはデコード待ち）
+	Decoded,				// デコード済みで転送待ち
+	Ready,					// 転送済み（代わりのテクスチャから差し替えてよい）
+	Failed,					// デコードか転送に失敗した（代わりのテクスチャのまま）
+};
+
+/// <summary>
+/// テクスチャ要求1件分（ハンドルとして共有する）
+/// 同じパスの要求は同じものを返す
+/// </summary>
+struct TextureRequest {
+	std::string path;
+	std::atomic<TextureState> state{ TextureState::Decoding };
+	/// <summary>デコード結果（ワーカーが書き込み、完了キューを通してメインスレッドへ渡す、転送後は解放する）</summary>
+	std::shared_ptr<DecodedTexture> decoded;
+	std::chrono::high_resolution_clock::time_point requestTime;
+	double decodeMs = 0.0;			// デコードにかかった時間
+	double readyMs = 0.0;			// 要求から転送完了（または失敗）まで
+};
+using TextureHandle = std::shared_ptr<TextureRequest>;
+
+/// <summary>デコード処理（ワーカースレッドから呼ばれる、デバイスは使わないこと）</summary>
+using TextureDecoder = std::function<bool(const std::string& path, DecodedTexture& decoded)>;
+/// <summary>転送処理（メインスレッドから呼ばれる）</summary>
+using TextureUploader = std::function<bool(const TextureRequest& request)>;
+
+/// <summary>
+/// デコードを終えた要求の受け渡し（複数のワーカーが積み、メインスレッドだけが取り出す）
+/// 積む側はCASで先頭に繋ぐだけのロックフリーのスタックで、取り出す側は全体を一度に外して積まれた順に戻す
+/// （取り出しは常に全体なのでABA問題は起きない）
+/// </summary>
+class TextureCompletionQueue
+{
+private:
+	struct Node {
+		TextureHandle request;
+		Node* next;
+	};
+	std::atomic<Node*> _head{ nullptr };
+
+public:
+	TextureCompletionQueue() = default;
+	~TextureCompletionQueue();
+	TextureCompletionQueue(const TextureCompletionQueue&) = delete;
+	TextureCompletionQueue& operator=(const TextureCompletionQueue&) = delete;
+
+	/// <summary>積む（どのスレッドからでもよい）</summary>
+	void Push(const TextureHandle& request);
+	/// <summary>積まれているものをすべて積まれた順にoutの末尾へ移す（取り出すスレッドは1つに限る）</summary>
+	size_t PopAll(std::deque<TextureHandle>& out);
+	/// <summary>何も積まれていないか</summary>
+	bool Empty() const { return _head.load(std::memory_order_acquire) == nullptr; }
+};
+
+/// <summary>テクスチャ読み込みの集計</summary>
+struct TextureStreamStats {
+	size_t requested = 0;			// 要求されたテクスチャ数（同じパスは1つ）
+	size_t decoding = 0;			// デコード中
+	size_t waiting = 0;				// デコード済みで転送待ち
+	size_t ready = 0;				// 転送済み
+	size_t failed = 0;				// 失敗
+};
+
+/// <summary>
+/// テクスチャの非同期読み込み
+/// 要求はすぐに戻り、デコードはワーカースレッドで行う（呼び出し側はその間、代わりのテクスチャを使う）
+/// デコードを終えたものは完了キューに積まれ、メインスレッドが毎フレームUpdateで時間の許す分だけ転送する
+/// デコーダーと転送処理は外から渡すので、デバイス無しでもCPU側だけで動かせる
+/// </summary>
+class TextureStreamer
+{
+private:
+	TextureDecoder _decoder;
+	std::unique_ptr<ThreadPool> _pool;
+
+	std::mutex _mutex;
+	/// <summary>パスから要求（同じパスは一度だけデコードする）</summary>
+	std::unordered_map<std::string, TextureHandle> _requests;
+
+	TextureCompletionQueue _completed;
+	/// <summary>完了キューから取り出して転送を待っているもの（メインスレッドのみ触る）</summary>
+	std::deque<TextureHandle> _uploadQueue;
+
+	std::atomic<size_t> _decodingNum{ 0 };
+	size_t _readyNum = 0;
+	size_t _failedNum = 0;
+
+	void Decode(const TextureHandle& request);
+
+public:
+	/// <param name="decoder">デコード処理</param>
+	/// <param name="threadNum">ワーカースレッド数（0ならハードウェアスレッド数）</param>
+	/// <param name="threadBegin">各ワーカーの開始時に呼ばれる（COM初期化など）</param>
+	/// <param name="threadEnd">各ワーカーの終了時に呼ばれる</param>
+	explicit TextureStreamer(TextureDecoder decoder, size_t threadNum = 0,
+		std::function<void()> threadBegin = nullptr, std::function<void()> threadEnd = nullptr);
+	/// <summary>デコード中のものは完了を待つ（転送はしない）</summary>
+	~TextureStreamer();
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	/// <summary>
+	/// テクスチャを要求する（どのスレッドから呼んでもよく、デコードを待たずに戻る）
+	/// </summary>
+	/// <param name="path">テクスチャファイルパス</param>
+	/// <returns>要求のハンドル（stateがReadyになるまでは代わりのテクスチャを使う）</returns>
+	TextureHandle Request(const std::string& path);
+
+	/// <summary>
+	/// デコードを終えたものを転送する（メインスレッドから毎フレーム呼ぶ）
+	/// 予算を超えた分は次のフレームに回す（1つ目は時間に関わらず転送する）
+	/// </summary>
+	/// <param name="maxUploads">1回で転送する最大数</param>
+	/// <param name="budgetMs">1回で転送に使う時間の目安（ミリ秒）</param>
+	/// <param name="upload">転送処理</param>
+	/// <returns>転送した数（失敗を含む）</returns>
+	size_t Update(size_t maxUploads, double budgetMs, const TextureUploader& upload);
+
+	/// <summary>
+	/// 転送済みの要求を忘れる（次に要求されたら読み込み直す、メインスレッドから呼ぶ）
+	/// テクスチャを破棄したときに呼ぶ（Ready以外のものはそのまま）
+	/// </summary>
+	void Forget(const std::string& path);
+
+	/// <summary>デコード中も転送待ちも無いか</summary>
+	bool Idle() const;
+
+	/// <summary>集計（メインスレッドから呼ぶ）</summary>
+	TextureStreamStats GetStats();
+};
@@ -0,0 +1,64 @@
+﻿#include "ThreadPool.h"
+#include <algorithm>
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threadNum, function<void()> threadBegin, function<void()> threadEnd)
+{
+	if (threadNum == 0) {
+		threadNum = max<size_t>(1, thread::hardware_concurrency());
+	}
+	_threads.reserve(threadNum);
+	for (size_t i = 0; i < threadNum; ++i) {
+		_threads.emplace_back(&ThreadPool::WorkerMain, this, threadBegin, threadEnd);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stop = true;
+	}
+	_condition.notify_all();
+	for (auto& th : _threads) {
+		th.join();
+	}
+}
+
+void ThreadPool::Submit(function<void()> task)
+{
+	{
+		lock_guard<mutex> lock(_mutex);
+		_tasks.emplace_back(move(task));
+	}
+	_condition.notify_one();
+}
+
+size_t ThreadPool::ThreadNum() const
+{
+	return _threads.size();
+}
+
+void ThreadPool::WorkerMain(function<void()> threadBegin, function<void()> threadEnd)
+{
+	if (threadBegin) {
+		threadBegin();
+	}
+	while (true) {
+		function<void()> task;
+		{
+			unique_lock<mutex> lock(_mutex);
+			_condition.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+			// 終了指示があっても積まれているタスクは処理しきる
+			if (_tasks.empty()) {
+				break;
+			}
+			task = move(_tasks.front());
+			_tasks.pop_front();
+		}
+		task();
+	}
+	if (threadEnd) {
+		threadEnd();
+	}
+}
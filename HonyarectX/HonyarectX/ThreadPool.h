@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// 固定数のワーカースレッドでタスクを処理するスレッドプール
+/// </summary>
+class ThreadPool
+{
+private:
+	std::vector<std::thread> _threads;
+	std::deque<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	bool _stop = false;
+
+	void WorkerMain(std::function<void()> threadBegin, std::function<void()> threadEnd);
+
+public:
+	/// <param name="threadNum">スレッド数（0ならハードウェアスレッド数）</param>
+	/// <param name="threadBegin">各ワーカーの開始時に呼ばれる（COM初期化など）</param>
+	/// <param name="threadEnd">各ワーカーの終了時に呼ばれる</param>
+	explicit ThreadPool(size_t threadNum = 0,
+		std::function<void()> threadBegin = nullptr,
+		std::function<void()> threadEnd = nullptr);
+	/// <summary>積まれているタスクをすべて処理してからスレッドを終了する</summary>
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// <summary>タスクを積む（ワーカースレッドから積んでもよい）</summary>
+	void Submit(std::function<void()> task);
+
+	/// <summary>戻り値をfutureで受け取るタスクを積む</summary>
+	template<typename F>
+	auto Enqueue(F&& func) -> std::future<decltype(func())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::forward<F>(func));
+		auto ret = task->get_future();
+		Submit([task]() { (*task)(); });
+		return ret;
+	}
+
+	size_t ThreadNum() const;
+};
@@ -0,0 +1,263 @@
+﻿#include "VMDParser.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <future>
+
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	// 各セクションの1件のサイズ（ファイル上は詰めて並ぶ）
+	const size_t vmd_header_size = 30;
+	const size_t vmd_bone_size = 15 + 4 + 12 + 16 + 64;
+	const size_t vmd_morph_size = 15 + 4 + 4;
+	const size_t vmd_camera_size = 4 + 4 + 12 + 12 + 24 + 4 + 1;
+	const size_t vmd_light_size = 4 + 12 + 12;
+	const size_t vmd_self_shadow_size = 4 + 1 + 4;
+	const size_t vmd_ik_header_size = 4 + 1 + 4;
+	const size_t vmd_ik_bone_size = 20 + 1;
+
+	/// <summary>範囲を確かめながら先頭から読み進める</summary>
+	class VMDReader
+	{
+	private:
+		const uint8_t* _p;
+		const uint8_t* _end;
+
+	public:
+		VMDReader(const uint8_t* data, size_t size) : _p(data), _end(data + size) {}
+
+		size_t Remaining() const { return static_cast<size_t>(_end - _p); }
+
+		/// <summary>続くrecordSizeバイトのレコードの個数を読む（ファイルに収まらなければfalse）</summary>
+		bool ReadCount(size_t recordSize, uint32_t& count)
+		{
+			if (Remaining() < sizeof(count)) {
+				return false;
+			}
+			memcpy(&count, _p, sizeof(count));
+			_p += sizeof(count);
+			return count <= Remaining() / recordSize;
+		}
+
+		/// <summary>残りがsizeバイト以上あることを確かめて、その先頭を返す</summary>
+		const uint8_t* Take(size_t size)
+		{
+			if (Remaining() < size) {
+				return nullptr;
+			}
+			auto p = _p;
+			_p += size;
+			return p;
+		}
+	};
+
+	/// <summary>固定長の名前（NULで終わらない場合もある）</summary>
+	inline void ReadName(const uint8_t* p, size_t size, string& name)
+	{
+		auto s = reinterpret_cast<const char*>(p);
+		name.assign(s, find(s, s + size, '\0'));
+	}
+
+	template<typename T>
+	inline const uint8_t* ReadValue(const uint8_t* p, T& value)
+	{
+		memcpy(&value, p, sizeof(value));
+		return p + sizeof(value);
+	}
+}
+
+size_t VMDData::KeyFrameNum() const
+{
+	return boneKeyFrames.size() + morphKeyFrames.size() + cameraKeyFrames.size() + lightKeyFrames.size() +
+		selfShadowKeyFrames.size() + ikEnableData.size();
+}
+
+void VMDData::Clear()
+{
+	modelName.clear();
+	boneKeyFrames.clear();
+	morphKeyFrames.clear();
+	cameraKeyFrames.clear();
+	lightKeyFrames.clear();
+	selfShadowKeyFrames.clear();
+	ikEnableData.clear();
+}
+
+bool ParseVMDMemory(const uint8_t* data, size_t size, VMDData& vmd)
+{
+	vmd.Clear();
+	if (data == nullptr) {
+		return false;
+	}
+	VMDReader reader(data, size);
+
+	// ヘッダ（30バイト）とモデル名（旧形式の"file"は10バイト、"0002"などの番号が付いたものは20バイト）
+	auto header = reader.Take(vmd_header_size);
+	if (header == nullptr || memcmp(header, "Vocaloid Motion Data ", 21) != 0) {
+		return false;
+	}
+	auto modelNameSize = memcmp(header + 21, "file", 4) == 0 ? static_cast<size_t>(10) : static_cast<size_t>(20);
+	auto modelName = reader.Take(modelNameSize);
+	if (modelName == nullptr) {
+		return false;
+	}
+	ReadName(modelName, modelNameSize, vmd.modelName);
+
+	// ボーン
+	uint32_t count = 0;
+	if (!reader.ReadCount(vmd_bone_size, count)) {
+		return false;
+	}
+	vmd.boneKeyFrames.resize(count);
+	auto p = reader.Take(vmd_bone_size * count);
+	for (auto& key : vmd.boneKeyFrames) {
+		ReadName(p, 15, key.name);
+		ReadValue(p + 15, key.frameNo);
+		ReadValue(p + 19, key.location);
+		ReadValue(p + 31, key.quaternion);
+		// 補間は先頭の16バイト（4本の曲線の制御点）のみ使う
+		memcpy(key.bezier, p + 47, sizeof(key.bezier));
+		p += vmd_bone_size;
+	}
+
+	// 表情
+	if (!reader.ReadCount(vmd_morph_size, count)) {
+		return false;
+	}
+	vmd.morphKeyFrames.resize(count);
+	p = reader.Take(vmd_morph_size * count);
+	for (auto& key : vmd.morphKeyFrames) {
+		ReadName(p, 15, key.name);
+		ReadValue(p + 15, key.frameNo);
+		ReadValue(p + 19, key.weight);
+		p += vmd_morph_size;
+	}
+
+	// ここから先のセクションは無いファイルもある（セクションの境目で終わっていれば残りは空）
+	if (reader.Remaining() == 0) {
+		return true;
+	}
+	// カメラ
+	if (!reader.ReadCount(vmd_camera_size, count)) {
+		return false;
+	}
+	vmd.cameraKeyFrames.resize(count);
+	p = reader.Take(vmd_camera_size * count);
+	for (auto& key : vmd.cameraKeyFrames) {
+		ReadValue(p, key.frameNo);
+		ReadValue(p + 4, key.distance);
+		ReadValue(p + 8, key.position);
+		ReadValue(p + 20, key.eulerAngle);
+		memcpy(key.interpolation, p + 32, sizeof(key.interpolation));
+		ReadValue(p + 56, key.fov);
+		key.perspective = p[60] == 0;	// 0がON
+		p += vmd_camera_size;
+	}
+
+	if (reader.Remaining() == 0) {
+		return true;
+	}
+	// 照明
+	if (!reader.ReadCount(vmd_light_size, count)) {
+		return false;
+	}
+	vmd.lightKeyFrames.resize(count);
+	p = reader.Take(vmd_light_size * count);
+	for (auto& key : vmd.lightKeyFrames) {
+		ReadValue(p, key.frameNo);
+		ReadValue(p + 4, key.rgb);
+		ReadValue(p + 16, key.vec);
+		p += vmd_light_size;
+	}
+
+	if (reader.Remaining() == 0) {
+		return true;
+	}
+	// セルフ影
+	if (!reader.ReadCount(vmd_self_shadow_size, count)) {
+		return false;
+	}
+	vmd.selfShadowKeyFrames.resize(count);
+	p = reader.Take(vmd_self_shadow_size * count);
+	for (auto& key : vmd.selfShadowKeyFrames) {
+		ReadValue(p, key.frameNo);
+		key.mode = p[4];
+		ReadValue(p + 5, key.distance);
+		p += vmd_self_shadow_size;
+	}
+
+	if (reader.Remaining() == 0) {
+		return true;
+	}
+	// IKオンオフ（キーフレームごとに切り替える可能性のあるIKの名前とフラグがすべて並ぶ）
+	if (!reader.ReadCount(vmd_ik_header_size, count)) {
+		return false;
+	}
+	vmd.ikEnableData.resize(count);
+	for (auto& ikEnable : vmd.ikEnableData) {
+		p = reader.Take(vmd_ik_header_size);
+		if (p == nullptr) {
+			return false;
+		}
+		ReadValue(p, ikEnable.frameNo);
+		// p[4]は表示のフラグで使わない
+		uint32_t ikBoneCount = 0;
+		ReadValue(p + 5, ikBoneCount);
+		if (ikBoneCount > reader.Remaining() / vmd_ik_bone_size) {
+			return false;
+		}
+		p = reader.Take(vmd_ik_bone_size * ikBoneCount);
+		string name;
+		for (uint32_t i = 0; i < ikBoneCount; ++i) {
+			ReadName(p, 20, name);
+			ikEnable.ikEnableTable[name] = p[20] != 0;
+			p += vmd_ik_bone_size;
+		}
+	}
+	return true;
+}
+
+bool ParseVMDFile(const char* path, VMDData& vmd)
+{
+	MappedFile file;
+	if (!file.Open(path)) {
+		vmd.Clear();
+		return false;
+	}
+	return ParseVMDMemory(file.Data(), file.Size(), vmd);
+}
+
+vector<VMDFileResult> ParseVMDFiles(const vector<string>& paths, ThreadPool* pool)
+{
+	vector<VMDFileResult> results(paths.size());
+	auto parse = [&paths, &results](size_t i) {
+		auto& result = results[i];
+		result.path = paths[i];
+		result.succeeded = ParseVMDFile(paths[i].c_str(), result.data);
+	};
+	if (pool == nullptr) {
+		for (size_t i = 0; i < paths.size(); ++i) {
+			parse(i);
+		}
+		return results;
+	}
+	// ファイルごとにタスクにする（結果はそれぞれの要素に書くので排他は要らない）
+	vector<future<void>> tasks;
+	tasks.reserve(paths.size());
+	for (size_t i = 0; i < paths.size(); ++i) {
+		tasks.push_back(pool->Enqueue([&parse, i]() { parse(i); }));
+	}
+	for (auto& task : tasks) {
+		task.get();
+	}
+	return results;
+}
+
+vector<VMDFileResult> ParseVMDDirectory(const char* directory, ThreadPool* pool)
+{
+	return ParseVMDFiles(ListFiles(directory, ".vmd"), pool);
+}
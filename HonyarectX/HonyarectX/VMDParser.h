@@ -0,0 +1,89 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <DirectXMath.h>
+#include "AnimationClip.h"
+#include "MorphEngine.h"
+
+class ThreadPool;
+
+//IKオンオフデータ
+struct VMDIKEnable {
+	uint32_t frameNo;
+	std::unordered_map<std::string, bool> ikEnableTable;
+};
+
+/// <summary>カメラのキーフレーム</summary>
+struct VMDCameraKeyFrame {
+	uint32_t frameNo;					// フレーム番号
+	float distance;						// 距離
+	DirectX::XMFLOAT3 position;			// 座標
+	DirectX::XMFLOAT3 eulerAngle;		// オイラー角
+	uint8_t interpolation[24];			// 補間
+	uint32_t fov;						// 視界角
+	bool perspective;					// パースフラグON/OFF
+};
+
+/// <summary>照明のキーフレーム</summary>
+struct VMDLightKeyFrame {
+	uint32_t frameNo;					// フレーム番号
+	DirectX::XMFLOAT3 rgb;				// ライト色
+	DirectX::XMFLOAT3 vec;				// 光線ベクトル（平行光線）
+};
+
+/// <summary>セルフ影のキーフレーム</summary>
+struct VMDSelfShadowKeyFrame {
+	uint32_t frameNo;					// フレーム番号
+	uint8_t mode;						// 影モード（0:影なし、1：モード1、2:モード2）
+	float distance;						// 距離
+};
+
+/// <summary>VMDファイルの内容</summary>
+struct VMDData {
+	std::string modelName;								// モーションを作ったモデルの名前
+	std::vector<BoneKeyFrame> boneKeyFrames;			// ボーン
+	std::vector<MorphKeyFrame> morphKeyFrames;			// 表情
+	std::vector<VMDCameraKeyFrame> cameraKeyFrames;		// カメラ
+	std::vector<VMDLightKeyFrame> lightKeyFrames;		// 照明
+	std::vector<VMDSelfShadowKeyFrame> selfShadowKeyFrames;	// セルフ影
+	std::vector<VMDIKEnable> ikEnableData;				// IKのオンオフ
+
+	/// <summary>すべての種類のキーフレームの数</summary>
+	size_t KeyFrameNum() const;
+	void Clear();
+};
+
+/// <summary>
+/// VMDをメモリから読み込む
+/// 先頭から1回だけ読み進め、各セクションは個数がファイルに収まることを確かめてから確保する
+/// 名前は固定長の領域のNULまで（NULが無ければ領域の終わりまで）
+/// カメラ以降のセクションが無い古いファイルも読める（無いセクションは空になる）
+/// </summary>
+/// <param name="data">ファイルの内容（メモリマップしたものをそのまま渡してよい）</param>
+/// <param name="size">ファイルサイズ</param>
+/// <param name="vmd">結果（失敗した場合の内容は不定）</param>
+/// <returns>VMDでないか、セクションの途中で終わっている場合はfalse</returns>
+bool ParseVMDMemory(const uint8_t* data, size_t size, VMDData& vmd);
+
+/// <summary>VMDファイルをメモリマップして読み込む</summary>
+bool ParseVMDFile(const char* path, VMDData& vmd);
+
+/// <summary>まとめて読み込んだVMDファイル1つ分の結果</summary>
+struct VMDFileResult {
+	std::string path;
+	bool succeeded = false;
+	VMDData data;
+};
+
+/// <summary>
+/// 複数のVMDファイルを並列に読み込む（結果はpathsと同じ順）
+/// </summary>
+/// <param name="pool">読み込むスレッド（nullptrなら呼び出したスレッドで順に読み込む）</param>
+std::vector<VMDFileResult> ParseVMDFiles(const std::vector<std::string>& paths, ThreadPool* pool);
+
+/// <summary>ディレクトリにあるVMDファイル（.vmd、サブディレクトリは含まない）をすべて並列に読み込む</summary>
+std::vector<VMDFileResult> ParseVMDDirectory(const char* directory, ThreadPool* pool);
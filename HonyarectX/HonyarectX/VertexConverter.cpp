@@ -0,0 +1,268 @@
+﻿#include "VertexConverter.h"
+#include <DirectXPackedVector.h>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+using namespace std;
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace
+{
+	int16_t ToSnorm16(float v)
+	{
+		v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+		return static_cast<int16_t>(lroundf(v * 32767.0f));
+	}
+
+	float FromSnorm16(int16_t v)
+	{
+		// -32768は-32767と同じ扱い（DXGIのSNORMと同じ）
+		return max(static_cast<float>(v) / 32767.0f, -1.0f);
+	}
+
+	float SignNotZero(float v)
+	{
+		return v >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	/// <summary>正規化した法線（長さが0の場合はZ軸）</summary>
+	XMFLOAT3 NormalizeNormal(const XMFLOAT3& normal)
+	{
+		auto len = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		if (len <= 0.0f) {
+			return XMFLOAT3(0.0f, 0.0f, 1.0f);
+		}
+		return XMFLOAT3(normal.x / len, normal.y / len, normal.z / len);
+	}
+
+	/// <summary>法線を八面体マッピングで2成分にする</summary>
+	void EncodeOctahedral(const XMFLOAT3& normal, int16_t* out)
+	{
+		auto n = NormalizeNormal(normal);
+		auto l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+		auto x = n.x / l1;
+		auto y = n.y / l1;
+		if (n.z < 0.0f) {
+			// 下半球は折り返す
+			auto ox = (1.0f - fabsf(y)) * SignNotZero(x);
+			auto oy = (1.0f - fabsf(x)) * SignNotZero(y);
+			x = ox;
+			y = oy;
+		}
+		out[0] = ToSnorm16(x);
+		out[1] = ToSnorm16(y);
+	}
+
+	/// <summary>八面体マッピングした法線を戻す（シェーダー側と同じ計算）</summary>
+	XMFLOAT3 DecodeOctahedral(const int16_t* in)
+	{
+		XMFLOAT3 n(FromSnorm16(in[0]), FromSnorm16(in[1]), 0.0f);
+		n.z = 1.0f - fabsf(n.x) - fabsf(n.y);
+		auto t = max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return NormalizeNormal(n);
+	}
+
+	void EncodeUV(const XMFLOAT2& uv, uint16_t* out)
+	{
+		out[0] = XMConvertFloatToHalf(uv.x);
+		out[1] = XMConvertFloatToHalf(uv.y);
+	}
+
+	XMFLOAT2 DecodeUV(const uint16_t* in)
+	{
+		return XMFLOAT2(XMConvertHalfToFloat(in[0]), XMConvertHalfToFloat(in[1]));
+	}
+
+	/// <summary>転送先へ書き込む（アライメントされていない位置でもよい）</summary>
+	template<typename T>
+	void Store(uint8_t* stream, size_t idx, const T& value)
+	{
+		memcpy(stream + idx * sizeof(T), &value, sizeof(T));
+	}
+
+	template<typename T>
+	T Load(const vector<uint8_t>& stream, size_t idx)
+	{
+		T ret;
+		assert((idx + 1) * sizeof(T) <= stream.size());
+		memcpy(&ret, stream.data() + idx * sizeof(T), sizeof(T));
+		return ret;
+	}
+}
+
+const char* VertexLayoutName(VertexLayout layout)
+{
+	switch (layout) {
+	case VertexLayout::Raw:
+		return "raw";
+	case VertexLayout::Packed32:
+		return "packed32";
+	case VertexLayout::Split:
+		return "split";
+	}
+	return "unknown";
+}
+
+VertexStreamFormat GetVertexStreamFormat(VertexLayout layout)
+{
+	VertexStreamFormat ret = {};
+	switch (layout) {
+	case VertexLayout::Raw:
+		ret.streamNum = 1;
+		ret.strides[0] = sizeof(PMDVertex);
+		break;
+	case VertexLayout::Packed32:
+		ret.streamNum = 1;
+		ret.strides[0] = sizeof(PackedVertex);
+		break;
+	case VertexLayout::Split:
+		ret.streamNum = 3;
+		ret.strides[0] = sizeof(XMFLOAT3);
+		ret.strides[1] = sizeof(SkinVertex);
+		ret.strides[2] = sizeof(AttributeVertex);
+		break;
+	}
+	return ret;
+}
+
+size_t GetVertexBytes(VertexLayout layout, size_t vertexNum)
+{
+	auto format = GetVertexStreamFormat(layout);
+	size_t ret = 0;
+	for (size_t i = 0; i < format.streamNum; ++i) {
+		ret += format.strides[i] * vertexNum;
+	}
+	return ret;
+}
+
+void ConvertVertices(const PMDView<PMDVertex>& vertices, VertexLayout layout, uint8_t* const* streams)
+{
+	if (layout == VertexLayout::Raw) {
+		memcpy(streams[0], vertices.bytes(), vertices.byteSize());
+		return;
+	}
+
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		auto src = vertices[i];
+		if (layout == VertexLayout::Packed32) {
+			PackedVertex dst = {};
+			dst.pos = src.pos;
+			auto n = NormalizeNormal(src.normal);
+			dst.normal[0] = ToSnorm16(n.x);
+			dst.normal[1] = ToSnorm16(n.y);
+			dst.normal[2] = ToSnorm16(n.z);
+			EncodeUV(src.uv, dst.uv);
+			dst.boneNo[0] = src.boneNo[0];
+			dst.boneNo[1] = src.boneNo[1];
+			dst.boneWeight = src.boneWeight;
+			Store(streams[0], i, dst);
+		}
+		else {
+			SkinVertex skin = {};
+			skin.boneNo[0] = src.boneNo[0];
+			skin.boneNo[1] = src.boneNo[1];
+			skin.boneWeight = src.boneWeight;
+			AttributeVertex attr = {};
+			EncodeOctahedral(src.normal, attr.normal);
+			EncodeUV(src.uv, attr.uv);
+			Store(streams[0], i, src.pos);
+			Store(streams[1], i, skin);
+			Store(streams[2], i, attr);
+		}
+	}
+}
+
+void ConvertVertices(const PMDView<PMDVertex>& vertices, VertexLayout layout, ConvertedVertices& converted)
+{
+	auto format = GetVertexStreamFormat(layout);
+	converted.layout = layout;
+	converted.vertexNum = vertices.size();
+	uint8_t* streams[vertex_stream_max] = {};
+	for (size_t i = 0; i < vertex_stream_max; ++i) {
+		converted.streams[i].clear();
+		if (i < format.streamNum) {
+			converted.streams[i].resize(format.strides[i] * vertices.size());
+			streams[i] = converted.streams[i].data();
+		}
+	}
+	if (vertices.empty()) {
+		return;
+	}
+	ConvertVertices(vertices, layout, streams);
+}
+
+DecodedVertex DecodeVertex(const ConvertedVertices& converted, size_t idx)
+{
+	DecodedVertex ret = {};
+	switch (converted.layout) {
+	case VertexLayout::Raw:
+	{
+		auto src = Load<PMDVertex>(converted.streams[0], idx);
+		ret.pos = src.pos;
+		ret.normal = src.normal;
+		ret.uv = src.uv;
+		ret.boneNo[0] = src.boneNo[0];
+		ret.boneNo[1] = src.boneNo[1];
+		ret.boneWeight = src.boneWeight;
+		break;
+	}
+	case VertexLayout::Packed32:
+	{
+		auto src = Load<PackedVertex>(converted.streams[0], idx);
+		ret.pos = src.pos;
+		ret.normal = XMFLOAT3(FromSnorm16(src.normal[0]), FromSnorm16(src.normal[1]), FromSnorm16(src.normal[2]));
+		ret.uv = DecodeUV(src.uv);
+		ret.boneNo[0] = src.boneNo[0];
+		ret.boneNo[1] = src.boneNo[1];
+		ret.boneWeight = src.boneWeight;
+		break;
+	}
+	case VertexLayout::Split:
+	{
+		auto skin = Load<SkinVertex>(converted.streams[1], idx);
+		auto attr = Load<AttributeVertex>(converted.streams[2], idx);
+		ret.pos = Load<XMFLOAT3>(converted.streams[0], idx);
+		ret.normal = DecodeOctahedral(attr.normal);
+		ret.uv = DecodeUV(attr.uv);
+		ret.boneNo[0] = skin.boneNo[0];
+		ret.boneNo[1] = skin.boneNo[1];
+		ret.boneWeight = skin.boneWeight;
+		break;
+	}
+	}
+	return ret;
+}
+
+VertexConversionError VerifyVertices(const PMDView<PMDVertex>& vertices, const ConvertedVertices& converted)
+{
+	VertexConversionError ret;
+	assert(vertices.size() == converted.vertexNum);
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		auto src = vertices[i];
+		auto dst = DecodeVertex(converted, i);
+
+		ret.maxPositionError = max({ ret.maxPositionError,
+			fabsf(src.pos.x - dst.pos.x), fabsf(src.pos.y - dst.pos.y), fabsf(src.pos.z - dst.pos.z) });
+
+		// 長さが0の法線は比較しない
+		auto lenSq = src.normal.x * src.normal.x + src.normal.y * src.normal.y + src.normal.z * src.normal.z;
+		if (lenSq > 0.0f) {
+			auto a = NormalizeNormal(src.normal);
+			auto b = NormalizeNormal(dst.normal);
+			auto dot = a.x * b.x + a.y * b.y + a.z * b.z;
+			dot = dot < -1.0f ? -1.0f : (dot > 1.0f ? 1.0f : dot);
+			ret.maxNormalAngle = max(ret.maxNormalAngle, XMConvertToDegrees(acosf(dot)));
+		}
+
+		ret.maxUVError = max({ ret.maxUVError, fabsf(src.uv.x - dst.uv.x), fabsf(src.uv.y - dst.uv.y) });
+
+		if (src.boneNo[0] != dst.boneNo[0] || src.boneNo[1] != dst.boneNo[1] || src.boneWeight != dst.boneWeight) {
+			++ret.boneMismatchNum;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,114 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include "PMDModelData.h"
+
+/// <summary>GPUに転送する頂点の形式</summary>
+enum class VertexLayout {
+	Raw,			// PMDの頂点そのまま（38バイト、1ストリーム）
+	Packed32,		// 32バイトにまとめた形式（1ストリーム）
+	Split,			// 座標、スキニング、属性の3ストリームに分けた形式
+};
+
+/// <summary>ストリーム数の最大</summary>
+constexpr size_t vertex_stream_max = 3;
+
+/// <summary>
+/// Packed32の頂点（32バイト）
+/// 法線はR16G16B16A16_SNORM（wは0）、UVはR16G16_FLOAT
+/// </summary>
+struct PackedVertex {
+	DirectX::XMFLOAT3 pos;				// 頂点座標
+	int16_t normal[4];					// 法線ベクトル
+	uint16_t uv[2];						// UV座標（半精度）
+	uint16_t boneNo[2];					// ボーン番号
+	uint8_t boneWeight;					// ボーン影響度
+	uint8_t reserved[3];
+};
+
+/// <summary>Splitのスキニング用ストリーム（8バイト）</summary>
+struct SkinVertex {
+	uint16_t boneNo[2];					// ボーン番号
+	uint8_t boneWeight;					// ボーン影響度
+	uint8_t reserved[3];
+};
+
+/// <summary>
+/// Splitの属性ストリーム（8バイト）
+/// 法線は八面体マッピングしたR16G16_SNORM、UVはR16G16_FLOAT
+/// </summary>
+struct AttributeVertex {
+	int16_t normal[2];					// 法線ベクトル（八面体マッピング）
+	uint16_t uv[2];						// UV座標（半精度）
+};
+
+static_assert(sizeof(PackedVertex) == 32, "PackedVertex size mismatch");
+static_assert(sizeof(SkinVertex) == 8, "SkinVertex size mismatch");
+static_assert(sizeof(AttributeVertex) == 8, "AttributeVertex size mismatch");
+
+/// <summary>形式ごとのストリーム構成</summary>
+struct VertexStreamFormat {
+	size_t streamNum;							// ストリーム数
+	uint32_t strides[vertex_stream_max];		// ストリームごとの1頂点あたりのバイト数
+};
+
+/// <summary>頂点形式に変換した結果（ツールや検証用にCPU側で保持する）</summary>
+struct ConvertedVertices {
+	VertexLayout layout = VertexLayout::Raw;
+	size_t vertexNum = 0;
+	std::vector<uint8_t> streams[vertex_stream_max];
+};
+
+/// <summary>変換後の頂点を元の精度に戻したもの</summary>
+struct DecodedVertex {
+	DirectX::XMFLOAT3 pos;				// 頂点座標
+	DirectX::XMFLOAT3 normal;			// 法線ベクトル
+	DirectX::XMFLOAT2 uv;				// UV座標
+	uint16_t boneNo[2];					// ボーン番号
+	uint8_t boneWeight;					// ボーン影響度
+};
+
+/// <summary>変換による誤差</summary>
+struct VertexConversionError {
+	float maxPositionError = 0.0f;		// 座標の最大誤差
+	float maxNormalAngle = 0.0f;		// 法線の最大角度差（度）
+	float maxUVError = 0.0f;			// UVの最大誤差
+	size_t boneMismatchNum = 0;			// ボーン番号か影響度が一致しなかった頂点数
+};
+
+/// <summary>頂点バッファのサイズ（変換でどれだけ減ったかの報告用）</summary>
+struct VertexMemoryStats {
+	VertexLayout layout = VertexLayout::Raw;
+	size_t sourceBytes = 0;				// PMDの頂点のままの場合のバイト数（最適化でまとめる前の頂点数分）
+	size_t convertedBytes = 0;			// 変換後のバイト数（全ストリーム合計）
+};
+
+/// <summary>形式名（ログ用）</summary>
+const char* VertexLayoutName(VertexLayout layout);
+
+/// <summary>形式ごとのストリーム構成を返す</summary>
+VertexStreamFormat GetVertexStreamFormat(VertexLayout layout);
+
+/// <summary>指定の形式で頂点数分のバイト数（全ストリーム合計）</summary>
+size_t GetVertexBytes(VertexLayout layout, size_t vertexNum);
+
+/// <summary>
+/// PMDの頂点を指定の形式に変換する
+/// 転送先はストリームごとに頂点数×ストライド分確保しておくこと（アップロードバッファに直接書いてよい）
+/// </summary>
+/// <param name="vertices">PMDの頂点</param>
+/// <param name="layout">変換先の形式</param>
+/// <param name="streams">ストリームごとの転送先</param>
+void ConvertVertices(const PMDView<PMDVertex>& vertices, VertexLayout layout, uint8_t* const* streams);
+
+/// <summary>PMDの頂点を指定の形式に変換し、CPU側に保持する</summary>
+void ConvertVertices(const PMDView<PMDVertex>& vertices, VertexLayout layout, ConvertedVertices& converted);
+
+/// <summary>変換後の頂点を1つ取り出す</summary>
+DecodedVertex DecodeVertex(const ConvertedVertices& converted, size_t idx);
+
+/// <summary>変換後の頂点を元の頂点と比較する</summary>
+VertexConversionError VerifyVertices(const PMDView<PMDVertex>& vertices, const ConvertedVertices& converted);
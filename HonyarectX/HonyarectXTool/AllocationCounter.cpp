@@ -0,0 +1,82 @@
+﻿#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// グローバルなnew/deleteを置き換えて確保の回数を数える
+// 置き換えはリンクしたツール全体（どのサブコマンドや本体のコードの確保も）に効くので、比較用のコマンドの中ではなくこのファイルにまとめる
+// どの形のnewもmallocで確保し、どの形のdeleteもfreeで解放する
+
+using namespace std;
+
+namespace
+{
+	atomic<size_t> allocation_count(0);
+
+	void* CountedAllocate(size_t size) noexcept
+	{
+		allocation_count.fetch_add(1, memory_order_relaxed);
+		return malloc(size != 0 ? size : 1);
+	}
+}
+
+size_t AllocationCount()
+{
+	return allocation_count.load();
+}
+
+void* operator new(size_t size)
+{
+	if (auto p = CountedAllocate(size)) {
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	if (auto p = CountedAllocate(size)) {
+		return p;
+	}
+	throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+	return CountedAllocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
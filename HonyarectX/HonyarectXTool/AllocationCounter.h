@@ -0,0 +1,6 @@
+﻿#pragma once
+
+#include <cstddef>
+
+/// <summary>ツールを起動してからグローバルなoperator newでヒープから確保した回数（確保しないはずの処理の前後で比べる）</summary>
+size_t AllocationCount();
@@ -0,0 +1,2903 @@
+﻿#include "ToolCommands.h"
+#include "PMDModelData.h"
+#include "MappedFile.h"
+#include "AnimationClip.h"
+#include "AnimationLOD.h"
+#include "AnimationBlender.h"
+#include "MotionLibrary.h"
+#include "VMDParser.h"
+#include "MorphEngine.h"
+#include "PoseCache.h"
+#include "ThreadPool.h"
+#include "Skeleton.h"
+#include "IKSolver.h"
+#include "IncrementalPose.h"
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	using Clock = chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start)
+	{
+		return chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+
+	/// <summary>VMDファイルのボーンのキーフレームを読み込む（MotionLibraryと同じパーサーを使う）</summary>
+	bool LoadVMDBoneKeyFrames(const char* path, vector<BoneKeyFrame>& keyframes)
+	{
+		VMDData vmd;
+		if (!ParseVMDFile(path, vmd)) {
+			return false;
+		}
+		keyframes = move(vmd.boneKeyFrames);
+		return true;
+	}
+
+	/// <summary>
+	/// 従来のPMDActorで使っていたベジェ曲線の計算（比較用）
+	/// </summary>
+	float GetYFromXOnBezier(float x, const XMFLOAT2& a, const XMFLOAT2& b)
+	{
+		const uint8_t n = 12;
+		if (a.x == a.y && b.x == b.y)
+			return x;			// 計算不要
+
+		float t = x;
+		const float k0 = 1 + 3 * a.x - 3 * b.x;		// t^3の係数
+		const float k1 = 3 * b.x - 6 * a.x;			// t^2の係数
+		const float k2 = 3 * a.x;					// tの係数
+
+		// 誤差の範囲内かどうかに使用する定数
+		constexpr float epsilon = 0.0005f;
+
+		for (int i = 0; i < n; ++i) {
+			// f(t)求めます
+			auto ft = k0 * t * t * t + k1 * t * t + k2 * t - x;
+			// もし結果が0に近い（誤差の範囲内）なら打ち切り
+			if (ft <= epsilon && ft >= -epsilon)
+				break;
+
+			t -= ft / 2;
+		}
+		// 既に求めたいtは求めているのでyを計算する
+		auto r = 1 - t;
+		return t * t * t + 3 * t * t * r * b.y + 3 * t * r * r * a.y;
+	}
+
+	/// <summary>
+	/// ベジェ曲線の、xに対するyをdoubleの二分法で正確に求める（誤差の基準）
+	/// </summary>
+	float GetYFromXOnBezierExact(float x, const XMFLOAT2& a, const XMFLOAT2& b)
+	{
+		if (a.x == a.y && b.x == b.y)
+			return x;
+		auto bezier = [](double t, double p1, double p2) {
+			auto r = 1.0 - t;
+			return t * t * t + 3.0 * t * t * r * p2 + 3.0 * t * r * r * p1;
+		};
+		double lo = 0.0;
+		double hi = 1.0;
+		for (int i = 0; i < 60; ++i) {
+			auto mid = (lo + hi) * 0.5;
+			if (bezier(mid, a.x, b.x) < x) {
+				lo = mid;
+			}
+			else {
+				hi = mid;
+			}
+		}
+		return static_cast<float>(bezier((lo + hi) * 0.5, a.y, b.y));
+	}
+
+	/// <summary>VMDの補間パラメータから曲線1本分の制御点を取り出す（curve: 0～3がX, Y, Z, 回転）</summary>
+	void GetBezierControlPoints(const uint8_t* bezier, int curve, XMFLOAT2& p1, XMFLOAT2& p2)
+	{
+		p1 = XMFLOAT2(bezier[curve] / 127.0f, bezier[4 + curve] / 127.0f);
+		p2 = XMFLOAT2(bezier[8 + curve] / 127.0f, bezier[12 + curve] / 127.0f);
+	}
+
+	using BezierFunction = float (*)(float x, const XMFLOAT2& a, const XMFLOAT2& b);
+
+	/// <summary>
+	/// 従来のボーン名ごとのキーフレーム配列によるサンプリング（比較用）
+	/// 毎フレーム、ボーン名でボーンを探し、配列をコピーして後ろから線形に探す
+	/// 補間曲線はX, Y, Z, 回転の4本を1本ずつ渡された関数で計算する
+	/// </summary>
+	class LegacyMotion
+	{
+	private:
+		struct KeyFrame {
+			uint32_t frameNo;
+			XMVECTOR quaternion;
+			XMFLOAT3 offset;
+			XMFLOAT2 p1[4];
+			XMFLOAT2 p2[4];
+		};
+		unordered_map<string, vector<KeyFrame>> _motiondata;
+		map<string, uint32_t> _boneTable;
+		BezierFunction _bezier;
+
+	public:
+		LegacyMotion(const vector<BoneKeyFrame>& keyframes, const vector<string>& boneNames, BezierFunction bezier) :
+			_bezier(bezier)
+		{
+			for (uint32_t i = 0; i < boneNames.size(); ++i) {
+				_boneTable.emplace(boneNames[i], i);
+			}
+			for (auto& f : keyframes) {
+				KeyFrame key = { f.frameNo, XMLoadFloat4(&f.quaternion), f.location, {}, {} };
+				for (int c = 0; c < 4; ++c) {
+					GetBezierControlPoints(f.bezier, c, key.p1[c], key.p2[c]);
+				}
+				_motiondata[f.name].push_back(key);
+			}
+			// 従来の<=では同じフレームの順番が決まらないので、比較のために同じ規則（後に書かれたものを使う）にそろえる
+			for (auto& motion : _motiondata) {
+				auto& keys = motion.second;
+				stable_sort(keys.begin(), keys.end(), [](const KeyFrame& lval, const KeyFrame& rval) {
+					return lval.frameNo < rval.frameNo;
+					});
+				vector<KeyFrame> unique;
+				for (auto& key : keys) {
+					if (!unique.empty() && unique.back().frameNo == key.frameNo) {
+						unique.back() = key;
+					}
+					else {
+						unique.push_back(key);
+					}
+				}
+				keys.swap(unique);
+			}
+		}
+
+		void Sample(uint32_t frameNo, BonePose* poses) const
+		{
+			for (auto& bonemotion : _motiondata) {
+				auto itBone = _boneTable.find(bonemotion.first);
+				if (itBone == _boneTable.end()) {
+					continue;
+				}
+				auto keyframes = bonemotion.second;
+				auto rit = find_if(keyframes.rbegin(), keyframes.rend(), [frameNo](const KeyFrame& keyframe) {
+					return keyframe.frameNo <= frameNo;
+					});
+				auto& pose = poses[itBone->second];
+				if (rit == keyframes.rend()) {
+					// 最初のキーフレームより前は最初のキーフレームのまま（AnimationClipと同じ）
+					XMStoreFloat4(&pose.rotation, keyframes.front().quaternion);
+					pose.translation = keyframes.front().offset;
+					continue;
+				}
+				auto it = rit.base();
+				if (it != keyframes.end()) {
+					auto x = static_cast<float>(frameNo - rit->frameNo) / static_cast<float>(it->frameNo - rit->frameNo);
+					float t[4];
+					for (int c = 0; c < 4; ++c) {
+						t[c] = _bezier(x, it->p1[c], it->p2[c]);
+					}
+					XMStoreFloat4(&pose.rotation, XMQuaternionSlerp(rit->quaternion, it->quaternion, t[3]));
+					XMStoreFloat3(&pose.translation, XMVectorLerpV(XMLoadFloat3(&rit->offset), XMLoadFloat3(&it->offset),
+						XMVectorSet(t[0], t[1], t[2], 0.0f)));
+				}
+				else {
+					XMStoreFloat4(&pose.rotation, rit->quaternion);
+					pose.translation = rit->offset;
+				}
+			}
+		}
+	};
+
+	float MaxDifference(const BonePose& a, const BonePose& b)
+	{
+		float diff = 0.0f;
+		diff = max(diff, fabsf(a.rotation.x - b.rotation.x));
+		diff = max(diff, fabsf(a.rotation.y - b.rotation.y));
+		diff = max(diff, fabsf(a.rotation.z - b.rotation.z));
+		diff = max(diff, fabsf(a.rotation.w - b.rotation.w));
+		diff = max(diff, fabsf(a.translation.x - b.translation.x));
+		diff = max(diff, fabsf(a.translation.y - b.translation.y));
+		diff = max(diff, fabsf(a.translation.z - b.translation.z));
+		return diff;
+	}
+	/// <summary>
+	/// クリップからボーン行列を求める（PMDActor::BuildBoneMatricesのうちIKを除いたもの）
+	/// 回転と移動のまま親から子へ順に姿勢をつなげ、最後に行列にする
+	/// </summary>
+	class ForwardKinematics
+	{
+	private:
+		const AnimationClip& _clip;
+		Skeleton _skeleton;
+
+	public:
+		ForwardKinematics(const PMDModelData& model, const AnimationClip& clip) : _clip(clip)
+		{
+			_skeleton.Build(model);
+		}
+
+		void Evaluate(uint32_t frame, BonePose* poses, vector<XMMATRIX>& matrices) const
+		{
+			vector<BoneTransform> transforms(matrices.size(), IdentityBoneTransform());
+			_clip.Sample(static_cast<float>(frame), poses);
+			for (auto& track : _clip.Tracks()) {
+				transforms[track.bone] = PoseToBoneTransform(poses[track.bone], _skeleton.RestPosition(track.bone));
+			}
+			_skeleton.LocalToModel(transforms.data());
+			for (size_t i = 0; i < matrices.size(); ++i) {
+				matrices[i] = BoneTransformToMatrix(transforms[i]);
+			}
+		}
+	};
+
+	float MaxDifference(const XMMATRIX& a, const XMMATRIX& b)
+	{
+		XMFLOAT4X4 fa, fb;
+		XMStoreFloat4x4(&fa, a);
+		XMStoreFloat4x4(&fb, b);
+		float diff = 0.0f;
+		for (int r = 0; r < 4; ++r) {
+			for (int c = 0; c < 4; ++c) {
+				diff = max(diff, fabsf(fa.m[r][c] - fb.m[r][c]));
+			}
+		}
+		return diff;
+	}
+
+	/// <summary>
+	/// 従来のPMDActor::LoadVMDFileと同じくfreadで読み込む（比較用）
+	/// IKの名前は元の実装ではNUL終端を前提にしていたが、合成したファイルでもはみ出さないように領域内で打ち切る
+	/// </summary>
+	bool LegacyReadVMD(const char* path, VMDData& vmd)
+	{
+		vmd.Clear();
+		FILE* fp = nullptr;
+#ifdef _MSC_VER
+		fopen_s(&fp, path, "rb");
+#else
+		fp = fopen(path, "rb");
+#endif
+		if (fp == nullptr) {
+			return false;
+		}
+		fseek(fp, 50, SEEK_SET);	// 最初の50バイトは飛ばしてOK
+		uint32_t keyframeNum = 0;
+		fread(&keyframeNum, sizeof(keyframeNum), 1, fp);
+		struct VMDKeyFrame {
+			char boneName[15];		// ボーン名
+			uint32_t frameNo;		// フレーム番号
+			XMFLOAT3 location;		// 位置
+			XMFLOAT4 quaternion;	// クォータニオン（回転）
+			uint8_t bezier[64];		// [4][4][4] ベジェ補間パラメータ
+		};
+		vector<VMDKeyFrame> keyframes(keyframeNum);
+		for (auto& keyframe : keyframes) {
+			fread(keyframe.boneName, sizeof(keyframe.boneName), 1, fp);
+			fread(&keyframe.frameNo, sizeof(keyframe.frameNo) + sizeof(keyframe.location) + sizeof(keyframe.quaternion) +
+				sizeof(keyframe.bezier), 1, fp);
+		}
+		vmd.boneKeyFrames.resize(keyframes.size());
+		for (size_t i = 0; i < keyframes.size(); ++i) {
+			auto& f = keyframes[i];
+			auto& key = vmd.boneKeyFrames[i];
+			key.name.assign(f.boneName, find(f.boneName, f.boneName + sizeof(f.boneName), '\0'));
+			key.frameNo = f.frameNo;
+			key.location = f.location;
+			key.quaternion = f.quaternion;
+			copy(f.bezier, f.bezier + sizeof(key.bezier), key.bezier);
+		}
+
+#pragma pack(1)
+		struct VMDMorph {
+			char name[15];
+			uint32_t frameNo;
+			float weight;
+		};
+		struct VMDCamera {
+			uint32_t frameNo;
+			float distance;
+			XMFLOAT3 pos;
+			XMFLOAT3 eulerAngle;
+			uint8_t interpolation[24];
+			uint32_t fov;
+			uint8_t persFlg;
+		};
+		struct VMDSelfShadow {
+			uint32_t frameNo;
+			uint8_t mode;
+			float distance;
+		};
+#pragma pack()
+		struct VMDLight {
+			uint32_t frameNo;
+			XMFLOAT3 rgb;
+			XMFLOAT3 vec;
+		};
+		uint32_t count = 0;
+		fread(&count, sizeof(count), 1, fp);
+		vector<VMDMorph> morphs(count);
+		fread(morphs.data(), sizeof(VMDMorph), count, fp);
+		vmd.morphKeyFrames.resize(count);
+		for (size_t i = 0; i < count; ++i) {
+			auto& morph = morphs[i];
+			auto& key = vmd.morphKeyFrames[i];
+			key.name.assign(morph.name, find(morph.name, morph.name + sizeof(morph.name), '\0'));
+			key.frameNo = morph.frameNo;
+			key.weight = morph.weight;
+		}
+		count = 0;
+		fread(&count, sizeof(count), 1, fp);
+		vector<VMDCamera> cameras(count);
+		fread(cameras.data(), sizeof(VMDCamera), count, fp);
+		for (auto& camera : cameras) {
+			VMDCameraKeyFrame key;
+			key.frameNo = camera.frameNo;
+			key.distance = camera.distance;
+			key.position = camera.pos;
+			key.eulerAngle = camera.eulerAngle;
+			copy(camera.interpolation, camera.interpolation + sizeof(key.interpolation), key.interpolation);
+			key.fov = camera.fov;
+			key.perspective = camera.persFlg == 0;
+			vmd.cameraKeyFrames.push_back(key);
+		}
+		count = 0;
+		fread(&count, sizeof(count), 1, fp);
+		vector<VMDLight> lights(count);
+		fread(lights.data(), sizeof(VMDLight), count, fp);
+		for (auto& light : lights) {
+			vmd.lightKeyFrames.push_back({ light.frameNo, light.rgb, light.vec });
+		}
+		count = 0;
+		fread(&count, sizeof(count), 1, fp);
+		vector<VMDSelfShadow> selfShadows(count);
+		fread(selfShadows.data(), sizeof(VMDSelfShadow), count, fp);
+		for (auto& selfShadow : selfShadows) {
+			vmd.selfShadowKeyFrames.push_back({ selfShadow.frameNo, selfShadow.mode, selfShadow.distance });
+		}
+		count = 0;
+		fread(&count, sizeof(count), 1, fp);
+		vmd.ikEnableData.resize(count);
+		for (auto& ikEnable : vmd.ikEnableData) {
+			fread(&ikEnable.frameNo, sizeof(ikEnable.frameNo), 1, fp);
+			uint8_t visibleFlg = 0;
+			fread(&visibleFlg, sizeof(visibleFlg), 1, fp);
+			uint32_t ikBoneCount = 0;
+			fread(&ikBoneCount, sizeof(ikBoneCount), 1, fp);
+			for (uint32_t i = 0; i < ikBoneCount; ++i) {
+				char ikBoneName[20];
+				fread(ikBoneName, sizeof(ikBoneName), 1, fp);
+				uint8_t flg = 0;
+				fread(&flg, sizeof(flg), 1, fp);
+				ikEnable.ikEnableTable[string(ikBoneName, find(ikBoneName, ikBoneName + sizeof(ikBoneName), '\0'))] = flg != 0;
+			}
+		}
+		fclose(fp);
+		return true;
+	}
+
+	/// <summary>2つのVMDの内容が同じか</summary>
+	bool SameVMD(const VMDData& a, const VMDData& b)
+	{
+		auto sameBytes = [](const void* x, const void* y, size_t size) { return memcmp(x, y, size) == 0; };
+		if (a.boneKeyFrames.size() != b.boneKeyFrames.size() || a.morphKeyFrames.size() != b.morphKeyFrames.size() ||
+			a.cameraKeyFrames.size() != b.cameraKeyFrames.size() || a.lightKeyFrames.size() != b.lightKeyFrames.size() ||
+			a.selfShadowKeyFrames.size() != b.selfShadowKeyFrames.size() || a.ikEnableData.size() != b.ikEnableData.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.boneKeyFrames.size(); ++i) {
+			auto& x = a.boneKeyFrames[i];
+			auto& y = b.boneKeyFrames[i];
+			if (x.name != y.name || x.frameNo != y.frameNo || !sameBytes(&x.location, &y.location, sizeof(x.location)) ||
+				!sameBytes(&x.quaternion, &y.quaternion, sizeof(x.quaternion)) || !sameBytes(x.bezier, y.bezier, sizeof(x.bezier))) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.morphKeyFrames.size(); ++i) {
+			auto& x = a.morphKeyFrames[i];
+			auto& y = b.morphKeyFrames[i];
+			if (x.name != y.name || x.frameNo != y.frameNo || !sameBytes(&x.weight, &y.weight, sizeof(x.weight))) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.cameraKeyFrames.size(); ++i) {
+			auto& x = a.cameraKeyFrames[i];
+			auto& y = b.cameraKeyFrames[i];
+			if (x.frameNo != y.frameNo || !sameBytes(&x.distance, &y.distance, sizeof(x.distance)) ||
+				!sameBytes(&x.position, &y.position, sizeof(x.position)) || !sameBytes(&x.eulerAngle, &y.eulerAngle, sizeof(x.eulerAngle)) ||
+				!sameBytes(x.interpolation, y.interpolation, sizeof(x.interpolation)) || x.fov != y.fov || x.perspective != y.perspective) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.lightKeyFrames.size(); ++i) {
+			auto& x = a.lightKeyFrames[i];
+			auto& y = b.lightKeyFrames[i];
+			if (x.frameNo != y.frameNo || !sameBytes(&x.rgb, &y.rgb, sizeof(x.rgb)) || !sameBytes(&x.vec, &y.vec, sizeof(x.vec))) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.selfShadowKeyFrames.size(); ++i) {
+			auto& x = a.selfShadowKeyFrames[i];
+			auto& y = b.selfShadowKeyFrames[i];
+			if (x.frameNo != y.frameNo || x.mode != y.mode || !sameBytes(&x.distance, &y.distance, sizeof(x.distance))) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < a.ikEnableData.size(); ++i) {
+			if (a.ikEnableData[i].frameNo != b.ikEnableData[i].frameNo ||
+				a.ikEnableData[i].ikEnableTable != b.ikEnableData[i].ikEnableTable) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// おおよそbytesバイトのVMDを合成する（ほとんどはボーンのキーフレームで、すべてのセクションを含む）
+	/// 名前には領域いっぱいまで使ってNULで終わらないものも混ぜる
+	/// </summary>
+	/// <param name="boundaries">セクションの境目（ここで終わるファイルも読めなければならない）</param>
+	vector<uint8_t> BuildSyntheticVMD(size_t bytes, uint32_t seed, vector<size_t>& boundaries)
+	{
+		mt19937 random(seed);
+		uniform_int_distribution<int> byte(0, 255);
+		uniform_int_distribution<int> letter('a', 'z');
+		vector<uint8_t> data;
+		auto put = [&data](const void* p, size_t size) {
+			auto bytes = static_cast<const uint8_t*>(p);
+			data.insert(data.end(), bytes, bytes + size);
+		};
+		auto putU32 = [&put](uint32_t value) { put(&value, sizeof(value)); };
+		auto putName = [&](size_t size) {
+			// 領域いっぱいの名前、短い名前、空の名前
+			auto length = static_cast<size_t>(random() % (size + 1));
+			for (size_t i = 0; i < size; ++i) {
+				data.push_back(i < length ? static_cast<uint8_t>(letter(random)) : 0);
+			}
+		};
+		auto putRandom = [&](size_t size) {
+			for (size_t i = 0; i < size; ++i) {
+				data.push_back(static_cast<uint8_t>(byte(random)));
+			}
+		};
+		char header[30] = "Vocaloid Motion Data 0002";
+		put(header, sizeof(header));
+		putName(20);
+
+		auto boneNum = static_cast<uint32_t>(bytes * 95 / 100 / 111);
+		putU32(boneNum);
+		for (uint32_t i = 0; i < boneNum; ++i) {
+			putName(15);
+			putU32(i / 64);
+			putRandom(12 + 16 + 64);
+		}
+		auto morphNum = static_cast<uint32_t>(bytes * 3 / 100 / 23);
+		putU32(morphNum);
+		for (uint32_t i = 0; i < morphNum; ++i) {
+			putName(15);
+			putU32(i / 16);
+			putRandom(4);
+		}
+		boundaries.push_back(data.size());
+		auto cameraNum = static_cast<uint32_t>(bytes / 100 / 61);
+		putU32(cameraNum);
+		putRandom(static_cast<size_t>(cameraNum) * 61);
+		boundaries.push_back(data.size());
+		auto lightNum = static_cast<uint32_t>(bytes / 200 / 28);
+		putU32(lightNum);
+		putRandom(static_cast<size_t>(lightNum) * 28);
+		boundaries.push_back(data.size());
+		auto selfShadowNum = static_cast<uint32_t>(bytes / 400 / 9);
+		putU32(selfShadowNum);
+		putRandom(static_cast<size_t>(selfShadowNum) * 9);
+		boundaries.push_back(data.size());
+		auto ikNum = static_cast<uint32_t>(bytes / 400 / 93);
+		putU32(ikNum);
+		for (uint32_t i = 0; i < ikNum; ++i) {
+			putU32(i);
+			data.push_back(1);
+			putU32(4);
+			for (int b = 0; b < 4; ++b) {
+				putName(20);
+				data.push_back(static_cast<uint8_t>(random() % 2));
+			}
+		}
+		boundaries.push_back(data.size());
+		return data;
+	}
+
+	bool WriteFile(const char* path, const vector<uint8_t>& data)
+	{
+		FILE* fp = nullptr;
+#ifdef _MSC_VER
+		fopen_s(&fp, path, "wb");
+#else
+		fp = fopen(path, "wb");
+#endif
+		if (fp == nullptr) {
+			return false;
+		}
+		auto written = fwrite(data.data(), 1, data.size(), fp);
+		fclose(fp);
+		return written == data.size();
+	}
+
+	/// <summary>モーションを読み込むモデル（PMDActorと同じくボーン名と表情を用意する、表情の頂点は並べ替えない）</summary>
+	struct MotionTarget {
+		PMDModelData model;
+		vector<string> boneNames;
+		MorphEngine morphs;
+
+		bool Load(const char* path)
+		{
+			if (!model.Load(path)) {
+				return false;
+			}
+			boneNames.resize(model.Bones().size());
+			for (size_t i = 0; i < boneNames.size(); ++i) {
+				boneNames[i] = model.BoneName(i);
+			}
+			vector<uint32_t> vertexToSource(model.Vertices().size());
+			for (uint32_t v = 0; v < vertexToSource.size(); ++v) {
+				vertexToSource[v] = v;
+			}
+			morphs.Build(model, vertexToSource);
+			return true;
+		}
+	};
+}
+
+int BenchClipCommand(int argc, char** argv)
+{
+	int frameNum = 10000;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			frameNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("bench-clip: no input\n");
+		return 1;
+	}
+	PMDModelData model;
+	if (!model.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	vector<string> boneNames(model.Bones().size());
+	for (size_t i = 0; i < boneNames.size(); ++i) {
+		boneNames[i] = model.BoneName(i);
+	}
+
+	// サンプリング結果が従来と一致するかの許容誤差
+	const float max_difference = 1.0e-4f;
+	int result = 0;
+	for (size_t p = 1; p < paths.size(); ++p) {
+		auto path = paths[p];
+		vector<BoneKeyFrame> keyframes;
+		if (!LoadVMDBoneKeyFrames(path, keyframes)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		AnimationClip clip;
+		auto start = Clock::now();
+		clip.Compile(keyframes, boneNames);
+		auto compileMs = ElapsedMs(start);
+		// 一致の確認は正確に解いたもの、速度の比較は従来の計算で行う
+		LegacyMotion exact(keyframes, boneNames, GetYFromXOnBezierExact);
+		LegacyMotion legacy(keyframes, boneNames, GetYFromXOnBezier);
+		printf("%s: keyframes %zu -> %zu  tracks %zu / %zu bones  duration %u  compile %.3f ms\n", path,
+			keyframes.size(), clip.KeyNum(), clip.Tracks().size(), boneNames.size(), clip.Duration(), compileMs);
+		if (clip.Tracks().empty()) {
+			continue;
+		}
+
+		// 全フレームで一致を確認する（最後のキーフレームの後も少し見る）
+		vector<BonePose> clipPoses(boneNames.size());
+		vector<BonePose> legacyPoses(boneNames.size());
+		float maxDiff = 0.0f;
+		for (uint32_t frame = 0; frame <= clip.Duration() + 10; ++frame) {
+			clip.Sample(static_cast<float>(frame), clipPoses.data());
+			exact.Sample(frame, legacyPoses.data());
+			for (auto& track : clip.Tracks()) {
+				maxDiff = max(maxDiff, MaxDifference(clipPoses[track.bone], legacyPoses[track.bone]));
+			}
+		}
+
+		// 速度（ループ再生と同じくフレームを巻き戻しながら）
+		auto loop = clip.Duration() + 1;
+		start = Clock::now();
+		for (int i = 0; i < frameNum; ++i) {
+			legacy.Sample(static_cast<uint32_t>(i) % loop, legacyPoses.data());
+		}
+		auto legacyMs = ElapsedMs(start);
+		start = Clock::now();
+		for (int i = 0; i < frameNum; ++i) {
+			clip.Sample(static_cast<float>(static_cast<uint32_t>(i) % loop), clipPoses.data());
+		}
+		auto clipMs = ElapsedMs(start);
+
+		auto boneSamples = static_cast<double>(clip.Tracks().size()) * frameNum;
+		auto legacyRate = boneSamples / (legacyMs / 1000.0);
+		auto clipRate = boneSamples / (clipMs / 1000.0);
+		auto ok = maxDiff <= max_difference;
+		printf("  legacy %.2f Mbones/s  clip %.2f Mbones/s  (%.1fx)  max diff %g  %s\n", legacyRate / 1.0e6,
+			clipRate / 1.0e6, clipRate / legacyRate, maxDiff, ok ? "ok" : "MISMATCH");
+		if (!ok) {
+			result = 1;
+		}
+	}
+	return result;
+}
+
+int BenchBezierCommand(int argc, char** argv)
+{
+	int repeat = 20;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeat = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+
+	// モーションの補間パラメータ（無ければ乱数で作る）
+	vector<array<uint8_t, 16>> beziers;
+	for (auto path : paths) {
+		vector<BoneKeyFrame> keyframes;
+		if (!LoadVMDBoneKeyFrames(path, keyframes)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		for (auto& keyframe : keyframes) {
+			array<uint8_t, 16> bezier;
+			copy(keyframe.bezier, keyframe.bezier + bezier.size(), bezier.begin());
+			beziers.push_back(bezier);
+		}
+	}
+	if (beziers.empty()) {
+		mt19937 random(1);
+		uniform_int_distribution<int> dist(0, 127);
+		beziers.resize(4096);
+		for (auto& bezier : beziers) {
+			for (auto& b : bezier) {
+				b = static_cast<uint8_t>(dist(random));
+			}
+		}
+	}
+	vector<BezierCurves> curves(beziers.size());
+	size_t linearNum = 0;
+	for (size_t i = 0; i < beziers.size(); ++i) {
+		ComputeBezierCurves(beziers[i].data(), curves[i]);
+		for (int c = 0; c < 4; ++c) {
+			linearNum += (curves[i].linearMask >> c) & 1;
+		}
+	}
+	printf("curves %zu (linear %zu)  %s\n", curves.size() * 4, linearNum, paths.empty() ? "random" : "from motions");
+
+	// 1本あたりのxの数（キーフレーム間のフレームに相当）
+	const int sample_num = 33;
+	double legacyMax = 0.0, legacySum = 0.0;
+	double simdMax = 0.0, simdSum = 0.0;
+	for (size_t i = 0; i < curves.size(); ++i) {
+		for (int s = 0; s < sample_num; ++s) {
+			auto x = static_cast<float>(s) / (sample_num - 1);
+			XMFLOAT4 y;
+			XMStoreFloat4(&y, SolveBezierCurves(curves[i], XMVectorReplicate(x)));
+			float ys[4] = { y.x, y.y, y.z, y.w };
+			for (int c = 0; c < 4; ++c) {
+				XMFLOAT2 p1, p2;
+				GetBezierControlPoints(beziers[i].data(), c, p1, p2);
+				auto exact = GetYFromXOnBezierExact(x, p1, p2);
+				auto legacyError = fabs(GetYFromXOnBezier(x, p1, p2) - exact);
+				auto simdError = fabs(ys[c] - exact);
+				legacyMax = max(legacyMax, static_cast<double>(legacyError));
+				legacySum += legacyError;
+				simdMax = max(simdMax, static_cast<double>(simdError));
+				simdSum += simdError;
+			}
+		}
+	}
+	auto evaluationNum = static_cast<double>(curves.size()) * 4 * sample_num;
+
+	// 速度（1回で4本を計算するのと、1本ずつ計算するのを、同じ曲線の本数で比べる）
+	vector<array<XMFLOAT2, 8>> controlPoints(beziers.size());
+	for (size_t i = 0; i < beziers.size(); ++i) {
+		for (int c = 0; c < 4; ++c) {
+			GetBezierControlPoints(beziers[i].data(), c, controlPoints[i][c * 2], controlPoints[i][c * 2 + 1]);
+		}
+	}
+	float sink = 0.0f;
+	auto start = Clock::now();
+	for (int r = 0; r < repeat; ++r) {
+		for (size_t i = 0; i < curves.size(); ++i) {
+			auto& points = controlPoints[i];
+			for (int s = 0; s < sample_num; ++s) {
+				auto x = static_cast<float>(s) / (sample_num - 1);
+				for (int c = 0; c < 4; ++c) {
+					sink += GetYFromXOnBezier(x, points[c * 2], points[c * 2 + 1]);
+				}
+			}
+		}
+	}
+	auto legacyMs = ElapsedMs(start);
+	auto sum = XMVectorZero();
+	start = Clock::now();
+	for (int r = 0; r < repeat; ++r) {
+		for (size_t i = 0; i < curves.size(); ++i) {
+			for (int s = 0; s < sample_num; ++s) {
+				auto x = static_cast<float>(s) / (sample_num - 1);
+				sum += SolveBezierCurves(curves[i], XMVectorReplicate(x));
+			}
+		}
+	}
+	auto simdMs = ElapsedMs(start);
+	sink += XMVectorGetX(sum);
+
+	auto legacyNs = legacyMs * 1.0e6 / (evaluationNum * repeat);
+	auto simdNs = simdMs * 1.0e6 / (evaluationNum * repeat);
+	printf("  legacy  %.2f ns/curve  max error %.6f  mean error %.7f\n", legacyNs, legacyMax, legacySum / evaluationNum);
+	printf("  simd    %.2f ns/curve  max error %.6f  mean error %.7f  (%.1fx)  [%g]\n", simdNs, simdMax,
+		simdSum / evaluationNum, legacyNs / simdNs, sink);
+	// 新しい計算は従来以上の精度であること
+	return simdMax <= max(legacyMax, 1.0e-4) ? 0 : 1;
+}
+
+int PoseCacheCommand(int argc, char** argv)
+{
+	size_t threadNum = 0;
+	int loopNum = 3;
+	double maxMegaBytes = 8.0;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threadNum = static_cast<size_t>(max(0, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			loopNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			maxMegaBytes = max(0.0, atof(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("pose-cache: no input\n");
+		return 1;
+	}
+	PMDModelData model;
+	if (!model.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	vector<string> boneNames(model.Bones().size());
+	for (size_t i = 0; i < boneNames.size(); ++i) {
+		boneNames[i] = model.BoneName(i);
+	}
+	auto boneNum = boneNames.size();
+	auto maxBytes = static_cast<size_t>(maxMegaBytes * 1024 * 1024);
+	ThreadPool pool(threadNum);
+
+	// 量子化した行列の許容誤差（回転部分は1/32767、位置はモデルの大きさ程度を掛けたもの）
+	const float max_quantize_error = 2.0e-3f;
+	int result = 0;
+	for (size_t p = 1; p < paths.size(); ++p) {
+		auto path = paths[p];
+		vector<BoneKeyFrame> keyframes;
+		if (!LoadVMDBoneKeyFrames(path, keyframes)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		AnimationClip clip;
+		clip.Compile(keyframes, boneNames);
+		ForwardKinematics fk(model, clip);
+		auto frameNum = clip.Duration() + 1;
+		PoseEvaluator evaluate = [&fk, boneNum](uint32_t frame, vector<XMMATRIX>& matrices) {
+			vector<BonePose> poses(boneNum);
+			fk.Evaluate(frame, poses.data(), matrices);
+		};
+		printf("%s: frames %u  bones %zu\n", path, frameNum, boneNum);
+
+		for (auto format : { PoseCacheFormat::Matrix, PoseCacheFormat::Quantized }) {
+			auto formatName = format == PoseCacheFormat::Matrix ? "matrix" : "quantized";
+			// Eager: 1スレッドとワーカースレッドでベイクする
+			PoseCache cache;
+			cache.Reset(boneNum, frameNum, format, maxBytes);
+			auto start = Clock::now();
+			cache.Bake(evaluate, nullptr);
+			auto serialMs = ElapsedMs(start);
+			cache.Reset(boneNum, frameNum, format, maxBytes);
+			start = Clock::now();
+			cache.Bake(evaluate, &pool);
+			auto parallelMs = ElapsedMs(start);
+
+			// 保存したものが計算し直したものと一致するか
+			vector<XMMATRIX> expected(boneNum);
+			vector<XMMATRIX> loaded(boneNum);
+			vector<BonePose> poses(boneNum);
+			float maxDiff = 0.0f;
+			for (uint32_t frame = 0; frame < cache.FrameCapacity(); ++frame) {
+				fk.Evaluate(frame, poses.data(), expected);
+				cache.Load(frame, loaded.data());
+				for (size_t b = 0; b < boneNum; ++b) {
+					maxDiff = max(maxDiff, MaxDifference(expected[b], loaded[b]));
+				}
+			}
+			auto ok = cache.CachedFrameNum() == cache.FrameCapacity() &&
+				(format == PoseCacheFormat::Matrix ? maxDiff == 0.0f : maxDiff <= max_quantize_error);
+
+			// Lazy: ループ再生し、計算したフレーム数と1フレームあたりの時間を比べる
+			PoseCache lazy;
+			lazy.Reset(boneNum, frameNum, format, maxBytes);
+			size_t evaluated = 0;
+			double evaluateMs = 0.0;
+			double loadMs = 0.0;
+			for (int loop = 0; loop < loopNum; ++loop) {
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					start = Clock::now();
+					if (lazy.Contains(frame)) {
+						lazy.Load(frame, loaded.data());
+						loadMs += ElapsedMs(start);
+						continue;
+					}
+					fk.Evaluate(frame, poses.data(), loaded);
+					if (lazy.CanStore(frame)) {
+						lazy.Store(frame, loaded.data());
+					}
+					evaluateMs += ElapsedMs(start);
+					++evaluated;
+				}
+			}
+			auto played = static_cast<size_t>(frameNum) * loopNum;
+			auto loadedNum = played - evaluated;
+			printf("  %-9s %u/%u frames  %.1f KB  bake %.3f ms -> %.3f ms (%zu threads)  max diff %g  %s\n", formatName,
+				cache.FrameCapacity(), frameNum, cache.MemoryBytes() / 1024.0, serialMs, parallelMs, pool.ThreadNum(), maxDiff,
+				ok ? "ok" : "MISMATCH");
+			printf("            lazy %d loops: evaluated %zu / %zu frames  evaluate %.2f us/frame  load %.2f us/frame\n", loopNum,
+				evaluated, played, evaluated ? evaluateMs * 1000.0 / evaluated : 0.0, loadedNum ? loadMs * 1000.0 / loadedNum : 0.0);
+			if (!ok || evaluated != frameNum + static_cast<size_t>(frameNum - lazy.FrameCapacity()) * (loopNum - 1)) {
+				result = 1;
+			}
+		}
+	}
+	return result;
+}
+
+int CompressClipCommand(int argc, char** argv)
+{
+	ClipCompressOptions options;
+	int frameNum = 10000;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			options.maxAngle = XMConvertToRadians(static_cast<float>(atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			options.maxDistance = static_cast<float>(atof(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			frameNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-q") == 0) {
+			options.quantizeRotations = false;
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("compress-clip: no input\n");
+		return 1;
+	}
+	PMDModelData model;
+	if (!model.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	vector<string> boneNames(model.Bones().size());
+	for (size_t i = 0; i < boneNames.size(); ++i) {
+		boneNames[i] = model.BoneName(i);
+	}
+	printf("max angle %.3f deg  max distance %g  quantize %s\n", XMConvertToDegrees(options.maxAngle), options.maxDistance,
+		options.quantizeRotations ? "on" : "off");
+
+	int result = 0;
+	size_t totalBytes = 0;
+	size_t totalCompressedBytes = 0;
+	for (size_t p = 1; p < paths.size(); ++p) {
+		auto path = paths[p];
+		vector<BoneKeyFrame> keyframes;
+		if (!LoadVMDBoneKeyFrames(path, keyframes)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		AnimationClip clip;
+		clip.Compile(keyframes, boneNames);
+		auto compressed = clip;
+		auto start = Clock::now();
+		auto stats = compressed.Compress(options);
+		auto compressMs = ElapsedMs(start);
+		totalBytes += stats.bytes;
+		totalCompressedBytes += stats.compressedBytes;
+
+		// 全フレームで圧縮前との差を測る（取り除いたトラックは初期姿勢と比べる）
+		BonePose rest = { XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 0.0f) };
+		vector<BonePose> expected(boneNames.size(), rest);
+		vector<BonePose> actual(boneNames.size(), rest);
+		float maxAngle = 0.0f;
+		float maxDistance = 0.0f;
+		for (uint32_t frame = 0; frame <= clip.Duration() + 10; ++frame) {
+			fill(actual.begin(), actual.end(), rest);
+			clip.Sample(static_cast<float>(frame), expected.data());
+			compressed.Sample(static_cast<float>(frame), actual.data());
+			for (auto& track : clip.Tracks()) {
+				auto& a = expected[track.bone];
+				auto& b = actual[track.bone];
+				auto qa = XMQuaternionNormalize(XMLoadFloat4(&a.rotation));
+				auto qb = XMQuaternionNormalize(XMLoadFloat4(&b.rotation));
+				auto dot = fabsf(XMVectorGetX(XMVector4Dot(qa, qb)));
+				maxAngle = max(maxAngle, 2.0f * acosf(min(dot, 1.0f)));
+				maxDistance = max(maxDistance,
+					XMVectorGetX(XMVector3Length(XMLoadFloat3(&a.translation) - XMLoadFloat3(&b.translation))));
+			}
+		}
+
+		// サンプリングの速度
+		auto loop = clip.Duration() + 1;
+		start = Clock::now();
+		for (int i = 0; i < frameNum; ++i) {
+			clip.Sample(static_cast<float>(static_cast<uint32_t>(i) % loop), expected.data());
+		}
+		auto sampleMs = ElapsedMs(start);
+		start = Clock::now();
+		for (int i = 0; i < frameNum; ++i) {
+			compressed.Sample(static_cast<float>(static_cast<uint32_t>(i) % loop), actual.data());
+		}
+		auto compressedSampleMs = ElapsedMs(start);
+
+		// 判定は量子化の誤差で許容誤差をわずかに超えることがあるので、少しだけ余裕を持たせる
+		auto ok = maxAngle <= options.maxAngle * 1.01f + 1.0e-5f && maxDistance <= options.maxDistance * 1.01f + 1.0e-6f;
+		printf("%s: keys %zu -> %zu  tracks %zu -> %zu (constant %zu, rest %zu removed)  compress %.3f ms\n", path,
+			stats.keyNum, stats.compressedKeyNum, stats.trackNum, compressed.Tracks().size(), stats.constantTrackNum,
+			stats.restTrackNum, compressMs);
+		printf("  %zu bytes -> %zu bytes (%.1fx, VMD %zu bytes)  max error %.4f deg %.6f  sample %.2f -> %.2f us/frame  %s\n",
+			stats.bytes, stats.compressedBytes, static_cast<double>(stats.bytes) / max<size_t>(1, stats.compressedBytes),
+			keyframes.size() * 111, XMConvertToDegrees(maxAngle), maxDistance, sampleMs * 1000.0 / frameNum,
+			compressedSampleMs * 1000.0 / frameNum, ok ? "ok" : "OVER");
+		if (!ok) {
+			result = 1;
+		}
+	}
+	printf("total %zu bytes -> %zu bytes (%.1fx)\n", totalBytes, totalCompressedBytes,
+		static_cast<double>(totalBytes) / max<size_t>(1, totalCompressedBytes));
+	return result;
+}
+
+int AnimLODCommand(int argc, char** argv)
+{
+	size_t actorNum = 64;
+	float maxDistance = 3000.0f;
+	uint32_t displayFrameNum = 600;
+	AnimationLODPolicy policy;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			actorNum = static_cast<size_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			maxDistance = max(1.0f, static_cast<float>(atof(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			displayFrameNum = static_cast<uint32_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			policy.reducedInterval = static_cast<uint32_t>(max(1, atoi(argv[++i])));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("anim-lod: no input\n");
+		return 1;
+	}
+	PMDModelData model;
+	if (!model.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	vector<string> boneNames(model.Bones().size());
+	for (size_t i = 0; i < boneNames.size(); ++i) {
+		boneNames[i] = model.BoneName(i);
+	}
+	auto boneNum = boneNames.size();
+	vector<BoneKeyFrame> keyframes;
+	if (!LoadVMDBoneKeyFrames(paths[1], keyframes)) {
+		printf("%s: failed to load\n", paths[1]);
+		return 1;
+	}
+	AnimationClip clip;
+	clip.Compile(keyframes, boneNames);
+	clip.Compress(ClipCompressOptions());
+	ForwardKinematics fk(model, clip);
+	auto lastFrame = clip.Duration();
+
+	// バウンディングスフィア（PMDActorと同じくAABBの中心から最も遠い頂点まで）
+	auto& vertices = model.Vertices();
+	auto minPos = XMVectorReplicate(FLT_MAX);
+	auto maxPos = XMVectorReplicate(-FLT_MAX);
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		auto p = vertices[i].pos;
+		minPos = XMVectorMin(minPos, XMLoadFloat3(&p));
+		maxPos = XMVectorMax(maxPos, XMLoadFloat3(&p));
+	}
+	auto center = (minPos + maxPos) * 0.5f;
+	float radius = 0.0f;
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		auto p = vertices[i].pos;
+		radius = max(radius, XMVectorGetX(XMVector3Length(XMLoadFloat3(&p) - center)));
+	}
+	// 720pの画角45°（Dx12Wrapperと同じ）
+	const float projection_scale = 720.0f / (2.0f * tanf(XM_PIDIV4 * 0.5f));
+
+	// IKはツールでは解かないので、姿勢の計算は段階によらず同じ（IKを省いた分の削減はこの結果に含まれない）
+	vector<BonePose> poses(boneNum);
+	size_t evaluateCalls = 0;
+	AnimationPoseEvaluator evaluate = [&](uint32_t frame, bool, vector<XMMATRIX>& matrices) {
+		fk.Evaluate(frame, poses.data(), matrices);
+		++evaluateCalls;
+	};
+	printf("%s: frames %u  bones %zu  radius %.2f  actors %zu  distance %.0f-%.0f  %u display frames (60Hz)\n", paths[1],
+		lastFrame + 1, boneNum, radius, actorNum, radius * 2.0f, maxDistance, displayFrameNum);
+
+	// 群衆：距離を等間隔に並べ、再生位置をずらしたアクターを60Hzで更新する
+	// 基準はすべてFullで毎フレーム計算したもの
+	vector<float> distances(actorNum);
+	vector<float> phases(actorNum);
+	mt19937 random(1);
+	uniform_real_distribution<float> phase(0.0f, static_cast<float>(lastFrame + 1));
+	for (size_t a = 0; a < actorNum; ++a) {
+		distances[a] = radius * 2.0f + (maxDistance - radius * 2.0f) * a / max<size_t>(1, actorNum - 1);
+		phases[a] = phase(random);
+	}
+	auto frameAt = [lastFrame](float phase, uint32_t displayFrame) {
+		return fmodf(phase + displayFrame * 0.5f, static_cast<float>(lastFrame + 1));
+	};
+
+	vector<vector<XMMATRIX>> matrices(actorNum, vector<XMMATRIX>(boneNum, XMMatrixIdentity()));
+	auto start = Clock::now();
+	for (uint32_t f = 0; f < displayFrameNum; ++f) {
+		for (size_t a = 0; a < actorNum; ++a) {
+			evaluate(static_cast<uint32_t>(frameAt(phases[a], f)), true, matrices[a]);
+		}
+	}
+	auto fullMs = ElapsedMs(start);
+	auto fullCalls = evaluateCalls;
+
+	vector<AnimationLOD> lods(actorNum);
+	evaluateCalls = 0;
+	start = Clock::now();
+	for (uint32_t f = 0; f < displayFrameNum; ++f) {
+		for (size_t a = 0; a < actorNum; ++a) {
+			auto& lod = lods[a];
+			if (f == 0) {
+				lod.SetPolicy(policy);
+			}
+			lod.Select(ProjectedPixels(radius, distances[a], projection_scale));
+			lod.Update(frameAt(phases[a], f), lastFrame, evaluate, matrices[a]);
+		}
+	}
+	auto lodMs = ElapsedMs(start);
+	auto lodCalls = evaluateCalls;
+	AnimationLODStats stats;
+	size_t tierActors[animation_lod_tier_num] = {};
+	for (auto& lod : lods) {
+		stats.Add(lod.Stats());
+		++tierActors[static_cast<size_t>(lod.Tier())];
+	}
+	for (size_t t = 0; t < animation_lod_tier_num; ++t) {
+		printf("  %-8s %3zu actors  %8llu updates\n", AnimationLODTierName(static_cast<AnimationLODTier>(t)), tierActors[t],
+			static_cast<unsigned long long>(stats.updates[t]));
+	}
+	printf("  evaluations %zu -> %zu (ik %llu)  interpolations %llu  %.2f ms -> %.2f ms (%.1fx)\n", fullCalls, lodCalls,
+		static_cast<unsigned long long>(stats.ikEvaluations), static_cast<unsigned long long>(stats.interpolations), fullMs, lodMs,
+		fullMs / max(1.0e-6, lodMs));
+
+	// Reducedの補間の誤差（計算したフレームでは一致し、間のフレームでは補間した分だけずれる）
+	AnimationLOD reduced;
+	reduced.SetPolicy(policy);
+	reduced.SetTier(AnimationLODTier::Reduced);
+	vector<XMMATRIX> expected(boneNum);
+	vector<XMMATRIX> interpolated(boneNum);
+	float keyDiff = 0.0f;
+	float betweenDiff = 0.0f;
+	for (uint32_t frame = 0; frame <= lastFrame; ++frame) {
+		reduced.Update(static_cast<float>(frame), lastFrame, evaluate, interpolated);
+		fk.Evaluate(frame, poses.data(), expected);
+		auto& diff = frame % policy.reducedInterval == 0 ? keyDiff : betweenDiff;
+		for (size_t b = 0; b < boneNum; ++b) {
+			diff = max(diff, MaxDifference(expected[b], interpolated[b]));
+		}
+	}
+	// 間のフレームのずれを、Reducedになる最も大きい見た目での画面上のピクセルに直したもの
+	printf("  reduced every %u frames: max diff %g at evaluated frames, %g between (%.1f px at %.0f px tall)\n",
+		policy.reducedInterval, keyDiff, betweenDiff, betweenDiff * policy.reducedPixels / (radius * 2.0f), policy.reducedPixels);
+
+	uint64_t updateNum = 0;
+	for (auto n : stats.updates) {
+		updateNum += n;
+	}
+	auto ok = updateNum == static_cast<uint64_t>(actorNum) * displayFrameNum && stats.evaluations == lodCalls &&
+		lodCalls <= fullCalls && keyDiff == 0.0f;
+	printf("  %s\n", ok ? "ok" : "MISMATCH");
+	return ok ? 0 : 1;
+}
+
+int BlendLayersCommand(int argc, char** argv)
+{
+	const char* rootBoneName = "上半身";
+	uint32_t fadeFrames = 10;
+	int repeatNum = 20;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			rootBoneName = argv[++i];
+		}
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			fadeFrames = static_cast<uint32_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 3) {
+		printf("blend-layers: no input\n");
+		return 1;
+	}
+	PMDModelData model;
+	if (!model.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	auto& bones = model.Bones();
+	vector<string> boneNames(bones.size());
+	for (size_t i = 0; i < boneNames.size(); ++i) {
+		boneNames[i] = model.BoneName(i);
+	}
+	auto boneNum = boneNames.size();
+	AnimationClip clips[2];
+	for (int c = 0; c < 2; ++c) {
+		vector<BoneKeyFrame> keyframes;
+		if (!LoadVMDBoneKeyFrames(paths[c + 1], keyframes)) {
+			printf("%s: failed to load\n", paths[c + 1]);
+			return 1;
+		}
+		clips[c].Compile(keyframes, boneNames);
+		clips[c].Compress(ClipCompressOptions());
+	}
+	auto& base = clips[0];
+	auto& overlay = clips[1];
+
+	// 起点のボーンとその子孫のマスク（親は子より前に並んでいるとは限らないので親をたどって判定する）
+	auto root = find(boneNames.begin(), boneNames.end(), rootBoneName) - boneNames.begin();
+	if (root == static_cast<ptrdiff_t>(boneNum)) {
+		printf("%s: no bone\n", rootBoneName);
+		return 1;
+	}
+	vector<float> mask(boneNum, 0.0f);
+	for (size_t b = 0; b < boneNum; ++b) {
+		for (auto p = b; p < boneNum; p = bones[p].parentNo) {
+			if (p == static_cast<size_t>(root)) {
+				mask[b] = 1.0f;
+				break;
+			}
+		}
+	}
+	auto maskedTrackNum = count_if(overlay.Tracks().begin(), overlay.Tracks().end(), [&mask](const AnimationTrack& track) {
+		return mask[track.bone] > 0.0f;
+	});
+	printf("%s + %s (%s and below: %zu bones, %zu / %zu tracks)\n", paths[1], paths[2], rootBoneName,
+		static_cast<size_t>(count(mask.begin(), mask.end(), 1.0f)), static_cast<size_t>(maskedTrackNum), overlay.Tracks().size());
+
+	// クリップだけで求めた姿勢（トラックの無いボーンは初期姿勢）
+	const BonePose rest = { XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, 0.0f) };
+	auto sampleClip = [boneNum, &rest](const AnimationClip& clip, uint32_t frame, vector<BonePose>& poses) {
+		poses.assign(boneNum, rest);
+		clip.Sample(static_cast<float>(frame % (clip.Duration() + 1)), poses.data());
+	};
+	// 回転はqと-q、正規化の有無を区別しない
+	auto poseDiff = [](const BonePose& a, const BonePose& b) {
+		auto qa = XMQuaternionNormalize(XMLoadFloat4(&a.rotation));
+		auto qb = XMQuaternionNormalize(XMLoadFloat4(&b.rotation));
+		auto dot = fabsf(XMVectorGetX(XMVector4Dot(qa, qb)));
+		auto distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&a.translation) - XMLoadFloat3(&b.translation)));
+		return max(2.0f * acosf(min(dot, 1.0f)), distance);
+	};
+	auto frameNum = max(base.Duration(), overlay.Duration()) + 1;
+	AnimationBlendBuffers buffers;
+	vector<BonePose> expected0, expected1;
+	int result = 0;
+	auto report = [&result](const char* name, float diff, float tolerance, size_t sampled, size_t expectedSampled) {
+		auto ok = diff <= tolerance && sampled == expectedSampled;
+		printf("  %-10s max diff %-10g sampled %zu tracks/frame  %s\n", name, diff, sampled, ok ? "ok" : "MISMATCH");
+		if (!ok) {
+			result = 1;
+		}
+	};
+
+	// 1つのクリップだけ：クリップそのものと一致し、姿勢キャッシュを使える
+	AnimationBlender blender;
+	blender.Reset(boneNum);
+	blender.Play(0, &base, 0, 0);
+	float diff = 0.0f;
+	auto single = true;
+	for (uint32_t frame = 0; frame < frameNum * 2; ++frame) {
+		blender.Evaluate(frame, buffers);
+		sampleClip(base, frame, expected0);
+		for (size_t b = 0; b < boneNum; ++b) {
+			diff = max(diff, MaxDifference(buffers.poses[b], expected0[b]));
+		}
+		uint32_t clipFrame = 0;
+		single = single && blender.SingleClip(frame, clipFrame) == &base && clipFrame == frame % (base.Duration() + 1);
+	}
+	report("single", single ? diff : FLT_MAX, 0.0f, buffers.sampledTrackNum, base.Tracks().size());
+
+	// 重み0のレイヤーはサンプリングしない
+	auto layer = blender.AddLayer(AnimationBlendMode::Override, 0.0f);
+	blender.Play(layer, &overlay, 0, 0);
+	blender.Evaluate(frameNum / 2, buffers);
+	sampleClip(base, frameNum / 2, expected0);
+	diff = 0.0f;
+	for (size_t b = 0; b < boneNum; ++b) {
+		diff = max(diff, MaxDifference(buffers.poses[b], expected0[b]));
+	}
+	report("weight 0", diff, 0.0f, buffers.sampledTrackNum, base.Tracks().size());
+
+	// マスク：起点より下は上のクリップ（トラックが無ければ初期姿勢）、それ以外は下のクリップ
+	blender.SetLayerWeight(layer, 1.0f);
+	blender.SetLayerMask(layer, mask);
+	diff = 0.0f;
+	for (uint32_t frame = 0; frame < frameNum; ++frame) {
+		blender.Evaluate(frame, buffers);
+		sampleClip(base, frame, expected0);
+		sampleClip(overlay, frame, expected1);
+		for (size_t b = 0; b < boneNum; ++b) {
+			diff = max(diff, MaxDifference(buffers.poses[b], mask[b] > 0.0f ? expected1[b] : expected0[b]));
+		}
+	}
+	report("masked", diff, 0.0f, buffers.sampledTrackNum, base.Tracks().size() + maskedTrackNum);
+
+	// クロスフェード：始めは前のクリップ、終わりは新しいクリップだけをサンプリングする
+	blender.Reset(boneNum);
+	blender.Play(0, &base, 0, 0);
+	const uint32_t fade_start = 5;
+	blender.Play(0, &overlay, fade_start, fadeFrames);
+	blender.Evaluate(fade_start, buffers);
+	sampleClip(base, fade_start, expected0);
+	diff = 0.0f;
+	for (size_t b = 0; b < boneNum; ++b) {
+		diff = max(diff, MaxDifference(buffers.poses[b], expected0[b]));
+	}
+	report("fade from", diff, 0.0f, buffers.sampledTrackNum, base.Tracks().size());
+	blender.Evaluate(fade_start + fadeFrames / 2, buffers);
+	auto fadingSampled = buffers.sampledTrackNum;
+	blender.Evaluate(fade_start + fadeFrames, buffers);
+	sampleClip(overlay, fadeFrames, expected1);
+	diff = 0.0f;
+	for (size_t b = 0; b < boneNum; ++b) {
+		diff = max(diff, MaxDifference(buffers.poses[b], expected1[b]));
+	}
+	report("fade to", diff, 0.0f, buffers.sampledTrackNum, overlay.Tracks().size());
+	report("fading", 0.0f, 0.0f, fadingSampled, base.Tracks().size() + overlay.Tracks().size());
+
+	// 加算：上のクリップの最初のフレームでは差分が無いので下のクリップのまま
+	blender.Reset(boneNum);
+	blender.Play(0, &base, 0, 0);
+	layer = blender.AddLayer(AnimationBlendMode::Additive);
+	const uint32_t additive_start = 7;
+	blender.Play(layer, &overlay, additive_start, 0);
+	blender.Evaluate(additive_start, buffers);
+	sampleClip(base, additive_start, expected0);
+	diff = 0.0f;
+	for (size_t b = 0; b < boneNum; ++b) {
+		diff = max(diff, poseDiff(buffers.poses[b], expected0[b]));
+	}
+	report("additive", diff, 1.0e-3f, buffers.sampledTrackNum, base.Tracks().size() + overlay.Tracks().size());
+
+	// 1フレームあたりの評価時間（すべてのクリップの全トラックをサンプリングして全ボーンを重ねる場合と比べる）
+	auto measure = [&](const AnimationBlender& b) {
+		auto start = Clock::now();
+		for (int r = 0; r < repeatNum; ++r) {
+			for (uint32_t frame = 0; frame < frameNum; ++frame) {
+				b.Evaluate(frame, buffers);
+			}
+		}
+		return ElapsedMs(start) * 1000.0 / (static_cast<double>(repeatNum) * frameNum);
+	};
+	AnimationBlender masked;
+	masked.Reset(boneNum);
+	masked.Play(0, &base, 0, 0);
+	masked.SetLayerMask(masked.AddLayer(AnimationBlendMode::Override), mask);
+	masked.Play(1, &overlay, 0, 0);
+	AnimationBlender idle;
+	idle.Reset(boneNum);
+	idle.Play(0, &base, 0, 0);
+	idle.Play(idle.AddLayer(AnimationBlendMode::Override, 0.0f), &overlay, 0, 0);
+	auto maskedUs = measure(masked);
+	auto idleUs = measure(idle);
+	auto start = Clock::now();
+	for (int r = 0; r < repeatNum; ++r) {
+		for (uint32_t frame = 0; frame < frameNum; ++frame) {
+			sampleClip(base, frame, expected0);
+			sampleClip(overlay, frame, expected1);
+			for (size_t b = 0; b < boneNum; ++b) {
+				auto q = XMQuaternionSlerp(XMLoadFloat4(&expected0[b].rotation), XMLoadFloat4(&expected1[b].rotation), mask[b]);
+				XMStoreFloat4(&expected0[b].rotation, q);
+				XMStoreFloat3(&expected0[b].translation, XMVectorLerp(XMLoadFloat3(&expected0[b].translation),
+					XMLoadFloat3(&expected1[b].translation), mask[b]));
+			}
+		}
+	}
+	auto naiveUs = ElapsedMs(start) * 1000.0 / (static_cast<double>(repeatNum) * frameNum);
+	printf("  evaluate: masked %.2f us  weight-0 layer %.2f us  (sampling both clips on every bone %.2f us)\n", maskedUs,
+		idleUs, naiveUs);
+	return result;
+}
+
+int MotionLibraryCommand(int argc, char** argv)
+{
+	int actorNum = 200;
+	int threadNum = 4;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			actorNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threadNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("motion-library: no input\n");
+		return 1;
+	}
+	MotionTarget target;
+	if (!target.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	auto& morphs = target.morphs;
+	vector<const char*> motionPaths(paths.begin() + 1, paths.end());
+	auto motionNum = motionPaths.size();
+	printf("%s: actors %d  motions %zu  threads %d\n", paths[0], actorNum, motionNum, threadNum);
+
+	// 共有しない場合（アクターごとに読み込んでコンパイルし、それぞれが持つ）
+	vector<MotionHandle> privates;
+	size_t privateBytes = 0;
+	auto start = Clock::now();
+	for (int a = 0; a < actorNum; ++a) {
+		for (auto path : motionPaths) {
+			MotionLibrary library;
+			auto motion = library.Load(path, library.BindSkeleton(target.boneNames, morphs), morphs);
+			if (motion == nullptr) {
+				printf("%s: failed to load\n", path);
+				return 1;
+			}
+			privateBytes += motion->MemoryBytes();
+			privates.push_back(motion);
+		}
+	}
+	auto privateMs = ElapsedMs(start);
+	printf("  private: %.2f ms  parses %zu  %zu bytes\n", privateMs, actorNum * motionNum, privateBytes);
+
+	// 共有する場合（アクターは複数のスレッドから同時に骨格を得て読み込む）
+	MotionLibrary library;
+	vector<vector<MotionHandle>> handles(actorNum);
+	ThreadPool pool(threadNum);
+	start = Clock::now();
+	vector<future<void>> loadings;
+	for (int a = 0; a < actorNum; ++a) {
+		loadings.push_back(pool.Enqueue([&, a]() {
+			auto skeleton = library.BindSkeleton(target.boneNames, morphs);
+			for (auto path : motionPaths) {
+				handles[a].push_back(library.Load(path, skeleton, morphs));
+			}
+		}));
+	}
+	for (auto& loading : loadings) {
+		loading.get();
+	}
+	auto sharedMs = ElapsedMs(start);
+	auto stats = library.Stats();
+	printf("  shared: %.2f ms  loads %zu compiles %zu hits %zu  files %zu motions %zu (referenced %zu) skeletons %zu  %zu bytes\n",
+		sharedMs, stats.loads, stats.compiles, stats.hits, stats.fileNum, stats.motionNum, stats.referencedNum, stats.skeletonNum,
+		stats.bytes);
+
+	int result = 0;
+	auto check = [&result](bool ok, const char* what) {
+		if (!ok) {
+			printf("  NG: %s\n", what);
+			result = 1;
+		}
+	};
+	check(stats.loads == motionNum && stats.compiles == motionNum, "each motion is loaded and compiled once");
+	check(stats.hits == (actorNum - 1) * motionNum, "other actors hit");
+	check(stats.skeletonNum == 1 && stats.skeletonHits == static_cast<size_t>(actorNum - 1), "actors share the skeleton");
+	bool same = true;
+	for (auto& actorHandles : handles) {
+		same &= actorHandles == handles[0];
+	}
+	check(same, "actors share the same motions");
+
+	// 共有したものと、アクターごとに読み込んだものは同じ姿勢になる
+	auto boneNum = target.boneNames.size();
+	vector<BonePose> sharedPoses(boneNum);
+	vector<BonePose> privatePoses(boneNum);
+	float diff = 0.0f;
+	for (size_t m = 0; m < motionNum; ++m) {
+		auto& shared = *handles[0][m];
+		auto& own = *privates[m];
+		for (uint32_t frame = 0; frame <= shared.clip.Duration(); ++frame) {
+			shared.clip.Sample(static_cast<float>(frame), sharedPoses.data());
+			own.clip.Sample(static_cast<float>(frame), privatePoses.data());
+			for (size_t b = 0; b < boneNum; ++b) {
+				diff = max(diff, MaxDifference(sharedPoses[b], privatePoses[b]));
+			}
+		}
+		same = shared.morphTracks.size() == own.morphTracks.size() && shared.ikSwitches.size() == own.ikSwitches.size();
+		check(same, "morph and IK tracks match");
+	}
+	printf("  shared vs private: max diff %g\n", diff);
+	check(diff == 0.0f, "shared motions sample the same poses");
+	privates.clear();
+
+	// 同じモデルを別に読み込んだもの（複製したアクター）は骨格もモーションも共有し、コンパイルしない
+	MotionTarget clone;
+	clone.Load(paths[0]);
+	start = Clock::now();
+	auto cloneSkeleton = library.BindSkeleton(clone.boneNames, clone.morphs);
+	vector<MotionHandle> cloneHandles;
+	for (auto path : motionPaths) {
+		cloneHandles.push_back(library.Load(path, cloneSkeleton, clone.morphs));
+	}
+	auto cloneUs = ElapsedMs(start) * 1000.0;
+	stats = library.Stats();
+	printf("  clone: %.1f us  loads %zu compiles %zu  skeletons %zu\n", cloneUs, stats.loads, stats.compiles, stats.skeletonNum);
+	check(cloneSkeleton == handles[0][0]->skeleton && cloneHandles == handles[0] && stats.compiles == motionNum,
+		"clone shares the skeleton and motions");
+
+	// ボーンの並びが違う骨格はVMDを読み込み直さずにコンパイルだけする
+	auto otherBoneNames = target.boneNames;
+	otherBoneNames.back() += "_";
+	auto otherSkeleton = library.BindSkeleton(otherBoneNames, morphs);
+	vector<MotionHandle> otherHandles;
+	for (auto path : motionPaths) {
+		otherHandles.push_back(library.Load(path, otherSkeleton, morphs));
+	}
+	stats = library.Stats();
+	printf("  other skeleton: loads %zu compiles %zu  motions %zu skeletons %zu  %zu bytes\n", stats.loads, stats.compiles,
+		stats.motionNum, stats.skeletonNum, stats.bytes);
+	check(stats.loads == motionNum && stats.compiles == motionNum * 2 && stats.skeletonNum == 2,
+		"other skeleton compiles without loading");
+
+	// 読み込めないもの
+	check(library.Load("motion/not_found.vmd", cloneSkeleton, morphs) == nullptr && library.Stats().failures == 1,
+		"missing file fails");
+
+	// 参照が無くなったものから破棄される
+	otherHandles.clear();
+	otherSkeleton.reset();
+	auto purged = library.Purge();
+	stats = library.Stats();
+	printf("  purge (other skeleton released): %zu  motions %zu skeletons %zu  %zu bytes\n", purged, stats.motionNum,
+		stats.skeletonNum, stats.bytes);
+	check(purged == motionNum && stats.fileNum == motionNum && stats.skeletonNum == 1, "only unreferenced motions are purged");
+	handles.clear();
+	cloneHandles.clear();
+	cloneSkeleton.reset();
+	purged = library.Purge();
+	stats = library.Stats();
+	printf("  purge (all released): %zu  files %zu skeletons %zu  %zu bytes\n", purged, stats.fileNum, stats.skeletonNum,
+		stats.bytes);
+	check(purged == motionNum && stats.fileNum == 0 && stats.skeletonNum == 0 && stats.bytes == 0, "all motions are purged");
+	return result;
+}
+
+int BindMotionCommand(int argc, char** argv)
+{
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		paths.push_back(argv[i]);
+	}
+	if (paths.size() < 2) {
+		printf("bind-motion: no input\n");
+		return 1;
+	}
+	auto modelPaths = ListFiles(paths[0], ".pmd");
+	if (modelPaths.empty()) {
+		modelPaths.push_back(paths[0]);
+	}
+	vector<const char*> motionPaths(paths.begin() + 1, paths.end());
+	vector<VMDData> vmds(motionPaths.size());
+	for (size_t m = 0; m < motionPaths.size(); ++m) {
+		if (!ParseVMDFile(motionPaths[m], vmds[m])) {
+			printf("%s: failed to load\n", motionPaths[m]);
+			return 1;
+		}
+	}
+
+	int result = 0;
+	MotionLibrary library;
+	vector<SkeletonHandle> skeletons;
+	vector<MotionHandle> motions;
+	double bindMs = 0.0;
+	for (auto& modelPath : modelPaths) {
+		MotionTarget target;
+		if (!target.Load(modelPath.c_str())) {
+			printf("%s: failed to load\n", modelPath.c_str());
+			result = 1;
+			continue;
+		}
+		auto start = Clock::now();
+		auto skeleton = library.BindSkeleton(target.boneNames, target.morphs);
+		auto shared = find(skeletons.begin(), skeletons.end(), skeleton) != skeletons.end();
+		vector<MotionHandle> bound;
+		for (auto path : motionPaths) {
+			bound.push_back(library.Load(path, skeleton, target.morphs));
+		}
+		auto ms = ElapsedMs(start);
+		bindMs += ms;
+		printf("%s: bones %zu morphs %zu  %s  %.3f ms\n", modelPath.c_str(), target.boneNames.size(), target.morphs.MorphNum(),
+			shared ? "shared skeleton" : "new skeleton", ms);
+		for (size_t m = 0; m < motionPaths.size(); ++m) {
+			auto& motion = *bound[m];
+			auto& vmd = vmds[m];
+			printf("  %s: tracks %zu  unmatched bones %zu morphs %zu", motionPaths[m], motion.clip.Tracks().size(),
+				motion.unmatchedBones.size(), motion.unmatchedMorphs.size());
+			for (size_t i = 0; i < motion.unmatchedBones.size() && i < 4; ++i) {
+				printf(" %s%s", i == 0 ? "(" : "", motion.unmatchedBones[i].c_str());
+			}
+			printf("%s\n", motion.unmatchedBones.empty() ? "" : motion.unmatchedBones.size() > 4 ? " ...)" : ")");
+
+			// ボーン番号で引くIKのオンオフが、名前で引く従来の方法と同じになる
+			bool same = true;
+			auto lastFrame = vmd.ikEnableData.empty() ? 0 : vmd.ikEnableData.back().frameNo + 1;
+			for (uint32_t frame = 0; frame <= lastFrame; ++frame) {
+				auto it = find_if(vmd.ikEnableData.rbegin(), vmd.ikEnableData.rend(), [frame](const VMDIKEnable& ikEnable) {
+					return ikEnable.frameNo <= frame;
+				});
+				auto ikSwitch = motion.FindIKSwitch(frame);
+				for (uint32_t b = 0; b < target.boneNames.size(); ++b) {
+					auto enabled = true;
+					if (it != vmd.ikEnableData.rend()) {
+						auto found = it->ikEnableTable.find(target.boneNames[b]);
+						enabled = found == it->ikEnableTable.end() || found->second;
+					}
+					same &= enabled == (ikSwitch == nullptr || ikSwitch->disabled[b] == 0);
+				}
+			}
+			if (!same) {
+				printf("  NG: IK switches differ from name lookup\n");
+				result = 1;
+			}
+		}
+		skeletons.push_back(skeleton);
+		motions.insert(motions.end(), bound.begin(), bound.end());
+	}
+	auto stats = library.Stats();
+	printf("models %zu  skeletons %zu  compiles %zu hits %zu loads %zu  bind %.3f ms\n", modelPaths.size(), stats.skeletonNum,
+		stats.compiles, stats.hits, stats.loads, bindMs);
+	if (stats.loads != motionPaths.size() || stats.compiles != stats.skeletonNum * motionPaths.size()) {
+		printf("NG: each motion must be loaded once and compiled once per skeleton\n");
+		result = 1;
+	}
+	return result;
+}
+
+int ParseVMDCommand(int argc, char** argv)
+{
+	size_t syntheticMegaBytes = 8;
+	int syntheticNum = 8;
+	int threadNum = 4;
+	int repeatNum = 3;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			syntheticMegaBytes = static_cast<size_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			syntheticNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threadNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	int result = 0;
+	ThreadPool pool(threadNum);
+
+	// 実際のファイル（ディレクトリならその中のVMDすべて）を従来の読み込みと比べる
+	for (auto path : paths) {
+		auto files = ParseVMDDirectory(path, &pool);
+		if (files.empty()) {
+			files.resize(1);
+			files[0].path = path;
+			files[0].succeeded = ParseVMDFile(path, files[0].data);
+		}
+		for (auto& file : files) {
+			if (!file.succeeded) {
+				printf("%s: failed to parse\n", file.path.c_str());
+				result = 1;
+				continue;
+			}
+			auto& vmd = file.data;
+			VMDData legacy;
+			auto same = LegacyReadVMD(file.path.c_str(), legacy) && SameVMD(vmd, legacy);
+			printf("%s: bones %zu morphs %zu cameras %zu lights %zu self shadows %zu ik %zu  %s\n", file.path.c_str(),
+				vmd.boneKeyFrames.size(), vmd.morphKeyFrames.size(), vmd.cameraKeyFrames.size(), vmd.lightKeyFrames.size(),
+				vmd.selfShadowKeyFrames.size(), vmd.ikEnableData.size(), same ? "same as fread" : "NG: differs from fread");
+			result |= same ? 0 : 1;
+		}
+	}
+
+	// 合成したファイルで、途中で切れたものや個数の壊れたものを読んでもはみ出さないことを確かめる
+	auto syntheticBytes = syntheticMegaBytes * 1024 * 1024;
+	vector<size_t> boundaries;
+	auto synthetic = BuildSyntheticVMD(64 * 1024, 0, boundaries);
+	VMDData vmd;
+	size_t truncatedNum = 0;
+	size_t wrongNum = 0;
+	mt19937 random(1);
+	for (size_t size = 0; size <= synthetic.size(); size += (size < 4096 ? 1 : 1 + random() % 97)) {
+		// 末尾の後ろを読めば検出できるように、ちょうどのサイズの領域に写す
+		vector<uint8_t> truncated(synthetic.begin(), synthetic.begin() + size);
+		auto succeeded = ParseVMDMemory(truncated.data(), truncated.size(), vmd);
+		auto expected = find(boundaries.begin(), boundaries.end(), size) != boundaries.end();
+		wrongNum += succeeded != expected ? 1 : 0;
+		++truncatedNum;
+	}
+	for (auto boundary : boundaries) {
+		wrongNum += ParseVMDMemory(synthetic.data(), boundary, vmd) ? 0 : 1;
+		++truncatedNum;
+	}
+	auto corrupted = synthetic;
+	uint32_t hugeCount = 0xffffffff;
+	memcpy(corrupted.data() + 50, &hugeCount, sizeof(hugeCount));
+	wrongNum += ParseVMDMemory(corrupted.data(), corrupted.size(), vmd) ? 1 : 0;
+	printf("truncated / corrupted: %zu sizes  %s\n", truncatedNum + 1, wrongNum == 0 ? "ok" : "NG");
+	result |= wrongNum == 0 ? 0 : 1;
+
+	// 数MBのファイルを書き出して、従来のfreadと1スレッド、並列で読み込む時間を比べる
+	vector<string> files;
+	size_t totalBytes = 0;
+	size_t totalKeyFrames = 0;
+	for (int f = 0; f < syntheticNum; ++f) {
+		char path[64];
+		snprintf(path, sizeof(path), "parse-vmd-synthetic-%d.vmd", f);
+		boundaries.clear();
+		synthetic = BuildSyntheticVMD(syntheticBytes, static_cast<uint32_t>(f + 1), boundaries);
+		if (!WriteFile(path, synthetic)) {
+			printf("%s: failed to write\n", path);
+			return 1;
+		}
+		files.push_back(path);
+		totalBytes += synthetic.size();
+	}
+	bool same = true;
+	for (auto& file : files) {
+		VMDData parsed;
+		VMDData legacy;
+		same &= ParseVMDFile(file.c_str(), parsed) && LegacyReadVMD(file.c_str(), legacy) && SameVMD(parsed, legacy);
+		totalKeyFrames += parsed.KeyFrameNum();
+	}
+	printf("synthetic: %d files  %.1f MB  %zu keyframes  %s\n", syntheticNum, totalBytes / (1024.0 * 1024.0), totalKeyFrames,
+		same ? "same as fread" : "NG: differs from fread");
+	result |= same ? 0 : 1;
+
+	auto report = [&](const char* name, const function<void()>& parse) {
+		auto best = DBL_MAX;
+		for (int r = 0; r < repeatNum; ++r) {
+			auto start = Clock::now();
+			parse();
+			best = min(best, ElapsedMs(start));
+		}
+		printf("  %-12s %8.2f ms  %6.1f M keyframes/s  %7.1f MB/s\n", name, best, totalKeyFrames / best / 1000.0,
+			totalBytes / (1024.0 * 1024.0) / (best / 1000.0));
+	};
+	report("fread", [&files]() {
+		for (auto& file : files) {
+			VMDData legacy;
+			LegacyReadVMD(file.c_str(), legacy);
+		}
+	});
+	report("mapped", [&files]() {
+		ParseVMDFiles(files, nullptr);
+	});
+	char parallelName[32];
+	snprintf(parallelName, sizeof(parallelName), "mapped x%d", threadNum);
+	report(parallelName, [&files, &pool]() {
+		ParseVMDFiles(files, &pool);
+	});
+	for (auto& file : files) {
+		remove(file.c_str());
+	}
+	return result;
+}
+
+namespace
+{
+	/// <summary>
+	/// 以前のPMDActorと同じ、名前のmapに置いたノードを「センター」から再帰でたどって親の行列を掛ける方法（比較用）
+	/// </summary>
+	class RecursiveHierarchy
+	{
+	private:
+		struct BoneNode {
+			uint32_t boneIdx;
+			vector<BoneNode*> children;
+		};
+		map<string, BoneNode> _boneNodeTable;
+		vector<BoneNode*> _boneNodeAddressArray;
+		BoneNode* _centerNode = nullptr;
+
+		void Multiply(vector<XMMATRIX>& matrices, const BoneNode* node, const XMMATRIX& mat) const
+		{
+			matrices[node->boneIdx] *= mat;
+			for (auto& cnode : node->children) {
+				Multiply(matrices, cnode, matrices[node->boneIdx]);
+			}
+		}
+
+	public:
+		RecursiveHierarchy(const PMDModelData& model)
+		{
+			auto& bones = model.Bones();
+			_boneNodeAddressArray.resize(bones.size());
+			for (uint32_t i = 0; i < bones.size(); ++i) {
+				auto& node = _boneNodeTable[model.BoneName(i)];
+				node.boneIdx = i;
+				_boneNodeAddressArray[i] = &node;
+			}
+			for (uint32_t i = 0; i < bones.size(); ++i) {
+				if (bones[i].parentNo < bones.size()) {
+					_boneNodeAddressArray[bones[i].parentNo]->children.push_back(_boneNodeAddressArray[i]);
+				}
+			}
+			auto center = _boneNodeTable.find("センター");
+			_centerNode = center != _boneNodeTable.end() ? &center->second : nullptr;
+		}
+
+		void LocalToModel(vector<XMMATRIX>& matrices) const
+		{
+			if (_centerNode != nullptr) {
+				Multiply(matrices, _centerNode, XMMatrixIdentity());
+			}
+		}
+
+		/// <summary>「センター」の子孫（再帰で行列を掛けるボーン）</summary>
+		vector<bool> Reached() const
+		{
+			vector<bool> reached(_boneNodeAddressArray.size(), false);
+			vector<const BoneNode*> stack;
+			if (_centerNode != nullptr) {
+				stack.push_back(_centerNode);
+			}
+			while (!stack.empty()) {
+				auto node = stack.back();
+				stack.pop_back();
+				reached[node->boneIdx] = true;
+				stack.insert(stack.end(), node->children.begin(), node->children.end());
+			}
+			return reached;
+		}
+	};
+
+	/// <summary>
+	/// ボーン1と2が互いを親にしたモデルを書き出してSkeletonを作り、並べ終わるか（すべてのボーンがちょうど1回ずつ、親より後に並ぶか）確かめる
+	/// </summary>
+	bool CheckCyclicSkeleton(const PMDModelData& model)
+	{
+		if (model.Bones().size() < 3) {
+			return true;
+		}
+		MappedFile file;
+		if (!file.Open(model.Path().c_str())) {
+			return false;
+		}
+		// ボーンはシグネチャ、ヘッダ、頂点、インデックス、マテリアルの後ろ
+		auto bonesOffset = 3 + sizeof(PMDHeader) + sizeof(uint32_t) + model.Vertices().byteSize()
+			+ sizeof(uint32_t) + model.Indices().byteSize() + sizeof(uint32_t) + model.Materials().byteSize() + sizeof(uint16_t);
+		vector<uint8_t> data(file.Data(), file.Data() + file.Size());
+		file.Close();
+		uint16_t parents[] = { 2, 1 };
+		for (size_t b = 1; b <= 2; ++b) {
+			memcpy(data.data() + bonesOffset + b * sizeof(PMDBone) + offsetof(PMDBone, parentNo), &parents[b - 1], sizeof(uint16_t));
+		}
+		const char* path = "bench-skeleton-cyclic.pmd";
+		bool ok = WriteFile(path, data);
+		// マップしたままだと消せないので、確かめ終わったら閉じる
+		{
+			PMDModelData cyclic;
+			ok = ok && cyclic.Load(path) && cyclic.Bones()[1].parentNo == 2 && cyclic.Bones()[2].parentNo == 1;
+			if (ok) {
+				Skeleton skeleton;
+				skeleton.Build(cyclic);
+				auto boneNum = cyclic.Bones().size();
+				auto& order = skeleton.Order();
+				vector<bool> placed(boneNum, false);
+				ok = order.size() == boneNum;
+				for (size_t i = 0; ok && i < order.size(); ++i) {
+					auto bone = order[i];
+					auto parent = skeleton.Parent(bone);
+					ok = bone < boneNum && !placed[bone] && (parent == Skeleton::no_parent || placed[parent]);
+					placed[bone] = true;
+				}
+				// 循環はどちらか一方の親を切って根にする
+				ok = ok && (skeleton.Parent(1) == Skeleton::no_parent) != (skeleton.Parent(2) == Skeleton::no_parent);
+			}
+		}
+		remove(path);
+		return ok;
+	}
+}
+
+int BenchSkeletonCommand(int argc, char** argv)
+{
+	int repeatNum = 20000;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	vector<string> modelPaths;
+	for (auto path : paths) {
+		auto files = ListFiles(path, ".pmd");
+		if (files.empty()) {
+			files.push_back(path);
+		}
+		modelPaths.insert(modelPaths.end(), files.begin(), files.end());
+	}
+	if (modelPaths.empty()) {
+		printf("bench-skeleton: no input\n");
+		return 1;
+	}
+
+	int result = 0;
+	double recursiveTotalUs = 0.0;
+	double linearTotalUs = 0.0;
+	size_t recursiveTotalMultiplyNum = 0;
+	size_t linearTotalMultiplyNum = 0;
+	size_t cyclicNGNum = 0;
+	mt19937 random(1);
+	uniform_real_distribution<float> angle(-0.5f, 0.5f);
+	for (auto& modelPath : modelPaths) {
+		PMDModelData model;
+		if (!model.Load(modelPath.c_str())) {
+			printf("%s: failed to load\n", modelPath.c_str());
+			result = 1;
+			continue;
+		}
+		auto boneNum = model.Bones().size();
+		Skeleton skeleton;
+		skeleton.Build(model);
+		RecursiveHierarchy recursive(model);
+
+		// どのボーンも基準点を中心に適当に回した姿勢
+		vector<XMMATRIX> locals(boneNum);
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			auto& pos = skeleton.RestPosition(b);
+			locals[b] = XMMatrixTranslation(-pos.x, -pos.y, -pos.z)
+				* XMMatrixRotationX(angle(random)) * XMMatrixRotationY(angle(random)) * XMMatrixRotationZ(angle(random))
+				* XMMatrixTranslation(pos.x, pos.y, pos.z);
+		}
+
+		// 再帰でたどるボーンは同じ順に同じ掛け算をするので、ビット単位で一致する
+		auto recursiveMatrices = locals;
+		recursive.LocalToModel(recursiveMatrices);
+		auto linearMatrices = locals;
+		skeleton.LocalToModel(linearMatrices.data());
+		auto reached = recursive.Reached();
+		// 名前が重なるボーンは以前は1つのノードにまとまっていた（正しく掛からないので比べない）
+		map<string, size_t> nameCounts;
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			++nameCounts[model.BoneName(b)];
+		}
+		size_t mismatchNum = 0;
+		size_t unreachedNum = 0;
+		size_t duplicatedNum = 0;
+		size_t recursiveMultiplyNum = 0;
+		size_t linearMultiplyNum = 0;
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			recursiveMultiplyNum += reached[b] ? 1 : 0;
+			linearMultiplyNum += skeleton.Parent(b) != Skeleton::no_parent ? 1 : 0;
+			if (nameCounts[model.BoneName(b)] > 1) {
+				++duplicatedNum;
+				continue;
+			}
+			if (!reached[b]) {
+				// 「センター」の外にあるボーンは、以前は親の行列が掛からなかった
+				unreachedNum += skeleton.Parent(b) != Skeleton::no_parent ? 1 : 0;
+				continue;
+			}
+			mismatchNum += memcmp(&recursiveMatrices[b], &linearMatrices[b], sizeof(XMMATRIX)) != 0 ? 1 : 0;
+		}
+		// 途中のボーンから掛け直しても、全体を計算したものと一致する
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			auto parent = skeleton.Parent(b);
+			if (parent == Skeleton::no_parent) {
+				continue;
+			}
+			auto matrices = linearMatrices;
+			const uint32_t* begin;
+			const uint32_t* end;
+			skeleton.Subtree(b, begin, end);
+			for (auto bone = begin; bone != end; ++bone) {
+				matrices[*bone] = locals[*bone];
+			}
+			skeleton.MultiplySubtree(b, matrices[parent], matrices.data());
+			if (memcmp(matrices.data(), linearMatrices.data(), sizeof(XMMATRIX) * boneNum) != 0) {
+				++mismatchNum;
+			}
+		}
+
+		// 速さ（毎回ボーンごとの行列から計算し直す）
+		vector<XMMATRIX> matrices(boneNum);
+		auto start = Clock::now();
+		for (int n = 0; n < repeatNum; ++n) {
+			copy(locals.begin(), locals.end(), matrices.begin());
+			recursive.LocalToModel(matrices);
+		}
+		auto recursiveUs = ElapsedMs(start) * 1000.0 / repeatNum;
+		start = Clock::now();
+		for (int n = 0; n < repeatNum; ++n) {
+			copy(locals.begin(), locals.end(), matrices.begin());
+			skeleton.LocalToModel(matrices.data());
+		}
+		auto linearUs = ElapsedMs(start) * 1000.0 / repeatNum;
+		recursiveTotalUs += recursiveUs;
+		linearTotalUs += linearUs;
+		recursiveTotalMultiplyNum += recursiveMultiplyNum;
+		linearTotalMultiplyNum += linearMultiplyNum;
+
+		// 掛けるボーンの数が違う（以前は「センター」の外を掛けなかった）ので、1ボーンあたりの時間も出す
+		printf("%s: bones %zu roots %zu %s  recursive %.3f us (%zu bones %.1f ns/bone)  linear %.3f us (%zu bones %.1f ns/bone)  previously unparented %zu duplicated names %zu%s\n",
+			modelPath.c_str(), boneNum, skeleton.RootNum(), skeleton.IsSorted() ? "in order" : "reordered",
+			recursiveUs, recursiveMultiplyNum, recursiveMultiplyNum > 0 ? recursiveUs * 1000.0 / recursiveMultiplyNum : 0.0,
+			linearUs, linearMultiplyNum, linearMultiplyNum > 0 ? linearUs * 1000.0 / linearMultiplyNum : 0.0,
+			unreachedNum, duplicatedNum, mismatchNum == 0 ? "" : "  NG: matrices differ");
+		if (mismatchNum != 0) {
+			result = 1;
+		}
+		if (!CheckCyclicSkeleton(model)) {
+			printf("%s: NG: bones 1 and 2 made each other's parent are not ordered\n", modelPath.c_str());
+			++cyclicNGNum;
+			result = 1;
+		}
+	}
+	printf("cyclic parents: %zu models  %s\n", modelPaths.size(), cyclicNGNum == 0 ? "ok" : "NG");
+	printf("total: recursive %.3f us (%.1f ns/bone)  linear %.3f us (%.1f ns/bone) per evaluation of every model\n",
+		recursiveTotalUs, recursiveTotalMultiplyNum > 0 ? recursiveTotalUs * 1000.0 / recursiveTotalMultiplyNum : 0.0,
+		linearTotalUs, linearTotalMultiplyNum > 0 ? linearTotalUs * 1000.0 / linearTotalMultiplyNum : 0.0);
+	return result;
+}
+
+namespace
+{
+	XMMATRIX LookAtMatrix(const XMVECTOR& origin, const XMVECTOR& lookat, XMFLOAT3& up, XMFLOAT3& right)
+	{
+		return XMMatrixTranspose(::LookAtMatrix(origin, up, right)) * ::LookAtMatrix(lookat, up, right);
+	}
+
+	/// <summary>以前のPMDActorと同じ、ボーンごとに4x4行列を作って掛け、IKも行列のまま解く方法（比較用）</summary>
+	class MatrixPose
+	{
+	private:
+		const Skeleton& _skeleton;
+		const IKSolver& _ik;
+		const float epsilon = 0.0005f;
+
+		void SolveLookAt(const IKChain& ik, vector<XMMATRIX>& boneMatrices) const
+		{
+			// この関数に来た時点でノードはひとつしかなく、チェーンに入っているノード番号はIKのルートノードのものなので、
+			// このルートノードからターゲットに向かうベクトルを考えれば良い
+			auto opos1 = XMLoadFloat3(&_skeleton.RestPosition(ik.nodeIdxes[0]));
+			auto tpos1 = XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx));	// ！？
+
+			auto opos2 = XMVector3Transform(opos1, boneMatrices[ik.nodeIdxes[0]]);
+			auto tpos2 = XMVector3Transform(tpos1, boneMatrices[ik.boneIdx]);
+
+			auto originVec = XMVectorSubtract(tpos1, opos1);
+			auto targetVec = XMVectorSubtract(tpos2, opos2);
+
+			originVec = XMVector3Normalize(originVec);
+			targetVec = XMVector3Normalize(targetVec);
+
+			auto up = XMFLOAT3(0, 1, 0);
+			auto right = XMFLOAT3(1, 0, 0);
+			XMMATRIX mat = XMMatrixTranslationFromVector(-opos2) * LookAtMatrix(originVec, targetVec, up, right) * XMMatrixTranslationFromVector(opos2);
+
+			boneMatrices[ik.nodeIdxes[0]] = mat;
+		}
+
+		void SolveCosineIK(const IKChain& ik, vector<XMMATRIX>& boneMatrices) const
+		{
+			vector<XMVECTOR> positions;		// IK構成点を保存
+			array<float, 2> edgeLens;		// IKのそれぞれのボーン間の距離を保存
+
+			// ターゲット（末端ボーンではなく、末端ボーンが近づく目標ボーンの座標を取得）
+			auto targetPos = XMVector3Transform(XMLoadFloat3(&_skeleton.RestPosition(ik.boneIdx)), boneMatrices[ik.boneIdx]);
+
+			// IKチェーンが逆順なので、逆に並ぶようにしている
+			// 末端ボーン
+			positions.emplace_back(XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx)));
+			// 中間及びルートボーン
+			for (auto& chainBoneIdx : ik.nodeIdxes) {
+				positions.emplace_back(XMLoadFloat3(&_skeleton.RestPosition(chainBoneIdx)));
+			}
+			// ちょっと分かりづらいので逆にしておく
+			reverse(positions.begin(), positions.end());
+
+			// 元の長さを測っておく
+			edgeLens[0] = XMVectorGetX(XMVector3Length(XMVectorSubtract(positions[1], positions[0])));
+			edgeLens[1] = XMVectorGetX(XMVector3Length(XMVectorSubtract(positions[2], positions[1])));
+
+			// ルートボーン座標変換（逆順になっているため使用するインデックスに注意）
+			positions[0] = XMVector3Transform(positions[0], boneMatrices[ik.nodeIdxes[1]]);
+			// 真ん中はどうせ自動計算されるので計算しない
+			// 先端ボーン
+			positions[2] = XMVector3Transform(positions[2], boneMatrices[ik.boneIdx]);		// 本当はik.targetIdxだが・・・！？
+
+			// ルートから先端へのベクトルを作っておく
+			auto linearVec = XMVectorSubtract(positions[2], positions[0]);
+			float a = XMVectorGetX(XMVector3Length(linearVec));
+			float b = edgeLens[0];
+			float c = edgeLens[1];
+
+			linearVec = XMVector3Normalize(linearVec);
+
+			// ルートから真ん中への角度計算
+			float theta1 = acosf((a * a + b * b - c * c) / (2 * a * b));
+
+			// 真ん中からターゲットへの角度計算
+			float theta2 = acosf((b * b + c * c - a * a) / (2 * b * c));
+
+			// 「軸」を求める
+			// もし真ん中が「ひざ」であった場合には強制的にX軸とする。
+			XMVECTOR axis;
+			if (!(_skeleton.Flags(ik.nodeIdxes[0]) & skeleton_bone_knee)) {
+				auto vm = XMVector3Normalize(XMVectorSubtract(positions[2], positions[0]));
+				auto vt = XMVector3Normalize(XMVectorSubtract(targetPos, positions[0]));
+				axis = XMVector3Cross(vt, vm);
+			}
+			else {
+				auto right = XMFLOAT3(1, 0, 0);
+				axis = XMLoadFloat3(&right);
+			}
+
+			// 注意点・・・IKチェーンは根っこに向かってから数えられるため1が根っこに近い
+			auto mat1 = XMMatrixTranslationFromVector(-positions[0]);
+			mat1 *= XMMatrixRotationAxis(axis, theta1);
+			mat1 *= XMMatrixTranslationFromVector(positions[0]);
+
+			auto mat2 = XMMatrixTranslationFromVector(-positions[1]);
+			mat2 *= XMMatrixRotationAxis(axis, theta2 - XM_PI);
+			mat2 *= XMMatrixTranslationFromVector(positions[1]);
+
+			boneMatrices[ik.nodeIdxes[1]] *= mat1;
+			boneMatrices[ik.nodeIdxes[0]] = mat2 * boneMatrices[ik.nodeIdxes[1]];
+			boneMatrices[ik.targetIdx] = boneMatrices[ik.nodeIdxes[0]];//直前の影響を受ける
+		}
+
+		void SolveCCDIK(const IKChain& ik, vector<XMMATRIX>& boneMatrices) const
+		{
+			// ターゲット
+			auto targetOriginPos = XMLoadFloat3(&_skeleton.RestPosition(ik.boneIdx));
+
+			auto parentMat = boneMatrices[_skeleton.IKParent(ik.boneIdx)];
+			XMVECTOR det;
+			auto invParentMat = XMMatrixInverse(&det, parentMat);
+			auto targetNextPos = XMVector3Transform(targetOriginPos, boneMatrices[ik.boneIdx] * invParentMat);
+
+			// まずはIKの間にあるボーンの座標を入れておく(逆順注意)
+			std::vector<XMVECTOR> bonePositions;
+			// 末端ノード
+			auto endPos = XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx));
+			// 中間ノード（ルートを含む）
+			for (auto& cidx : ik.nodeIdxes) {
+				bonePositions.push_back(XMLoadFloat3(&_skeleton.RestPosition(cidx)));
+			}
+
+			vector<XMMATRIX> mats(bonePositions.size());
+			fill(mats.begin(), mats.end(), XMMatrixIdentity());
+			// ちょっとよくわからないが、PMDエディタの6.8°が0.03になっており、これは180で割っただけの値である。
+			// つまりこれをラジアンとして使用するにはXM_PIを乗算しなければならない…と思われる。
+			auto ikLimit = ik.limit * XM_PI;
+			// ikに設定されている試行回数だけ繰り返す
+			for (int c = 0; c < ik.iterations; ++c) {
+				// ターゲットと末端がほぼ一致したら抜ける
+				if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+					break;
+				}
+				// それぞれのボーンを遡りながら角度制限に引っ掛からないように曲げていく
+				for (int bidx = 0; bidx < static_cast<int>(bonePositions.size()); ++bidx) {
+					const auto& pos = bonePositions[bidx];
+
+					// まず現在のノードから末端までと、現在のノードからターゲットまでのベクトルを作る
+					auto vecToEnd = XMVectorSubtract(endPos, pos);
+					auto vecToTarget = XMVectorSubtract(targetNextPos, pos);
+					vecToEnd = XMVector3Normalize(vecToEnd);
+					vecToTarget = XMVector3Normalize(vecToTarget);
+
+					// ほぼ同じベクトルになってしまった場合は外積できないため次のボーンに引き渡す
+					if (XMVectorGetX(XMVector3Length(XMVectorSubtract(vecToEnd, vecToTarget))) <= epsilon) {
+						continue;
+					}
+					// 外積計算および角度計算
+					auto cross = XMVector3Normalize(XMVector3Cross(vecToEnd, vecToTarget));
+					float angle = XMVectorGetX(XMVector3AngleBetweenVectors(vecToEnd, vecToTarget));
+					angle = min(angle, ikLimit);						// 回転限界補正
+					XMMATRIX rot = XMMatrixRotationAxis(cross, angle);	// 回転行列
+					// posを中心に回転
+					auto mat = XMMatrixTranslationFromVector(-pos) *
+						rot *
+						XMMatrixTranslationFromVector(pos);
+					mats[bidx] *= mat;									// 回転行列を保持しておく（乗算で回転重ね掛けを作っておく）
+					// 対象となる点をすべて回転させる（現在の点から見て末端側を回転）
+					for (auto idx = bidx - 1; idx >= 0; --idx) {		// 自分を回転させる必要はない
+						bonePositions[idx] = XMVector3Transform(bonePositions[idx], mat);
+					}
+					endPos = XMVector3Transform(endPos, mat);
+					// もし正解に近くなってたらループを抜ける
+					if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+						break;
+					}
+				}
+			}
+			int idx = 0;
+			for (auto& cidx : ik.nodeIdxes) {
+				boneMatrices[cidx] = mats[idx];
+				++idx;
+			}
+			// IKの根元から先を親の行列に付け直す
+			_skeleton.MultiplySubtree(ik.nodeIdxes.back(), parentMat, boneMatrices.data());
+		}
+
+	public:
+		MatrixPose(const Skeleton& skeleton, const IKSolver& ik) : _skeleton(skeleton), _ik(ik) {}
+
+		void ForwardKinematics(const BonePose* poses, const vector<uint32_t>& bones, vector<XMMATRIX>& boneMatrices) const
+		{
+			fill(boneMatrices.begin(), boneMatrices.end(), XMMatrixIdentity());
+			for (auto bone : bones) {
+				auto& pose = poses[bone];
+				auto& pos = _skeleton.RestPosition(bone);
+				auto mat = XMMatrixTranslation(-pos.x, -pos.y, -pos.z)
+					* XMMatrixRotationQuaternion(XMLoadFloat4(&pose.rotation))
+					* XMMatrixTranslation(pos.x, pos.y, pos.z);
+				boneMatrices[bone] = mat * XMMatrixTranslationFromVector(XMLoadFloat3(&pose.translation));
+			}
+			_skeleton.LocalToModel(boneMatrices.data());
+		}
+
+		void IKSolve(const uint8_t* disabled, vector<XMMATRIX>& boneMatrices) const
+		{
+			for (auto& ik : _ik.Chains()) {
+				if (disabled != nullptr && disabled[ik.boneIdx]) {
+					continue;
+				}
+				switch (ik.nodeIdxes.size()) {
+				case 0:
+					break;
+				case 1:
+					SolveLookAt(ik, boneMatrices);
+					break;
+				case 2:
+					SolveCosineIK(ik, boneMatrices);
+					break;
+				default:
+					SolveCCDIK(ik, boneMatrices);
+					break;
+				}
+			}
+		}
+	};
+
+	/// <summary>PMDActor::BuildBoneMatricesと同じく、回転と移動のままでつなげてIKを解き、最後に行列にする</summary>
+	void BuildBoneMatrices(const Skeleton& skeleton, const IKSolver& ik, const BonePose* poses, const vector<uint32_t>& bones,
+		const uint8_t* disabled, bool solveIK, vector<BoneTransform>& transforms, vector<XMMATRIX>& boneMatrices)
+	{
+		fill(transforms.begin(), transforms.end(), IdentityBoneTransform());
+		for (auto bone : bones) {
+			transforms[bone] = PoseToBoneTransform(poses[bone], skeleton.RestPosition(bone));
+		}
+		skeleton.LocalToModel(transforms.data());
+		if (solveIK) {
+			ik.Solve(skeleton, disabled, transforms.data());
+		}
+		for (size_t i = 0; i < boneMatrices.size(); ++i) {
+			boneMatrices[i] = BoneTransformToMatrix(transforms[i]);
+		}
+	}
+}
+
+int BenchPoseCommand(int argc, char** argv)
+{
+	int repeatNum = 20;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("bench-pose: no input\n");
+		return 1;
+	}
+	MotionTarget target;
+	if (!target.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	auto boneNum = target.boneNames.size();
+	Skeleton skeleton;
+	skeleton.Build(target.model);
+	IKSolver ik;
+	ik.Build(target.model, skeleton);
+	MatrixPose matrixPose(skeleton, ik);
+	MotionLibrary library;
+	auto motionSkeleton = library.BindSkeleton(target.boneNames, target.morphs);
+
+	// 誤差の許容量（モデルの大きさは20程度）
+	// IKはCCDの打ち切りの判定（epsilon）をまたぐことがあり、丸めの違いが少し大きくなる（それでも画面上では1画素よりずっと小さい）
+	const float fk_tolerance = 1e-4f;
+	const float ik_tolerance = 1e-2f;
+	int result = 0;
+	for (size_t m = 1; m < paths.size(); ++m) {
+		auto motion = library.Load(paths[m], motionSkeleton, target.morphs);
+		if (motion == nullptr) {
+			printf("%s: failed to load\n", paths[m]);
+			result = 1;
+			continue;
+		}
+		auto& clip = motion->clip;
+		auto frameNum = clip.Duration() + 1;
+		vector<uint32_t> bones;
+		for (auto& track : clip.Tracks()) {
+			bones.push_back(track.bone);
+		}
+		// フレームごとの姿勢とIKのオンオフ
+		vector<BonePose> poses(boneNum * frameNum);
+		vector<const uint8_t*> disabled(frameNum);
+		for (uint32_t frame = 0; frame < frameNum; ++frame) {
+			clip.Sample(static_cast<float>(frame), poses.data() + frame * boneNum);
+			auto ikSwitch = motion->FindIKSwitch(frame);
+			disabled[frame] = ikSwitch != nullptr ? ikSwitch->disabled.data() : nullptr;
+		}
+
+		// 以前の行列での計算と同じ結果になる（回転と移動にしたことによる丸めの違いだけ）
+		vector<XMMATRIX> expected(boneNum);
+		vector<XMMATRIX> actual(boneNum);
+		vector<BoneTransform> transforms(boneNum);
+		float fkDiff = 0.0f;
+		float ikDiff = 0.0f;
+		uint32_t worstFrame = 0;
+		uint32_t worstBone = 0;
+		for (uint32_t frame = 0; frame < frameNum; ++frame) {
+			auto framePoses = poses.data() + frame * boneNum;
+			for (int solveIK = 0; solveIK < 2; ++solveIK) {
+				matrixPose.ForwardKinematics(framePoses, bones, expected);
+				if (solveIK) {
+					matrixPose.IKSolve(disabled[frame], expected);
+				}
+				BuildBoneMatrices(skeleton, ik, framePoses, bones, disabled[frame], solveIK != 0, transforms, actual);
+				for (uint32_t b = 0; b < boneNum; ++b) {
+					auto diff = MaxDifference(expected[b], actual[b]);
+					auto& maxDiff = solveIK ? ikDiff : fkDiff;
+					if (diff > maxDiff) {
+						maxDiff = diff;
+						if (solveIK) {
+							worstFrame = frame;
+							worstBone = b;
+						}
+					}
+				}
+			}
+		}
+
+		// 速さ（全フレームをrepeatNum回評価する）
+		double times[2][2];
+		for (int solveIK = 0; solveIK < 2; ++solveIK) {
+			auto start = Clock::now();
+			for (int n = 0; n < repeatNum; ++n) {
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					matrixPose.ForwardKinematics(poses.data() + frame * boneNum, bones, expected);
+					if (solveIK) {
+						matrixPose.IKSolve(disabled[frame], expected);
+					}
+				}
+			}
+			times[solveIK][0] = ElapsedMs(start) * 1000.0 / (repeatNum * frameNum);
+			start = Clock::now();
+			for (int n = 0; n < repeatNum; ++n) {
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					BuildBoneMatrices(skeleton, ik, poses.data() + frame * boneNum, bones, disabled[frame], solveIK != 0,
+						transforms, actual);
+				}
+			}
+			times[solveIK][1] = ElapsedMs(start) * 1000.0 / (repeatNum * frameNum);
+		}
+
+		auto ok = fkDiff <= fk_tolerance && ikDiff <= ik_tolerance;
+		printf("%s: frames %u bones %zu tracks %zu chains %zu\n", paths[m], frameNum, boneNum, bones.size(), ik.Chains().size());
+		printf("  max diff  fk %g  ik %g (frame %u %s)  %s\n", fkDiff, ikDiff, worstFrame, target.boneNames[worstBone].c_str(),
+			ok ? "ok" : "NG");
+		printf("  fk       matrix %.2f us/frame  trs %.2f us/frame (x%.2f)\n", times[0][0], times[0][1], times[0][0] / times[0][1]);
+		printf("  fk + ik  matrix %.2f us/frame  trs %.2f us/frame (x%.2f)\n", times[1][0], times[1][1], times[1][0] / times[1][1]);
+		if (!ok) {
+			result = 1;
+		}
+	}
+	return result;
+}
+
+int DirtyPoseCommand(int argc, char** argv)
+{
+	int repeatNum = 20;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("dirty-pose: no input\n");
+		return 1;
+	}
+	MotionTarget target;
+	if (!target.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	auto boneNum = static_cast<uint32_t>(target.boneNames.size());
+	Skeleton skeleton;
+	skeleton.Build(target.model);
+	IKSolver ik;
+	ik.Build(target.model, skeleton);
+	MotionLibrary library;
+	auto motionSkeleton = library.BindSkeleton(target.boneNames, target.morphs);
+	// 視線を向ける代わりに手続き的に回すボーン
+	auto headBone = UINT32_MAX;
+	for (uint32_t b = 0; b < boneNum; ++b) {
+		if (target.boneNames[b] == "頭") {
+			headBone = b;
+			break;
+		}
+	}
+
+	// 再生の仕方
+	// play: 毎フレームIKまで解く
+	// look: 頭をモーションに関係なく手続き的に回し続ける
+	// lod: IKを解くかどうかを数フレームおきに切り替え、書き込む行列も2つを交互に使う（アニメーションのLODの段階の切り替え相当）
+	const char* scenario_names[] = { "play", "look", "lod" };
+	const uint32_t lod_interval = 8;
+	int result = 0;
+	for (size_t m = 1; m < paths.size(); ++m) {
+		auto motion = library.Load(paths[m], motionSkeleton, target.morphs);
+		if (motion == nullptr) {
+			printf("%s: failed to load\n", paths[m]);
+			result = 1;
+			continue;
+		}
+		auto& clip = motion->clip;
+		auto frameNum = clip.Duration() + 1;
+		vector<uint32_t> bones;
+		for (auto& track : clip.Tracks()) {
+			bones.push_back(track.bone);
+		}
+		// フレームごとの姿勢とIKのオンオフ
+		vector<BonePose> poses(boneNum * frameNum);
+		vector<const uint8_t*> disabled(frameNum);
+		for (uint32_t frame = 0; frame < frameNum; ++frame) {
+			clip.Sample(static_cast<float>(frame), poses.data() + frame * boneNum);
+			auto ikSwitch = motion->FindIKSwitch(frame);
+			disabled[frame] = ikSwitch != nullptr ? ikSwitch->disabled.data() : nullptr;
+		}
+		printf("%s: frames %u bones %u tracks %zu chains %zu\n", paths[m], frameNum, boneNum, bones.size(), ik.Chains().size());
+
+		for (int scenario = 0; scenario < 3; ++scenario) {
+			auto look = scenario == 1;
+			auto lod = scenario == 2;
+			if (look && headBone == UINT32_MAX) {
+				continue;
+			}
+			// すべて計算し直す側は、頭を回した姿勢をモーションの姿勢として渡す
+			auto expectedPoses = poses;
+			auto expectedBones = bones;
+			vector<BoneTransform> heads(frameNum);
+			if (look) {
+				if (find(bones.begin(), bones.end(), headBone) == bones.end()) {
+					expectedBones.push_back(headBone);
+				}
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					auto& head = expectedPoses[frame * boneNum + headBone];
+					auto angle = 0.5f * sinf(frame * 0.1f);
+					XMStoreFloat4(&head.rotation, XMQuaternionRotationAxis(XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), angle));
+					head.translation = XMFLOAT3(0.0f, 0.0f, 0.0f);
+					heads[frame] = PoseToBoneTransform(head, skeleton.RestPosition(headBone));
+				}
+			}
+
+			IncrementalPose pose;
+			pose.Reset(skeleton, ik);
+			vector<XMMATRIX> outputs[2] = { vector<XMMATRIX>(boneNum), vector<XMMATRIX>(boneNum) };
+			auto update = [&](uint32_t frame) -> vector<XMMATRIX>& {
+				auto solveIK = !lod || (frame / lod_interval) % 2 == 0;
+				auto& output = outputs[lod ? frame % 2 : 0];
+				pose.SetPoses(poses.data() + frame * boneNum, bones, skeleton);
+				if (look) {
+					pose.SetLocal(headBone, heads[frame]);
+				}
+				pose.Update(skeleton, ik, disabled[frame], solveIK, output.data());
+				return output;
+			};
+			auto evaluate = [&](uint32_t frame, vector<BoneTransform>& transforms, vector<XMMATRIX>& matrices) {
+				auto solveIK = !lod || (frame / lod_interval) % 2 == 0;
+				BuildBoneMatrices(skeleton, ik, expectedPoses.data() + frame * boneNum, expectedBones, disabled[frame], solveIK,
+					transforms, matrices);
+			};
+
+			// ループ再生（2周目は最後のフレームから先頭へ戻る）で、すべて計算し直したものと完全に同じになる
+			vector<XMMATRIX> expected(boneNum);
+			vector<BoneTransform> transforms(boneNum);
+			float maxDiff = 0.0f;
+			uint32_t worstFrame = 0;
+			uint32_t worstBone = 0;
+			for (uint32_t n = 0; n < frameNum * 2; ++n) {
+				auto frame = n % frameNum;
+				auto& actual = update(frame);
+				evaluate(frame, transforms, expected);
+				for (uint32_t b = 0; b < boneNum; ++b) {
+					auto diff = MaxDifference(expected[b], actual[b]);
+					if (diff > maxDiff) {
+						maxDiff = diff;
+						worstFrame = frame;
+						worstBone = b;
+					}
+				}
+			}
+
+			// 速さ（全フレームをrepeatNum周再生する）
+			pose.ResetStats();
+			auto start = Clock::now();
+			for (int n = 0; n < repeatNum; ++n) {
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					update(frame);
+				}
+			}
+			auto incrementalTime = ElapsedMs(start) * 1000.0 / (repeatNum * frameNum);
+			start = Clock::now();
+			for (int n = 0; n < repeatNum; ++n) {
+				for (uint32_t frame = 0; frame < frameNum; ++frame) {
+					evaluate(frame, transforms, expected);
+				}
+			}
+			auto fullTime = ElapsedMs(start) * 1000.0 / (repeatNum * frameNum);
+
+			auto ok = maxDiff == 0.0f;
+			auto& stats = pose.Stats();
+			auto updates = static_cast<double>(stats.updates);
+			printf("  %-4s  max diff %g", scenario_names[scenario], maxDiff);
+			if (!ok) {
+				printf(" (frame %u %s)", worstFrame, target.boneNames[worstBone].c_str());
+			}
+			printf("  %s\n", ok ? "ok" : "NG");
+			printf("        bones %.1f / %u  matrices %.1f per frame  idle %llu / %llu  ik solves %llu skips %llu\n",
+				stats.boneUpdates / updates, boneNum, stats.matrixUpdates / updates,
+				static_cast<unsigned long long>(stats.idleUpdates), static_cast<unsigned long long>(stats.updates),
+				static_cast<unsigned long long>(stats.ikSolves), static_cast<unsigned long long>(stats.ikSkips));
+			printf("        incremental %.2f us/frame  full %.2f us/frame (x%.2f)\n", incrementalTime, fullTime,
+				fullTime / incrementalTime);
+			if (!ok) {
+				result = 1;
+			}
+		}
+	}
+	return result;
+}
+
+namespace
+{
+	/// <summary>以前のIK（チェーンを解くたびに作業用のvectorを確保し、基準点から長さや向きを求める）。比較用</summary>
+	class LegacyIKSolver
+	{
+	private:
+		const Skeleton& _skeleton;
+		const float epsilon = 0.0005f;
+
+		void SolveLookAt(const IKChain& ik, BoneTransform* transforms) const
+		{
+			// この関数に来た時点でノードはひとつしかなく、チェーンに入っているノード番号はIKのルートノードのものなので、
+			// このルートノードからターゲットに向かうベクトルを考えれば良い
+			auto opos1 = XMLoadFloat3(&_skeleton.RestPosition(ik.nodeIdxes[0]));
+			auto tpos1 = XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx));	// ！？
+
+			auto opos2 = TransformPoint(opos1, transforms[ik.nodeIdxes[0]]);
+			auto tpos2 = TransformPoint(tpos1, transforms[ik.boneIdx]);
+
+			auto originVec = XMVectorSubtract(tpos1, opos1);
+			auto targetVec = XMVectorSubtract(tpos2, opos2);
+
+			originVec = XMVector3Normalize(originVec);
+			targetVec = XMVector3Normalize(targetVec);
+
+			// 向きを合わせる回転をopos2を中心にかける
+			auto up = XMFLOAT3(0, 1, 0);
+			auto right = XMFLOAT3(1, 0, 0);
+			auto rot = XMQuaternionRotationMatrix(LookAtMatrix(originVec, targetVec, up, right));
+			transforms[ik.nodeIdxes[0]] = RotationAround(rot, opos2);
+		}
+
+		void SolveCosineIK(const IKChain& ik, BoneTransform* transforms) const
+		{
+			vector<XMVECTOR> positions;		// IK構成点を保存
+			array<float, 2> edgeLens;		// IKのそれぞれのボーン間の距離を保存
+
+			// ターゲット（末端ボーンではなく、末端ボーンが近づく目標ボーンの座標を取得）
+			auto targetPos = TransformPoint(XMLoadFloat3(&_skeleton.RestPosition(ik.boneIdx)), transforms[ik.boneIdx]);
+
+			// IKチェーンが逆順なので、逆に並ぶようにしている
+			// 末端ボーン
+			positions.emplace_back(XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx)));
+			// 中間及びルートボーン
+			for (auto& chainBoneIdx : ik.nodeIdxes) {
+				positions.emplace_back(XMLoadFloat3(&_skeleton.RestPosition(chainBoneIdx)));
+			}
+			// ちょっと分かりづらいので逆にしておく
+			reverse(positions.begin(), positions.end());
+
+			// 元の長さを測っておく
+			edgeLens[0] = XMVectorGetX(XMVector3Length(XMVectorSubtract(positions[1], positions[0])));
+			edgeLens[1] = XMVectorGetX(XMVector3Length(XMVectorSubtract(positions[2], positions[1])));
+
+			// ルートボーン座標変換（逆順になっているため使用するインデックスに注意）
+			positions[0] = TransformPoint(positions[0], transforms[ik.nodeIdxes[1]]);
+			// 真ん中はどうせ自動計算されるので計算しない
+			// 先端ボーン
+			positions[2] = TransformPoint(positions[2], transforms[ik.boneIdx]);		// 本当はik.targetIdxだが・・・！？
+
+			// ルートから先端へのベクトルを作っておく
+			auto linearVec = XMVectorSubtract(positions[2], positions[0]);
+			float a = XMVectorGetX(XMVector3Length(linearVec));
+			float b = edgeLens[0];
+			float c = edgeLens[1];
+
+			linearVec = XMVector3Normalize(linearVec);
+
+			// ルートから真ん中への角度計算
+			float theta1 = acosf((a * a + b * b - c * c) / (2 * a * b));
+
+			// 真ん中からターゲットへの角度計算
+			float theta2 = acosf((b * b + c * c - a * a) / (2 * b * c));
+
+			// 「軸」を求める
+			// もし真ん中が「ひざ」であった場合には強制的にX軸とする。
+			XMVECTOR axis;
+			if (!(_skeleton.Flags(ik.nodeIdxes[0]) & skeleton_bone_knee)) {
+				auto vm = XMVector3Normalize(XMVectorSubtract(positions[2], positions[0]));
+				auto vt = XMVector3Normalize(XMVectorSubtract(targetPos, positions[0]));
+				axis = XMVector3Cross(vt, vm);
+			}
+			else {
+				auto right = XMFLOAT3(1, 0, 0);
+				axis = XMLoadFloat3(&right);
+			}
+
+			// 注意点・・・IKチェーンは根っこに向かってから数えられるため1が根っこに近い
+			auto rot2 = RotationAround(XMQuaternionRotationAxis(axis, theta2 - XM_PI), positions[1]);
+
+			transforms[ik.nodeIdxes[1]] = RotateBoneTransformAround(transforms[ik.nodeIdxes[1]], XMQuaternionRotationAxis(axis, theta1), positions[0]);
+			transforms[ik.nodeIdxes[0]] = MultiplyBoneTransform(rot2, transforms[ik.nodeIdxes[1]]);
+			transforms[ik.targetIdx] = transforms[ik.nodeIdxes[0]];//直前の影響を受ける
+		}
+
+		void SolveCCDIK(const IKChain& ik, BoneTransform* transforms) const
+		{
+			// ターゲット
+			auto targetOriginPos = XMLoadFloat3(&_skeleton.RestPosition(ik.boneIdx));
+
+			// IK親の姿勢から見たターゲットの位置（回転と移動だけなので逆変換は共役と回転1回で求まる）
+			auto parent = transforms[_skeleton.IKParent(ik.boneIdx)];
+			auto invParent = InverseBoneTransform(parent);
+			auto targetNextPos = TransformPoint(targetOriginPos, MultiplyBoneTransform(transforms[ik.boneIdx], invParent));
+
+			// まずはIKの間にあるボーンの座標を入れておく(逆順注意)
+			vector<XMVECTOR> bonePositions;
+			// 末端ノード
+			auto endPos = XMLoadFloat3(&_skeleton.RestPosition(ik.targetIdx));
+			// 中間ノード（ルートを含む）
+			for (auto& cidx : ik.nodeIdxes) {
+				bonePositions.push_back(XMLoadFloat3(&_skeleton.RestPosition(cidx)));
+			}
+
+			vector<BoneTransform> mats(bonePositions.size(), IdentityBoneTransform());
+			// ちょっとよくわからないが、PMDエディタの6.8°が0.03になっており、これは180で割っただけの値である。
+			// つまりこれをラジアンとして使用するにはXM_PIを乗算しなければならない…と思われる。
+			auto ikLimit = ik.limit * XM_PI;
+			// ikに設定されている試行回数だけ繰り返す
+			for (int c = 0; c < ik.iterations; ++c) {
+				// ターゲットと末端がほぼ一致したら抜ける
+				if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+					break;
+				}
+				// それぞれのボーンを遡りながら角度制限に引っ掛からないように曲げていく
+				for (int bidx = 0; bidx < static_cast<int>(bonePositions.size()); ++bidx) {
+					const auto& pos = bonePositions[bidx];
+
+					// まず現在のノードから末端までと、現在のノードからターゲットまでのベクトルを作る
+					auto vecToEnd = XMVectorSubtract(endPos, pos);
+					auto vecToTarget = XMVectorSubtract(targetNextPos, pos);
+					vecToEnd = XMVector3Normalize(vecToEnd);
+					vecToTarget = XMVector3Normalize(vecToTarget);
+
+					// ほぼ同じベクトルになってしまった場合は外積できないため次のボーンに引き渡す
+					if (XMVectorGetX(XMVector3Length(XMVectorSubtract(vecToEnd, vecToTarget))) <= epsilon) {
+						continue;
+					}
+					// 外積計算および角度計算
+					auto cross = XMVector3Normalize(XMVector3Cross(vecToEnd, vecToTarget));
+					float angle = XMVectorGetX(XMVector3AngleBetweenVectors(vecToEnd, vecToTarget));
+					angle = min(angle, ikLimit);						// 回転限界補正
+					// posを中心に回転
+					auto rot = XMQuaternionRotationAxis(cross, angle);
+					mats[bidx] = RotateBoneTransformAround(mats[bidx], rot, pos);	// 回転を保持しておく（回転を重ね掛けしておく）
+					// 対象となる点をすべて回転させる（現在の点から見て末端側を回転）
+					// 点をいくつも回すので、クォータニオンで1点ずつ回すより回転行列にしてから掛けるほうが軽い
+					auto rotMat = XMMatrixRotationQuaternion(rot);
+					for (auto idx = bidx - 1; idx >= 0; --idx) {		// 自分を回転させる必要はない
+						bonePositions[idx] = XMVectorAdd(XMVector3TransformNormal(XMVectorSubtract(bonePositions[idx], pos), rotMat), pos);
+					}
+					endPos = XMVectorAdd(XMVector3TransformNormal(XMVectorSubtract(endPos, pos), rotMat), pos);
+					// もし正解に近くなってたらループを抜ける
+					if (XMVectorGetX(XMVector3Length(XMVectorSubtract(endPos, targetNextPos))) <= epsilon) {
+						break;
+					}
+				}
+			}
+			int idx = 0;
+			for (auto& cidx : ik.nodeIdxes) {
+				transforms[cidx] = mats[idx];
+				++idx;
+			}
+			// IKの根元から先を親の姿勢に付け直す
+			_skeleton.MultiplySubtree(ik.nodeIdxes.back(), parent, transforms);
+		}
+
+	public:
+		explicit LegacyIKSolver(const Skeleton& skeleton) : _skeleton(skeleton)
+		{
+		}
+
+		void SolveChain(const IKChain& ik, BoneTransform* transforms) const
+		{
+			switch (ik.nodeIdxes.size()) {
+			case 0:
+				break;
+			case 1:
+				SolveLookAt(ik, transforms);
+				break;
+			case 2:
+				SolveCosineIK(ik, transforms);
+				break;
+			default:
+				SolveCCDIK(ik, transforms);
+				break;
+			}
+		}
+	};
+}
+
+int BenchIKCommand(int argc, char** argv)
+{
+	int repeatNum = 20;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeatNum = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() < 2) {
+		printf("bench-ik: no input\n");
+		return 1;
+	}
+	MotionTarget target;
+	if (!target.Load(paths[0])) {
+		printf("%s: failed to load\n", paths[0]);
+		return 1;
+	}
+	auto boneNum = static_cast<uint32_t>(target.boneNames.size());
+	Skeleton skeleton;
+	skeleton.Build(target.model);
+	IKSolver ik;
+	ik.Build(target.model, skeleton);
+	LegacyIKSolver legacy(skeleton);
+	MotionLibrary library;
+	auto motionSkeleton = library.BindSkeleton(target.boneNames, target.morphs);
+
+	// チェーンごとの書き換えるボーン（解き直す前にIKの前の姿勢へ戻す）
+	auto& chains = ik.Chains();
+	vector<vector<uint32_t>> writes(chains.size());
+	vector<uint8_t> flags(boneNum);
+	for (size_t c = 0; c < chains.size(); ++c) {
+		fill(flags.begin(), flags.end(), 0);
+		ik.AffectedBones(chains[c], skeleton, flags.data());
+		for (uint32_t b = 0; b < boneNum; ++b) {
+			if (flags[b] & ik_bone_write) {
+				writes[c].push_back(b);
+			}
+		}
+	}
+
+	int result = 0;
+	for (size_t m = 1; m < paths.size(); ++m) {
+		auto motion = library.Load(paths[m], motionSkeleton, target.morphs);
+		if (motion == nullptr) {
+			printf("%s: failed to load\n", paths[m]);
+			result = 1;
+			continue;
+		}
+		auto& clip = motion->clip;
+		auto frameNum = clip.Duration() + 1;
+		vector<uint32_t> bones;
+		for (auto& track : clip.Tracks()) {
+			bones.push_back(track.bone);
+		}
+
+		// チェーンごとの集計（時間は書き換えるボーンを戻す分を含む）
+		struct ChainStats {
+			double legacyNs = 0.0;
+			double newNs = 0.0;
+			size_t legacyAllocations = 0;
+			size_t newAllocations = 0;
+			size_t solves = 0;
+			float maxDiff = 0.0f;
+		};
+		vector<ChainStats> stats(chains.size());
+
+		vector<BonePose> poses(boneNum);
+		vector<BoneTransform> transforms(boneNum);
+		vector<BoneTransform> input(boneNum);
+		vector<BoneTransform> expected(boneNum);
+		vector<XMMATRIX> matrices(boneNum);
+		for (uint32_t frame = 0; frame < frameNum; ++frame) {
+			// IKを解く前の姿勢から、前のチェーンの結果を受け継ぎながら1本ずつ解く
+			clip.Sample(static_cast<float>(frame), poses.data());
+			auto ikSwitch = motion->FindIKSwitch(frame);
+			auto disabled = ikSwitch != nullptr ? ikSwitch->disabled.data() : nullptr;
+			BuildBoneMatrices(skeleton, ik, poses.data(), bones, disabled, false, transforms, matrices);
+			for (size_t c = 0; c < chains.size(); ++c) {
+				auto& chain = chains[c];
+				if (disabled != nullptr && disabled[chain.boneIdx]) {
+					continue;
+				}
+				auto& chainStats = stats[c];
+				input = transforms;
+				expected = transforms;
+				legacy.SolveChain(chain, expected.data());
+
+				// 以前の方法
+				auto allocations = AllocationCount();
+				auto start = Clock::now();
+				for (int n = 0; n < repeatNum; ++n) {
+					for (auto bone : writes[c]) {
+						transforms[bone] = input[bone];
+					}
+					legacy.SolveChain(chain, transforms.data());
+				}
+				chainStats.legacyNs += ElapsedMs(start) * 1e6 / repeatNum;
+				chainStats.legacyAllocations += AllocationCount() - allocations;
+
+				// 読み込み時に選んだ関数
+				allocations = AllocationCount();
+				start = Clock::now();
+				for (int n = 0; n < repeatNum; ++n) {
+					for (auto bone : writes[c]) {
+						transforms[bone] = input[bone];
+					}
+					ik.SolveChain(chain, skeleton, transforms.data());
+				}
+				chainStats.newNs += ElapsedMs(start) * 1e6 / repeatNum;
+				chainStats.newAllocations += AllocationCount() - allocations;
+				++chainStats.solves;
+
+				// 同じ計算なので結果は完全に一致する
+				for (uint32_t b = 0; b < boneNum; ++b) {
+					chainStats.maxDiff = max(chainStats.maxDiff, MaxDifference(BoneTransformToMatrix(expected[b]),
+						BoneTransformToMatrix(transforms[b])));
+				}
+			}
+		}
+
+		printf("%s: frames %u chains %zu\n", paths[m], frameNum, chains.size());
+		printf("  %-16s %-7s %5s %5s %6s  %12s %12s          %s\n", "chain", "kind", "nodes", "iter", "solves", "legacy",
+			"new", "allocs/solve");
+		double legacyTotal = 0.0;
+		double newTotal = 0.0;
+		size_t newAllocations = 0;
+		float maxDiff = 0.0f;
+		for (size_t c = 0; c < chains.size(); ++c) {
+			auto& chain = chains[c];
+			auto& chainStats = stats[c];
+			if (chainStats.solves == 0) {
+				printf("  %-16s %-7s %5zu %5u      0  (disabled)\n", target.boneNames[chain.boneIdx].c_str(),
+					IKChainKindName(chain.kind), chain.nodeIdxes.size(), chain.iterations);
+				continue;
+			}
+			auto solves = static_cast<double>(chainStats.solves);
+			printf("  %-16s %-7s %5zu %5u %6zu  %9.1f ns %9.1f ns (x%.2f)  %.1f -> %.1f  diff %g\n",
+				target.boneNames[chain.boneIdx].c_str(), IKChainKindName(chain.kind), chain.nodeIdxes.size(), chain.iterations,
+				chainStats.solves, chainStats.legacyNs / solves, chainStats.newNs / solves, chainStats.legacyNs / chainStats.newNs,
+				chainStats.legacyAllocations / (solves * repeatNum), chainStats.newAllocations / (solves * repeatNum),
+				chainStats.maxDiff);
+			legacyTotal += chainStats.legacyNs;
+			newTotal += chainStats.newNs;
+			newAllocations += chainStats.newAllocations;
+			maxDiff = max(maxDiff, chainStats.maxDiff);
+		}
+		auto ok = maxDiff == 0.0f && newAllocations == 0;
+		printf("  total  legacy %.2f us/frame  new %.2f us/frame (x%.2f)  allocations %zu  max diff %g  %s\n",
+			legacyTotal / frameNum / 1000.0, newTotal / frameNum / 1000.0, newTotal > 0.0 ? legacyTotal / newTotal : 1.0,
+			newAllocations, maxDiff,
+			ok ? "ok" : "NG");
+		if (!ok) {
+			result = 1;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,998 @@
+﻿#include "ToolCommands.h"
+#include "PMDModelData.h"
+#include "VertexConverter.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "BonePalette.h"
+#include "MorphEngine.h"
+#include "VMDParser.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+using namespace DirectX;
+
+namespace
+{
+	using Clock = chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start)
+	{
+		return chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+
+	/// <summary>
+	/// 従来のfreadによる読み込み（比較用）
+	/// 頂点とインデックスを一旦vectorに読み込んでから転送先へコピーする
+	/// </summary>
+	bool LoadWithFread(const char* path, vector<unsigned char>& uploadBuffer)
+	{
+		FILE* fp = fopen(path, "rb");
+		if (fp == nullptr) {
+			return false;
+		}
+		char signature[3];
+		PMDHeader header = {};
+		fread(signature, sizeof(signature), 1, fp);
+		fread(&header, sizeof(header), 1, fp);
+
+		uint32_t vertNum = 0;
+		fread(&vertNum, sizeof(vertNum), 1, fp);
+		vector<unsigned char> vertices(vertNum * sizeof(PMDVertex));
+		fread(vertices.data(), vertices.size(), 1, fp);
+
+		uint32_t indicesNum = 0;
+		fread(&indicesNum, sizeof(indicesNum), 1, fp);
+		vector<uint16_t> indices(indicesNum);
+		fread(indices.data(), indices.size() * sizeof(indices[0]), 1, fp);
+
+		uint32_t materialNum = 0;
+		fread(&materialNum, sizeof(materialNum), 1, fp);
+		vector<PMDMaterial> materials(materialNum);
+		fread(materials.data(), materials.size() * sizeof(PMDMaterial), 1, fp);
+
+		uint16_t boneNum = 0;
+		fread(&boneNum, sizeof(boneNum), 1, fp);
+		vector<PMDBone> bones(boneNum);
+		fread(bones.data(), sizeof(PMDBone), boneNum, fp);
+
+		uint16_t ikNum = 0;
+		fread(&ikNum, sizeof(ikNum), 1, fp);
+		for (int i = 0; i < ikNum; ++i) {
+			PMDIKHeader ik = {};
+			fread(&ik.boneIdx, sizeof(ik.boneIdx), 1, fp);
+			fread(&ik.targetIdx, sizeof(ik.targetIdx), 1, fp);
+			fread(&ik.chainLen, sizeof(ik.chainLen), 1, fp);
+			fread(&ik.iterations, sizeof(ik.iterations), 1, fp);
+			fread(&ik.limit, sizeof(ik.limit), 1, fp);
+			vector<uint16_t> nodeIdxes(ik.chainLen);
+			fread(nodeIdxes.data(), sizeof(uint16_t), ik.chainLen, fp);
+		}
+		fclose(fp);
+
+		uploadBuffer.resize(vertices.size() + indices.size() * sizeof(uint16_t));
+		memcpy(uploadBuffer.data(), vertices.data(), vertices.size());
+		memcpy(uploadBuffer.data() + vertices.size(), indices.data(), indices.size() * sizeof(uint16_t));
+		return true;
+	}
+
+	/// <summary>PMDModelDataによる読み込み（マップしたファイルから転送先へ直接コピー）</summary>
+	bool LoadWithMapping(const char* path, vector<unsigned char>& uploadBuffer)
+	{
+		PMDModelData model;
+		if (!model.Load(path)) {
+			return false;
+		}
+		auto& vertices = model.Vertices();
+		auto& indices = model.Indices();
+		uploadBuffer.resize(vertices.byteSize() + indices.byteSize());
+		memcpy(uploadBuffer.data(), vertices.bytes(), vertices.byteSize());
+		memcpy(uploadBuffer.data() + vertices.byteSize(), indices.bytes(), indices.byteSize());
+		return true;
+	}
+
+	/// <summary>二つのビューのバイト列が一致するか</summary>
+	template<typename T>
+	bool SameBytes(const PMDView<T>& lval, const PMDView<T>& rval)
+	{
+		return lval.byteSize() == rval.byteSize() &&
+			(lval.byteSize() == 0 || memcmp(lval.bytes(), rval.bytes(), lval.byteSize()) == 0);
+	}
+
+	/// <summary>生のPMDとクック済みファイルから読んだ内容が一致するか</summary>
+	bool SameModel(const PMDModelData& raw, const PMDModelData& cooked)
+	{
+		if (memcmp(&raw.Header(), &cooked.Header(), sizeof(PMDHeader)) != 0 ||
+			!SameBytes(raw.Vertices(), cooked.Vertices()) ||
+			!SameBytes(raw.Indices(), cooked.Indices()) ||
+			!SameBytes(raw.Materials(), cooked.Materials()) ||
+			!SameBytes(raw.Bones(), cooked.Bones()) ||
+			!SameBytes(raw.KneeBones(), cooked.KneeBones()) ||
+			!SameBytes(raw.BoneNameOrder(), cooked.BoneNameOrder()) ||
+			raw.IKs().size() != cooked.IKs().size() ||
+			raw.Skins().size() != cooked.Skins().size() ||
+			raw.MaterialTextures().size() != cooked.MaterialTextures().size()) {
+			return false;
+		}
+		for (size_t i = 0; i < raw.IKs().size(); ++i) {
+			auto& lval = raw.IKs()[i];
+			auto& rval = cooked.IKs()[i];
+			if (memcmp(&lval.header, &rval.header, sizeof(PMDIKHeader)) != 0 || !SameBytes(lval.nodeIdxes, rval.nodeIdxes)) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < raw.Skins().size(); ++i) {
+			auto& lval = raw.Skins()[i];
+			auto& rval = cooked.Skins()[i];
+			if (memcmp(&lval.header, &rval.header, sizeof(PMDSkinHeader)) != 0 || !SameBytes(lval.vertices, rval.vertices)) {
+				return false;
+			}
+		}
+		for (size_t i = 0; i < raw.MaterialTextures().size(); ++i) {
+			auto& lval = raw.MaterialTextures()[i];
+			auto& rval = cooked.MaterialTextures()[i];
+			if (lval.texPath != rval.texPath || lval.sphPath != rval.sphPath ||
+				lval.spaPath != rval.spaPath || lval.toonPath != rval.toonPath) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// クック済みファイルの中でsectionと同じ並びの位置offsetをvalueで書き換えたコピーを作り、その読み込みが失敗するか
+	/// （範囲外の番号を参照するクック済みファイルを受け付けないかの確認用）
+	/// </summary>
+	bool RejectsCorruptedCooked(const string& cookedPath, const char* sourcePath,
+		const void* section, size_t sectionSize, size_t offset, const void* value, size_t valueSize)
+	{
+		MappedFile file;
+		if (!file.Open(cookedPath.c_str())) {
+			return false;
+		}
+		vector<uint8_t> data(file.Data(), file.Data() + file.Size());
+		file.Close();
+		auto bytes = static_cast<const uint8_t*>(section);
+		auto found = search(data.begin(), data.end(), bytes, bytes + sectionSize);
+		if (found == data.end()) {
+			return false;
+		}
+		memcpy(&*found + offset, value, valueSize);
+
+		auto corruptedPath = cookedPath + ".corrupted";
+		FILE* fp = fopen(corruptedPath.c_str(), "wb");
+		if (fp == nullptr) {
+			return false;
+		}
+		auto written = fwrite(data.data(), 1, data.size(), fp);
+		fclose(fp);
+		bool rejected = false;
+		{
+			PMDModelData model;
+			rejected = written == data.size() && !model.LoadCooked(corruptedPath.c_str(), sourcePath);
+		}
+		remove(corruptedPath.c_str());
+		return rejected;
+	}
+
+	/// <summary>
+	/// 三角形を頂点データのバイト列で表したもの（巻き方向を保ったまま最小の頂点が先頭になるよう回す）
+	/// 頂点番号が変わっても同じ三角形なら同じになる
+	/// </summary>
+	string TriangleKey(const PMDView<PMDVertex>& vertices, const uint16_t* tri)
+	{
+		string keys[3];
+		for (size_t k = 0; k < 3; ++k) {
+			auto v = vertices[tri[k]];
+			keys[k].assign(reinterpret_cast<const char*>(&v), sizeof(v));
+		}
+		size_t first = min_element(keys, keys + 3) - keys;
+		return keys[first] + keys[(first + 1) % 3] + keys[(first + 2) % 3];
+	}
+
+	/// <summary>最適化前後でマテリアルごとの三角形の集合が同じか</summary>
+	bool SameTriangles(const PMDModelData& model, const OptimizedMesh& mesh)
+	{
+		auto& materials = model.Materials();
+		auto sourceVertices = model.Vertices();
+		auto sourceIndices = reinterpret_cast<const uint16_t*>(model.Indices().bytes());
+		auto vertices = mesh.VertexView();
+		if (mesh.indices.size() != model.Indices().size()) {
+			return false;
+		}
+		size_t offset = 0;
+		for (size_t m = 0; m < materials.size(); ++m) {
+			auto indicesNum = materials[m].indicesNum;
+			vector<string> lval, rval;
+			for (size_t i = 0; i + 3 <= indicesNum; i += 3) {
+				lval.push_back(TriangleKey(sourceVertices, sourceIndices + offset + i));
+				rval.push_back(TriangleKey(vertices, mesh.indices.data() + offset + i));
+			}
+			sort(lval.begin(), lval.end());
+			sort(rval.begin(), rval.end());
+			if (lval != rval) {
+				return false;
+			}
+			offset += indicesNum;
+		}
+		return true;
+	}
+
+	XMFLOAT3 Sub(const XMFLOAT3& lval, const XMFLOAT3& rval)
+	{
+		return XMFLOAT3(lval.x - rval.x, lval.y - rval.y, lval.z - rval.z);
+	}
+
+	float Dot(const XMFLOAT3& lval, const XMFLOAT3& rval)
+	{
+		return lval.x * rval.x + lval.y * rval.y + lval.z * rval.z;
+	}
+
+	XMFLOAT3 MulAdd(const XMFLOAT3& base, const XMFLOAT3& v, float s)
+	{
+		return XMFLOAT3(base.x + v.x * s, base.y + v.y * s, base.z + v.z * s);
+	}
+
+	/// <summary>点から三角形までの最短距離（Ericson, Real-Time Collision Detection 5.1.5）</summary>
+	float PointTriangleDistance(const XMFLOAT3& p, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+	{
+		auto ab = Sub(b, a), ac = Sub(c, a), ap = Sub(p, a);
+		XMFLOAT3 closest;
+		float d1 = Dot(ab, ap), d2 = Dot(ac, ap);
+		auto bp = Sub(p, b);
+		float d3 = Dot(ab, bp), d4 = Dot(ac, bp);
+		auto cp = Sub(p, c);
+		float d5 = Dot(ab, cp), d6 = Dot(ac, cp);
+		float vc = d1 * d4 - d3 * d2, vb = d5 * d2 - d1 * d6, va = d3 * d6 - d5 * d4;
+		if (d1 <= 0.0f && d2 <= 0.0f) {
+			closest = a;
+		}
+		else if (d3 >= 0.0f && d4 <= d3) {
+			closest = b;
+		}
+		else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+			closest = MulAdd(a, ab, d1 / (d1 - d3));
+		}
+		else if (d6 >= 0.0f && d5 <= d6) {
+			closest = c;
+		}
+		else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+			closest = MulAdd(a, ac, d2 / (d2 - d6));
+		}
+		else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+			closest = MulAdd(b, Sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		}
+		else {
+			float denom = va + vb + vc;
+			if (denom == 0.0f) {
+				// 潰れた三角形（面積0）
+				closest = a;
+			}
+			else {
+				closest = MulAdd(MulAdd(a, ab, vb / denom), ac, vc / denom);
+			}
+		}
+		auto d = Sub(p, closest);
+		return sqrtf(Dot(d, d));
+	}
+
+	/// <summary>
+	/// 三角形を一様グリッドに登録し、点から最も近い三角形までの距離を求める
+	/// LODの誤差が申告どおりかを確かめるのに使う
+	/// </summary>
+	class TriangleGrid
+	{
+	private:
+		const PMDView<PMDVertex>& _vertices;
+		const vector<uint16_t>& _indices;
+		XMFLOAT3 _origin;
+		float _cellSize;
+		int _res[3];
+		vector<vector<uint32_t>> _cells;
+
+		int CellCoord(float v, int axis) const
+		{
+			auto origin = axis == 0 ? _origin.x : axis == 1 ? _origin.y : _origin.z;
+			return max(0, min(_res[axis] - 1, static_cast<int>(floorf((v - origin) / _cellSize))));
+		}
+
+	public:
+		TriangleGrid(const PMDView<PMDVertex>& vertices, const vector<uint16_t>& indices, const XMFLOAT3& center, float radius)
+			: _vertices(vertices), _indices(indices)
+		{
+			_origin = XMFLOAT3(center.x - radius, center.y - radius, center.z - radius);
+			_cellSize = max(radius * 2.0f / 48.0f, 1e-6f);
+			_res[0] = _res[1] = _res[2] = 48;
+			_cells.resize(48 * 48 * 48);
+			for (uint32_t t = 0; t * 3 + 3 <= indices.size(); ++t) {
+				int lo[3] = { _res[0], _res[1], _res[2] }, hi[3] = { -1, -1, -1 };
+				for (size_t k = 0; k < 3; ++k) {
+					auto p = vertices[indices[t * 3 + k]].pos;
+					float c[3] = { p.x, p.y, p.z };
+					for (int axis = 0; axis < 3; ++axis) {
+						lo[axis] = min(lo[axis], CellCoord(c[axis], axis));
+						hi[axis] = max(hi[axis], CellCoord(c[axis], axis));
+					}
+				}
+				for (int z = lo[2]; z <= hi[2]; ++z) {
+					for (int y = lo[1]; y <= hi[1]; ++y) {
+						for (int x = lo[0]; x <= hi[0]; ++x) {
+							_cells[(z * _res[1] + y) * _res[0] + x].push_back(t);
+						}
+					}
+				}
+			}
+		}
+
+		/// <summary>点から最も近い三角形までの距離（三角形が無ければ負）</summary>
+		float Distance(const XMFLOAT3& p) const
+		{
+			int pc[3] = { CellCoord(p.x, 0), CellCoord(p.y, 1), CellCoord(p.z, 2) };
+			float best = -1.0f;
+			int maxRing = max(_res[0], max(_res[1], _res[2]));
+			for (int r = 0; r < maxRing; ++r) {
+				// 半径rの殻（チェビシェフ距離がちょうどr）のセルだけを見る
+				for (int z = pc[2] - r; z <= pc[2] + r; ++z) {
+					for (int y = pc[1] - r; y <= pc[1] + r; ++y) {
+						for (int x = pc[0] - r; x <= pc[0] + r; ++x) {
+							if (max(abs(x - pc[0]), max(abs(y - pc[1]), abs(z - pc[2]))) != r ||
+								x < 0 || y < 0 || z < 0 || x >= _res[0] || y >= _res[1] || z >= _res[2]) {
+								continue;
+							}
+							for (auto t : _cells[(z * _res[1] + y) * _res[0] + x]) {
+								auto d = PointTriangleDistance(p, _vertices[_indices[t * 3]].pos,
+									_vertices[_indices[t * 3 + 1]].pos, _vertices[_indices[t * 3 + 2]].pos);
+								if (best < 0.0f || d < best) {
+									best = d;
+								}
+							}
+						}
+					}
+				}
+				// まだ見ていないセルは少なくともr×セル幅離れている
+				if (best >= 0.0f && best <= r * _cellSize) {
+					break;
+				}
+			}
+			return best;
+		}
+	};
+
+	/// <summary>
+	/// パレットで分割した結果が元のメッシュと同じ描画になるか
+	/// バッチがマテリアルの範囲を順に埋めていること、頂点のボーンをパレットで戻すと元の（影響する）ボーンになること
+	/// </summary>
+	bool VerifyBonePalettes(const PMDView<PMDVertex>& vertices, const vector<BonePaletteSource>& sources, const BonePaletteMesh& mesh)
+	{
+		auto meshVertices = mesh.split ? mesh.VertexView() : vertices;
+		for (size_t l = 0; l < sources.size(); ++l) {
+			auto& source = sources[l];
+			auto& level = mesh.levels[l];
+			size_t offset = 0;
+			auto batch = level.batches.begin();
+			for (uint32_t m = 0; m < source.materialIndexNums.size(); ++m) {
+				auto rangeEnd = offset + source.materialIndexNums[m] / 3 * 3;
+				for (; offset < rangeEnd; ++batch) {
+					if (batch == level.batches.end() || batch->material != m || batch->indexOffset != offset ||
+						batch->indexNum == 0 || batch->indexNum % 3 != 0) {
+						return false;
+					}
+					auto& palette = mesh.palettes[batch->palette];
+					if (palette.size() > mesh.paletteSize ||
+						find(level.palettes.begin(), level.palettes.end(), batch->palette) == level.palettes.end()) {
+						return false;
+					}
+					for (size_t i = offset; i < offset + batch->indexNum; ++i) {
+						auto v = meshVertices[level.indices[i]];
+						auto src = vertices[source.indices[i]];
+						if (mesh.split && mesh.vertexRemap[level.indices[i]] != source.indices[i]) {
+							return false;
+						}
+						if (v.boneNo[0] >= palette.size() || v.boneNo[1] >= palette.size() ||
+							memcmp(&v.pos, &src.pos, sizeof(v.pos)) != 0 || memcmp(&v.normal, &src.normal, sizeof(v.normal)) != 0 ||
+							memcmp(&v.uv, &src.uv, sizeof(v.uv)) != 0 || v.boneWeight != src.boneWeight) {
+							return false;
+						}
+						if ((src.boneWeight > 0 && palette[v.boneNo[0]] != src.boneNo[0]) ||
+							(src.boneWeight < 100 && palette[v.boneNo[1]] != src.boneNo[1])) {
+							return false;
+						}
+					}
+					offset += batch->indexNum;
+				}
+				offset += source.materialIndexNums[m] % 3;
+			}
+			if (batch != level.batches.end()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// <summary>VMDファイルから表情のキーフレームだけを読む</summary>
+	bool LoadVMDMorphKeyFrames(const char* path, vector<MorphKeyFrame>& keyframes)
+	{
+		VMDData vmd;
+		if (!ParseVMDFile(path, vmd)) {
+			return false;
+		}
+		keyframes = move(vmd.morphKeyFrames);
+		return true;
+	}
+
+	/// <summary>
+	/// 表情を適用した座標を全頂点について愚直に計算する（MorphEngineの検証用）
+	/// </summary>
+	void ApplyMorphsBruteForce(const PMDModelData& model, const vector<uint32_t>& vertexToSource,
+		const MorphEngine& engine, vector<XMFLOAT3>& positions)
+	{
+		auto sourceNum = model.Vertices().size();
+		vector<XMFLOAT3> sourcePositions(sourceNum);
+		for (size_t i = 0; i < sourceNum; ++i) {
+			sourcePositions[i] = model.Vertices()[i].pos;
+		}
+		auto& skins = model.Skins();
+		if (!skins.empty() && skins[0].header.type == pmd_skin_base) {
+			// MorphEngineの表情番号はbase以外の表情を順に数えたもの
+			auto& base = skins[0].vertices;
+			size_t morph = 0;
+			for (size_t s = 1; s < skins.size(); ++s) {
+				if (skins[s].header.type == pmd_skin_base) {
+					continue;
+				}
+				auto weight = engine.GetWeight(morph++);
+				if (weight == 0.0f) {
+					continue;
+				}
+				for (size_t i = 0; i < skins[s].vertices.size(); ++i) {
+					auto sv = skins[s].vertices[i];
+					sourcePositions[base[sv.vertIdx].vertIdx] = MulAdd(sourcePositions[base[sv.vertIdx].vertIdx], sv.pos, weight);
+				}
+			}
+		}
+		positions.resize(vertexToSource.size());
+		for (size_t v = 0; v < vertexToSource.size(); ++v) {
+			positions[v] = sourcePositions[vertexToSource[v]];
+		}
+	}
+}
+
+int BenchPMDCommand(int argc, char** argv)
+{
+	int iterations = 100;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("bench-pmd: no input\n");
+		return 1;
+	}
+
+	vector<unsigned char> uploadBuffer;
+	for (auto path : paths) {
+		PMDModelData model;
+		if (!model.Load(path)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		printf("%s: %zu vertices, %zu indices, %zu materials, %zu bones, %zu iks\n", path,
+			model.Vertices().size(), model.Indices().size(), model.Materials().size(),
+			model.Bones().size(), model.IKs().size());
+
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			LoadWithFread(path, uploadBuffer);
+		}
+		auto freadMs = ElapsedMs(start) / iterations;
+
+		start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			LoadWithMapping(path, uploadBuffer);
+		}
+		auto mappedMs = ElapsedMs(start) / iterations;
+
+		printf("  fread: %.3f ms  mapped: %.3f ms  (x%.2f)\n", freadMs, mappedMs, freadMs / mappedMs);
+	}
+	return 0;
+}
+
+int CookPMDCommand(int argc, char** argv)
+{
+	int iterations = 100;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("cook-pmd: no input\n");
+		return 1;
+	}
+
+	for (auto path : paths) {
+		auto cookedPath = PMDModelData::CookedPath(path);
+		PMDModelData raw;
+		if (!raw.Load(path)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		if (!raw.WriteCooked(cookedPath.c_str())) {
+			printf("%s: failed to write\n", cookedPath.c_str());
+			return 1;
+		}
+		PMDModelData cooked;
+		if (!cooked.LoadCooked(cookedPath.c_str(), path)) {
+			printf("%s: failed to load cooked file\n", cookedPath.c_str());
+			return 1;
+		}
+		if (!SameModel(raw, cooked)) {
+			printf("%s: cooked data mismatch\n", cookedPath.c_str());
+			return 1;
+		}
+
+		// 範囲外の番号を参照するように書き換えたクック済みファイルは読み込まない
+		size_t corruptedNum = 0;
+		size_t rejectedNum = 0;
+		auto corrupt = [&](const void* section, size_t sectionSize, size_t offset, const void* value, size_t valueSize) {
+			++corruptedNum;
+			rejectedNum += RejectsCorruptedCooked(cookedPath, path, section, sectionSize, offset, value, valueSize) ? 1 : 0;
+		};
+		auto vertexNum = static_cast<uint16_t>(raw.Vertices().size());
+		auto materialIndices = static_cast<uint32_t>(raw.Indices().size() + 1);
+		auto boneNum16 = static_cast<uint16_t>(raw.Bones().size());
+		auto boneNum32 = static_cast<uint32_t>(raw.Bones().size());
+		if (!raw.Indices().empty() && raw.Vertices().size() <= UINT16_MAX) {
+			corrupt(raw.Indices().bytes(), raw.Indices().byteSize(), 0, &vertexNum, sizeof(vertexNum));
+		}
+		if (!raw.Materials().empty()) {
+			corrupt(raw.Materials().bytes(), raw.Materials().byteSize(), offsetof(PMDMaterial, indicesNum), &materialIndices, sizeof(materialIndices));
+		}
+		if (!raw.IKs().empty()) {
+			auto& header = raw.IKs()[0].header;
+			corrupt(&header, sizeof(header), offsetof(PMDIKHeader, boneIdx), &boneNum16, sizeof(boneNum16));
+			corrupt(&header, sizeof(header), offsetof(PMDIKHeader, targetIdx), &boneNum16, sizeof(boneNum16));
+			// ノード番号はIKの順に連結されている
+			vector<uint16_t> nodes;
+			for (auto& ik : raw.IKs()) {
+				for (size_t i = 0; i < ik.nodeIdxes.size(); ++i) {
+					nodes.push_back(ik.nodeIdxes[i]);
+				}
+			}
+			if (!nodes.empty()) {
+				corrupt(nodes.data(), nodes.size() * sizeof(uint16_t), 0, &boneNum16, sizeof(boneNum16));
+			}
+		}
+		auto& skins = raw.Skins();
+		if (skins.size() >= 2 && skins[0].header.type == pmd_skin_base) {
+			// baseは頂点番号、base以外はbase内の番号、baseは先頭だけ
+			auto& base = skins[0].vertices;
+			auto& skin = skins[1];
+			auto vertexNum32 = static_cast<uint32_t>(raw.Vertices().size());
+			auto baseVertNum = static_cast<uint32_t>(base.size());
+			auto baseType = pmd_skin_base;
+			if (!base.empty()) {
+				corrupt(base.bytes(), base.byteSize(), offsetof(PMDSkinVertex, vertIdx), &vertexNum32, sizeof(vertexNum32));
+			}
+			if (!skin.vertices.empty()) {
+				corrupt(skin.vertices.bytes(), skin.vertices.byteSize(), offsetof(PMDSkinVertex, vertIdx), &baseVertNum, sizeof(baseVertNum));
+			}
+			corrupt(&skin.header, sizeof(skin.header), offsetof(PMDSkinHeader, type), &baseType, sizeof(baseType));
+		}
+		if (!raw.KneeBones().empty()) {
+			corrupt(raw.KneeBones().bytes(), raw.KneeBones().byteSize(), 0, &boneNum32, sizeof(boneNum32));
+		}
+		if (!raw.BoneNameOrder().empty()) {
+			corrupt(raw.BoneNameOrder().bytes(), raw.BoneNameOrder().byteSize(), 0, &boneNum16, sizeof(boneNum16));
+		}
+		if (rejectedNum != corruptedNum) {
+			printf("%s: %zu of %zu out-of-range references accepted\n", cookedPath.c_str(), corruptedNum - rejectedNum, corruptedNum);
+			return 1;
+		}
+
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			PMDModelData model;
+			model.Load(path);
+		}
+		auto rawMs = ElapsedMs(start) / iterations;
+
+		start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			PMDModelData model;
+			model.LoadCooked(cookedPath.c_str(), path);
+		}
+		auto cookedMs = ElapsedMs(start) / iterations;
+
+		printf("%s -> %s\n", path, cookedPath.c_str());
+		printf("  raw: %.3f ms  cooked: %.3f ms  (x%.2f)  out-of-range references rejected: %zu\n", rawMs, cookedMs, rawMs / cookedMs, rejectedNum);
+	}
+	return 0;
+}
+
+int ConvertVerticesCommand(int argc, char** argv)
+{
+	if (argc == 0) {
+		printf("convert-vertices: no input\n");
+		return 1;
+	}
+
+	const VertexLayout layouts[] = { VertexLayout::Raw, VertexLayout::Packed32, VertexLayout::Split };
+	int ret = 0;
+	for (int i = 0; i < argc; ++i) {
+		auto path = argv[i];
+		PMDModelData model;
+		if (!model.Load(path)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		auto& vertices = model.Vertices();
+		printf("%s: %zu vertices\n", path, vertices.size());
+		for (auto layout : layouts) {
+			ConvertedVertices converted;
+			auto start = Clock::now();
+			ConvertVertices(vertices, layout, converted);
+			auto convertMs = ElapsedMs(start);
+			auto error = VerifyVertices(vertices, converted);
+			auto bytes = GetVertexBytes(layout, vertices.size());
+			printf("  %-8s %8zu bytes (saved %8zu)  %.3f ms  pos %.2e  normal %.3f deg  uv %.2e  bone mismatch %zu\n",
+				VertexLayoutName(layout), bytes, vertices.byteSize() - bytes, convertMs,
+				error.maxPositionError, error.maxNormalAngle, error.maxUVError, error.boneMismatchNum);
+			if (error.maxPositionError > 0.0f || error.boneMismatchNum > 0) {
+				// 座標とボーンは変換で変わってはいけない
+				ret = 1;
+			}
+		}
+	}
+	return ret;
+}
+
+int OptimizeMeshCommand(int argc, char** argv)
+{
+	int iterations = 1;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("optimize-mesh: no input\n");
+		return 1;
+	}
+
+	for (auto path : paths) {
+		PMDModelData model;
+		if (!model.Load(path)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		OptimizedMesh mesh;
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			if (!OptimizeMesh(model, mesh)) {
+				printf("%s: failed to optimize\n", path);
+				return 1;
+			}
+		}
+		auto optimizeMs = ElapsedMs(start) / iterations;
+		if (!SameTriangles(model, mesh)) {
+			printf("%s: triangles mismatch\n", path);
+			return 1;
+		}
+		auto& stats = mesh.stats;
+		printf("%s: %.3f ms\n", path, optimizeMs);
+		printf("  vertices %zu -> %zu (welded %zu)  ACMR %.3f -> %.3f  ATVR %.3f -> %.3f\n",
+			stats.sourceVertexNum, stats.vertexNum, stats.weldedVertexNum,
+			stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+	}
+	return 0;
+}
+
+int SimplifyMeshCommand(int argc, char** argv)
+{
+	int iterations = 1;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = max(1, atoi(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("simplify-mesh: no input\n");
+		return 1;
+	}
+
+	int result = 0;
+	for (auto path : paths) {
+		PMDModelData model;
+		OptimizedMesh mesh;
+		if (!model.Load(path) || !OptimizeMesh(model, mesh)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		auto materialIndexNums = GetMaterialIndexNums(model);
+		MeshLODSet lodSet;
+		auto start = Clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			if (!GenerateMeshLODs(mesh.VertexView(), mesh.IndexView(), materialIndexNums, DefaultLODTriangleRatios(), lodSet)) {
+				printf("%s: failed to simplify\n", path);
+				return 1;
+			}
+		}
+		auto simplifyMs = ElapsedMs(start) / iterations;
+		printf("%s: %.3f ms  triangles %zu  radius %.3f\n", path, simplifyMs, lodSet.triangleNum, lodSet.radius);
+
+		// 参照されている頂点（元の表面上の点）
+		auto vertices = mesh.VertexView();
+		vector<bool> used(vertices.size(), false);
+		for (auto idx : mesh.indices) {
+			used[idx] = true;
+		}
+		auto prevTriangleNum = lodSet.triangleNum;
+		for (size_t n = 0; n < lodSet.lods.size(); ++n) {
+			auto& lod = lodSet.lods[n];
+			size_t indexTotal = 0;
+			for (auto rangeNum : lod.materialIndexNums) {
+				indexTotal += rangeNum;
+			}
+			bool ok = lod.triangleNum < prevTriangleNum && lod.materialIndexNums.size() == materialIndexNums.size() &&
+				indexTotal == lod.indices.size() && lod.triangleNum * 3 == lod.indices.size();
+			prevTriangleNum = lod.triangleNum;
+
+			// 元の頂点からLODの表面までの距離が申告した誤差以内か
+			TriangleGrid grid(vertices, lod.indices, lodSet.center, lodSet.radius);
+			float measured = 0.0f;
+			for (size_t v = 0; v < vertices.size(); ++v) {
+				if (used[v]) {
+					measured = max(measured, grid.Distance(vertices[v].pos));
+				}
+			}
+			ok = ok && measured <= lod.error + lodSet.radius * 1e-5f;
+			printf("  LOD%zu: triangles %zu (%.1f%%)  error %.4f  measured %.4f  %s\n",
+				n + 1, lod.triangleNum, 100.0 * lod.triangleNum / max<size_t>(lodSet.triangleNum, 1),
+				lod.error, measured, ok ? "ok" : "NG");
+			if (!ok) {
+				result = 1;
+			}
+		}
+		for (float distance : { 50.0f, 100.0f, 200.0f, 400.0f, 800.0f }) {
+			// 高さ720、画角45度のときの投影スケール
+			auto projectionScale = 720.0f / (2.0f * tanf(XM_PIDIV4 * 0.5f));
+			printf("  distance %.0f: LOD%zu\n", distance, SelectMeshLOD(lodSet, distance, projectionScale, 1.0f));
+		}
+	}
+	return result;
+}
+
+int PartitionBonesCommand(int argc, char** argv)
+{
+	vector<size_t> paletteSizes;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			paletteSizes.push_back(static_cast<size_t>(max(0, atoi(argv[++i]))));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("partition-bones: no input\n");
+		return 1;
+	}
+	if (paletteSizes.empty()) {
+		paletteSizes = { bone_palette_max, 64, 32 };
+	}
+
+	int result = 0;
+	for (auto path : paths) {
+		PMDModelData model;
+		OptimizedMesh mesh;
+		MeshLODSet lodSet;
+		if (!model.Load(path) || !OptimizeMesh(model, mesh) ||
+			!GenerateMeshLODs(mesh.VertexView(), mesh.IndexView(), GetMaterialIndexNums(model), DefaultLODTriangleRatios(), lodSet)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		// 元のメッシュと各LODをまとめて分割する（アクターと同じ）
+		vector<BonePaletteSource> sources(1);
+		sources[0].indices = mesh.IndexView();
+		sources[0].materialIndexNums = GetMaterialIndexNums(model);
+		for (auto& lod : lodSet.lods) {
+			BonePaletteSource source;
+			source.indices = PMDView<uint16_t>(reinterpret_cast<const uint8_t*>(lod.indices.data()), lod.indices.size());
+			source.materialIndexNums = lod.materialIndexNums;
+			sources.push_back(source);
+		}
+		printf("%s: bones %zu  materials %zu  vertices %zu\n", path, model.Bones().size(),
+			sources[0].materialIndexNums.size(), mesh.vertices.size());
+
+		for (auto paletteSize : paletteSizes) {
+			BonePaletteMesh palettes;
+			auto start = Clock::now();
+			if (!PartitionBonePalettes(mesh.VertexView(), sources, model.Bones().size(), paletteSize, palettes)) {
+				printf("  palette %zu: failed to partition\n", paletteSize);
+				result = 1;
+				continue;
+			}
+			auto partitionMs = ElapsedMs(start);
+			auto ok = VerifyBonePalettes(mesh.VertexView(), sources, palettes);
+			size_t maxPaletteBones = 0;
+			for (auto& palette : palettes.palettes) {
+				maxPaletteBones = max(maxPaletteBones, palette.size());
+			}
+			auto& level = palettes.levels[0];
+			auto uploadBones = palettes.UploadBoneNum(0);
+			// 転送量はパレットごとにワールド行列1つを加えたもの
+			auto uploadBytes = (uploadBones + level.palettes.size()) * 64;
+			printf("  palette %3zu: %.3f ms  %s  vertices %zu  draws %zu  max bones/draw %zu  upload %zu bones (%zu bytes, avg %.0f bytes/draw)  %s\n",
+				paletteSize, partitionMs, palettes.split ? "split" : "whole",
+				palettes.split ? palettes.vertices.size() : mesh.vertices.size(), level.batches.size(), maxPaletteBones,
+				uploadBones, uploadBytes, static_cast<double>(uploadBytes) / max<size_t>(level.batches.size(), 1),
+				ok ? "ok" : "NG");
+			for (size_t l = 1; l < palettes.levels.size(); ++l) {
+				printf("    LOD%zu: draws %zu  upload %zu bones\n", l, palettes.levels[l].batches.size(), palettes.UploadBoneNum(l));
+			}
+			if (!ok) {
+				result = 1;
+			}
+		}
+	}
+	return result;
+}
+
+int MorphBenchCommand(int argc, char** argv)
+{
+	int frameNum = 600;
+	size_t paletteSize = bone_palette_max;
+	const char* motionPath = nullptr;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			frameNum = max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			paletteSize = static_cast<size_t>(max(0, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			motionPath = argv[++i];
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("morph-bench: no input\n");
+		return 1;
+	}
+	vector<MorphKeyFrame> keyframes;
+	if (motionPath != nullptr && !LoadVMDMorphKeyFrames(motionPath, keyframes)) {
+		printf("%s: failed to load\n", motionPath);
+		return 1;
+	}
+
+	int result = 0;
+	for (auto path : paths) {
+		// アクターと同じく、最適化とパレットの分割をした頂点に対して表情を作る
+		PMDModelData model;
+		OptimizedMesh mesh;
+		BonePaletteMesh palettes;
+		vector<BonePaletteSource> sources(1);
+		if (!model.Load(path) || !OptimizeMesh(model, mesh)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		sources[0].indices = mesh.IndexView();
+		sources[0].materialIndexNums = GetMaterialIndexNums(model);
+		if (!PartitionBonePalettes(mesh.VertexView(), sources, model.Bones().size(), paletteSize, palettes)) {
+			printf("%s: failed to partition\n", path);
+			return 1;
+		}
+		auto vertices = palettes.split ? palettes.VertexView() : mesh.VertexView();
+		vector<uint32_t> vertexToSource(vertices.size());
+		for (size_t v = 0; v < vertices.size(); ++v) {
+			vertexToSource[v] = mesh.vertexRemap[palettes.split ? palettes.vertexRemap[v] : v];
+		}
+
+		MorphEngine engine;
+		auto start = Clock::now();
+		if (!engine.Build(model, vertexToSource)) {
+			printf("%s: failed to build morphs\n", path);
+			result = 1;
+			continue;
+		}
+		auto buildMs = ElapsedMs(start);
+		printf("%s: %.3f ms  morphs %zu  morph vertices %zu / %zu  offsets %zu\n", path, buildMs,
+			engine.MorphNum(), engine.MorphVertexNum(), vertices.size(), engine.OffsetNum());
+		if (engine.MorphNum() == 0) {
+			continue;
+		}
+		auto tracks = engine.CompileTracks(keyframes);
+		if (motionPath != nullptr) {
+			printf("  %s: keyframes %zu  tracks %zu\n", motionPath, keyframes.size(), tracks.size());
+		}
+
+		// 転送先の頂点バッファ（CPU側）
+		ConvertedVertices converted;
+		ConvertVertices(vertices, VertexLayout::Packed32, converted);
+		auto stride = GetVertexStreamFormat(VertexLayout::Packed32).strides[0];
+		auto stream = converted.streams[0].data();
+
+		double applyMs = 0.0;
+		double bruteMs = 0.0;
+		size_t dirtyVertexTotal = 0;
+		size_t rangeTotal = 0;
+		size_t activeTotal = 0;
+		size_t uploadFrames = 0;
+		float maxError = 0.0f;
+		vector<XMFLOAT3> expected;
+		auto morphNum = static_cast<uint32_t>(engine.MorphNum());
+		for (int f = 0; f < frameNum; ++f) {
+			if (!tracks.empty()) {
+				engine.SetWeights(tracks, static_cast<float>(f));
+			}
+			else if (f / 30 % 4 != 3) {
+				// モーションが無ければ、30フレームごとに3つの表情を入れ替えながら動かす（4回に1回は止めておく）
+				engine.ResetWeights();
+				auto phase = sinf(XM_PI * (f % 30) / 30.0f);
+				for (uint32_t k = 0; k < 3; ++k) {
+					engine.SetWeight((f / 30 + k * 5) % morphNum, phase * phase);
+				}
+			}
+			start = Clock::now();
+			if (engine.Apply()) {
+				engine.WritePositions(stream, stride);
+				++uploadFrames;
+			}
+			applyMs += ElapsedMs(start);
+			dirtyVertexTotal += engine.DirtyVertexNum();
+			rangeTotal += engine.DirtyRanges().size();
+			activeTotal += engine.ActiveMorphNum();
+
+			// 全頂点を計算し直したものと一致するか
+			start = Clock::now();
+			ApplyMorphsBruteForce(model, vertexToSource, engine, expected);
+			bruteMs += ElapsedMs(start);
+			for (size_t v = 0; v < expected.size(); ++v) {
+				XMFLOAT3 pos;
+				memcpy(&pos, stream + v * stride, sizeof(pos));
+				auto d = Sub(pos, expected[v]);
+				maxError = max(maxError, sqrtf(Dot(d, d)));
+			}
+		}
+		auto ok = maxError <= 1e-4f;
+		auto fullBytes = vertices.size() * stride;
+		auto dirtyBytes = static_cast<double>(dirtyVertexTotal) * stride / frameNum;
+		printf("  %d frames: apply %.4f ms/frame (full recompute %.4f ms)  active morphs %.1f  upload frames %zu\n",
+			frameNum, applyMs / frameNum, bruteMs / frameNum, static_cast<double>(activeTotal) / frameNum, uploadFrames);
+		printf("  dirty %.1f vertices/frame in %.1f ranges  upload %.0f bytes/frame (full %zu bytes, %.2f%%)  max error %g  %s\n",
+			static_cast<double>(dirtyVertexTotal) / frameNum, static_cast<double>(rangeTotal) / frameNum,
+			dirtyBytes, fullBytes, 100.0 * dirtyBytes / max<size_t>(fullBytes, 1), maxError, ok ? "ok" : "NG");
+		if (!ok) {
+			result = 1;
+		}
+	}
+	return result;
+}
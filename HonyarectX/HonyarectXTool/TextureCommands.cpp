@@ -0,0 +1,820 @@
+﻿#include "ToolCommands.h"
+#include "ImageDecoder.h"
+#include "MappedFile.h"
+#include "PMDModelData.h"
+#include "TextureCache.h"
+#include "TextureCooker.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#include <objbase.h>
+#endif
+using namespace std;
+using namespace DirectX;
+
+#ifdef _MSC_VER
+#pragma comment(lib, "DirectXTex.lib")
+#endif
+
+namespace
+{
+	using Clock = chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start)
+	{
+		return chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+
+	/// <summary>FNV-1aによるチェックサム（転送された内容が壊れていないかの確認用）</summary>
+	uint64_t Checksum(const uint8_t* data, size_t size)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ data[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	/// <summary>
+	/// ファイルの中身をそのまま1行のR8イメージにするデコーダー（WICを使わずにCPUだけで動かすため）
+	/// デコードの代わりに1バイトずつ変換しながら写して、ファイルサイズに比例した時間がかかるようにする
+	/// </summary>
+	bool DecodeRawFile(const string& path, DecodedTexture& decoded)
+	{
+		MappedFile file;
+		if (!file.Open(path.c_str()) || file.Size() == 0) {
+			return false;
+		}
+		if (FAILED(decoded.image.Initialize2D(DXGI_FORMAT_R8_UNORM, file.Size(), 1, 1, 1))) {
+			return false;
+		}
+		auto src = file.Data();
+		auto dst = decoded.image.GetPixels();
+		for (size_t i = 0; i < file.Size(); ++i) {
+			dst[i] = src[i] ^ 0xff;
+		}
+		decoded.metadata = decoded.image.GetMetadata();
+		return true;
+	}
+
+	/// <summary>パスの正規化の確認</summary>
+	bool CheckNormalizeTexturePath()
+	{
+		const char* cases[][2] = {
+			{ "Model\\Tex.BMP", "model/tex.bmp" },
+			{ "Model/../toon/./toon01.bmp", "toon/toon01.bmp" },
+			{ "./Model//a/b/../../c.sph", "model/c.sph" },
+			{ "../shared/X.png", "../shared/x.png" },
+			{ "/abs/Dir/../a.bmp", "/abs/a.bmp" },
+			// Shift-JISの「ソ」（0x83 0x5C）と「ア」（0x83 0x41）の2バイト目は変換しない
+			{ "Model\\\x83\x5c\x83\x41.BMP", "model/\x83\x5c\x83\x41.bmp" },
+		};
+		auto ok = true;
+		for (auto& c : cases) {
+			auto normalized = NormalizeTexturePath(c[0]);
+			if (normalized != c[1]) {
+				printf("  normalize \"%s\" -> \"%s\" (expected \"%s\")\n", c[0], normalized.c_str(), c[1]);
+				ok = false;
+			}
+		}
+		return ok;
+	}
+
+	/// <summary>
+	/// テクスチャキャッシュを使うアクターの代わり（Dx12Wrapperと同じ手順でキャッシュを使う）
+	/// テクスチャの実体の代わりにサイズを持ち、破棄されたテクスチャが参照中でないことを確認する
+	/// </summary>
+	class CacheSimulator
+	{
+	private:
+		struct Content {
+			uint64_t hash = 0;
+			size_t bytes = 0;
+		};
+		unordered_map<string, Content> _contents;			// パスからファイルの内容（読み込みを省くための控え）
+		unordered_map<uint64_t, size_t> _contentRefs;		// 内容ごとの参照数
+		unordered_map<uint64_t, size_t> _lastRelease;		// 内容ごとの最後に参照が無くなった時刻
+		vector<uint64_t> _entryHashes;						// エントリ番号から内容（テクスチャの実体の代わり）
+		size_t _tick = 0;
+
+	public:
+		TextureCache cache;
+		size_t loads = 0;									// ファイルを読んだ回数
+		size_t badEvictions = 0;							// 参照中のテクスチャを破棄した回数
+		size_t lruViolations = 0;							// 残っているものより新しいものを破棄した回数
+
+		CacheSimulator(size_t budget) :
+			cache(budget, [this](uint32_t entry, const vector<string>& paths) { OnEvict(entry, paths); })
+		{
+		}
+
+		void OnEvict(uint32_t entry, const vector<string>&)
+		{
+			auto hash = _entryHashes[entry];
+			if (_contentRefs[hash] > 0) {
+				++badEvictions;
+			}
+			// 参照の無いまま残っているものは、破棄したものより後に使われていること
+			for (size_t e = 0; e < _entryHashes.size(); ++e) {
+				auto other = _entryHashes[e];
+				if (e != entry && other != 0 && _contentRefs[other] == 0 && _lastRelease[other] < _lastRelease[hash]) {
+					++lruViolations;
+				}
+			}
+			_entryHashes[entry] = 0;
+		}
+
+		/// <summary>テクスチャを参照する（ファイルが無ければ何もせずfalse）</summary>
+		bool Acquire(const string& rawPath)
+		{
+			auto path = NormalizeTexturePath(rawPath);
+			auto it = _contents.find(path);
+			if (it == _contents.end()) {
+				// 正規化したパスは小文字になるので、大文字小文字を区別するファイルシステムでは元のパスで開く
+				MappedFile file;
+				if (!file.Open(rawPath.c_str())) {
+					return false;
+				}
+				Content content = { HashTextureContent(file.Data(), file.Size()), file.Size() };
+				it = _contents.emplace(path, content).first;
+			}
+			cache.AddRef(path);
+			++_contentRefs[it->second.hash];
+			if (cache.FindPath(path) == texture_cache_invalid) {
+				// 読み込み（Dx12Wrapper::InsertTextureと同じく、内容が同じものが無ければ作る）
+				++loads;
+				auto created = cache.FindContent(it->second.hash) == texture_cache_invalid;
+				auto entry = cache.Insert(path, it->second.hash, it->second.bytes);
+				if (created) {
+					_entryHashes.resize(max<size_t>(_entryHashes.size(), entry + 1), 0);
+					_entryHashes[entry] = it->second.hash;
+				}
+			}
+			return true;
+		}
+
+		void Release(const string& rawPath)
+		{
+			auto path = NormalizeTexturePath(rawPath);
+			auto hash = _contents[path].hash;
+			if (--_contentRefs[hash] == 0) {
+				_lastRelease[hash] = ++_tick;
+			}
+			cache.Release(path);
+		}
+
+		/// <summary>保持しているテクスチャの内容がすべて異なること</summary>
+		bool UniqueContents() const
+		{
+			unordered_map<uint64_t, size_t> seen;
+			for (auto hash : _entryHashes) {
+				if (hash != 0 && ++seen[hash] > 1) {
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	bool IsTGAPath(const string& path)
+	{
+		auto dot = path.rfind('.');
+		return dot != string::npos && NormalizeTexturePath(path.substr(dot)) == ".tga";
+	}
+
+	/// <summary>BMP（.sph/.spaを含む）とTGAを自前のデコーダーでデコードする（WICを使わずにCPUだけで動かすため）</summary>
+	HRESULT DecodeImageMemory(const string& path, const uint8_t* data, size_t size, ScratchImage& image, bool useSIMD = true)
+	{
+		if (IsTGAPath(path)) {
+			return DecodeTGAMemory(data, size, nullptr, image, useSIMD);
+		}
+		return DecodeBMPMemory(data, size, nullptr, image, useSIMD);
+	}
+
+	bool LoadImageFile(const string& path, ScratchImage& image)
+	{
+		MappedFile file;
+		return file.Open(path.c_str()) && SUCCEEDED(DecodeImageMemory(path, file.Data(), file.Size(), image));
+	}
+
+#ifdef _WIN32
+	/// <summary>WICやDirectXTexでデコードしたイメージをR8G8B8A8に揃える（自前のデコーダーとの比較用）</summary>
+	bool ToRGBA8(const Image& image, vector<uint8_t>& rgba)
+	{
+		size_t r = 0, b = 2;
+		auto hasAlpha = true;
+		switch (image.format) {
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+			r = 2;
+			b = 0;
+			break;
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+			r = 2;
+			b = 0;
+			hasAlpha = false;
+			break;
+		default:
+			return false;
+		}
+		rgba.resize(image.width * image.height * 4);
+		for (size_t y = 0; y < image.height; ++y) {
+			auto src = image.pixels + y * image.rowPitch;
+			auto dst = rgba.data() + y * image.width * 4;
+			for (size_t x = 0; x < image.width; ++x, src += 4, dst += 4) {
+				dst[0] = src[r];
+				dst[1] = src[1];
+				dst[2] = src[b];
+				dst[3] = hasAlpha ? src[3] : 0xff;
+			}
+		}
+		return true;
+	}
+#endif
+
+	/// <summary>RGBとアルファそれぞれの二乗誤差の合計</summary>
+	struct SquaredError {
+		double rgb = 0.0;
+		double alpha = 0.0;
+		size_t pixelNum = 0;
+
+		/// <summary>2つのR8G8B8A8の誤差を加える</summary>
+		void Add(const vector<uint8_t>& a, const vector<uint8_t>& b)
+		{
+			for (size_t i = 0; i < a.size(); i += 4) {
+				for (size_t ch = 0; ch < 3; ++ch) {
+					double d = static_cast<double>(a[i + ch]) - b[i + ch];
+					rgb += d * d;
+				}
+				double d = static_cast<double>(a[i + 3]) - b[i + 3];
+				alpha += d * d;
+			}
+			pixelNum += a.size() / 4;
+		}
+
+		/// <summary>PSNR（誤差が無ければ99.99）</summary>
+		static double PSNR(double error, size_t sampleNum)
+		{
+			auto mse = error / max<size_t>(1, sampleNum);
+			return mse <= 0.0 ? 99.99 : min(99.99, 10.0 * log10(255.0 * 255.0 / mse));
+		}
+		double RGBPSNR() const { return PSNR(rgb, pixelNum * 3); }
+		double AlphaPSNR() const { return PSNR(alpha, pixelNum); }
+	};
+
+	/// <summary>
+	/// ミップマップがリニアな色で平均されていることの確認
+	/// 黒と白の市松模様を縮小すると、sRGBでそのまま平均した128ではなくリニアの0.5に当たる188になる
+	/// </summary>
+	bool CheckGammaCorrectMips()
+	{
+		ScratchImage image;
+		if (FAILED(image.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, 8, 8, 1, 1))) {
+			return false;
+		}
+		auto img = image.GetImage(0, 0, 0);
+		for (size_t y = 0; y < 8; ++y) {
+			for (size_t x = 0; x < 8; ++x) {
+				auto p = img->pixels + y * img->rowPitch + x * 4;
+				p[0] = p[1] = p[2] = ((x + y) & 1) ? 0xff : 0;
+				p[3] = 0xff;
+			}
+		}
+		TextureCookOptions options;
+		options.format = TextureCookFormat::RGBA;
+		CookedTexture cooked;
+		vector<uint8_t> rgba;
+		if (!CookTexture(*img, options, cooked) || cooked.mips.size() != 4 || !DecompressCookedMip(cooked, 1, rgba)) {
+			return false;
+		}
+		for (size_t i = 0; i < rgba.size(); i += 4) {
+			if (rgba[i] < 186 || rgba[i] > 190 || rgba[i + 3] != 0xff) {
+				printf("  gamma: mip 1 value %d (expected 188)\n", rgba[i]);
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int DecodeImageCommand(int argc, char** argv)
+{
+	size_t repeat = 20;
+	size_t threadNum = 0;
+	vector<string> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			repeat = static_cast<size_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threadNum = static_cast<size_t>(max(0, atoi(argv[++i])));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("decode-image: no input\n");
+		return 1;
+	}
+#ifdef _WIN32
+	// 今までの読み込み（WIC）との比較に必要
+	CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+#endif
+
+	// ファイルは先にマップしておき、デコードの時間だけを計る
+	vector<unique_ptr<MappedFile>> files;
+	for (auto& path : paths) {
+		files.emplace_back(new MappedFile());
+		if (!files.back()->Open(path.c_str())) {
+			printf("%s: failed to open\n", path.c_str());
+			return 1;
+		}
+	}
+
+	printf("simd %s  repeat %zu\n", ImageDecoderHasSIMD() ? "sse2" : "none", repeat);
+	auto ok = true;
+	double scalarTotalMs = 0.0;
+	double simdTotalMs = 0.0;
+	size_t decodedBytes = 0;
+	for (size_t f = 0; f < paths.size(); ++f) {
+		auto& path = paths[f];
+		auto data = files[f]->Data();
+		auto size = files[f]->Size();
+		ScratchImage scalar, simd;
+		auto start = Clock::now();
+		auto decoded = true;
+		for (size_t r = 0; r < repeat; ++r) {
+			decoded = decoded && SUCCEEDED(DecodeImageMemory(path, data, size, scalar, false));
+		}
+		auto scalarMs = ElapsedMs(start) / repeat;
+		start = Clock::now();
+		for (size_t r = 0; r < repeat; ++r) {
+			decoded = decoded && SUCCEEDED(DecodeImageMemory(path, data, size, simd, true));
+		}
+		auto simdMs = ElapsedMs(start) / repeat;
+		if (!decoded) {
+			printf("%s: not supported\n", path.c_str());
+			ok = false;
+			continue;
+		}
+		// SIMDの有無で結果が同じこと
+		auto match = scalar.GetPixelsSize() == simd.GetPixelsSize() &&
+			memcmp(scalar.GetPixels(), simd.GetPixels(), simd.GetPixelsSize()) == 0;
+		auto& meta = simd.GetMetadata();
+		printf("%s: %zux%zu  scalar %.4f ms  simd %.4f ms (%.2fx)",
+			path.c_str(), meta.width, meta.height, scalarMs, simdMs, scalarMs / max(simdMs, 1e-6));
+#ifdef _WIN32
+		// 今までの読み込みと同じ画素になること
+		ScratchImage current;
+		start = Clock::now();
+		for (size_t r = 0; r < repeat; ++r) {
+			if (IsTGAPath(path)) {
+				decoded = decoded && SUCCEEDED(LoadFromTGAMemory(data, size, nullptr, current));
+			}
+			else {
+				decoded = decoded && SUCCEEDED(LoadFromWICMemory(data, size, WIC_FLAGS_NONE, nullptr, current));
+			}
+		}
+		auto currentMs = ElapsedMs(start) / repeat;
+		vector<uint8_t> currentRGBA;
+		match = match && decoded && ToRGBA8(*current.GetImage(0, 0, 0), currentRGBA) &&
+			currentRGBA.size() == simd.GetPixelsSize() && memcmp(currentRGBA.data(), simd.GetPixels(), currentRGBA.size()) == 0;
+		printf("  current %.4f ms (%.2fx)", currentMs, currentMs / max(simdMs, 1e-6));
+#endif
+		printf("  %s\n", match ? "match" : "MISMATCH");
+		ok = ok && match;
+		scalarTotalMs += scalarMs;
+		simdTotalMs += simdMs;
+		decodedBytes += simd.GetPixelsSize();
+	}
+
+	// 全ファイルをrepeat回ずつ、1スレッドで順に処理した場合とスレッドプールで並列に処理した場合
+	auto decodeAll = [&](size_t f) {
+		ScratchImage image;
+		return SUCCEEDED(DecodeImageMemory(paths[f], files[f]->Data(), files[f]->Size(), image));
+	};
+	auto start = Clock::now();
+	for (size_t r = 0; r < repeat; ++r) {
+		for (size_t f = 0; f < paths.size(); ++f) {
+			decodeAll(f);
+		}
+	}
+	auto sequentialMs = ElapsedMs(start);
+	ThreadPool pool(threadNum);
+	vector<future<bool>> results;
+	start = Clock::now();
+	for (size_t r = 0; r < repeat; ++r) {
+		for (size_t f = 0; f < paths.size(); ++f) {
+			results.push_back(pool.Enqueue([&decodeAll, f]() { return decodeAll(f); }));
+		}
+	}
+	size_t parallelFailed = 0;
+	for (auto& result : results) {
+		parallelFailed += result.get() ? 0 : 1;
+	}
+	auto parallelMs = ElapsedMs(start);
+	ok = ok && parallelFailed == 0;
+
+	auto megaBytes = static_cast<double>(decodedBytes) * repeat / (1024.0 * 1024.0);
+	printf("total scalar %.3f ms  simd %.3f ms (%.2fx)\n", scalarTotalMs, simdTotalMs, scalarTotalMs / max(simdTotalMs, 1e-6));
+	printf("batch of %zu decodes: sequential %.3f ms (%.1f MB/s)  %zu threads %.3f ms (%.1f MB/s, %.2fx)  failed %zu  %s\n",
+		results.size(), sequentialMs, megaBytes / (sequentialMs / 1000.0), pool.ThreadNum(), parallelMs,
+		megaBytes / (parallelMs / 1000.0), sequentialMs / max(parallelMs, 1e-6), parallelFailed, ok ? "ok" : "NG");
+#ifdef _WIN32
+	CoUninitialize();
+#endif
+	return ok ? 0 : 1;
+}
+
+int CookTextureCommand(int argc, char** argv)
+{
+	auto format = TextureCookFormat::Auto;
+	vector<string> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			++i;
+			if (strcmp(argv[i], "bc1") == 0) {
+				format = TextureCookFormat::BC1;
+			}
+			else if (strcmp(argv[i], "bc3") == 0) {
+				format = TextureCookFormat::BC3;
+			}
+			else if (strcmp(argv[i], "rgba") == 0) {
+				format = TextureCookFormat::RGBA;
+			}
+			else {
+				format = TextureCookFormat::Auto;
+			}
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("cook-texture: no input\n");
+		return 1;
+	}
+
+	auto ok = CheckGammaCorrectMips();
+	printf("gamma-correct mips %s\n", ok ? "ok" : "NG");
+
+	// 画質の下限（RGBとアルファそれぞれ、全ミップマップの画素をまとめたもの）
+	// BC1は4x4に2色しか持てないので、細かい模様の小さなテクスチャでは30dBを下回ることがある
+	const double min_psnr = 25.0;
+	size_t sourceTotal = 0;
+	size_t cookedTotal = 0;
+	double encodeTotalMs = 0.0;
+	for (auto& path : paths) {
+		ScratchImage image;
+		if (!LoadImageFile(path, image)) {
+			printf("%s: failed to load (uncompressed bmp/tga only)\n", path.c_str());
+			ok = false;
+			continue;
+		}
+		auto source = image.GetImage(0, 0, 0);
+		TextureCookOptions options;
+		options.format = format;
+		CookedTexture cooked;
+		auto start = Clock::now();
+		if (!CookTexture(*source, options, cooked)) {
+			printf("%s: failed to cook\n", path.c_str());
+			ok = false;
+			continue;
+		}
+		auto encodeMs = ElapsedMs(start);
+		// 比較の基準は、同じミップマップを圧縮せずに作ったもの
+		options.format = TextureCookFormat::RGBA;
+		CookedTexture reference;
+		CookTexture(*source, options, reference);
+
+		// 書き出したファイルを読み戻して、同じ内容になることを確認する
+		auto cookedPath = CookedTexturePath(path);
+		CookedTexture loaded;
+		auto roundTrip = WriteCookedTexture(cookedPath.c_str(), cooked, path.c_str());
+		if (roundTrip) {
+			MappedFile file;
+			roundTrip = file.Open(cookedPath.c_str()) &&
+				IsCookedTextureFresh(file.Data(), file.Size(), path.c_str()) &&
+				LoadCookedTexture(file.Data(), file.Size(), loaded) &&
+				loaded.format == cooked.format && loaded.data == cooked.data && loaded.mips.size() == reference.mips.size();
+		}
+
+		SquaredError mip0Error;
+		SquaredError totalError;
+		for (size_t m = 0; roundTrip && m < loaded.mips.size(); ++m) {
+			vector<uint8_t> actual, expected;
+			DecompressCookedMip(loaded, m, actual);
+			DecompressCookedMip(reference, m, expected);
+			if (m == 0) {
+				mip0Error.Add(actual, expected);
+			}
+			totalError.Add(actual, expected);
+		}
+		auto textureOk = roundTrip && totalError.RGBPSNR() >= min_psnr && totalError.AlphaPSNR() >= min_psnr;
+		ok = ok && textureOk;
+
+		// 今まではミップマップ無しのRGBA8で置いていた
+		auto sourceBytes = static_cast<size_t>(cooked.Width()) * cooked.Height() * 4;
+		sourceTotal += sourceBytes;
+		cookedTotal += cooked.data.size();
+		encodeTotalMs += encodeMs;
+		const char* formatName = cooked.format == DXGI_FORMAT_BC1_UNORM ? "BC1" : cooked.format == DXGI_FORMAT_BC3_UNORM ? "BC3" : "RGBA";
+		printf("%s: %ux%u %s mips %zu  %zu -> %zu bytes (%.2fx)  encode %.3f ms  PSNR rgb %.2f (mip0 %.2f) alpha %.2f (mip0 %.2f)  %s\n",
+			path.c_str(), cooked.Width(), cooked.Height(), formatName, cooked.mips.size(), sourceBytes, cooked.data.size(),
+			static_cast<double>(sourceBytes) / max<size_t>(1, cooked.data.size()), encodeMs,
+			totalError.RGBPSNR(), mip0Error.RGBPSNR(), totalError.AlphaPSNR(), mip0Error.AlphaPSNR(), textureOk ? "ok" : "NG");
+	}
+	printf("total %zu -> %zu bytes (%.2fx)  encode %.3f ms  %s\n", sourceTotal, cookedTotal,
+		static_cast<double>(sourceTotal) / max<size_t>(1, cookedTotal), encodeTotalMs, ok ? "ok" : "NG");
+	return ok ? 0 : 1;
+}
+
+int TextureCacheCommand(int argc, char** argv)
+{
+	size_t actorNum = 12;
+	double budgetRatio = 0.25;
+	vector<const char*> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			actorNum = static_cast<size_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			budgetRatio = max(0.0, atof(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("texture-cache: no input\n");
+		return 1;
+	}
+	auto ok = CheckNormalizeTexturePath();
+	printf("normalize paths %s\n", ok ? "ok" : "NG");
+
+	// アクターごとに参照するテクスチャ（マテリアルごとに基本テクスチャ、sph、spa、toon）
+	// PMD以外はそのテクスチャ1枚だけを参照するアクターとして扱う（別名のコピーで内容による共有を確かめる）
+	vector<vector<string>> modelTextures;
+	for (auto path : paths) {
+		auto len = strlen(path);
+		if (len < 4 || NormalizeTexturePath(path + len - 4) != ".pmd") {
+			modelTextures.push_back(vector<string>(1, path));
+			continue;
+		}
+		PMDModelData model;
+		if (!model.Load(path)) {
+			printf("%s: failed to load\n", path);
+			return 1;
+		}
+		vector<string> textures;
+		for (auto& tex : model.MaterialTextures()) {
+			for (auto texPath : { &tex.texPath, &tex.sphPath, &tex.spaPath, &tex.toonPath }) {
+				if (!texPath->empty()) {
+					textures.push_back(*texPath);
+				}
+			}
+		}
+		modelTextures.push_back(textures);
+	}
+
+	// モデルを順に並べてアクターを作る（参照先のテクスチャを読み込む）
+	CacheSimulator sim(SIZE_MAX);
+	vector<size_t> actors;
+	size_t references = 0;
+	size_t naiveBytes = 0;
+	unordered_map<string, size_t> pathBytes;
+	size_t missingFiles = 0;
+	auto start = Clock::now();
+	for (size_t a = 0; a < actorNum; ++a) {
+		auto model = a % modelTextures.size();
+		for (auto& texPath : modelTextures[model]) {
+			if (!sim.Acquire(texPath)) {
+				++missingFiles;
+				continue;
+			}
+			// キャッシュが無い場合（参照ごとに作る）と、パスだけで共有した場合のサイズ
+			MappedFile file;
+			file.Open(texPath.c_str());
+			++references;
+			naiveBytes += file.Size();
+			pathBytes[NormalizeTexturePath(texPath)] = file.Size();
+		}
+		actors.push_back(model);
+	}
+	auto acquireMs = ElapsedMs(start);
+	size_t pathDedupBytes = 0;
+	for (auto& bytes : pathBytes) {
+		pathDedupBytes += bytes.second;
+	}
+	auto stats = sim.cache.Stats();
+	printf("%zu actors of %zu models: references %zu (missing %zu)  unique paths %zu  textures %zu  acquire %.3f ms\n",
+		actorNum, modelTextures.size(), references, missingFiles, pathBytes.size(), stats.entryNum, acquireMs);
+	printf("  memory: per reference %zu bytes  per path %zu bytes  cached %zu bytes (%.1f%% of per reference)\n",
+		naiveBytes, pathDedupBytes, stats.residentBytes, 100.0 * stats.residentBytes / max<size_t>(naiveBytes, 1));
+	printf("  path hits %zu  content hits %zu  misses %zu\n", stats.pathHits, stats.contentHits, stats.misses);
+	ok = ok && stats.residentBytes <= pathDedupBytes && sim.UniqueContents() && stats.evictions == 0;
+
+	// 予算を絞り、アクターを半分ずつ入れ替えながら破棄と読み直しを確認する
+	auto budget = static_cast<size_t>(stats.residentBytes * budgetRatio);
+	sim.cache.SetBudget(budget);
+	auto evictionsBefore = sim.cache.Stats().evictions;
+	ok = ok && evictionsBefore == 0;	// 全部参照中なので破棄されない
+	for (int round = 0; round < 4; ++round) {
+		// 前半のアクターを破棄
+		auto half = actors.size() / 2;
+		for (size_t a = 0; a < half; ++a) {
+			for (auto& texPath : modelTextures[actors[a]]) {
+				if (pathBytes.count(NormalizeTexturePath(texPath))) {
+					sim.Release(texPath);
+				}
+			}
+		}
+		actors.erase(actors.begin(), actors.begin() + half);
+		auto afterRelease = sim.cache.Stats();
+		// 別のモデルから作り直す
+		auto loadsBefore = sim.loads;
+		for (size_t a = 0; a < half; ++a) {
+			auto model = (a + round + 1) % modelTextures.size();
+			for (auto& texPath : modelTextures[model]) {
+				if (pathBytes.count(NormalizeTexturePath(texPath))) {
+					sim.Acquire(texPath);
+				}
+			}
+			actors.push_back(model);
+		}
+		auto afterLoad = sim.cache.Stats();
+		printf("  round %d: budget %zu  released -> %zu bytes (%zu textures, %zu referenced)  reloaded %zu  -> %zu bytes  evictions %zu\n",
+			round, budget, afterRelease.residentBytes, afterRelease.entryNum, afterRelease.referencedNum,
+			sim.loads - loadsBefore, afterLoad.residentBytes, afterLoad.evictions);
+	}
+	// すべて破棄すると予算まで減る
+	for (auto model : actors) {
+		for (auto& texPath : modelTextures[model]) {
+			if (pathBytes.count(NormalizeTexturePath(texPath))) {
+				sim.Release(texPath);
+			}
+		}
+	}
+	stats = sim.cache.Stats();
+	printf("  all released: %zu bytes (budget %zu)  textures %zu  referenced %zu  evictions %zu  peak %zu bytes\n",
+		stats.residentBytes, budget, stats.entryNum, stats.referencedNum, stats.evictions, stats.peakBytes);
+	ok = ok && stats.residentBytes <= budget && stats.referencedNum == 0 && sim.badEvictions == 0 && sim.lruViolations == 0 &&
+		sim.UniqueContents();
+	printf("  bad evictions %zu  lru violations %zu  %s\n", sim.badEvictions, sim.lruViolations, ok ? "ok" : "NG");
+	return ok ? 0 : 1;
+}
+
+int TextureStreamCommand(int argc, char** argv)
+{
+	size_t threadNum = 0;
+	size_t maxUploads = 4;
+	double budgetMs = 2.0;
+	vector<string> paths;
+	for (int i = 0; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threadNum = static_cast<size_t>(max(0, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+			maxUploads = static_cast<size_t>(max(1, atoi(argv[++i])));
+		}
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			budgetMs = max(0.0, atof(argv[++i]));
+		}
+		else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.empty()) {
+		printf("texture-stream: no input\n");
+		return 1;
+	}
+
+	// 1スレッドで順にデコードした結果（時間の比較と内容の確認用）
+	unordered_map<string, uint64_t> expected;
+	size_t totalBytes = 0;
+	auto start = Clock::now();
+	for (auto& path : paths) {
+		if (expected.find(path) != expected.end()) {
+			continue;
+		}
+		DecodedTexture decoded;
+		if (!DecodeRawFile(path, decoded)) {
+			printf("%s: failed to load\n", path.c_str());
+			return 1;
+		}
+		expected[path] = Checksum(decoded.image.GetPixels(), decoded.image.GetPixelsSize());
+		totalBytes += decoded.image.GetPixelsSize();
+	}
+	auto sequentialMs = ElapsedMs(start);
+	// 存在しないファイルは失敗として代わりのテクスチャのまま残る
+	const string missingPath = "texture-stream-missing.bmp";
+
+	TextureStreamer streamer(DecodeRawFile, threadNum);
+
+	// 複数のスレッドから同じパスを要求し、同じハンドルが返ることと要求がすぐに戻ることを確認する
+	const size_t requestThreadNum = 4;
+	vector<vector<TextureHandle>> handles(requestThreadNum);
+	vector<double> requestMaxMs(requestThreadNum, 0.0);
+	start = Clock::now();
+	{
+		vector<thread> threads;
+		for (size_t t = 0; t < requestThreadNum; ++t) {
+			threads.emplace_back([&, t]() {
+				for (size_t i = 0; i <= paths.size(); ++i) {
+					auto& path = i < paths.size() ? paths[(i + t) % paths.size()] : missingPath;
+					auto requestStart = Clock::now();
+					handles[t].push_back(streamer.Request(path));
+					requestMaxMs[t] = max(requestMaxMs[t], ElapsedMs(requestStart));
+				}
+			});
+		}
+		for (auto& th : threads) {
+			th.join();
+		}
+	}
+	auto requestMs = ElapsedMs(start);
+
+	// メインスレッドの代わりに、毎フレームUpdateで予算内だけ転送する
+	unordered_map<string, size_t> uploaded;
+	size_t corrupted = 0;
+	size_t frameNum = 0;
+	size_t maxPerFrame = 0;
+	size_t overBudgetFrames = 0;
+	double updateMaxMs = 0.0;
+	auto upload = [&](const TextureRequest& request) {
+		auto& image = request.decoded->image;
+		auto it = expected.find(request.path);
+		if (it == expected.end() || Checksum(image.GetPixels(), image.GetPixelsSize()) != it->second) {
+			++corrupted;
+		}
+		++uploaded[request.path];
+		return true;
+	};
+	while (!streamer.Idle() && ElapsedMs(start) < 60000.0) {
+		auto updateStart = Clock::now();
+		auto num = streamer.Update(maxUploads, budgetMs, upload);
+		auto updateMs = ElapsedMs(updateStart);
+		updateMaxMs = max(updateMaxMs, updateMs);
+		maxPerFrame = max(maxPerFrame, num);
+		// 1つ目は予算に関わらず転送するので、2つ以上転送して予算を大きく超えたフレームを数える
+		if (num > 1 && updateMs > budgetMs * 2.0) {
+			++overBudgetFrames;
+		}
+		++frameNum;
+		this_thread::yield();
+	}
+	auto streamMs = ElapsedMs(start);
+
+	// 検証
+	auto ok = streamer.Idle() && corrupted == 0 && maxPerFrame <= maxUploads;
+	size_t sameHandle = 0;
+	for (size_t i = 0; i <= paths.size(); ++i) {
+		auto& path = i < paths.size() ? paths[i] : missingPath;
+		auto& handle = handles[0][i];
+		bool same = true;
+		for (size_t t = 1; t < requestThreadNum; ++t) {
+			same = same && handles[t][i < paths.size() ? (i + paths.size() - t % paths.size()) % paths.size() : i] == handle;
+		}
+		sameHandle += same ? 1 : 0;
+		if (!same || handle->path != path) {
+			ok = false;
+		}
+		auto state = handle->state.load();
+		if (i < paths.size()) {
+			ok = ok && state == TextureState::Ready && uploaded[path] == 1 && handle->decoded == nullptr;
+		}
+		else {
+			ok = ok && state == TextureState::Failed && uploaded.find(path) == uploaded.end();
+		}
+	}
+	auto stats = streamer.GetStats();
+	ok = ok && stats.requested == expected.size() + 1 && stats.ready == expected.size() && stats.failed == 1;
+
+	double readyMax = 0.0;
+	for (auto& handle : handles[0]) {
+		readyMax = max(readyMax, handle->readyMs);
+	}
+	printf("textures %zu (%zu requests, %zu bytes)  sequential decode %.3f ms\n",
+		expected.size(), requestThreadNum * (paths.size() + 1), totalBytes, sequentialMs);
+	printf("  request %.3f ms total, max %.4f ms per call  same handle %zu / %zu\n",
+		requestMs, *max_element(requestMaxMs.begin(), requestMaxMs.end()), sameHandle, paths.size() + 1);
+	printf("  streamed in %.3f ms (last ready %.3f ms)  frames %zu  uploads/frame max %zu (limit %zu)  update max %.3f ms (budget %.2f ms, over %zu)\n",
+		streamMs, readyMax, frameNum, maxPerFrame, maxUploads, updateMaxMs, budgetMs, overBudgetFrames);
+	printf("  ready %zu  failed %zu  corrupted %zu  %s\n", stats.ready, stats.failed, corrupted, ok ? "ok" : "NG");
+	return ok ? 0 : 1;
+}
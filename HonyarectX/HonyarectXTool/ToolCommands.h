@@ -0,0 +1,78 @@
+﻿#pragma once
+
+// 各サブコマンド（引数はサブコマンド名より後ろ、戻り値はプロセスの終了コード）
+
+/// <summary>PMDファイルの読み込み時間を計測する</summary>
+int BenchPMDCommand(int argc, char** argv);
+
+/// <summary>PMDファイルをクック済みファイル（.pmdc）に変換し、内容の一致と読み込み時間を確認する</summary>
+int CookPMDCommand(int argc, char** argv);
+
+/// <summary>頂点を各形式に変換し、サイズと元の頂点との誤差を表示する</summary>
+int ConvertVerticesCommand(int argc, char** argv);
+
+/// <summary>メッシュを最適化し、三角形が変わっていないことと頂点キャッシュ効率の変化を確認する</summary>
+int OptimizeMeshCommand(int argc, char** argv);
+
+/// <summary>メッシュのLODを作り、三角形数の減り方と申告した誤差が実際の距離以上であることを確認する</summary>
+int SimplifyMeshCommand(int argc, char** argv);
+
+/// <summary>ボーンパレットでメッシュを分割し、描画の分割数と転送量、元のメッシュと同じ描画になることを確認する</summary>
+int PartitionBonesCommand(int argc, char** argv);
+
+/// <summary>表情を毎フレーム適用し、全頂点を計算し直した結果と一致することと、転送する頂点の量を確認する</summary>
+int MorphBenchCommand(int argc, char** argv);
+
+/// <summary>テクスチャを非同期に読み込み、要求がすぐに戻ることと、フレームごとの転送数、内容が壊れていないことを確認する</summary>
+int TextureStreamCommand(int argc, char** argv);
+
+/// <summary>複数のアクターでテクスチャキャッシュを使い、共有による削減量と予算を超えたときの破棄の順番を確認する</summary>
+int TextureCacheCommand(int argc, char** argv);
+
+/// <summary>BMPとTGAを自前のデコーダーで読み込み、SIMDの有無や今までの読み込みと同じ結果になることと速度を確認する</summary>
+int DecodeImageCommand(int argc, char** argv);
+
+/// <summary>テクスチャをミップマップ付きのBC1/BC3にクックしてDDSファイルに書き出し、サイズと画質（PSNR）を表示する</summary>
+int CookTextureCommand(int argc, char** argv);
+
+/// <summary>モーションをクリップにコンパイルし、従来のサンプリングと同じ姿勢になることと、1秒あたりのボーン数を確認する</summary>
+int BenchClipCommand(int argc, char** argv);
+
+/// <summary>VMDの補間曲線を従来の計算とSIMDでまとめて解く計算で解き、正確な値との誤差と速度を比べる</summary>
+int BenchBezierCommand(int argc, char** argv);
+
+/// <summary>姿勢キャッシュをベイクとループ再生で埋め、保存した行列の誤差とメモリ、計算し直すのと比べた速度を確認する</summary>
+int PoseCacheCommand(int argc, char** argv);
+
+/// <summary>モーションのクリップを圧縮し、圧縮率と全フレームでの最大誤差、サンプリングの速度を確認する</summary>
+int CompressClipCommand(int argc, char** argv);
+
+/// <summary>距離の違うアクターの群衆でアニメーション更新のLODを試し、段階ごとの更新の回数と計算時間、補間の誤差を確認する</summary>
+int AnimLODCommand(int argc, char** argv);
+
+/// <summary>2つのモーションをレイヤーに重ね、マスク・クロスフェード・加算の結果とサンプリングしたトラック数、評価時間を確認する</summary>
+int BlendLayersCommand(int argc, char** argv);
+
+/// <summary>多数のアクターで同じモーションを読み込み、共有したときの読み込み回数とメモリ、時間を共有しない場合と比べる</summary>
+int MotionLibraryCommand(int argc, char** argv);
+
+/// <summary>ディレクトリのモデルすべてにモーションを結び付け、共有した骨格の数と、モデルに無いボーンや表情を確認する</summary>
+int BindMotionCommand(int argc, char** argv);
+
+/// <summary>VMDを従来のfreadによる読み込みと比べ、途中で切れたファイルの扱いと、合成した数MBのファイルでの読み込み速度を確認する</summary>
+int ParseVMDCommand(int argc, char** argv);
+
+/// <summary>骨格の行列を親から順に並べて1回のループで掛ける方法を、以前の再帰でたどる方法と比べる（結果の一致と速度）</summary>
+int BenchSkeletonCommand(int argc, char** argv);
+
+/// <summary>姿勢を回転と移動のままでつなげてIKを解き、最後に行列にする方法を、以前の行列での計算と比べる（誤差と速度）</summary>
+int BenchPoseCommand(int argc, char** argv);
+
+/// <summary>
+/// モーションを再生し、変わったボーンだけ計算し直した（IncrementalPose）行列がすべて計算し直したものと同じになるか確かめ、
+/// 計算し直したボーンの数と時間を比べる（頭を手続き的に回す場合と、IKの有無や書き込む先を切り替える場合も）
+/// </summary>
+int DirtyPoseCommand(int argc, char** argv);
+
+/// <summary>IKをチェーンごとに以前の解き方（毎回vectorを確保する）と比べる（結果の一致・時間・ヒープからの確保の回数）</summary>
+int BenchIKCommand(int argc, char** argv);
@@ -0,0 +1,62 @@
+﻿#include "ToolCommands.h"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	struct Command {
+		const char* name;					// サブコマンド名
+		int (*func)(int, char**);			// 実行する関数
+		const char* usage;					// 使い方
+	};
+
+	const Command commands[] = {
+		{ "bench-pmd", BenchPMDCommand, "bench-pmd <model.pmd>... [-n 回数]" },
+		{ "cook-pmd", CookPMDCommand, "cook-pmd <model.pmd>... [-n 回数]" },
+		{ "convert-vertices", ConvertVerticesCommand, "convert-vertices <model.pmd>..." },
+		{ "optimize-mesh", OptimizeMeshCommand, "optimize-mesh <model.pmd>... [-n 回数]" },
+		{ "simplify-mesh", SimplifyMeshCommand, "simplify-mesh <model.pmd>... [-n 回数]" },
+		{ "partition-bones", PartitionBonesCommand, "partition-bones <model.pmd>... [-p パレットサイズ]..." },
+		{ "morph-bench", MorphBenchCommand, "morph-bench <model.pmd>... [-m motion.vmd] [-n フレーム数] [-p パレットサイズ]" },
+		{ "texture-stream", TextureStreamCommand, "texture-stream <texture>... [-t スレッド数] [-u 1フレームの転送数] [-b 1フレームの予算ms]" },
+		{ "texture-cache", TextureCacheCommand, "texture-cache <model.pmd|texture>... [-a アクター数] [-b 予算（使用量に対する割合）]" },
+		{ "decode-image", DecodeImageCommand, "decode-image <texture>... [-n 回数] [-t スレッド数]" },
+		{ "cook-texture", CookTextureCommand, "cook-texture <texture>... [-f auto|bc1|bc3|rgba]" },
+		{ "bench-clip", BenchClipCommand, "bench-clip <model.pmd> <motion.vmd>... [-n フレーム数]" },
+		{ "bench-bezier", BenchBezierCommand, "bench-bezier [motion.vmd]... [-n 回数]" },
+		{ "pose-cache", PoseCacheCommand, "pose-cache <model.pmd> <motion.vmd>... [-t スレッド数] [-l ループ数] [-m 上限MB]" },
+		{ "compress-clip", CompressClipCommand, "compress-clip <model.pmd> <motion.vmd>... [-a 許容角度（度）] [-d 許容距離] [-q（量子化しない）] [-n フレーム数]" },
+		{ "anim-lod", AnimLODCommand, "anim-lod <model.pmd> <motion.vmd> [-n アクター数] [-d 最も遠い距離] [-f 更新回数] [-i Reducedの間隔]" },
+		{ "blend-layers", BlendLayersCommand, "blend-layers <model.pmd> <base.vmd> <overlay.vmd> [-b マスクの起点ボーン] [-f フェードのフレーム数] [-n 回数]" },
+		{ "motion-library", MotionLibraryCommand, "motion-library <model.pmd> <motion.vmd>... [-n アクター数] [-t スレッド数]" },
+		{ "bind-motion", BindMotionCommand, "bind-motion <model.pmd|ディレクトリ> <motion.vmd>..." },
+		{ "parse-vmd", ParseVMDCommand, "parse-vmd [motion.vmd|ディレクトリ]... [-s 合成するファイルのMB] [-c 合成するファイル数] [-t スレッド数] [-n 回数]" },
+		{ "bench-skeleton", BenchSkeletonCommand, "bench-skeleton <model.pmd|ディレクトリ>... [-n 回数]" },
+		{ "bench-pose", BenchPoseCommand, "bench-pose <model.pmd> <motion.vmd>... [-n 回数]" },
+		{ "dirty-pose", DirtyPoseCommand, "dirty-pose <model.pmd> <motion.vmd>... [-n 回数]" },
+		{ "bench-ik", BenchIKCommand, "bench-ik <model.pmd> <motion.vmd>... [-n 回数]" },
+	};
+
+	void PrintUsage()
+	{
+		printf("usage: HonyarectXTool <command> [args]\n");
+		for (auto& command : commands) {
+			printf("  %s\n", command.usage);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		PrintUsage();
+		return 1;
+	}
+	for (auto& command : commands) {
+		if (strcmp(argv[1], command.name) == 0) {
+			return command.func(argc - 2, argv + 2);
+		}
+	}
+	PrintUsage();
+	return 1;
+}